@@ -0,0 +1,67 @@
+/**
+ * arena.h
+ *
+ * Bump allocator for per-image state.
+ *
+ * Everything that belongs to one image session (header tables, parsed
+ * image.cfg entries, per-entry index arrays) is carved out of one arena and
+ * released together, instead of being malloc'd and freed piece by piece.
+ * Allocations are never freed individually.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/** Size of a regular arena block (larger requests get a block of their own) */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/** Alignment of every allocation */
+#define ARENA_ALIGNMENT 16
+
+/** One block of arena memory (opaque) */
+typedef struct ArenaBlock ArenaBlock;
+
+/**
+ * @brief A bump allocator.
+ */
+typedef struct
+{
+    ArenaBlock* head; /**< Block currently allocated from; older blocks follow */
+} Arena;
+
+/**
+ * @brief Initialize an empty arena (no memory is reserved until first use).
+ *
+ * @param arena Arena to initialize.
+ */
+void arena_init(Arena* arena);
+
+/**
+ * @brief Allocate uninitialized memory from an arena.
+ *
+ * @param arena Arena to allocate from.
+ * @param size  Number of bytes.
+ * @return ARENA_ALIGNMENT-aligned memory, or NULL if out of memory.
+ */
+void* arena_alloc(Arena* arena, size_t size);
+
+/**
+ * @brief Allocate a zeroed array from an arena.
+ *
+ * @param arena Arena to allocate from.
+ * @param count Number of elements (0 is treated as 1).
+ * @param size  Size of each element.
+ * @return Zeroed memory, or NULL on overflow or if out of memory.
+ */
+void* arena_calloc(Arena* arena, size_t count, size_t size);
+
+/**
+ * @brief Release all memory held by an arena.
+ *
+ * @param arena Arena to release (left empty and reusable).
+ */
+void arena_release(Arena* arena);
+
+#endif /* ARENA_H */
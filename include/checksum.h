@@ -9,18 +9,71 @@
 #ifndef CHECKSUM_H
 #define CHECKSUM_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+/**
+ * @brief Incremental checksum state.
+ *
+ * Allows the V-file checksum to be computed over data that arrives in
+ * arbitrary pieces (e.g. while copying) instead of re-reading a file.
+ */
+typedef struct
+{
+    uint32_t sum;    /**< Running sum of complete 4-byte words */
+    uint8_t tail[4]; /**< Bytes of an incomplete trailing word */
+    size_t tail_len; /**< Number of bytes in tail */
+} ChecksumState;
+
+/**
+ * @brief Initialize an incremental checksum.
+ *
+ * @param st Checksum state to initialize.
+ */
+void checksum_init(ChecksumState* st);
+
+/**
+ * @brief Add data to an incremental checksum.
+ *
+ * @param st   Checksum state.
+ * @param data Input bytes.
+ * @param len  Number of input bytes.
+ */
+void checksum_update(ChecksumState* st, const void* data, size_t len);
+
+/**
+ * @brief Finish an incremental checksum.
+ *
+ * Any incomplete trailing word is padded with zeros.
+ *
+ * @param st Checksum state.
+ * @return 32-bit checksum.
+ */
+uint32_t checksum_final(ChecksumState* st);
+
+/**
+ * @brief Check whether a "V*.fex" name holds a checksum of another entry.
+ *
+ * Names such as Vvbmeta.fex are real partitions rather than checksum files.
+ *
+ * @param name Base name of the file.
+ * @return Non-zero if the file stores the checksum of name + 1.
+ */
+int is_checksum_vfile(const char* name);
+
 /**
  * @brief Compute a simple 32-bit checksum for a given file.
  *
  * The checksum sums all 4-byte words in little-endian order,
- * padding any remaining bytes with zeros.
+ * padding any remaining bytes with zeros. If filename does not exist but
+ * filename.lz4 does, the decompressed data of the latter is summed.
  *
  * @param filename Path to the file.
- * @return 32-bit checksum, or 0 if the file cannot be opened.
+ * @param checksum Output: 32-bit checksum, set only on success.
+ * @return 0 on success, non-zero if the file cannot be opened or read in full
+ *         (e.g. a truncated or corrupt .lz4 frame).
  */
-uint32_t compute_checksum(const char* filename);
+int compute_checksum(const char* filename, uint32_t* checksum);
 
 /**
  * @brief Verify and update "V*.fex" checksums in the specified folder.
@@ -31,6 +84,17 @@ uint32_t compute_checksum(const char* filename);
  */
 void update_vfiles_if_needed(const char* dump_folder);
 
+/**
+ * @brief Verify and update a single "V*.fex" checksum file if mismatched.
+ *
+ * Lets callers that know which payloads changed avoid re-reading every
+ * checksummed file in the folder.
+ *
+ * @param dump_folder Path to folder containing extracted files.
+ * @param vfile_name  Name of the V*.fex file (e.g. "Vboot.fex").
+ */
+void update_vfile_if_needed(const char* dump_folder, const char* vfile_name);
+
 /**
  * @brief Verify "V*.fex" checksums without updating them.
  *
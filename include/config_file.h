@@ -3,16 +3,17 @@
  *
  * Functions to load, write, and print IMAGEWTY configuration files.
  *
- * Provides utilities to parse the `image.cfg` file from a dump folder,
- * manage memory for file headers, and output configuration in a
- * human-readable format.
+ * Provides utilities to parse the `image.cfg` file from a dump folder
+ * (into arena memory) and output configuration in a human-readable format.
  */
 
 #ifndef CONFIG_FILE_H
 #define CONFIG_FILE_H
 
+#include "arena.h"
 #include "img_header.h"
 #include <stdint.h>
+#include <stdio.h>
 
 /**
  * @brief Loads the IMAGEWTY configuration from an image.cfg file.
@@ -24,10 +25,43 @@
  * @param hdr Pointer to an ImageWTYHeader structure to populate.
  * @param files Pointer to a pointer where the allocated array of
  *              ImageWTYFileHeader will be stored.
- *              The caller is responsible for freeing it using `free_file_list`.
+ * @param arena Arena the array is allocated from; it lives until the arena
+ *              is released.
  * @return 0 on success, non-zero on failure (file not found, memory allocation error, etc.)
  */
-int load_image_config(const char* cfg_path, ImageWTYHeader* hdr, ImageWTYFileHeader** files);
+int load_image_config(const char* cfg_path, ImageWTYHeader* hdr, ImageWTYFileHeader** files,
+                      Arena* arena);
+
+/**
+ * @brief Loads an IMAGEWTY configuration from an open stream.
+ *
+ * Same as load_image_config(), e.g. for an image.cfg held in memory
+ * (fmemopen()). The stream must be seekable, since it is read twice.
+ *
+ * @param f Input stream positioned at the start of the configuration.
+ * @param hdr Pointer to an ImageWTYHeader structure to populate.
+ * @param files Pointer to a pointer where the allocated array of
+ *              ImageWTYFileHeader will be stored.
+ * @param arena Arena the array is allocated from.
+ * @return 0 on success, non-zero on failure.
+ */
+int load_image_config_stream(FILE* f, ImageWTYHeader* hdr, ImageWTYFileHeader** files,
+                             Arena* arena);
+
+/**
+ * @brief Writes the IMAGEWTY configuration to an open stream.
+ *
+ * Produces the same text as write_image_config(), e.g. into a memory
+ * stream for archive output.
+ *
+ * @param f Output stream.
+ * @param hdr Pointer to the ImageWTYHeader structure to write.
+ * @param files Array of ImageWTYFileHeader structures representing each file.
+ * @param num_files Number of files in the array.
+ * @return 0 on success, non-zero on a stream error.
+ */
+int write_image_config_stream(FILE* f, const ImageWTYHeader* hdr, const ImageWTYFileHeader* files,
+                              uint32_t num_files);
 
 /**
  * @brief Writes the IMAGEWTY configuration to an image.cfg file.
@@ -44,12 +78,4 @@ int load_image_config(const char* cfg_path, ImageWTYHeader* hdr, ImageWTYFileHea
 int write_image_config(const char* cfg_path, const ImageWTYHeader* hdr,
                        const ImageWTYFileHeader* files, uint32_t num_files);
 
-/**
- * @brief Frees memory allocated for the file headers array.
- *
- * @param files Pointer to the array of ImageWTYFileHeader structures
- *              previously allocated by `load_image_config`.
- */
-void free_file_list(ImageWTYFileHeader* files);
-
 #endif /* CONFIG_FILE_H */
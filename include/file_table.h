@@ -0,0 +1,106 @@
+/**
+ * file_table.h
+ *
+ * Compact struct-of-arrays view of an image's file header table.
+ *
+ * ImageWTYFileHeader keeps the file name and type strings inline, so a scan
+ * over offsets or lengths drags about 330 bytes per entry through the
+ * cache. A FileTable holds the numeric fields in parallel arrays and the
+ * strings in one shared pool (identical strings are stored once), so bulk
+ * passes such as offset sorting, overlap checks and name lookups only touch
+ * the data they need. Tables are built from a header array and allocated
+ * from an arena; they are read-only snapshots and do not follow later
+ * changes to the headers.
+ */
+
+#ifndef FILE_TABLE_H
+#define FILE_TABLE_H
+
+#include <stdint.h>
+
+#include "arena.h"
+#include "img_header.h"
+
+/**
+ * @brief Handle of a string in a FileTable's string pool.
+ */
+typedef struct
+{
+    uint32_t off; /**< Offset of the first character in the pool */
+    uint32_t len; /**< Length without the terminating NUL */
+} StrRef;
+
+/**
+ * @brief File header table in struct-of-arrays form.
+ */
+typedef struct
+{
+    uint32_t count;            /**< Number of entries */
+    uint32_t* offset;          /**< Data offset of each entry */
+    uint32_t* stored_length;   /**< Stored (padded) length of each entry */
+    uint32_t* original_length; /**< Original length of each entry */
+    StrRef* filename;          /**< File name of each entry */
+    StrRef* maintype;          /**< Main type of each entry */
+    StrRef* subtype;           /**< Sub type of each entry */
+    char* pool;                /**< Interned NUL-terminated strings */
+    uint32_t* name_slots;      /**< Name hash table: entry index + 1, 0 if empty */
+    uint32_t name_mask;        /**< Number of name slots minus one */
+} FileTable;
+
+/**
+ * @brief Build a file table from a header array.
+ *
+ * @param table Table to fill.
+ * @param files File header array.
+ * @param count Number of entries.
+ * @param arena Arena the table is allocated from.
+ * @return 0 on success, non-zero if out of memory.
+ */
+int file_table_build(FileTable* table, const ImageWTYFileHeader* files, uint32_t count,
+                     Arena* arena);
+
+/**
+ * @brief Resolve a string handle.
+ *
+ * @param table File table.
+ * @param ref   Handle from one of the table's string arrays.
+ * @return NUL-terminated string inside the pool.
+ */
+const char* file_table_str(const FileTable* table, StrRef ref);
+
+/**
+ * @brief Find an entry by file name.
+ *
+ * @param table File table.
+ * @param name  File name to look for.
+ * @return Index of the first entry with that name, or -1 if not found.
+ */
+long file_table_find(const FileTable* table, const char* name);
+
+/**
+ * @brief Order the entries by data offset.
+ *
+ * Entries are sorted by offset, then stored length, then index (the sort is
+ * a stable radix sort, so equal ranges keep their table order).
+ *
+ * @param table File table.
+ * @param order Output: table->count entry indices in sorted order.
+ * @param arena Arena for scratch memory.
+ * @return 0 on success, non-zero if out of memory.
+ */
+int file_table_sort_by_offset(const FileTable* table, uint32_t* order, Arena* arena);
+
+/**
+ * @brief Find the entries whose data range repeats an earlier entry's range.
+ *
+ * shared[i] is set to the lowest index j < i with the same offset and
+ * stored length as entry i, or -1 if there is none or entry i is empty.
+ *
+ * @param table  File table.
+ * @param shared Output: table->count indices.
+ * @param arena  Arena for scratch memory.
+ * @return 0 on success, non-zero if out of memory.
+ */
+int file_table_shared_ranges(const FileTable* table, long* shared, Arena* arena);
+
+#endif /* FILE_TABLE_H */
@@ -0,0 +1,57 @@
+/**
+ * img_bufpool.h
+ *
+ * Process-wide pool of I/O buffers.
+ *
+ * Every data and header buffer used by the copy, checksum and header code
+ * is checked out of this pool and returned when done. Buffers are
+ * page-aligned (enough for O_DIRECT and any SIMD load), sized in
+ * power-of-two classes, and kept for reuse once returned, so repeated
+ * transfers do not go back to the allocator. The total size of all buffers
+ * ever held by the pool is capped by a fixed budget.
+ */
+
+#ifndef IMG_BUFPOOL_H
+#define IMG_BUFPOOL_H
+
+#include <stddef.h>
+
+/** Alignment of every pool buffer (and smallest size class) */
+#define BUFPOOL_ALIGNMENT 4096
+
+/** Largest size class */
+#define BUFPOOL_MAX_SIZE (16 * 1024 * 1024)
+
+/** Upper bound on the memory held by the pool */
+#define BUFPOOL_BUDGET (64 * 1024 * 1024)
+
+/** Buffers of at least this size may be backed by huge pages */
+#define BUFPOOL_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * @brief Back large buffers with huge pages from now on.
+ *
+ * Explicit huge pages (MAP_HUGETLB) are tried first; if none are reserved,
+ * transparent huge pages are requested for the buffer instead.
+ *
+ * @param enable Non-zero to enable.
+ */
+void bufpool_set_huge_pages(int enable);
+
+/**
+ * @brief Check a buffer out of the pool.
+ *
+ * @param size Minimum size in bytes (at most BUFPOOL_MAX_SIZE).
+ * @return BUFPOOL_ALIGNMENT-aligned buffer, or NULL (with a message on
+ *         stderr) if the budget is exhausted or memory cannot be mapped.
+ */
+void* bufpool_get(size_t size);
+
+/**
+ * @brief Return a buffer to the pool.
+ *
+ * @param buf Buffer from bufpool_get() (NULL is ignored).
+ */
+void bufpool_put(void* buf);
+
+#endif /* IMG_BUFPOOL_H */
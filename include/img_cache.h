@@ -0,0 +1,83 @@
+/**
+ * img_cache.h
+ *
+ * Local build cache for repacked images.
+ *
+ * Repacking the same dump folder twice produces the same image, so the
+ * result of a repack can be stored under a key derived from everything
+ * that determines its bytes (image.cfg, the computed header table and the
+ * content hash of every payload) and handed back on the next identical
+ * build without writing a single payload.
+ *
+ * The same per-user cache directory also keeps the measured repack
+ * throughput that `repack --plan` uses for its time estimates.
+ */
+
+#ifndef IMG_CACHE_H
+#define IMG_CACHE_H
+
+#include <stdint.h>
+
+/** Environment variable selecting the build cache directory */
+#define CACHE_ENV_VAR "IMAGEWTY_CACHE"
+
+/** Hash cache kept inside a dump folder (a manifest, see manifest.h) */
+#define CACHE_DUMP_HASHES_FILE ".imagewty-hashes"
+
+/** Smallest repack (in bytes) whose throughput is worth recording */
+#define THROUGHPUT_MIN_BYTES (1024 * 1024)
+
+/**
+ * @brief Resolve the default build cache directory.
+ *
+ * Uses CACHE_ENV_VAR if set, otherwise `$XDG_CACHE_HOME/imagewty-tool/images`
+ * or `~/.cache/imagewty-tool/images`.
+ *
+ * @return Cache directory path (never NULL; points to static storage).
+ */
+const char* cache_default_directory(void);
+
+/**
+ * @brief Copy a cached image to the output file if one exists for the key.
+ *
+ * The copy is a reflink where the filesystem supports it.
+ *
+ * @param cache_dir   Cache directory.
+ * @param key_hex     Build key (hex SHA-256).
+ * @param output_file Path where the image is written.
+ * @return 0 on a cache hit, non-zero on a miss or error.
+ */
+int cache_fetch(const char* cache_dir, const char* key_hex, const char* output_file);
+
+/**
+ * @brief Store a freshly built image in the cache.
+ *
+ * @param cache_dir  Cache directory (created if needed).
+ * @param key_hex    Build key (hex SHA-256).
+ * @param image_file Path to the image to store.
+ * @return 0 on success, non-zero on error.
+ */
+int cache_store(const char* cache_dir, const char* key_hex, const char* image_file);
+
+/**
+ * @brief Record the throughput of a completed repack.
+ *
+ * Kept as an exponential moving average in
+ * `$XDG_CACHE_HOME/imagewty-tool/throughput` (or `~/.cache/...`). Runs
+ * smaller than THROUGHPUT_MIN_BYTES are ignored.
+ *
+ * @param bytes   Number of bytes written.
+ * @param seconds Elapsed wall-clock time.
+ */
+void cache_record_throughput(uint64_t bytes, double seconds);
+
+/**
+ * @brief Load the recorded repack throughput.
+ *
+ * @param bytes_per_sec Output: average throughput in bytes per second.
+ * @param samples       Output: number of runs the average is based on.
+ * @return 0 if a measurement is available, non-zero otherwise.
+ */
+int cache_load_throughput(double* bytes_per_sec, uint32_t* samples);
+
+#endif /* IMG_CACHE_H */
@@ -0,0 +1,84 @@
+/**
+ * img_edit.h
+ *
+ * In-place editing of IMAGEWTY images.
+ *
+ * These functions modify an existing image directly instead of going
+ * through a full extract + repack cycle, touching only the header fields
+ * and data ranges affected by the change.
+ */
+
+#ifndef IMG_EDIT_H
+#define IMG_EDIT_H
+
+/**
+ * @brief Replace the contents of one embedded file.
+ *
+ * If the new data fits in the entry's current stored_length it is written
+ * over the existing range; otherwise it is appended at the end of the image
+ * and the entry is pointed at the new location. The header table and the
+ * matching V*.fex checksum (if present) are patched in place.
+ *
+ * @param img_filename Path to the IMAGEWTY image to modify.
+ * @param entry_name   Name of the embedded file (e.g. "env.fex").
+ * @param new_file     Path to the file holding the new contents.
+ * @return 0 on success, non-zero on error.
+ */
+int replace_entry(const char* img_filename, const char* entry_name, const char* new_file);
+
+/**
+ * @brief Number of spare header slots reserved when the header table grows.
+ *
+ * When adding an entry requires relocating data out of the way of the
+ * header table, room for this many further entries is freed at the same
+ * time so that subsequent additions only rewrite headers.
+ */
+#define EDIT_HEADER_SLACK 4
+
+/**
+ * @brief Add a new embedded file to an existing image.
+ *
+ * The new header is written into free space after the header table. If the
+ * first data entries are in the way, only those entries are moved to the end
+ * of the image; all other payloads stay where they are. The new data is
+ * appended to the end of the image.
+ *
+ * @param img_filename Path to the IMAGEWTY image to modify.
+ * @param new_file     Path to the file to add (its base name becomes the entry name).
+ * @param maintype     Main type string, or NULL for the default ("RFSFAT16").
+ * @param subtype      Sub type string, or NULL to derive it from the file name.
+ * @return 0 on success, non-zero on error.
+ */
+int add_entry(const char* img_filename, const char* new_file, const char* maintype,
+              const char* subtype);
+
+/**
+ * @brief Remove an embedded file from an existing image.
+ *
+ * The following headers are shifted down by one slot; payloads are not
+ * moved. If the removed entry's data was at the end of the image, the image
+ * is truncated.
+ *
+ * @param img_filename Path to the IMAGEWTY image to modify.
+ * @param entry_name   Name of the embedded file to remove.
+ * @return 0 on success, non-zero on error.
+ */
+int remove_entry(const char* img_filename, const char* entry_name);
+
+/**
+ * @brief Pack an image's payloads tightly behind the header table.
+ *
+ * Computes the packed layout (in current offset order, with the same
+ * alignment rules as calculate_padding()) and moves only the ranges whose
+ * position changes. Entries sharing an identical data range keep sharing
+ * it. Bytes after the last entry that no entry describes (e.g. a vendor
+ * trailer) are moved to follow the packed data. Offsets, stored lengths and
+ * total_image_size are updated and the image is truncated to its new size.
+ *
+ * @param img_filename Path to the IMAGEWTY image.
+ * @param output_file  Path of a new compacted image, or NULL to compact in place.
+ * @return 0 on success, non-zero on error.
+ */
+int compact_image(const char* img_filename, const char* output_file);
+
+#endif /* IMG_EDIT_H */
@@ -1,8 +1,9 @@
 /**
  * img_extract.h
  *
- * Functions to extract all files from an IMAGEWTY image into a dump folder.
- * After extraction, verifies integrity of extracted files using V*.fex checksums.
+ * Functions to extract all files from an IMAGEWTY image into a dump folder
+ * or a pax archive. After extraction, verifies integrity of extracted files
+ * using V*.fex checksums.
  */
 
 #ifndef IMG_EXTRACT_H
@@ -10,15 +11,71 @@
 
 #include "img_header.h"
 
+/** Dump folder used when the image is read from standard input */
+#define EXTRACT_STDIN_DUMP_DIR "stdin.dump"
+
+/**
+ * @brief Options controlling where extract_image() writes the entries.
+ */
+typedef struct
+{
+    /**
+     * Path of a pax archive to write instead of a dump folder ("-" for
+     * standard output), or NULL. The archive holds the generated image.cfg
+     * followed by every entry under its file name, in data offset order;
+     * entries sharing an earlier entry's data range are stored as hard
+     * links to it. Data is copied from the image straight into the archive,
+     * so no per-file output is created.
+     */
+    const char* tar_path;
+
+    /**
+     * Names of the entries to extract (entry_count of them), or NULL for
+     * all entries. Only the selected data ranges are read, so a single
+     * entry of a compressed image is decompressed from the nearest
+     * checkpoint or block; V*.fex checks are limited to selected entries.
+     * Not available for an image on standard input.
+     */
+    const char* const* entries;
+    int entry_count; /**< Number of names in entries */
+
+    /**
+     * Write dump folder entries of at least LZ4_MIN_FILE_SIZE bytes as
+     * <name>.lz4 LZ4 frames (see img_lz4.h). V*.fex files and image.cfg
+     * stay plain; repack and the checksum helpers read either form. Not
+     * available with tar_path.
+     */
+    int compress;
+} ExtractOptions;
+
+/**
+ * @brief Fill an ExtractOptions structure with the default settings.
+ *
+ * @param opts Options to initialize.
+ */
+void extract_options_init(ExtractOptions* opts);
+
 /**
  * @brief Extracts all files from an IMAGEWTY image into a dump folder.
  *
  * This function reads the image headers, extracts each file to the appropriate
  * location, and verifies the integrity of V*.fex files using their checksums.
  *
- * @param img_filename Path to the IMAGEWTY image file.
+ * With "-" as the file name the image is read from standard input, which
+ * need not be seekable: entries are written in a single forward pass in
+ * data offset order, into EXTRACT_STDIN_DUMP_DIR.
+ *
+ * An image inside a zip bundle is named "bundle.zip!/member" and extracted
+ * into <member>.dump: a stored member is copied straight out of the
+ * archive, a deflated one is inflated in a single forward pass. A gzip or
+ * xz compressed image (e.g. firmware.img.gz) is extracted into
+ * <image>.dump (firmware.img.dump) the same way.
+ *
+ * @param img_filename Path to the IMAGEWTY image file, "-" for standard
+ *                     input, or "bundle.zip!/member".
+ * @param opts         Extract options, or NULL for the defaults.
  * @return 0 on success, non-zero on error.
  */
-int extract_image(const char* img_filename);
+int extract_image(const char* img_filename, const ExtractOptions* opts);
 
 #endif /* IMG_EXTRACT_H */
@@ -11,6 +11,8 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "arena.h"
+
 /** Magic string identifying an ImageWTY file */
 #define IMAGEWTY_MAGIC "IMAGEWTY"
 
@@ -20,6 +22,17 @@
 /** Offset where the file headers section begins */
 #define FILE_HEADERS_START 0x400
 
+/** Byte offset of total_image_size inside the main header */
+#define IMG_HEADER_TOTAL_SIZE_OFFSET 0x18
+
+/** Byte offset of num_files inside the main header */
+#define IMG_HEADER_NUM_FILES_OFFSET 0x3C
+
+/** Byte offsets of the size/location fields inside a file header */
+#define FILE_HEADER_STORED_LENGTH_OFFSET 0x124
+#define FILE_HEADER_ORIGINAL_LENGTH_OFFSET 0x12C
+#define FILE_HEADER_OFFSET_OFFSET 0x134
+
 /**
  * @brief Main IMAGEWTY image header structure.
  *
@@ -96,13 +109,55 @@ void read_file_header(FILE* f, ImageWTYFileHeader* fh, uint32_t file_header_leng
 /**
  * @brief Reads all file headers sequentially from the IMAGEWTY image.
  *
- * Allocates an array of ImageWTYFileHeader; caller must free the memory.
+ * The array is allocated from the given arena and lives until the arena
+ * is released.
  *
  * @param f               File pointer
  * @param num_files       Number of file headers to read
  * @param file_header_len Size of each file header (from main header)
- * @return Pointer to allocated array of ImageWTYFileHeader
+ * @param arena           Arena to allocate the array from
+ * @return Pointer to the array of ImageWTYFileHeader
+ */
+ImageWTYFileHeader* read_all_file_headers(FILE* f, uint32_t num_files, uint32_t file_header_len,
+                                          Arena* arena);
+
+/**
+ * @brief Serializes the main IMAGEWTY header into its on-disk layout.
+ *
+ * @param hdr Pointer to the header to serialize
+ * @param buf Output buffer of IMG_HEADER_HEADER_SIZE bytes (fully overwritten)
+ */
+void serialize_image_header(const ImageWTYHeader* hdr, uint8_t* buf);
+
+/**
+ * @brief Serializes a single file header into its on-disk layout.
+ *
+ * @param fh                 Pointer to the file header to serialize
+ * @param buf                Output buffer of file_header_length bytes (fully overwritten)
+ * @param file_header_length Size of the file header (from main header)
+ */
+void serialize_file_header(const ImageWTYFileHeader* fh, uint8_t* buf,
+                           uint32_t file_header_length);
+
+/**
+ * @brief Writes the main IMAGEWTY header at the start of the file.
+ *
+ * @param f   File pointer (opened for writing)
+ * @param hdr Pointer to the header to write
+ * @return 0 on success, non-zero on error
+ */
+int write_image_header(FILE* f, const ImageWTYHeader* hdr);
+
+/**
+ * @brief Writes a single file header into its slot of the header table.
+ *
+ * @param f                  File pointer (opened for writing)
+ * @param fh                 Pointer to the file header to write
+ * @param index              Index of the entry in the header table
+ * @param file_header_length Size of the file header (from main header)
+ * @return 0 on success, non-zero on error
  */
-ImageWTYFileHeader* read_all_file_headers(FILE* f, uint32_t num_files, uint32_t file_header_len);
+int write_file_header(FILE* f, const ImageWTYFileHeader* fh, uint32_t index,
+                      uint32_t file_header_length);
 
 #endif /* IMG_HEADER_H */
@@ -0,0 +1,123 @@
+/**
+ * img_inflate.h
+ *
+ * Random-access reader over a raw deflate stream stored in a file: a
+ * deflated zip member, or the body of a gzip file.
+ *
+ * Data is inflated on demand. While inflating, the decoder state at a
+ * deflate block boundary roughly every INFLATE_CHECKPOINT_SPAN bytes of
+ * output is kept as a checkpoint (the bit position in the compressed data
+ * plus the last INFLATE_WINDOW_SIZE bytes of output), so a read behind the
+ * current position resumes from the nearest checkpoint instead of the start
+ * of the stream. Checkpoints can be saved to an index file and reused by
+ * later runs.
+ */
+
+#ifndef IMG_INFLATE_H
+#define IMG_INFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Distance (in uncompressed bytes) between checkpoints */
+#define INFLATE_CHECKPOINT_SPAN (8 * 1024 * 1024)
+
+/** Size of the deflate window saved with each checkpoint */
+#define INFLATE_WINDOW_SIZE 32768
+
+/** DeflateStream.size of a stream whose length is not known yet */
+#define INFLATE_SIZE_UNKNOWN UINT64_MAX
+
+/**
+ * @brief Location of a raw deflate stream.
+ */
+typedef struct
+{
+    uint64_t data_offset; /**< File offset of the first compressed byte */
+    uint64_t comp_size;   /**< Exact length of the compressed data */
+    uint64_t size;        /**< Uncompressed size, or INFLATE_SIZE_UNKNOWN */
+    uint32_t crc;         /**< CRC-32 of the uncompressed data */
+} DeflateStream;
+
+/**
+ * @brief Random-access reader over a deflate stream.
+ */
+typedef struct Inflater Inflater;
+
+/**
+ * @brief Check for the gzip magic bytes.
+ *
+ * @param head First bytes of a file.
+ * @param len  Number of bytes in head.
+ * @return Non-zero if the file starts like a gzip file.
+ */
+int inflater_is_gzip(const uint8_t* head, size_t len);
+
+/**
+ * @brief Locate the deflate stream of a gzip file.
+ *
+ * Only single-member files are supported (concatenated members show up as
+ * trailing data when the stream is inflated). The uncompressed size is left
+ * unknown, since the trailer only records it modulo 4 GiB.
+ *
+ * @param fd     File descriptor.
+ * @param stream Output: the deflate stream.
+ * @return 0 on success, non-zero on error (with a message on stderr).
+ */
+int inflater_gzip_stream(int fd, DeflateStream* stream);
+
+/**
+ * @brief Start reading a deflate stream.
+ *
+ * @param fd         File descriptor (must stay open until inflater_close()).
+ * @param stream     Stream to read.
+ * @param index_path Checkpoint index file to load (if it exists and matches
+ *                   the stream; it also supplies an unknown size) and to
+ *                   update on close, or NULL.
+ * @return Reader, or NULL on error.
+ */
+Inflater* inflater_open(int fd, const DeflateStream* stream, const char* index_path);
+
+/**
+ * @brief Uncompressed size of the stream.
+ *
+ * @param z Reader.
+ * @return Size, or INFLATE_SIZE_UNKNOWN until inflater_scan() has run.
+ */
+uint64_t inflater_size(const Inflater* z);
+
+/**
+ * @brief Inflate the whole stream once, recording every checkpoint.
+ *
+ * This learns the uncompressed size and checks the CRC-32, and leaves a
+ * complete index for later random access.
+ *
+ * @param z Reader.
+ * @return 0 on success, non-zero on error (corrupt or truncated data).
+ */
+int inflater_scan(Inflater* z);
+
+/**
+ * @brief Read uncompressed bytes.
+ *
+ * Reads continuing where the previous one ended are served from the live
+ * decoder; other reads restart from the nearest checkpoint. The CRC-32 of
+ * the stream is checked once it has been inflated from start to end in one
+ * pass.
+ *
+ * @param z   Reader (with a known size).
+ * @param off Uncompressed offset.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read (off + len must not exceed the size).
+ * @return 0 on success, non-zero on error.
+ */
+int inflater_read(Inflater* z, uint64_t off, void* buf, size_t len);
+
+/**
+ * @brief Release a reader, saving new checkpoints to its index file.
+ *
+ * @param z Reader (NULL is ignored).
+ */
+void inflater_close(Inflater* z);
+
+#endif /* IMG_INFLATE_H */
@@ -0,0 +1,244 @@
+/**
+ * img_io.h
+ *
+ * Low-level data transfer helpers shared by the image editing, extraction
+ * and repacking code.
+ *
+ * All functions operate on raw file descriptors with absolute offsets, so
+ * callers mixing them with stdio must fflush() their FILE streams first.
+ */
+
+#ifndef IMG_IO_H
+#define IMG_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Environment variable selecting the I/O backend (see io_backend_from_name()) */
+#define IO_BACKEND_ENV_VAR "IMAGEWTY_IO"
+
+/**
+ * @brief Data transfer backend used by io_copy_range().
+ */
+typedef enum
+{
+    IO_BACKEND_AUTO,  /**< sync, with io_uring instead of the pread() fallback */
+    IO_BACKEND_SYNC,  /**< copy_file_range(), else pipelined pread() + pwrite() */
+    IO_BACKEND_URING, /**< always io_uring (see img_uring.h); error if unavailable */
+} IoBackend;
+
+/** Block alignment required for O_DIRECT transfers (covers 512 B and 4 KiB devices) */
+#define IO_DIRECT_ALIGNMENT 4096
+
+/** Size of one O_DIRECT transfer */
+#define IO_DIRECT_CHUNK_SIZE (4 * 1024 * 1024)
+
+/** Granularity of POSIX_FADV_WILLNEED requests issued ahead of sequential reads */
+#define IO_READAHEAD_WINDOW (8 * 1024 * 1024)
+
+/**
+ * @brief Consumer of data read by io_read_range().
+ *
+ * @param data Chunk of data.
+ * @param len  Chunk length.
+ * @param ctx  Caller context.
+ * @return 0 to continue, non-zero to abort the read.
+ */
+typedef int (*IoReadCallback)(const uint8_t* data, size_t len, void* ctx);
+
+/**
+ * @brief Parse a backend name ("auto", "sync" or "uring").
+ *
+ * @param name    Backend name.
+ * @param backend Output: parsed backend.
+ * @return 0 on success, non-zero if the name is unknown.
+ */
+int io_backend_from_name(const char* name, IoBackend* backend);
+
+/**
+ * @brief Select the data transfer backend for the rest of the process.
+ *
+ * @param backend Backend to use.
+ * @return 0 on success, non-zero if io_uring was requested but is unavailable.
+ */
+int io_set_backend(IoBackend backend);
+
+/**
+ * @brief Enable or disable O_DIRECT transfers for the rest of the process.
+ *
+ * In direct mode, io_copy_range() between two files and io_read_range()
+ * bypass the page cache: data moves in IO_DIRECT_CHUNK_SIZE blocks through
+ * an aligned buffer, reads are widened to aligned windows, and only the
+ * unaligned head and tail of each destination range go through the page
+ * cache. Files on filesystems without O_DIRECT support are copied normally.
+ *
+ * @param enable Non-zero to enable direct mode.
+ */
+void io_set_direct(int enable);
+
+/**
+ * @brief Drop copied data from the page cache once it has been used.
+ *
+ * A lighter alternative to direct mode: transfers still go through the
+ * page cache, but every range read or written by io_copy_range(),
+ * io_read_range() or io_release_range() is released afterwards (outputs
+ * are written back with sync_file_range() first), which keeps page-cache
+ * usage bounded on shared hosts.
+ *
+ * @param enable Non-zero to drop used ranges.
+ */
+void io_set_drop_cache(int enable);
+
+/**
+ * @brief Announce a sequential read of a range.
+ *
+ * Issues POSIX_FADV_SEQUENTIAL for the range and POSIX_FADV_WILLNEED for
+ * its first two IO_READAHEAD_WINDOW windows. Errors are ignored (hints only).
+ *
+ * @param fd  File descriptor.
+ * @param off Start of the range.
+ * @param len Length of the range (0 = to end of file).
+ */
+void io_advise_sequential(int fd, uint64_t off, uint64_t len);
+
+/**
+ * @brief Release a range that is no longer needed from the page cache.
+ *
+ * Does nothing unless io_set_drop_cache() was enabled. Written ranges are
+ * flushed with sync_file_range() first, since dirty pages cannot be dropped.
+ *
+ * @param fd      File descriptor.
+ * @param off     Start of the range.
+ * @param len     Length of the range (0 = to end of file).
+ * @param written Non-zero if the range was written.
+ */
+void io_release_range(int fd, uint64_t off, uint64_t len, int written);
+
+/**
+ * @brief Copy a byte range between two files (or within one file).
+ *
+ * copy_file_range() is used where possible, which lets the kernel share
+ * extents (reflink) or copy without bouncing data through user space. Where
+ * it is not supported between two files, the copy continues through
+ * io_uring (auto backend) or pipelined pread()/pwrite() (sync backend); the
+ * uring backend sends every copy between two files through io_uring.
+ * Overlapping ranges within the same file are handled like memmove().
+ *
+ * @param in_fd   Source file descriptor.
+ * @param in_off  Source offset.
+ * @param out_fd  Destination file descriptor.
+ * @param out_off Destination offset.
+ * @param len     Number of bytes to copy.
+ * @return 0 on success, non-zero on error.
+ */
+int io_copy_range(int in_fd, uint64_t in_off, int out_fd, uint64_t out_off, uint64_t len);
+
+/**
+ * @brief Copy a byte range between two different files and checksum it on the way.
+ *
+ * The data is moved through the reader/writer pipeline (see img_pipeline.h),
+ * or with O_DIRECT enabled through the aligned direct copy, and is summed
+ * while it is in memory, so the source range is read only once.
+ *
+ * @param in_fd    Source file descriptor.
+ * @param in_off   Source offset.
+ * @param out_fd   Destination file descriptor (must differ from in_fd).
+ * @param out_off  Destination offset.
+ * @param len      Number of bytes to copy.
+ * @param checksum Output: V*.fex checksum of the copied data (see checksum.h).
+ * @return 0 on success, non-zero on error.
+ */
+int io_copy_range_checksum(int in_fd, uint64_t in_off, int out_fd, uint64_t out_off,
+                           uint64_t len, uint32_t* checksum);
+
+/**
+ * @brief Read a byte range and pass it to a callback in chunks.
+ *
+ * @param fd  Source file descriptor.
+ * @param off Source offset.
+ * @param len Number of bytes to read.
+ * @param cb  Callback receiving the data in order.
+ * @param ctx Context passed to the callback.
+ * @return 0 on success, non-zero on error or if the callback aborted.
+ */
+int io_read_range(int fd, uint64_t off, uint64_t len, IoReadCallback cb, void* ctx);
+
+/**
+ * @brief Write a run of zero bytes at an absolute offset.
+ *
+ * @param fd  Destination file descriptor.
+ * @param off Destination offset.
+ * @param len Number of zero bytes to write.
+ * @return 0 on success, non-zero on error.
+ */
+int io_write_zeros(int fd, uint64_t off, uint64_t len);
+
+/**
+ * @brief Write a buffer to a stream at its current position.
+ *
+ * Partial writes (pipes, sockets) are continued until everything is written.
+ *
+ * @param fd  Destination file descriptor (need not be seekable).
+ * @param buf Data to write.
+ * @param len Number of bytes.
+ * @return 0 on success, non-zero on error.
+ */
+int io_write_all(int fd, const void* buf, size_t len);
+
+/**
+ * @brief Append a byte range of a file to a stream.
+ *
+ * Uses sendfile(), so the data goes from the page cache into the pipe or
+ * socket without a copy through user space; falls back to pread() and
+ * io_write_all() where the kernel does not support the pair of files.
+ *
+ * @param in_fd  Source file descriptor (regular file).
+ * @param in_off Source offset.
+ * @param out_fd Destination file descriptor (need not be seekable).
+ * @param len    Number of bytes to send.
+ * @return 0 on success, non-zero on error or if the source is too short.
+ */
+int io_send_range(int in_fd, uint64_t in_off, int out_fd, uint64_t len);
+
+/**
+ * @brief Append a run of zero bytes to a stream.
+ *
+ * @param fd  Destination file descriptor (need not be seekable).
+ * @param len Number of zero bytes.
+ * @return 0 on success, non-zero on error.
+ */
+int io_send_zeros(int fd, uint64_t len);
+
+/**
+ * @brief Reserve standard output for data.
+ *
+ * Returns a descriptor for the original standard output and points
+ * standard output at standard error, so progress messages printed while
+ * data is written cannot end up in the data stream.
+ *
+ * @return Descriptor of the original standard output, or -1 on error.
+ */
+int io_claim_stdout(void);
+
+/**
+ * @brief Undo io_claim_stdout().
+ *
+ * @param fd Descriptor returned by io_claim_stdout() (closed).
+ */
+void io_restore_stdout(int fd);
+
+/**
+ * @brief Make out_fd a copy of the first size bytes of in_fd.
+ *
+ * Tries a whole-file reflink (FICLONE) first, so that on btrfs, XFS and
+ * similar filesystems the copy shares all extents and costs no data I/O;
+ * otherwise the data is copied with io_copy_range().
+ *
+ * @param in_fd  Source file descriptor.
+ * @param out_fd Destination file descriptor (opened for writing, empty).
+ * @param size   Number of bytes to copy.
+ * @return 0 on success, non-zero on error.
+ */
+int io_clone_file(int in_fd, int out_fd, uint64_t size);
+
+#endif /* IMG_IO_H */
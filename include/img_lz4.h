@@ -0,0 +1,126 @@
+/**
+ * img_lz4.h
+ *
+ * LZ4 frame compression of dump folder entries.
+ *
+ * extract --compress=lz4 stores a large entry <name> as <name>.lz4: a
+ * standard LZ4 frame (readable by lz4 -d) of independently compressed and
+ * checksummed LZ4_BLOCK_SIZE blocks that records the uncompressed size,
+ * followed by a skippable frame holding the file offset of every block.
+ * The offsets let several threads decode blocks at once while the data is
+ * still delivered in order; frames without them are indexed by walking the
+ * block headers.
+ *
+ * Dump folder readers (repack, checksums, manifests) open entries through
+ * lz4_input_open(), which falls back to <name>.lz4 when <name> does not
+ * exist, so compressed and plain entries can be mixed freely. Any LZ4 frame
+ * without a dictionary is accepted there, e.g. the output of a plain
+ * `lz4 <name>`: linked blocks are decoded on one thread, and a frame that
+ * does not record its size is decoded once on open to find it.
+ */
+
+#ifndef IMG_LZ4_H
+#define IMG_LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "img_io.h"
+
+/** Suffix of a dump folder entry stored as an LZ4 frame */
+#define LZ4_FILE_SUFFIX ".lz4"
+
+/** Uncompressed size of every block but the last (the LZ4 frame maximum) */
+#define LZ4_BLOCK_SIZE (4 * 1024 * 1024)
+
+/** Entries smaller than this are left uncompressed by extract --compress */
+#define LZ4_MIN_FILE_SIZE (64 * 1024)
+
+/** Maximum number of threads decoding the blocks of one frame */
+#define LZ4_DECODE_THREADS 4
+
+/**
+ * @brief Writer of one LZ4 frame.
+ */
+typedef struct Lz4Writer Lz4Writer;
+
+/**
+ * @brief Dump folder entry opened for reading, plain or compressed.
+ */
+typedef struct
+{
+    int fd;         /**< Open file (plain data or LZ4 frame) */
+    int compressed; /**< fd holds an LZ4 frame */
+    uint64_t size;  /**< Size of the (uncompressed) data */
+} Lz4Input;
+
+/**
+ * @brief Start an LZ4 frame.
+ *
+ * The frame header is written right away, at the current position of fd.
+ *
+ * @param fd   Output file descriptor (written sequentially).
+ * @param size Number of bytes that will be passed to lz4_writer_write().
+ * @return Writer, or NULL on error (with a message on stderr).
+ */
+Lz4Writer* lz4_writer_open(int fd, uint64_t size);
+
+/**
+ * @brief Compress data into the frame.
+ *
+ * @param w    Writer.
+ * @param data Data to append.
+ * @param len  Number of bytes.
+ * @return 0 on success, non-zero on error.
+ */
+int lz4_writer_write(Lz4Writer* w, const void* data, size_t len);
+
+/**
+ * @brief Write the last block, the end mark and the block index.
+ *
+ * @param w Writer (all of the announced size written).
+ * @return 0 on success, non-zero on error.
+ */
+int lz4_writer_finish(Lz4Writer* w);
+
+/**
+ * @brief Release a writer (finished or not).
+ *
+ * @param w Writer (NULL is ignored).
+ */
+void lz4_writer_free(Lz4Writer* w);
+
+/**
+ * @brief Open a dump folder entry, or its LZ4 compressed form.
+ *
+ * path is opened if it exists; otherwise path + LZ4_FILE_SUFFIX is opened
+ * and its frame header checked. If the frame does not record its
+ * uncompressed size, the frame is decoded once here to find it.
+ *
+ * @param path Path of the entry as it would be stored uncompressed.
+ * @param in   Output: opened entry.
+ * @return 0 on success, non-zero on error (with a message on stderr).
+ */
+int lz4_input_open(const char* path, Lz4Input* in);
+
+/**
+ * @brief Read all data of an entry, decompressing it if needed.
+ *
+ * Plain files are read with io_read_range(). Compressed blocks are decoded
+ * by up to LZ4_DECODE_THREADS threads and handed to cb in order.
+ *
+ * @param in  Opened entry.
+ * @param cb  Consumer of the data; a non-zero return aborts the read.
+ * @param ctx Passed to cb.
+ * @return 0 on success, non-zero on error (corrupt frame or cb failure).
+ */
+int lz4_input_read(const Lz4Input* in, IoReadCallback cb, void* ctx);
+
+/**
+ * @brief Close an entry opened with lz4_input_open().
+ *
+ * @param in Entry.
+ */
+void lz4_input_close(Lz4Input* in);
+
+#endif /* IMG_LZ4_H */
@@ -0,0 +1,53 @@
+/**
+ * img_mount.h
+ *
+ * Read-only FUSE view of an IMAGEWTY image.
+ *
+ * The mounted directory holds one file per entry of the file header table
+ * and the image.cfg extract would write, so tools can read entries in
+ * place without extracting them. The kernel protocol is spoken directly
+ * on /dev/fuse (no libfuse): root mounts with mount(2), other users
+ * through fusermount3/fusermount.
+ *
+ * Reads of plain images and stored zip members are spliced from the image
+ * file into the reply, so data moves from the page cache to the reader
+ * without a copy through this process. Compressed images are decoded into
+ * a cache of MOUNT_CACHE_BLOCK_SIZE blocks shared by all open files.
+ */
+
+#ifndef IMG_MOUNT_H
+#define IMG_MOUNT_H
+
+/** Filesystem type shown in the mount table ("fuse." + this) */
+#define MOUNT_FS_SUBTYPE "imagewty"
+
+/** Largest read request negotiated with the kernel */
+#define MOUNT_MAX_READ (1024 * 1024)
+
+/** Size of one block of decoded data cached for compressed images */
+#define MOUNT_CACHE_BLOCK_SIZE (1024 * 1024)
+
+/** Number of cached blocks of decoded data */
+#define MOUNT_CACHE_BLOCKS 16
+
+/** Seconds the kernel may cache names and attributes (the view never changes) */
+#define MOUNT_ATTR_TIMEOUT 3600
+
+/**
+ * @brief Mount an image read-only and serve it until it is unmounted.
+ *
+ * Runs in the foreground. The view is detached again on SIGINT, SIGTERM or
+ * SIGHUP; an external umount (or fusermount -u) ends the call as well.
+ * Entries whose name cannot be a file name (empty, ".", "..", containing a
+ * '/' or "image.cfg") and later entries repeating an earlier name are not
+ * listed.
+ *
+ * @param img_filename Path to the IMAGEWTY image file (possibly gzip or xz
+ *                     compressed), or "bundle.zip!/member" for an image
+ *                     inside a zip bundle.
+ * @param mountpoint   Existing directory to mount the view on.
+ * @return 0 once unmounted, non-zero on error.
+ */
+int mount_image(const char* img_filename, const char* mountpoint);
+
+#endif /* IMG_MOUNT_H */
@@ -0,0 +1,40 @@
+/**
+ * img_pipeline.h
+ *
+ * Two-stage reader/writer pipeline for payload transfers.
+ *
+ * A reader thread fills a small ring of buffers from the source range
+ * while the calling thread writes them out, so reading and writing overlap
+ * even on devices that serve one request at a time (spinning disks,
+ * network filesystems). The V*.fex checksum of the data can be computed on
+ * the way through: the reader sums a chunk before handing it over unless
+ * the writer is already waiting for it, in which case the writer sums it
+ * after writing.
+ */
+
+#ifndef IMG_PIPELINE_H
+#define IMG_PIPELINE_H
+
+#include <stdint.h>
+
+/** Number of buffers in the ring */
+#define PIPELINE_DEPTH 4
+
+/** Size of each buffer (a multiple of 4, so chunk checksums can be added up) */
+#define PIPELINE_CHUNK_SIZE (1024 * 1024)
+
+/**
+ * @brief Copy a byte range between two different files through the pipeline.
+ *
+ * @param in_fd    Source file descriptor.
+ * @param in_off   Source offset.
+ * @param out_fd   Destination file descriptor (must differ from in_fd).
+ * @param out_off  Destination offset.
+ * @param len      Number of bytes to copy.
+ * @param checksum Optional output: V*.fex checksum of the copied data.
+ * @return 0 on success, non-zero on error.
+ */
+int pipeline_copy_range(int in_fd, uint64_t in_off, int out_fd, uint64_t out_off, uint64_t len,
+                        uint32_t* checksum);
+
+#endif /* IMG_PIPELINE_H */
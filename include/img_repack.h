@@ -7,6 +7,8 @@
 #ifndef IMG_REPACK_H
 #define IMG_REPACK_H
 
+#include <stdint.h>
+
 /**
  * @def PADDING_ALIGNMENT
  * @brief Alignment boundary used when calculating padded file sizes.
@@ -15,13 +17,71 @@
  */
 #define PADDING_ALIGNMENT 16
 
+/**
+ * @def MAX_PAYLOAD_ALIGNMENT
+ * @brief Largest accepted payload offset alignment (see RepackOptions).
+ */
+#define MAX_PAYLOAD_ALIGNMENT (1024 * 1024)
+
+/**
+ * @brief Options controlling how repack_image() lays out and writes an image.
+ */
+typedef struct
+{
+    uint32_t alignment;           /**< Payload offset alignment (power of two, 16 to 1 MiB) */
+    int dedup;                    /**< Store byte-identical files once, sharing one range */
+    const char* incremental_base; /**< Earlier output whose unchanged ranges are reused, or NULL */
+    const char* cache_dir;        /**< Build cache directory, or NULL to disable the cache */
+    int plan;                     /**< Only print the planned layout as JSON; write nothing */
+    int from_tar;                 /**< Read a tar/pax archive ("-" = stdin), not a folder */
+} RepackOptions;
+
+/**
+ * @brief Fill a RepackOptions structure with the default settings.
+ *
+ * @param opts Options to initialize.
+ */
+void repack_options_init(RepackOptions* opts);
+
+/**
+ * @brief Check that a payload alignment is acceptable for repack.
+ *
+ * @param alignment Requested alignment in bytes.
+ * @return 0 if valid, non-zero otherwise (an error is printed).
+ */
+int validate_alignment(uint64_t alignment);
+
+/**
+ * @brief Round an offset up to a multiple of the given alignment.
+ *
+ * @param offset    Offset in bytes.
+ * @param alignment Alignment in bytes (power of two).
+ * @return Aligned offset.
+ */
+uint64_t align_offset(uint64_t offset, uint32_t alignment);
+
+/**
+ * @brief Calculate aligned stored length and padding for a file.
+ *
+ * @param original_length Original file size in bytes.
+ * @param stored_length   Output parameter: padded file size.
+ * @param padding         Output parameter: number of padding bytes to add.
+ */
+void calculate_padding(uint64_t original_length, uint64_t* stored_length, uint64_t* padding);
+
 /**
  * @brief Repack all files from a dump folder into a single IMAGEWTY image.
  *
- * @param dump_folder Path to the folder containing extracted files and image.cfg.
- * @param output_file Path where the repacked IMAGEWTY image will be written.
+ * With "-" as output_file the image is written to standard output strictly
+ * in order (no seeking), so it can be piped into a compressor or uploader;
+ * progress messages then go to standard error.
+ *
+ * @param dump_folder Path to the folder containing extracted files and image.cfg
+ *                    (or to the archive, see RepackOptions.from_tar).
+ * @param output_file Path where the repacked IMAGEWTY image will be written, or "-".
+ * @param opts Repack options, or NULL for the defaults.
  * @return 0 on success, non-zero on error.
  */
-int repack_image(const char* dump_folder, const char* output_file);
+int repack_image(const char* dump_folder, const char* output_file, const RepackOptions* opts);
 
 #endif /* IMG_REPACK_H */
@@ -0,0 +1,154 @@
+/**
+ * img_source.h
+ *
+ * Read access to the bytes of an IMAGEWTY image wherever it is kept: a
+ * plain file, a gzip or xz compressed file (recognized by its magic
+ * bytes), standard input, or a member of a zip bundle, named as
+ * "bundle.zip!/firmware.img".
+ *
+ * A plain file or a stored zip member is a direct source: the image is the
+ * byte range [base, base + size) of fd, so payloads can be moved with the
+ * regular img_io transfers (zero-copy where the backend allows). Deflated
+ * zip members and gzip files are inflated on demand from the nearest
+ * checkpoint (see img_inflate.h), xz files from the start of the block
+ * holding the data (see img_xz.h), and standard input can only be read
+ * sequentially.
+ */
+
+#ifndef IMG_SOURCE_H
+#define IMG_SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "img_inflate.h"
+#include "img_io.h"
+#include "img_xz.h"
+
+/** Separator between a zip archive path and a member name */
+#define SOURCE_ZIP_SEPARATOR "!/"
+
+/** Suffix of the checkpoint index kept next to a gzip image */
+#define SOURCE_INDEX_SUFFIX ".idx"
+
+/**
+ * @brief Where the image bytes come from.
+ */
+typedef enum
+{
+    SOURCE_FILE,         /**< Plain image file */
+    SOURCE_STDIN,        /**< Standard input (sequential reads only) */
+    SOURCE_ZIP_STORED,   /**< Uncompressed zip member */
+    SOURCE_ZIP_DEFLATED, /**< Deflated zip member */
+    SOURCE_GZIP,         /**< gzip compressed file */
+    SOURCE_XZ            /**< xz compressed file */
+} SourceKind;
+
+/**
+ * @brief An open image.
+ */
+typedef struct
+{
+    SourceKind kind;    /**< Kind of source */
+    int fd;             /**< Image file, archive or standard input */
+    uint64_t base;      /**< Offset of the image in fd (direct sources) */
+    uint64_t size;      /**< Image size (UINT64_MAX for standard input) */
+    uint64_t pos;       /**< Image offset of the next source_read() */
+    time_t mtime;       /**< Modification time of the file holding the image */
+    Inflater* inflater; /**< Decoder of a deflated member or gzip file */
+    XzReader* xz;       /**< Decoder of an xz file */
+} ImageSource;
+
+/**
+ * @brief Keep inflate checkpoint indexes of deflated zip members in a directory.
+ *
+ * Each member gets one index file, named after a hash of the archive path,
+ * size and modification time and the member name. Later runs load it and
+ * can then seek within the member without inflating it from the start.
+ *
+ * @param dir Existing directory, or NULL to keep checkpoints in memory only.
+ */
+void source_set_index_dir(const char* dir);
+
+/**
+ * @brief Open an image.
+ *
+ * @param src  Source to initialize.
+ * @param path Image file, "-" for standard input, or "archive.zip!/member".
+ *             A path that names an existing file is always taken as a
+ *             file, even if it contains SOURCE_ZIP_SEPARATOR. A gzip file
+ *             without a valid index at path + SOURCE_INDEX_SUFFIX is
+ *             inflated once here to build it.
+ * @return 0 on success, non-zero on error (with a message on stderr).
+ */
+int source_open(ImageSource* src, const char* path);
+
+/**
+ * @brief Close an image opened with source_open().
+ *
+ * @param src Source.
+ */
+void source_close(ImageSource* src);
+
+/**
+ * @brief Tell whether the image is a byte range of src->fd.
+ *
+ * @param src Source.
+ * @return Non-zero for plain files and stored zip members.
+ */
+int source_is_direct(const ImageSource* src);
+
+/**
+ * @brief Read the next bytes of the image.
+ *
+ * @param src Source.
+ * @param buf Destination buffer.
+ * @param len Maximum number of bytes to read.
+ * @return Number of bytes read, 0 at the end of the image, -1 on error
+ *         (with a message on stderr).
+ */
+ssize_t source_read(ImageSource* src, void* buf, size_t len);
+
+/**
+ * @brief Read exactly len bytes at an image offset.
+ *
+ * @param src Source (not standard input).
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @param off Image offset.
+ * @return 0 on success, non-zero on error or if the range exceeds the image.
+ */
+int source_pread(ImageSource* src, void* buf, size_t len, uint64_t off);
+
+/**
+ * @brief Stream an image range through a callback, chunk by chunk.
+ *
+ * Direct sources go through io_read_range(), so the selected transfer mode
+ * applies.
+ *
+ * @param src Source (not standard input).
+ * @param off Image offset.
+ * @param len Number of bytes.
+ * @param cb  Callback invoked for each chunk, in order.
+ * @param ctx Context passed to the callback.
+ * @return 0 on success, non-zero on error, if the range exceeds the image,
+ *         or if the callback failed.
+ */
+int source_read_range(ImageSource* src, uint64_t off, uint64_t len, IoReadCallback cb,
+                      void* ctx);
+
+/**
+ * @brief Open a seekable stdio stream over the image.
+ *
+ * The stream reads through source_pread() and is meant for the header
+ * readers; closing it leaves the source open.
+ *
+ * @param src Source (not standard input); must outlive the stream.
+ * @return Stream, or NULL on error.
+ */
+FILE* source_fopen(ImageSource* src);
+
+#endif /* IMG_SOURCE_H */
@@ -0,0 +1,47 @@
+/**
+ * img_store.h
+ *
+ * Content-addressed, deduplicating store for IMAGEWTY images.
+ *
+ * Each embedded entry is split into variable-size chunks with a
+ * content-defined chunker (FastCDC-style gear hash). Unique chunks are kept
+ * once under the store's `chunks/` directory, and every image is recorded as
+ * a manifest listing its header region, per-entry chunk lists and the chunks
+ * of any bytes no entry covers, so near-duplicate images only cost the
+ * chunks that actually differ.
+ */
+
+#ifndef IMG_STORE_H
+#define IMG_STORE_H
+
+/** Environment variable selecting the store directory */
+#define STORE_ENV_VAR "IMAGEWTY_STORE"
+
+/** Store directory used when STORE_ENV_VAR is not set */
+#define STORE_DEFAULT_DIR "imagewty.store"
+
+/**
+ * @brief Add an IMAGEWTY image to the chunk store.
+ *
+ * Chunks the header region, every embedded entry and the ranges between
+ * and after them, writes the chunks that are not yet present and records a
+ * manifest with the SHA-256 of the whole image. The image ID is printed.
+ *
+ * @param img_filename Path to the IMAGEWTY image file.
+ * @return 0 on success, non-zero on error.
+ */
+int store_add_image(const char* img_filename);
+
+/**
+ * @brief Rebuild an image from the chunk store.
+ *
+ * The rebuilt image is checked against the SHA-256 recorded in its manifest
+ * and removed if it does not match.
+ *
+ * @param image_id    Full image ID or a unique prefix of it.
+ * @param output_file Path where the rebuilt image will be written.
+ * @return 0 on success, non-zero on error.
+ */
+int store_get_image(const char* image_id, const char* output_file);
+
+#endif /* IMG_STORE_H */
@@ -0,0 +1,151 @@
+/**
+ * img_tar.h
+ *
+ * Minimal pax (POSIX.1-2001 tar) archive writer and reader.
+ *
+ * Archives are written strictly sequentially to a file descriptor, so the
+ * output may be a pipe. Every member is a ustar header followed by its data
+ * padded to TAR_BLOCK_SIZE; names and link targets that do not fit the
+ * ustar fields are carried in a pax extended header in front of the member.
+ *
+ * The reader walks an archive member by member, also from a pipe. It
+ * understands ustar, pax (path, linkpath and size records) and GNU long
+ * names, which covers the archives written by tar(1) and by this module.
+ */
+
+#ifndef IMG_TAR_H
+#define IMG_TAR_H
+
+#include <stdint.h>
+#include <time.h>
+
+/** Size of a tar block (headers and data padding) */
+#define TAR_BLOCK_SIZE 512
+
+/** Member type: regular file */
+#define TAR_TYPE_FILE '0'
+
+/** Member type: hard link to an earlier member */
+#define TAR_TYPE_LINK '1'
+
+/** Member type: symbolic link */
+#define TAR_TYPE_SYMLINK '2'
+
+/** Member type: directory */
+#define TAR_TYPE_DIR '5'
+
+/** Member type: pax extended header for the next member */
+#define TAR_TYPE_PAX 'x'
+
+/** Member type: pax global extended header */
+#define TAR_TYPE_PAX_GLOBAL 'g'
+
+/** Member type: GNU long name of the next member */
+#define TAR_TYPE_GNU_LONGNAME 'L'
+
+/** Member type: GNU long link target of the next member */
+#define TAR_TYPE_GNU_LONGLINK 'K'
+
+/** Longest member name or link target accepted by the reader (including NUL) */
+#define TAR_NAME_MAX 1024
+
+/**
+ * @brief One archive member as seen by tar_next().
+ */
+typedef struct
+{
+    char name[TAR_NAME_MAX];     /**< Member name */
+    char linkname[TAR_NAME_MAX]; /**< Link target (links only) */
+    char type;                   /**< Member type (regular files are TAR_TYPE_FILE) */
+    uint64_t size;               /**< Data size */
+    uint64_t data_offset;        /**< Archive offset of the data */
+} TarMember;
+
+/**
+ * @brief Sequential archive reader.
+ */
+typedef struct
+{
+    int fd;           /**< Archive input */
+    uint64_t pos;     /**< Archive offset of the next unread byte */
+    uint64_t pending; /**< Unread data and padding of the current member */
+    int seekable;     /**< Skipped data is seeked over instead of read */
+} TarReader;
+
+/**
+ * @brief Write the header of one archive member.
+ *
+ * For a regular file, exactly size bytes of data must follow, then
+ * tar_write_padding().
+ *
+ * @param fd       Archive output.
+ * @param name     Member name.
+ * @param size     Data size (0 for links).
+ * @param type     TAR_TYPE_FILE or TAR_TYPE_LINK.
+ * @param linkname Link target for TAR_TYPE_LINK, else NULL.
+ * @param mtime    Modification time recorded for the member.
+ * @return 0 on success, non-zero on error.
+ */
+int tar_write_header(int fd, const char* name, uint64_t size, char type, const char* linkname,
+                     time_t mtime);
+
+/**
+ * @brief Pad member data to the next block boundary.
+ *
+ * @param fd   Archive output.
+ * @param size Data size of the member.
+ * @return 0 on success, non-zero on error.
+ */
+int tar_write_padding(int fd, uint64_t size);
+
+/**
+ * @brief Write a complete regular-file member from memory.
+ *
+ * @param fd    Archive output.
+ * @param name  Member name.
+ * @param data  Member data.
+ * @param size  Data size.
+ * @param mtime Modification time recorded for the member.
+ * @return 0 on success, non-zero on error.
+ */
+int tar_write_file(int fd, const char* name, const void* data, uint64_t size, time_t mtime);
+
+/**
+ * @brief Write the end-of-archive marker (two zero blocks).
+ *
+ * @param fd Archive output.
+ * @return 0 on success, non-zero on error.
+ */
+int tar_write_end(int fd);
+
+/**
+ * @brief Start reading an archive at the current position of a descriptor.
+ *
+ * @param r  Reader to initialize.
+ * @param fd Archive input (a regular file or a pipe).
+ */
+void tar_reader_init(TarReader* r, int fd);
+
+/**
+ * @brief Advance to the next member.
+ *
+ * Unread data of the previous member is skipped, and pax and GNU extension
+ * headers are applied to the member they describe.
+ *
+ * @param r Reader.
+ * @param m Output: the member; its data can then be read with tar_read_data().
+ * @return 0 for a member, 1 at the end of the archive, -1 on error.
+ */
+int tar_next(TarReader* r, TarMember* m);
+
+/**
+ * @brief Read data of the current member.
+ *
+ * @param r   Reader.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read (at most what is left of the member).
+ * @return 0 on success, non-zero on error or premature end of input.
+ */
+int tar_read_data(TarReader* r, void* buf, size_t len);
+
+#endif /* IMG_TAR_H */
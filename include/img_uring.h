@@ -0,0 +1,49 @@
+/**
+ * img_uring.h
+ *
+ * io_uring data transfer backend.
+ *
+ * Talks to the kernel through the raw io_uring_setup()/io_uring_enter()/
+ * io_uring_register() system calls, so no liburing is needed. One ring
+ * with a small set of registered buffers is created on first use and
+ * shared by the whole process. Each chunk of a copy is submitted as a
+ * linked read -> write pair, and several chunks are kept in flight at once,
+ * which keeps deep device queues busy from a single thread.
+ */
+
+#ifndef IMG_URING_H
+#define IMG_URING_H
+
+#include <stdint.h>
+
+/** Number of chunks (read + write pairs) kept in flight */
+#define URING_QUEUE_DEPTH 8
+
+/** Size of each registered buffer, i.e. of one chunk */
+#define URING_CHUNK_SIZE (512 * 1024)
+
+/**
+ * @brief Check whether io_uring can be used, creating the ring if needed.
+ *
+ * @return Non-zero if the ring is ready.
+ */
+int uring_available(void);
+
+/**
+ * @brief Copy a byte range between two different files through io_uring.
+ *
+ * @param in_fd   Source file descriptor.
+ * @param in_off  Source offset.
+ * @param out_fd  Destination file descriptor.
+ * @param out_off Destination offset.
+ * @param len     Number of bytes to copy.
+ * @return 0 on success, non-zero on error.
+ */
+int uring_copy_range(int in_fd, uint64_t in_off, int out_fd, uint64_t out_off, uint64_t len);
+
+/**
+ * @brief Tear down the ring and release its buffers.
+ */
+void uring_shutdown(void);
+
+#endif /* IMG_URING_H */
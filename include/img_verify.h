@@ -0,0 +1,31 @@
+/**
+ * img_verify.h
+ *
+ * Integrity check of IMAGEWTY images without extracting them.
+ */
+
+#ifndef IMG_VERIFY_H
+#define IMG_VERIFY_H
+
+/**
+ * @brief Verify an image in place.
+ *
+ * Checks that every entry's data range lies inside the image, then
+ * recomputes the checksum of every file covered by a V*.fex entry directly
+ * from the image data and compares it with the stored value.
+ *
+ * With entry names, only the V*.fex checks covering those entries run (a
+ * name may be the checked file or its V*.fex entry), so verifying one entry
+ * of a compressed image decompresses only that entry's data.
+ *
+ * @param img_filename Path to the IMAGEWTY image file (possibly gzip or xz
+ *                     compressed), or "bundle.zip!/member" for an image
+ *                     inside a zip bundle.
+ * @param entries      Names of the entries to check (entry_count of them).
+ * @param entry_count  Number of names, or 0 to check every entry.
+ * @return 0 if the image is consistent, non-zero otherwise (including a
+ *         name that matches no entry).
+ */
+int verify_image(const char* img_filename, const char* const* entries, int entry_count);
+
+#endif /* IMG_VERIFY_H */
@@ -0,0 +1,82 @@
+/**
+ * img_xz.h
+ *
+ * Random-access reader over an xz-compressed file.
+ *
+ * xz files carry their own index: the compressed and uncompressed offset of
+ * every block. Blocks are decoded independently, so a read starts at the
+ * block holding the requested offset and never needs earlier data; reads
+ * that continue where the previous one ended reuse the live decoder. Files
+ * written with several blocks (xz -T0, or --block-size) are therefore
+ * seekable at block granularity, while a single-block file has to be
+ * decoded from the start for every backward seek.
+ */
+
+#ifndef IMG_XZ_H
+#define IMG_XZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Single-block files larger than this get a note about slow seeking */
+#define XZ_SINGLE_BLOCK_NOTE_SIZE (64 * 1024 * 1024)
+
+/**
+ * @brief Random-access reader over an xz file.
+ */
+typedef struct XzReader XzReader;
+
+/**
+ * @brief Check for the xz magic bytes.
+ *
+ * @param head First bytes of a file.
+ * @param len  Number of bytes in head.
+ * @return Non-zero if the file starts like an xz file.
+ */
+int xz_is_xz(const uint8_t* head, size_t len);
+
+/**
+ * @brief Open an xz file and load its block index.
+ *
+ * All streams of the file (concatenated xz streams included) are indexed.
+ *
+ * @param fd File descriptor (must stay open until xz_close()).
+ * @return Reader, or NULL on error (with a message on stderr).
+ */
+XzReader* xz_open(int fd);
+
+/**
+ * @brief Uncompressed size of the file.
+ *
+ * @param x Reader.
+ * @return Size in bytes.
+ */
+uint64_t xz_size(const XzReader* x);
+
+/**
+ * @brief Number of blocks in the file.
+ *
+ * @param x Reader.
+ * @return Block count.
+ */
+uint64_t xz_block_count(const XzReader* x);
+
+/**
+ * @brief Read uncompressed bytes.
+ *
+ * @param x   Reader.
+ * @param off Uncompressed offset.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read (off + len must not exceed the size).
+ * @return 0 on success, non-zero on error (including a failed integrity check).
+ */
+int xz_read(XzReader* x, uint64_t off, void* buf, size_t len);
+
+/**
+ * @brief Release a reader.
+ *
+ * @param x Reader (NULL is ignored).
+ */
+void xz_close(XzReader* x);
+
+#endif /* IMG_XZ_H */
@@ -0,0 +1,48 @@
+/**
+ * img_zip.h
+ *
+ * Read-only access to members of zip archives, for images shipped inside
+ * vendor bundles.
+ *
+ * Members are located through the central directory (Zip64 included, so
+ * multi-GB bundles work). A stored member is just a byte range of the
+ * archive and is read in place; a deflated member is read through an
+ * Inflater (see img_inflate.h).
+ */
+
+#ifndef IMG_ZIP_H
+#define IMG_ZIP_H
+
+#include <stdint.h>
+
+/** Compression method: stored */
+#define ZIP_METHOD_STORED 0
+
+/** Compression method: deflate */
+#define ZIP_METHOD_DEFLATE 8
+
+/**
+ * @brief Location and format of one archive member.
+ */
+typedef struct
+{
+    uint64_t data_offset; /**< Archive offset of the member data */
+    uint64_t comp_size;   /**< Size of the member data in the archive */
+    uint64_t size;        /**< Uncompressed size */
+    uint32_t crc;         /**< CRC-32 of the uncompressed data */
+    uint16_t method;      /**< ZIP_METHOD_STORED or ZIP_METHOD_DEFLATE */
+} ZipEntry;
+
+/**
+ * @brief Look up a member of a zip archive by name.
+ *
+ * @param fd    Archive file descriptor.
+ * @param name  Member name as stored in the archive (e.g. "out/firmware.img").
+ * @param entry Output: the member.
+ * @return 0 on success, 1 if there is no such member, -1 on error (with a
+ *         message on stderr, e.g. not a zip archive, encrypted member or
+ *         unsupported compression method).
+ */
+int zip_find_entry(int fd, const char* name, ZipEntry* entry);
+
+#endif /* IMG_ZIP_H */
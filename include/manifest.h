@@ -0,0 +1,90 @@
+/**
+ * manifest.h
+ *
+ * Per-file content manifests for dump folders.
+ *
+ * A manifest records, for every file, its size, modification time and
+ * SHA-256 hash. It serves two purposes: describing which file contents an
+ * image was built from (so a later repack can tell what changed), and
+ * acting as a hash cache, since a file whose size and mtime still match a
+ * recorded entry does not need to be read again.
+ */
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stdint.h>
+
+#include "sha256.h"
+
+/**
+ * @brief Manifest record for a single file.
+ */
+typedef struct
+{
+    char filename[257];                 /**< File name relative to the dump folder */
+    uint64_t size;                      /**< File size in bytes */
+    int64_t mtime_sec;                  /**< Modification time (seconds) */
+    long mtime_nsec;                    /**< Modification time (nanoseconds) */
+    uint8_t digest[SHA256_DIGEST_SIZE]; /**< SHA-256 of the file contents */
+} ManifestEntry;
+
+/**
+ * @brief A list of manifest records.
+ */
+typedef struct
+{
+    ManifestEntry* entries; /**< Array of records */
+    uint32_t count;         /**< Number of records */
+} FileManifest;
+
+/**
+ * @brief Load a manifest from disk.
+ *
+ * @param path Path to the manifest file.
+ * @param m    Manifest to populate (must be released with manifest_free()).
+ * @return 0 on success, non-zero if the file is missing or invalid.
+ */
+int manifest_load(const char* path, FileManifest* m);
+
+/**
+ * @brief Write a manifest to disk (atomically, via a temporary file).
+ *
+ * @param path Path to the manifest file.
+ * @param m    Manifest to write.
+ * @return 0 on success, non-zero on error.
+ */
+int manifest_save(const char* path, const FileManifest* m);
+
+/**
+ * @brief Look up a record by file name.
+ *
+ * @param m    Manifest to search (may be NULL).
+ * @param name File name.
+ * @return Matching record, or NULL.
+ */
+const ManifestEntry* manifest_find(const FileManifest* m, const char* name);
+
+/**
+ * @brief Describe a file, reusing a cached hash when size and mtime match.
+ *
+ * A file stored as <name>.lz4 is described by its uncompressed data.
+ *
+ * @param dump_folder Folder containing the file.
+ * @param name        File name relative to dump_folder.
+ * @param cache       Previously recorded manifest used as hash cache (may be NULL).
+ * @param out         Record to fill in.
+ * @param hashed      Optional output: set to 1 if the file had to be read.
+ * @return 0 on success, non-zero on error.
+ */
+int manifest_describe_file(const char* dump_folder, const char* name, const FileManifest* cache,
+                           ManifestEntry* out, int* hashed);
+
+/**
+ * @brief Release memory held by a manifest.
+ *
+ * @param m Manifest to free.
+ */
+void manifest_free(FileManifest* m);
+
+#endif /* MANIFEST_H */
@@ -0,0 +1,81 @@
+/**
+ * sha256.h
+ *
+ * Minimal SHA-256 implementation used to content-address chunks and
+ * payloads. Supports incremental hashing of arbitrarily large inputs.
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Size of a SHA-256 digest in bytes */
+#define SHA256_DIGEST_SIZE 32
+
+/** Size of a hex-encoded SHA-256 digest including the terminating null */
+#define SHA256_HEX_SIZE (SHA256_DIGEST_SIZE * 2 + 1)
+
+/**
+ * @brief Incremental SHA-256 hashing state.
+ */
+typedef struct
+{
+    uint32_t state[8]; /**< Intermediate hash value */
+    uint64_t length;   /**< Total number of bytes hashed so far */
+    uint8_t block[64]; /**< Pending partial block */
+    size_t block_len;  /**< Number of bytes in the pending block */
+} Sha256Context;
+
+/**
+ * @brief Initialize a SHA-256 context.
+ *
+ * @param ctx Context to initialize.
+ */
+void sha256_init(Sha256Context* ctx);
+
+/**
+ * @brief Feed data into a SHA-256 context.
+ *
+ * @param ctx  Context previously initialized with sha256_init().
+ * @param data Input bytes.
+ * @param len  Number of input bytes.
+ */
+void sha256_update(Sha256Context* ctx, const void* data, size_t len);
+
+/**
+ * @brief Finish hashing and produce the digest.
+ *
+ * @param ctx    Context to finalize (must be re-initialized before reuse).
+ * @param digest Output buffer of SHA256_DIGEST_SIZE bytes.
+ */
+void sha256_final(Sha256Context* ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * @brief Hash a memory buffer in one call.
+ *
+ * @param data   Input bytes.
+ * @param len    Number of input bytes.
+ * @param digest Output buffer of SHA256_DIGEST_SIZE bytes.
+ */
+void sha256_buffer(const void* data, size_t len, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * @brief Hash the complete contents of a file.
+ *
+ * @param path   Path to the file.
+ * @param digest Output buffer of SHA256_DIGEST_SIZE bytes.
+ * @return 0 on success, non-zero if the file cannot be read.
+ */
+int sha256_file(const char* path, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * @brief Encode a digest as a lowercase hex string.
+ *
+ * @param digest Digest of SHA256_DIGEST_SIZE bytes.
+ * @param hex    Output buffer of SHA256_HEX_SIZE bytes.
+ */
+void sha256_to_hex(const uint8_t digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE]);
+
+#endif /* SHA256_H */
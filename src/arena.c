@@ -0,0 +1,114 @@
+/**
+ * @file arena.c
+ * @brief Bump allocator for per-image state.
+ *
+ * Blocks are chained newest first. Allocation bumps an offset in the
+ * newest block; when it does not fit, a new block of ARENA_BLOCK_SIZE (or
+ * the request size, if larger) is put in front of the chain.
+ */
+
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Header of an arena block; the usable memory follows it.
+ */
+struct ArenaBlock
+{
+    ArenaBlock* next; /**< Next older block */
+    size_t size;      /**< Usable bytes in this block */
+    size_t used;      /**< Bytes handed out so far */
+    _Alignas(ARENA_ALIGNMENT) unsigned char data[]; /**< Block memory */
+};
+
+/**
+ * @brief Initialize an empty arena.
+ *
+ * @param arena Arena to initialize.
+ */
+void arena_init(Arena* arena)
+{
+    arena->head = NULL;
+}
+
+/**
+ * @brief Allocate uninitialized memory from an arena.
+ *
+ * @param arena Arena to allocate from.
+ * @param size  Number of bytes.
+ * @return ARENA_ALIGNMENT-aligned memory, or NULL if out of memory.
+ */
+void* arena_alloc(Arena* arena, size_t size)
+{
+    if (size > SIZE_MAX - ARENA_ALIGNMENT)
+        return NULL;
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    ArenaBlock* b = arena->head;
+    if (!b || b->size - b->used < size)
+    {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        b = malloc(sizeof(ArenaBlock) + block_size);
+        if (!b)
+            return NULL;
+        b->size = block_size;
+        b->used = 0;
+
+        /* An oversized block is full right away: keep allocating from the current one */
+        if (block_size > ARENA_BLOCK_SIZE && arena->head)
+        {
+            b->next = arena->head->next;
+            arena->head->next = b;
+        }
+        else
+        {
+            b->next = arena->head;
+            arena->head = b;
+        }
+    }
+
+    void* p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+/**
+ * @brief Allocate a zeroed array from an arena.
+ *
+ * @param arena Arena to allocate from.
+ * @param count Number of elements (0 is treated as 1).
+ * @param size  Size of each element.
+ * @return Zeroed memory, or NULL on overflow or if out of memory.
+ */
+void* arena_calloc(Arena* arena, size_t count, size_t size)
+{
+    if (count == 0)
+        count = 1;
+    if (size != 0 && count > SIZE_MAX / size)
+        return NULL;
+
+    void* p = arena_alloc(arena, count * size);
+    if (p)
+        memset(p, 0, count * size);
+    return p;
+}
+
+/**
+ * @brief Release all memory held by an arena.
+ *
+ * @param arena Arena to release.
+ */
+void arena_release(Arena* arena)
+{
+    ArenaBlock* b = arena->head;
+    while (b)
+    {
+        ArenaBlock* older = b->next;
+        free(b);
+        b = older;
+    }
+    arena->head = NULL;
+}
@@ -5,6 +5,8 @@
  *        repacking firmware images or after extraction.
  */
 
+#define _GNU_SOURCE
+
 #include "checksum.h"
 
 #include <dirent.h>
@@ -14,56 +16,229 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "img_io.h"
+#include "img_lz4.h"
+
+/**
+ * @brief Initialize an incremental checksum.
+ *
+ * @param st Checksum state to initialize.
+ */
+void checksum_init(ChecksumState* st)
+{
+    st->sum = 0;
+    st->tail_len = 0;
+}
+
+/**
+ * @brief Add data to an incremental checksum.
+ *
+ * Words are formed across call boundaries, so splitting the input at
+ * arbitrary positions yields the same result as a single call.
+ *
+ * @param st   Checksum state.
+ * @param data Input bytes.
+ * @param len  Number of input bytes.
+ */
+void checksum_update(ChecksumState* st, const void* data, size_t len)
+{
+    const uint8_t* p = data;
+    uint32_t sum = st->sum;
+
+    /* Complete a word left over from the previous call */
+    while (st->tail_len > 0 && len > 0)
+    {
+        st->tail[st->tail_len++] = *p++;
+        len--;
+        if (st->tail_len == 4)
+        {
+            sum += (uint32_t)st->tail[0] | ((uint32_t)st->tail[1] << 8) |
+                   ((uint32_t)st->tail[2] << 16) | ((uint32_t)st->tail[3] << 24);
+            st->tail_len = 0;
+        }
+    }
+
+    /* Process all full 4-byte words */
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4)
+    {
+        uint32_t word = (uint32_t)p[i] | ((uint32_t)p[i + 1] << 8) | ((uint32_t)p[i + 2] << 16) |
+                        ((uint32_t)p[i + 3] << 24);
+        sum += word;
+    }
+
+    /* Keep remaining bytes for the next call */
+    for (; i < len; i++)
+        st->tail[st->tail_len++] = p[i];
+
+    st->sum = sum;
+}
+
+/**
+ * @brief Finish an incremental checksum.
+ *
+ * Any remaining bytes (<4) are padded with zeros.
+ *
+ * @param st Checksum state.
+ * @return 32-bit checksum.
+ */
+uint32_t checksum_final(ChecksumState* st)
+{
+    if (st->tail_len > 0)
+    {
+        uint8_t last[4] = {0};
+        memcpy(last, st->tail, st->tail_len);
+        st->sum += (uint32_t)last[0] | ((uint32_t)last[1] << 8) | ((uint32_t)last[2] << 16) |
+                   ((uint32_t)last[3] << 24);
+        st->tail_len = 0;
+    }
+    return st->sum;
+}
+
+/**
+ * @brief Check whether a "V*.fex" name holds a checksum of another entry.
+ *
+ * @param name Base name of the file.
+ * @return Non-zero if the file stores the checksum of name + 1.
+ */
+int is_checksum_vfile(const char* name)
+{
+    /* Only files starting with 'V' and ending with ".fex" */
+    if (name[0] != 'V' || !strstr(name, ".fex"))
+        return 0;
+
+    /* Skip known vbmeta variants */
+    if (strcmp(name, "Vvbmeta.fex") == 0 || strcmp(name, "Vvbmeta_system.fex") == 0 ||
+        strcmp(name, "Vvbmeta_vendor.fex") == 0)
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief io_read_range() callback feeding an incremental checksum.
+ *
+ * @param data Chunk of data.
+ * @param len  Chunk length.
+ * @param ctx  ChecksumState to update.
+ * @return Always 0.
+ */
+static int checksum_chunk(const uint8_t* data, size_t len, void* ctx)
+{
+    checksum_update((ChecksumState*)ctx, data, len);
+    return 0;
+}
+
 /**
  * @brief Compute a simple 32-bit checksum for a given file.
  *
  * The checksum sums all 4-byte words in little-endian order.
- * Any remaining bytes (<4) are padded with zeros.
+ * Any remaining bytes (<4) are padded with zeros. A file stored LZ4
+ * compressed (<filename>.lz4, see img_lz4.h) is checksummed as decompressed.
  *
  * @param filename Path to the file.
- * @return 32-bit checksum. Returns 0 if file cannot be opened.
+ * @param checksum Output: 32-bit checksum, set only on success.
+ * @return 0 on success, non-zero if the file cannot be opened or read in full.
  */
-uint32_t compute_checksum(const char* filename)
+int compute_checksum(const char* filename, uint32_t* checksum)
 {
-    FILE* f = fopen(filename, "rb");
-    if (!f)
+    Lz4Input in;
+    if (lz4_input_open(filename, &in) != 0)
+        return 1;
+
+    ChecksumState cs;
+    checksum_init(&cs);
+
+    /* Sequential read with readahead hints (and O_DIRECT / cache dropping if enabled),
+       or a multithreaded decode */
+    int ret = lz4_input_read(&in, checksum_chunk, &cs);
+
+    lz4_input_close(&in);
+    if (ret == 0)
+        *checksum = checksum_final(&cs);
+    return ret;
+}
+
+/**
+ * @brief Verify or update a single "V*.fex" checksum file.
+ *
+ * @param dump_folder Path to the folder containing extracted files.
+ * @param name        Name of the V*.fex file.
+ * @param update      If non-zero, a mismatched checksum is corrected.
+ */
+static void check_vfile(const char* dump_folder, const char* name, int update)
+{
+    /* Build full path to the V*.fex file */
+    char vfile_path[1024];
+    snprintf(vfile_path, sizeof(vfile_path), "%s/%s", dump_folder, name);
+
+    /* Read stored checksum from V*.fex (first 4 bytes) */
+    FILE* vf = fopen(vfile_path, "rb");
+    if (!vf)
     {
-        fprintf(stderr, "compute_checksum: Cannot open file '%s'\n", filename);
-        return 0;
+        fprintf(stderr, "Cannot open '%s'\n", vfile_path);
+        return;
     }
 
-    uint32_t sum = 0;
-    uint8_t buf[0x10000]; /* 64 KB buffer */
-    size_t n;
+    uint8_t chkbuf[4];
+    if (fread(chkbuf, 1, 4, vf) != 4)
+    {
+        fprintf(stderr, "Failed to read checksum from '%s'\n", vfile_path);
+        fclose(vf);
+        return;
+    }
+    fclose(vf);
+
+    uint32_t expected = (uint32_t)chkbuf[0] | ((uint32_t)chkbuf[1] << 8) |
+                        ((uint32_t)chkbuf[2] << 16) | ((uint32_t)chkbuf[3] << 24);
 
-    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    /* Build path to the real file (remove leading 'V') */
+    const char* realname = name + 1;
+    char realfile_path[1024];
+    snprintf(realfile_path, sizeof(realfile_path), "%s/%s", dump_folder, realname);
+
+    /* Compute actual checksum; a file that cannot be read in full is never "fixed" */
+    uint32_t actual;
+    if (compute_checksum(realfile_path, &actual) != 0)
     {
-        size_t i = 0;
+        fprintf(stderr, "[ERR]  %s could not be read, %s left unchanged\n", realname, name);
+        return;
+    }
 
-        /* Process all full 4-byte words */
-        for (; i + 4 <= n; i += 4)
+    if (actual == expected)
+    {
+        printf("[OK]   %s checksum matches (%u)\n", realname, actual);
+    }
+    else
+    {
+        if (update)
         {
-            uint32_t word = (uint32_t)buf[i] | ((uint32_t)buf[i + 1] << 8) |
-                            ((uint32_t)buf[i + 2] << 16) | ((uint32_t)buf[i + 3] << 24);
-            sum += word;
-        }
+            printf("[FIX]  %s checksum mismatch: expected %u, got %u -> updating...\n",
+                   realname, expected, actual);
+
+            FILE* vf2 = fopen(vfile_path, "wb");
+            if (!vf2)
+            {
+                fprintf(stderr, "Cannot write '%s': %s\n", vfile_path, strerror(errno));
+                return;
+            }
+
+            uint8_t newbuf[4] = {(uint8_t)(actual & 0xFF), (uint8_t)((actual >> 8) & 0xFF),
+                                 (uint8_t)((actual >> 16) & 0xFF),
+                                 (uint8_t)((actual >> 24) & 0xFF)};
 
-        /* Handle remaining bytes, if any */
-        size_t rem = n % 4;
-        if (rem)
+            fwrite(newbuf, 1, 4, vf2);
+            fclose(vf2);
+            printf("       Updated checksum in %s to %u\n", name, actual);
+        }
+        else
         {
-            uint8_t last[4] = {0};
-            memcpy(last, buf + n - rem, rem);
-            uint32_t word = (uint32_t)last[0] | ((uint32_t)last[1] << 8) |
-                            ((uint32_t)last[2] << 16) | ((uint32_t)last[3] << 24);
-            sum += word;
+            printf("[FAIL] %s checksum mismatch: expected %u, got %u\n", realname, expected,
+                   actual);
         }
-
-        sum &= 0xFFFFFFFFU;
     }
-
-    fclose(f);
-    return sum;
 }
 
 /**
@@ -92,83 +267,9 @@ static void check_vfiles_common(const char* dump_folder, int update)
     struct dirent* entry;
     while ((entry = readdir(dir)) != NULL)
     {
-        const char* name = entry->d_name;
-
-        /* Only process files starting with 'V' and ending with ".fex" */
-        if (name[0] != 'V' || !strstr(name, ".fex"))
-            continue;
-
-        /* Skip known vbmeta variants */
-        if (strcmp(name, "Vvbmeta.fex") == 0 || strcmp(name, "Vvbmeta_system.fex") == 0 ||
-            strcmp(name, "Vvbmeta_vendor.fex") == 0)
-        {
-            continue;
-        }
-
-        /* Build full path to the V*.fex file */
-        char vfile_path[1024];
-        snprintf(vfile_path, sizeof(vfile_path), "%s/%s", dump_folder, name);
-
-        /* Read stored checksum from V*.fex (first 4 bytes) */
-        FILE* vf = fopen(vfile_path, "rb");
-        if (!vf)
-        {
-            fprintf(stderr, "Cannot open '%s'\n", vfile_path);
-            continue;
-        }
-
-        uint8_t chkbuf[4];
-        if (fread(chkbuf, 1, 4, vf) != 4)
-        {
-            fprintf(stderr, "Failed to read checksum from '%s'\n", vfile_path);
-            fclose(vf);
-            continue;
-        }
-        fclose(vf);
-
-        uint32_t expected = (uint32_t)chkbuf[0] | ((uint32_t)chkbuf[1] << 8) |
-                            ((uint32_t)chkbuf[2] << 16) | ((uint32_t)chkbuf[3] << 24);
-
-        /* Build path to the real file (remove leading 'V') */
-        const char* realname = name + 1;
-        char realfile_path[1024];
-        snprintf(realfile_path, sizeof(realfile_path), "%s/%s", dump_folder, realname);
-
-        /* Compute actual checksum */
-        uint32_t actual = compute_checksum(realfile_path);
-
-        if (actual == expected)
-        {
-            printf("[OK]   %s checksum matches (%u)\n", realname, actual);
-        }
-        else
-        {
-            if (update)
-            {
-                printf("[FIX]  %s checksum mismatch: expected %u, got %u -> updating...\n",
-                       realname, expected, actual);
-
-                FILE* vf2 = fopen(vfile_path, "wb");
-                if (!vf2)
-                {
-                    fprintf(stderr, "Cannot write '%s': %s\n", vfile_path, strerror(errno));
-                    continue;
-                }
-
-                uint8_t newbuf[4] = {(uint8_t)(actual & 0xFF), (uint8_t)((actual >> 8) & 0xFF),
-                                     (uint8_t)((actual >> 16) & 0xFF),
-                                     (uint8_t)((actual >> 24) & 0xFF)};
-
-                fwrite(newbuf, 1, 4, vf2);
-                fclose(vf2);
-                printf("       Updated checksum in %s to %u\n", name, actual);
-            }
-            else
-            {
-                printf("[FAIL] %s checksum mismatch: expected %u, got %u\n", realname, expected,
-                       actual);
-            }
-        }
+        /* Only process V*.fex files that hold a checksum */
+        if (is_checksum_vfile(entry->d_name))
+            check_vfile(dump_folder, entry->d_name, update);
     }
 
     closedir(dir);
@@ -193,3 +294,15 @@ void update_vfiles_if_needed(const char* dump_folder)
 {
     check_vfiles_common(dump_folder, 1);
 }
+
+/**
+ * @brief Verify and update a single "V*.fex" checksum file if mismatched.
+ *
+ * @param dump_folder Path to folder containing extracted files.
+ * @param vfile_name  Name of the V*.fex file (e.g. "Vboot.fex").
+ */
+void update_vfile_if_needed(const char* dump_folder, const char* vfile_name)
+{
+    if (is_checksum_vfile(vfile_name))
+        check_vfile(dump_folder, vfile_name, 1);
+}
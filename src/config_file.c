@@ -115,20 +115,18 @@ typedef struct
  * --------------------------------------------------------------------------*/
 
 /**
- * @brief Load an IMAGEWTY configuration file (.cfg) into memory.
+ * @brief Load an IMAGEWTY configuration from an open (seekable) stream.
  *
- * @param cfg_path Path to the configuration file.
- * @param hdr      Pointer to ImageWTYHeader to fill.
- * @param files    Output pointer to an array of ImageWTYFileHeader.
+ * @param f     Input stream positioned at the start of the configuration.
+ * @param hdr   Pointer to ImageWTYHeader to fill.
+ * @param files Output pointer to an array of ImageWTYFileHeader.
+ * @param arena Arena the array is allocated from.
  * @return 0 on success, non-zero on failure.
  */
-int load_image_config(const char* cfg_path, ImageWTYHeader* hdr, ImageWTYFileHeader** files)
+int load_image_config_stream(FILE* f, ImageWTYHeader* hdr, ImageWTYFileHeader** files,
+                             Arena* arena)
 {
-    if (!cfg_path || !hdr || !files)
-        return 1;
-
-    FILE* f = fopen(cfg_path, "r");
-    if (!f)
+    if (!f || !hdr || !files || !arena)
         return 1;
 
     memset(hdr, 0, sizeof(*hdr));
@@ -136,6 +134,7 @@ int load_image_config(const char* cfg_path, ImageWTYHeader* hdr, ImageWTYFileHea
 
     char line[512];
     uint32_t num_files = 0;
+    long start = ftell(f);
 
     /* Global header field maps */
     UIntFieldMap hdr_uint_fields[] = {
@@ -201,21 +200,16 @@ int load_image_config(const char* cfg_path, ImageWTYHeader* hdr, ImageWTYFileHea
 
     hdr->num_files = num_files;
     if (num_files == 0)
-    {
-        fclose(f);
         return 0;
-    }
 
     /* Allocate file header array */
-    ImageWTYFileHeader* file_array = calloc(num_files, sizeof(ImageWTYFileHeader));
+    ImageWTYFileHeader* file_array = arena_calloc(arena, num_files, sizeof(ImageWTYFileHeader));
     if (!file_array)
-    {
-        fclose(f);
         return 1;
-    }
 
     /* --- Parse file blocks --- */
-    rewind(f);
+    if (fseek(f, start, SEEK_SET) != 0)
+        return 1;
     uint32_t current_file = 0;
     ImageWTYFileHeader* fh = NULL;
     int in_file_block = 0;
@@ -297,32 +291,51 @@ int load_image_config(const char* cfg_path, ImageWTYHeader* hdr, ImageWTYFileHea
         }
     }
 
-    fclose(f);
     *files = file_array;
     return 0;
 }
 
+/**
+ * @brief Load an IMAGEWTY configuration file (.cfg) into memory.
+ *
+ * @param cfg_path Path to the configuration file.
+ * @param hdr      Pointer to ImageWTYHeader to fill.
+ * @param files    Output pointer to an array of ImageWTYFileHeader.
+ * @param arena    Arena the array is allocated from.
+ * @return 0 on success, non-zero on failure.
+ */
+int load_image_config(const char* cfg_path, ImageWTYHeader* hdr, ImageWTYFileHeader** files,
+                      Arena* arena)
+{
+    if (!cfg_path)
+        return 1;
+
+    FILE* f = fopen(cfg_path, "r");
+    if (!f)
+        return 1;
+
+    int ret = load_image_config_stream(f, hdr, files, arena);
+    fclose(f);
+    return ret;
+}
+
 /* --------------------------------------------------------------------------
  * Write IMAGEWTY configuration
  * --------------------------------------------------------------------------*/
 
 /**
- * @brief Write an IMAGEWTY configuration file (.cfg).
+ * @brief Write an IMAGEWTY configuration to an open stream.
  *
- * @param cfg_path  Output path for the configuration file.
+ * @param f         Output stream.
  * @param hdr       Pointer to ImageWTYHeader.
  * @param files     Pointer to file headers array.
  * @param num_files Number of files in the array.
  * @return 0 on success, non-zero on failure.
  */
-int write_image_config(const char* cfg_path, const ImageWTYHeader* hdr,
-                       const ImageWTYFileHeader* files, uint32_t num_files)
+int write_image_config_stream(FILE* f, const ImageWTYHeader* hdr, const ImageWTYFileHeader* files,
+                              uint32_t num_files)
 {
-    if (!cfg_path || !hdr)
-        return 1;
-
-    FILE* f = fopen(cfg_path, "w");
-    if (!f)
+    if (!f || !hdr)
         return 1;
 
     fprintf(f, "[IMAGE_CFG]\n");
@@ -373,20 +386,30 @@ int write_image_config(const char* cfg_path, const ImageWTYHeader* hdr,
         }
     }
 
-    fclose(f);
-    return 0;
+    return ferror(f) ? 1 : 0;
 }
 
-/* --------------------------------------------------------------------------
- * Free resources
- * --------------------------------------------------------------------------*/
-
 /**
- * @brief Free an allocated file header list.
+ * @brief Write an IMAGEWTY configuration file (.cfg).
  *
- * @param files Pointer to ImageWTYFileHeader array.
+ * @param cfg_path  Output path for the configuration file.
+ * @param hdr       Pointer to ImageWTYHeader.
+ * @param files     Pointer to file headers array.
+ * @param num_files Number of files in the array.
+ * @return 0 on success, non-zero on failure.
  */
-void free_file_list(ImageWTYFileHeader* files)
+int write_image_config(const char* cfg_path, const ImageWTYHeader* hdr,
+                       const ImageWTYFileHeader* files, uint32_t num_files)
 {
-    free(files);
+    if (!cfg_path || !hdr)
+        return 1;
+
+    FILE* f = fopen(cfg_path, "w");
+    if (!f)
+        return 1;
+
+    int ret = write_image_config_stream(f, hdr, files, num_files);
+    if (fclose(f) != 0)
+        ret = 1;
+    return ret;
 }
@@ -0,0 +1,309 @@
+/**
+ * @file file_table.c
+ * @brief Compact struct-of-arrays view of an image's file header table.
+ *
+ * Strings are interned through a temporary open-addressing hash table while
+ * the pool is built; the file name index is a second hash table that stays
+ * with the table. Offset ordering uses an LSD radix sort over the 64-bit
+ * key (offset, stored length) one byte at a time, skipping bytes that are
+ * the same in every key, so typical tables need only a few passes.
+ */
+
+#define _GNU_SOURCE
+
+#include "file_table.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief FNV-1a hash of a byte string.
+ *
+ * @param s   String.
+ * @param len Length of the string.
+ * @return 32-bit hash.
+ */
+static uint32_t hash_string(const char* s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Smallest power of two that is at least twice n.
+ *
+ * @param n Number of keys the hash table must hold.
+ * @return Number of slots.
+ */
+static uint32_t hash_capacity(uint64_t n)
+{
+    uint32_t cap = 16;
+    while (cap < 2 * n)
+        cap <<= 1;
+    return cap;
+}
+
+/**
+ * @brief String pool under construction.
+ */
+typedef struct
+{
+    char* data;    /**< Pool memory */
+    uint32_t used; /**< Bytes used so far */
+    StrRef* slots; /**< Interning hash table (len == UINT32_MAX if empty) */
+    uint32_t mask; /**< Number of slots minus one */
+} PoolBuilder;
+
+/**
+ * @brief Add a string to the pool, reusing an identical earlier copy.
+ *
+ * @param pb  Pool under construction.
+ * @param s   String (need not be NUL-terminated within max).
+ * @param max Size of the field holding s.
+ * @return Handle of the interned string.
+ */
+static StrRef intern(PoolBuilder* pb, const char* s, size_t max)
+{
+    uint32_t len = (uint32_t)strnlen(s, max);
+    uint32_t slot = hash_string(s, len) & pb->mask;
+
+    while (pb->slots[slot].len != UINT32_MAX)
+    {
+        StrRef r = pb->slots[slot];
+        if (r.len == len && memcmp(pb->data + r.off, s, len) == 0)
+            return r;
+        slot = (slot + 1) & pb->mask;
+    }
+
+    StrRef r = {pb->used, len};
+    memcpy(pb->data + pb->used, s, len);
+    pb->data[pb->used + len] = '\0';
+    pb->used += len + 1;
+    pb->slots[slot] = r;
+    return r;
+}
+
+/**
+ * @brief Build a file table from a header array.
+ *
+ * @param table File table to fill.
+ * @param files File header array.
+ * @param count Number of entries.
+ * @param arena Arena the table is allocated from.
+ * @return 0 on success, non-zero if out of memory.
+ */
+int file_table_build(FileTable* table, const ImageWTYFileHeader* files, uint32_t count,
+                     Arena* arena)
+{
+    memset(table, 0, sizeof(*table));
+    table->count = count;
+
+    /* Upper bound of the pool size, if no string repeats */
+    uint64_t pool_size = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        pool_size += strnlen(files[i].filename, sizeof(files[i].filename)) + 1;
+        pool_size += strnlen(files[i].maintype, sizeof(files[i].maintype)) + 1;
+        pool_size += strnlen(files[i].subtype, sizeof(files[i].subtype)) + 1;
+    }
+    if (pool_size > UINT32_MAX)
+    {
+        fprintf(stderr, "File table too large\n");
+        return 1;
+    }
+
+    PoolBuilder pb;
+    pb.used = 0;
+    pb.mask = hash_capacity(3 * (uint64_t)count) - 1;
+    table->name_mask = hash_capacity(count) - 1;
+
+    table->offset = arena_alloc(arena, (size_t)count * sizeof(uint32_t));
+    table->stored_length = arena_alloc(arena, (size_t)count * sizeof(uint32_t));
+    table->original_length = arena_alloc(arena, (size_t)count * sizeof(uint32_t));
+    table->filename = arena_alloc(arena, (size_t)count * sizeof(StrRef));
+    table->maintype = arena_alloc(arena, (size_t)count * sizeof(StrRef));
+    table->subtype = arena_alloc(arena, (size_t)count * sizeof(StrRef));
+    table->pool = pb.data = arena_alloc(arena, (size_t)pool_size);
+    table->name_slots =
+        arena_calloc(arena, (size_t)table->name_mask + 1, sizeof(*table->name_slots));
+    pb.slots = arena_alloc(arena, ((size_t)pb.mask + 1) * sizeof(*pb.slots));
+
+    if (!table->offset || !table->stored_length || !table->original_length ||
+        !table->filename || !table->maintype || !table->subtype || !table->pool ||
+        !table->name_slots || !pb.slots)
+    {
+        perror("Memory allocation failed");
+        return 1;
+    }
+    memset(pb.slots, 0xFF, ((size_t)pb.mask + 1) * sizeof(*pb.slots));
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const ImageWTYFileHeader* fh = &files[i];
+        table->offset[i] = fh->offset;
+        table->stored_length[i] = fh->stored_length;
+        table->original_length[i] = fh->original_length;
+        table->filename[i] = intern(&pb, fh->filename, sizeof(fh->filename));
+        table->maintype[i] = intern(&pb, fh->maintype, sizeof(fh->maintype));
+        table->subtype[i] = intern(&pb, fh->subtype, sizeof(fh->subtype));
+
+        /* Index the name unless an earlier entry already has it */
+        StrRef name = table->filename[i];
+        uint32_t slot = hash_string(table->pool + name.off, name.len) & table->name_mask;
+        while (table->name_slots[slot] != 0 &&
+               table->filename[table->name_slots[slot] - 1].off != name.off)
+        {
+            slot = (slot + 1) & table->name_mask;
+        }
+        if (table->name_slots[slot] == 0)
+            table->name_slots[slot] = i + 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Resolve a string handle.
+ *
+ * @param table File table.
+ * @param ref   Handle from one of the table's string arrays.
+ * @return NUL-terminated string inside the pool.
+ */
+const char* file_table_str(const FileTable* table, StrRef ref)
+{
+    return table->pool + ref.off;
+}
+
+/**
+ * @brief Find an entry by file name.
+ *
+ * @param table File table.
+ * @param name  File name to look for.
+ * @return Index of the first entry with that name, or -1 if not found.
+ */
+long file_table_find(const FileTable* table, const char* name)
+{
+    size_t len = strlen(name);
+    uint32_t slot = hash_string(name, len) & table->name_mask;
+
+    for (uint32_t idx; (idx = table->name_slots[slot]) != 0;
+         slot = (slot + 1) & table->name_mask)
+    {
+        StrRef r = table->filename[idx - 1];
+        if (r.len == len && memcmp(table->pool + r.off, name, len) == 0)
+            return (long)idx - 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief Sort key of an entry: offset in the high half, stored length in the low half.
+ *
+ * @param table File table.
+ * @param i     Entry index.
+ * @return 64-bit key.
+ */
+static uint64_t offset_key(const FileTable* table, uint32_t i)
+{
+    return (uint64_t)table->offset[i] << 32 | table->stored_length[i];
+}
+
+/**
+ * @brief Order the entries by data offset (stable LSD radix sort).
+ *
+ * @param table File table.
+ * @param order Output: table->count entry indices in sorted order.
+ * @param arena Arena for scratch memory.
+ * @return 0 on success, non-zero if out of memory.
+ */
+int file_table_sort_by_offset(const FileTable* table, uint32_t* order, Arena* arena)
+{
+    uint32_t n = table->count;
+    for (uint32_t i = 0; i < n; i++)
+        order[i] = i;
+    if (n < 2)
+        return 0;
+
+    uint32_t* tmp = arena_alloc(arena, (size_t)n * sizeof(*tmp));
+    uint32_t (*hist)[256] = arena_calloc(arena, 8, sizeof(*hist));
+    if (!tmp || !hist)
+    {
+        perror("Memory allocation failed");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint64_t key = offset_key(table, i);
+        for (int b = 0; b < 8; b++)
+            hist[b][(key >> (8 * b)) & 0xFF]++;
+    }
+
+    uint32_t* src = order;
+    uint32_t* dst = tmp;
+    for (int b = 0; b < 8; b++)
+    {
+        /* Skip bytes that are equal in every key */
+        uint64_t first = (offset_key(table, 0) >> (8 * b)) & 0xFF;
+        if (hist[b][first] == n)
+            continue;
+
+        uint32_t pos = 0;
+        for (int d = 0; d < 256; d++)
+        {
+            uint32_t c = hist[b][d];
+            hist[b][d] = pos;
+            pos += c;
+        }
+        for (uint32_t i = 0; i < n; i++)
+        {
+            uint32_t idx = src[i];
+            dst[hist[b][(offset_key(table, idx) >> (8 * b)) & 0xFF]++] = idx;
+        }
+        uint32_t* swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != order)
+        memcpy(order, src, (size_t)n * sizeof(*order));
+    return 0;
+}
+
+/**
+ * @brief Find the entries whose data range repeats an earlier entry's range.
+ *
+ * After sorting by (offset, stored length, index), equal ranges are
+ * adjacent and the first of each run is the lowest index.
+ *
+ * @param table  File table.
+ * @param shared Output: table->count indices (-1 if not shared).
+ * @param arena  Arena for scratch memory.
+ * @return 0 on success, non-zero if out of memory.
+ */
+int file_table_shared_ranges(const FileTable* table, long* shared, Arena* arena)
+{
+    uint32_t n = table->count;
+    uint32_t* order = arena_alloc(arena, (size_t)n * sizeof(*order));
+    if (!order)
+    {
+        perror("Memory allocation failed");
+        return 1;
+    }
+    if (file_table_sort_by_offset(table, order, arena) != 0)
+        return 1;
+
+    uint32_t first = 0;
+    for (uint32_t k = 0; k < n; k++)
+    {
+        uint32_t i = order[k];
+        if (k == 0 || offset_key(table, i) != offset_key(table, order[first]))
+            first = k;
+        shared[i] = (k != first && table->stored_length[i] > 0) ? (long)order[first] : -1;
+    }
+    return 0;
+}
@@ -0,0 +1,208 @@
+/**
+ * @file img_bufpool.c
+ * @brief Process-wide pool of page-aligned I/O buffers.
+ *
+ * Buffers are anonymous mappings, so they are page-aligned by construction
+ * and can be handed back to the kernel individually. The pool keeps a small
+ * table of every mapping it holds; a returned buffer stays mapped and is
+ * handed out again to the next request of the same size class. Free buffers
+ * of other classes are unmapped when a new mapping would exceed the budget.
+ */
+
+#define _GNU_SOURCE
+
+#include "img_bufpool.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+/** Maximum number of buffers held at once */
+#define BUFPOOL_MAX_BUFFERS 64
+
+/**
+ * @brief One mapping held by the pool.
+ */
+typedef struct
+{
+    uint8_t* addr; /**< Start of the mapping */
+    size_t size;   /**< Size class of the mapping */
+    int in_use;    /**< Checked out by a caller */
+} PoolBuffer;
+
+/** All mappings held by the pool */
+static PoolBuffer pool[BUFPOOL_MAX_BUFFERS];
+
+/** Number of valid entries in pool */
+static size_t pool_count = 0;
+
+/** Sum of the sizes of all mappings in pool */
+static size_t pool_bytes = 0;
+
+/** Back large buffers with huge pages (see bufpool_set_huge_pages()) */
+static int pool_huge = 0;
+
+/** Protects all of the above */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Back large buffers with huge pages from now on.
+ *
+ * @param enable Non-zero to enable.
+ */
+void bufpool_set_huge_pages(int enable)
+{
+    pthread_mutex_lock(&pool_lock);
+    pool_huge = enable;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * @brief Round a request up to its size class.
+ *
+ * @param size Requested size (at most BUFPOOL_MAX_SIZE).
+ * @return Smallest power of two >= size and >= BUFPOOL_ALIGNMENT.
+ */
+static size_t size_class(size_t size)
+{
+    size_t cls = BUFPOOL_ALIGNMENT;
+    while (cls < size)
+        cls <<= 1;
+    return cls;
+}
+
+/**
+ * @brief Map a new buffer.
+ *
+ * @param size Size class of the buffer.
+ * @return Mapped buffer, or NULL on failure.
+ */
+static uint8_t* map_buffer(size_t size)
+{
+    const int prot = PROT_READ | PROT_WRITE;
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void* p = MAP_FAILED;
+
+    if (pool_huge && size >= BUFPOOL_HUGE_PAGE_SIZE)
+    {
+        p = mmap(NULL, size, prot, flags | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED)
+        {
+            /* No reserved huge pages: ask for transparent ones instead */
+            p = mmap(NULL, size, prot, flags, -1, 0);
+            if (p != MAP_FAILED)
+                madvise(p, size, MADV_HUGEPAGE);
+        }
+    }
+    else
+    {
+        p = mmap(NULL, size, prot, flags, -1, 0);
+    }
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/**
+ * @brief Unmap one buffer that is not checked out.
+ *
+ * Must be called with pool_lock held.
+ *
+ * @return 1 if a buffer was released, 0 if every buffer is in use.
+ */
+static int release_one_free(void)
+{
+    for (size_t i = 0; i < pool_count; i++)
+    {
+        if (pool[i].in_use)
+            continue;
+
+        munmap(pool[i].addr, pool[i].size);
+        pool_bytes -= pool[i].size;
+        pool[i] = pool[--pool_count];
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Check a buffer out of the pool.
+ *
+ * @param size Minimum size in bytes (at most BUFPOOL_MAX_SIZE).
+ * @return BUFPOOL_ALIGNMENT-aligned buffer, or NULL if the budget is
+ *         exhausted or memory cannot be mapped.
+ */
+void* bufpool_get(size_t size)
+{
+    if (size > BUFPOOL_MAX_SIZE)
+    {
+        fprintf(stderr, "I/O buffer of %zu bytes exceeds the %d MiB limit\n", size,
+                BUFPOOL_MAX_SIZE / (1024 * 1024));
+        return NULL;
+    }
+    size_t cls = size_class(size);
+
+    pthread_mutex_lock(&pool_lock);
+
+    for (size_t i = 0; i < pool_count; i++)
+    {
+        if (!pool[i].in_use && pool[i].size == cls)
+        {
+            pool[i].in_use = 1;
+            pthread_mutex_unlock(&pool_lock);
+            return pool[i].addr;
+        }
+    }
+
+    while ((pool_bytes + cls > BUFPOOL_BUDGET || pool_count == BUFPOOL_MAX_BUFFERS) &&
+           release_one_free())
+    {
+    }
+
+    uint8_t* addr = NULL;
+    if (pool_bytes + cls <= BUFPOOL_BUDGET && pool_count < BUFPOOL_MAX_BUFFERS)
+    {
+        addr = map_buffer(cls);
+        if (addr)
+        {
+            pool[pool_count].addr = addr;
+            pool[pool_count].size = cls;
+            pool[pool_count].in_use = 1;
+            pool_count++;
+            pool_bytes += cls;
+        }
+        else
+        {
+            perror("Cannot allocate I/O buffer");
+        }
+    }
+    else
+    {
+        fprintf(stderr, "I/O buffer budget of %d MiB exhausted\n",
+                BUFPOOL_BUDGET / (1024 * 1024));
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+    return addr;
+}
+
+/**
+ * @brief Return a buffer to the pool.
+ *
+ * @param buf Buffer from bufpool_get() (NULL is ignored).
+ */
+void bufpool_put(void* buf)
+{
+    if (!buf)
+        return;
+
+    pthread_mutex_lock(&pool_lock);
+    for (size_t i = 0; i < pool_count; i++)
+    {
+        if (pool[i].addr == buf)
+        {
+            pool[i].in_use = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,238 @@
+/**
+ * @file img_cache.c
+ * @brief Local build cache for repacked images.
+ *
+ * Cache layout: `<cache>/<key>.img`, one complete image per build key.
+ * Entries are written to a temporary file and renamed into place, so
+ * concurrent or interrupted builds never expose a partial image.
+ *
+ * The measured repack throughput is kept next to the default image cache,
+ * in `<user cache>/imagewty-tool/throughput`.
+ */
+
+#define _GNU_SOURCE
+
+#include "img_cache.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "img_io.h"
+
+/** Weight of the newest sample in the throughput moving average */
+#define THROUGHPUT_EMA_WEIGHT 0.3
+
+/**
+ * @brief Build the per-user imagewty-tool cache directory path.
+ *
+ * @param out  Output buffer.
+ * @param size Size of the output buffer.
+ */
+static void user_cache_directory(char* out, size_t size)
+{
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (xdg && *xdg)
+        snprintf(out, size, "%s/imagewty-tool", xdg);
+    else
+        snprintf(out, size, "%s/.cache/imagewty-tool", home ? home : ".");
+}
+
+/**
+ * @brief Resolve the default build cache directory.
+ *
+ * @return Cache directory path (never NULL; points to static storage).
+ */
+const char* cache_default_directory(void)
+{
+    static char dir[1100];
+
+    const char* env = getenv(CACHE_ENV_VAR);
+    if (env && *env)
+        return env;
+
+    char base[1024];
+    user_cache_directory(base, sizeof(base));
+    snprintf(dir, sizeof(dir), "%s/images", base);
+    return dir;
+}
+
+/**
+ * @brief Create a directory and all missing parents.
+ *
+ * @param path Directory path.
+ * @return 0 on success, non-zero on error.
+ */
+static int ensure_dir_tree(const char* path)
+{
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+
+    for (char* p = tmp + 1; *p; p++)
+    {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        if (mkdir(tmp, 0755) && errno != EEXIST)
+            break;
+        *p = '/';
+    }
+
+    if (mkdir(tmp, 0755) && errno != EEXIST)
+    {
+        fprintf(stderr, "Cannot create directory '%s': %s\n", tmp, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copy one file to another path, as a reflink where possible.
+ *
+ * @param src Source path.
+ * @param dst Destination path (created or truncated).
+ * @return 0 on success, non-zero on error.
+ */
+static int clone_path(const char* src, const char* dst)
+{
+    FILE* in = fopen(src, "rb");
+    if (!in)
+        return 1;
+
+    struct stat st;
+    if (fstat(fileno(in), &st) != 0)
+    {
+        fclose(in);
+        return 1;
+    }
+
+    FILE* out = fopen(dst, "wb");
+    if (!out)
+    {
+        fprintf(stderr, "Cannot create '%s': %s\n", dst, strerror(errno));
+        fclose(in);
+        return 1;
+    }
+
+    int ret = io_clone_file(fileno(in), fileno(out), (uint64_t)st.st_size);
+    fclose(in);
+    if (fclose(out) != 0)
+        ret = 1;
+    return ret;
+}
+
+/**
+ * @brief Copy a cached image to the output file if one exists for the key.
+ *
+ * @param cache_dir   Cache directory.
+ * @param key_hex     Build key (hex SHA-256).
+ * @param output_file Path where the image is written.
+ * @return 0 on a cache hit, non-zero on a miss or error.
+ */
+int cache_fetch(const char* cache_dir, const char* key_hex, const char* output_file)
+{
+    char path[1100];
+    snprintf(path, sizeof(path), "%s/%s.img", cache_dir, key_hex);
+
+    if (access(path, R_OK) != 0)
+        return 1;
+
+    if (clone_path(path, output_file) != 0)
+    {
+        fprintf(stderr, "Cannot copy cached image '%s'\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Store a freshly built image in the cache.
+ *
+ * @param cache_dir  Cache directory (created if needed).
+ * @param key_hex    Build key (hex SHA-256).
+ * @param image_file Path to the image to store.
+ * @return 0 on success, non-zero on error.
+ */
+int cache_store(const char* cache_dir, const char* key_hex, const char* image_file)
+{
+    if (ensure_dir_tree(cache_dir) != 0)
+        return 1;
+
+    char path[1100];
+    char tmp[1200];
+    snprintf(path, sizeof(path), "%s/%s.img", cache_dir, key_hex);
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid());
+
+    if (clone_path(image_file, tmp) != 0 || rename(tmp, path) != 0)
+    {
+        fprintf(stderr, "Cannot store image in cache '%s'\n", cache_dir);
+        unlink(tmp);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Load the recorded repack throughput.
+ *
+ * @param bytes_per_sec Output: average throughput in bytes per second.
+ * @param samples       Output: number of runs the average is based on.
+ * @return 0 if a measurement is available, non-zero otherwise.
+ */
+int cache_load_throughput(double* bytes_per_sec, uint32_t* samples)
+{
+    char base[1024];
+    char path[1100];
+    user_cache_directory(base, sizeof(base));
+    snprintf(path, sizeof(path), "%s/throughput", base);
+
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return 1;
+
+    int ok = fscanf(f, "repack %lf %u", bytes_per_sec, samples) == 2 && *bytes_per_sec > 0;
+    fclose(f);
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Record the throughput of a completed repack.
+ *
+ * @param bytes   Number of bytes written.
+ * @param seconds Elapsed wall-clock time.
+ */
+void cache_record_throughput(uint64_t bytes, double seconds)
+{
+    if (bytes < THROUGHPUT_MIN_BYTES || seconds <= 0)
+        return;
+
+    double rate = (double)bytes / seconds;
+    double avg;
+    uint32_t samples;
+    if (cache_load_throughput(&avg, &samples) == 0)
+        rate = avg + THROUGHPUT_EMA_WEIGHT * (rate - avg);
+    else
+        samples = 0;
+
+    char base[1024];
+    char path[1100];
+    char tmp[1200];
+    user_cache_directory(base, sizeof(base));
+    if (ensure_dir_tree(base) != 0)
+        return;
+    snprintf(path, sizeof(path), "%s/throughput", base);
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid());
+
+    /* Best effort: a lost measurement only degrades future estimates */
+    FILE* f = fopen(tmp, "w");
+    if (!f)
+        return;
+    fprintf(f, "repack %.0f %u\n", rate, samples + 1);
+    if (fclose(f) != 0 || rename(tmp, path) != 0)
+        unlink(tmp);
+}
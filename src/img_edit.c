@@ -0,0 +1,912 @@
+/**
+ * @file img_edit.c
+ * @brief In-place editing of IMAGEWTY images.
+ *
+ * Instead of extracting and repacking a whole image, the functions in this
+ * module patch individual header fields and rewrite only the data ranges
+ * that actually change. Space left behind by relocated entries is not
+ * reclaimed here.
+ */
+
+#define _GNU_SOURCE
+
+#include "img_edit.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "file_table.h"
+#include "img_bufpool.h"
+#include "img_header.h"
+#include "img_io.h"
+#include "img_repack.h"
+
+/** Copy buffer size used when writing entry data */
+#define EDIT_BUFFER_SIZE (64 * 1024)
+
+/** Main type used for added entries when none is given */
+#define DEFAULT_MAINTYPE "RFSFAT16"
+
+/**
+ * @brief Open an image and read its header table.
+ *
+ * @param path  Path to the image file.
+ * @param mode  fopen() mode ("r+b" for in-place modification).
+ * @param hdr   Pointer to ImageWTYHeader to populate.
+ * @param files Output pointer to the file header array.
+ * @param arena Image session arena; initialized here and holding the
+ *              header table on success.
+ * @return FILE* on success, or NULL on failure.
+ */
+static FILE* open_image_edit(const char* path, const char* mode, ImageWTYHeader* hdr,
+                             ImageWTYFileHeader** files, Arena* arena)
+{
+    arena_init(arena);
+
+    FILE* f = fopen(path, mode);
+    if (!f)
+    {
+        fprintf(stderr, "Cannot open image '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    read_image_header(f, hdr);
+    if (strncmp(hdr->magic, IMAGEWTY_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "Error: '%s' is not a valid IMAGEWTY image.\n", path);
+        fclose(f);
+        return NULL;
+    }
+
+    *files = read_all_file_headers(f, hdr->num_files, hdr->file_header_length, arena);
+    return f;
+}
+
+/**
+ * @brief Find an entry in the header table by file name.
+ *
+ * @param files     File header array.
+ * @param num_files Number of entries.
+ * @param name      File name to look for.
+ * @return Index of the entry, or -1 if not found.
+ */
+static long find_entry(const ImageWTYFileHeader* files, uint32_t num_files, const char* name)
+{
+    for (uint32_t i = 0; i < num_files; i++)
+    {
+        if (strcmp(files[i].filename, name) == 0)
+            return (long)i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Check whether an entry's data range overlaps any other entry.
+ *
+ * Images repacked with --dedup point identical entries at one shared
+ * range, which must then not be overwritten in place.
+ *
+ * @param files     File header array.
+ * @param num_files Number of entries.
+ * @param idx       Index of the entry to check.
+ * @return Non-zero if another entry uses part of the same range.
+ */
+static int range_is_shared(const ImageWTYFileHeader* files, uint32_t num_files, long idx)
+{
+    const ImageWTYFileHeader* fh = &files[idx];
+
+    for (uint32_t i = 0; i < num_files; i++)
+    {
+        if ((long)i == idx || files[i].stored_length == 0 || fh->stored_length == 0)
+            continue;
+        if (files[i].offset < fh->offset + fh->stored_length &&
+            fh->offset < files[i].offset + files[i].stored_length)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Write a 32-bit little-endian value at an absolute position.
+ *
+ * @param f     Image file.
+ * @param pos   Absolute byte position.
+ * @param value Value to write.
+ * @return 0 on success, non-zero on error.
+ */
+static int patch_uint32_le(FILE* f, uint64_t pos, uint32_t value)
+{
+    uint8_t buf[4] = {(uint8_t)(value & 0xFF), (uint8_t)((value >> 8) & 0xFF),
+                      (uint8_t)((value >> 16) & 0xFF), (uint8_t)((value >> 24) & 0xFF)};
+
+    if (fseeko(f, (off_t)pos, SEEK_SET) != 0 || fwrite(buf, 1, 4, f) != 4)
+    {
+        perror("Error patching image");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Compute the end of the used area of an image.
+ *
+ * @param hdr   Main header.
+ * @param files File header array.
+ * @return Highest offset + stored_length over all entries (at least the end
+ *         of the header table).
+ */
+static uint64_t image_data_end(const ImageWTYHeader* hdr, const ImageWTYFileHeader* files)
+{
+    uint64_t end = FILE_HEADERS_START + (uint64_t)hdr->num_files * hdr->file_header_length;
+
+    for (uint32_t i = 0; i < hdr->num_files; i++)
+    {
+        uint64_t entry_end = (uint64_t)files[i].offset + files[i].stored_length;
+        if (entry_end > end)
+            end = entry_end;
+    }
+    return end;
+}
+
+/**
+ * @brief Find where data can be appended to an image without overwriting anything.
+ *
+ * Bytes after the last entry that no entry describes (e.g. a vendor trailer
+ * or signature block) are kept, so this is the larger of the file size and
+ * image_data_end().
+ *
+ * @param f     Image file.
+ * @param hdr   Main header.
+ * @param files File header array.
+ * @param end   Output: first byte past everything the image holds.
+ * @return 0 on success, non-zero on error.
+ */
+static int image_append_end(FILE* f, const ImageWTYHeader* hdr, const ImageWTYFileHeader* files,
+                            uint64_t* end)
+{
+    struct stat st;
+    if (fflush(f) != 0 || fstat(fileno(f), &st) != 0)
+    {
+        perror("Error reading image size");
+        return 1;
+    }
+
+    *end = image_data_end(hdr, files);
+    if ((uint64_t)st.st_size > *end)
+        *end = (uint64_t)st.st_size;
+    return 0;
+}
+
+/**
+ * @brief Copy a file into the image and zero-fill up to the stored length.
+ *
+ * The V-file checksum of the copied data is computed on the fly.
+ *
+ * @param img           Image file.
+ * @param dest          Absolute destination offset in the image.
+ * @param src_path      Source file path.
+ * @param length        Number of bytes to copy from the source.
+ * @param stored_length Padded length of the destination range.
+ * @param checksum      Output: checksum of the copied data.
+ * @return 0 on success, non-zero on error.
+ */
+static int write_entry_data(FILE* img, uint64_t dest, const char* src_path, uint64_t length,
+                            uint64_t stored_length, uint32_t* checksum)
+{
+    FILE* in = fopen(src_path, "rb");
+    if (!in)
+    {
+        fprintf(stderr, "Cannot open file '%s': %s\n", src_path, strerror(errno));
+        return 1;
+    }
+
+    if (fseeko(img, (off_t)dest, SEEK_SET) != 0)
+    {
+        perror("Error seeking in image");
+        fclose(in);
+        return 1;
+    }
+
+    uint8_t* buf = bufpool_get(EDIT_BUFFER_SIZE);
+    if (!buf)
+    {
+        fclose(in);
+        return 1;
+    }
+
+    ChecksumState st;
+    uint64_t remaining = length;
+
+    checksum_init(&st);
+    while (remaining > 0)
+    {
+        size_t want = remaining > EDIT_BUFFER_SIZE ? EDIT_BUFFER_SIZE : (size_t)remaining;
+        if (fread(buf, 1, want, in) != want)
+        {
+            fprintf(stderr, "Error reading '%s'\n", src_path);
+            bufpool_put(buf);
+            fclose(in);
+            return 1;
+        }
+        if (fwrite(buf, 1, want, img) != want)
+        {
+            perror("Error writing image data");
+            bufpool_put(buf);
+            fclose(in);
+            return 1;
+        }
+        checksum_update(&st, buf, want);
+        remaining -= want;
+    }
+    bufpool_put(buf);
+    fclose(in);
+
+    /* Zero padding up to the stored length */
+    uint8_t zero_buf[PADDING_ALIGNMENT] = {0};
+    if (fwrite(zero_buf, 1, stored_length - length, img) != stored_length - length)
+    {
+        perror("Error writing padding");
+        return 1;
+    }
+
+    *checksum = checksum_final(&st);
+    return 0;
+}
+
+/**
+ * @brief Store a new checksum in the V-file belonging to an entry.
+ *
+ * Does nothing if the image has no matching checksum V-file.
+ *
+ * @param f          Image file.
+ * @param files      File header array.
+ * @param num_files  Number of entries.
+ * @param entry_name Name of the entry whose data changed.
+ * @param checksum   New checksum of the entry's data.
+ * @return 0 on success, non-zero on error.
+ */
+static int patch_vfile_checksum(FILE* f, const ImageWTYFileHeader* files, uint32_t num_files,
+                                const char* entry_name, uint32_t checksum)
+{
+    char vname[sizeof(files->filename) + 1];
+    snprintf(vname, sizeof(vname), "V%s", entry_name);
+
+    long vidx = find_entry(files, num_files, vname);
+    if (vidx < 0 || !is_checksum_vfile(vname))
+        return 0;
+
+    if (files[vidx].original_length < 4)
+    {
+        fprintf(stderr, "Warning: '%s' is too short to hold a checksum\n", vname);
+        return 0;
+    }
+
+    if (patch_uint32_le(f, files[vidx].offset, checksum) != 0)
+        return 1;
+    printf("       Updated checksum in %s to %u\n", vname, checksum);
+    return 0;
+}
+
+/**
+ * @brief Replace the contents of one embedded file.
+ *
+ * @param img_filename Path to the IMAGEWTY image to modify.
+ * @param entry_name   Name of the embedded file.
+ * @param new_file     Path to the file holding the new contents.
+ * @return 0 on success, non-zero on error.
+ */
+int replace_entry(const char* img_filename, const char* entry_name, const char* new_file)
+{
+    if (!img_filename || !entry_name || !new_file)
+    {
+        fprintf(stderr, "replace_entry: invalid parameters\n");
+        return 1;
+    }
+
+    struct stat st;
+    if (stat(new_file, &st) != 0)
+    {
+        fprintf(stderr, "Cannot stat '%s': %s\n", new_file, strerror(errno));
+        return 1;
+    }
+
+    ImageWTYHeader hdr;
+    ImageWTYFileHeader* files = NULL;
+    Arena session;
+    FILE* f = open_image_edit(img_filename, "r+b", &hdr, &files, &session);
+    if (!f)
+        return 1;
+
+    long idx = find_entry(files, hdr.num_files, entry_name);
+    if (idx < 0)
+    {
+        fprintf(stderr, "Entry '%s' not found in '%s'\n", entry_name, img_filename);
+        arena_release(&session);
+        fclose(f);
+        return 1;
+    }
+
+    ImageWTYFileHeader* fh = &files[idx];
+    uint64_t new_length = (uint64_t)st.st_size;
+    uint64_t stored_length, padding;
+    calculate_padding(new_length, &stored_length, &padding);
+
+    /* Fits in the current (unshared) range: overwrite in place. Otherwise relocate. */
+    int in_place =
+        stored_length <= fh->stored_length && !range_is_shared(files, hdr.num_files, idx);
+    uint64_t dest = fh->offset;
+    uint64_t total_size = hdr.total_image_size;
+
+    if (!in_place)
+    {
+        uint64_t end;
+        if (image_append_end(f, &hdr, files, &end) != 0)
+        {
+            arena_release(&session);
+            fclose(f);
+            return 1;
+        }
+        dest = align_offset(end, PADDING_ALIGNMENT);
+        total_size = dest + stored_length;
+    }
+
+    if (dest + stored_length > UINT32_MAX)
+    {
+        fprintf(stderr, "Error: '%s' does not fit in a 32-bit IMAGEWTY image\n", new_file);
+        arena_release(&session);
+        fclose(f);
+        return 1;
+    }
+
+    uint32_t checksum = 0;
+    uint64_t fh_pos = FILE_HEADERS_START + (uint64_t)idx * hdr.file_header_length;
+    int ret = write_entry_data(f, dest, new_file, new_length, stored_length, &checksum);
+
+    /* Patch the header table entry */
+    if (ret == 0)
+        ret =
+            patch_uint32_le(f, fh_pos + FILE_HEADER_STORED_LENGTH_OFFSET, (uint32_t)stored_length);
+    if (ret == 0)
+        ret = patch_uint32_le(f, fh_pos + FILE_HEADER_ORIGINAL_LENGTH_OFFSET, (uint32_t)new_length);
+    if (ret == 0 && !in_place)
+        ret = patch_uint32_le(f, fh_pos + FILE_HEADER_OFFSET_OFFSET, (uint32_t)dest);
+    if (ret == 0 && total_size != hdr.total_image_size)
+        ret = patch_uint32_le(f, IMG_HEADER_TOTAL_SIZE_OFFSET, (uint32_t)total_size);
+
+    if (ret == 0)
+    {
+        printf("Replaced: %s (%u -> %llu bytes, %s)\n", entry_name, fh->original_length,
+               (unsigned long long)new_length, in_place ? "in place" : "relocated to end");
+    }
+
+    /* Patch the matching V-file checksum, if the image has one */
+    if (ret == 0)
+        ret = patch_vfile_checksum(f, files, hdr.num_files, entry_name, checksum);
+
+    arena_release(&session);
+    if (fclose(f) != 0)
+    {
+        perror("Error closing image");
+        ret = 1;
+    }
+    return ret;
+}
+
+/**
+ * @brief Move the lowest data entries to the end of the image.
+ *
+ * Frees the area below `limit` so the header table can grow into it.
+ * Entries sharing the same data range are moved together. Empty entries
+ * below the limit are simply re-pointed.
+ *
+ * @param f     Image file.
+ * @param hdr   Main header.
+ * @param files File header array (offsets are updated).
+ * @param limit First byte that must not be occupied by data.
+ * @param end   In/out: end of the used area of the image.
+ * @return 0 on success, non-zero on error.
+ */
+static int relocate_below(FILE* f, const ImageWTYHeader* hdr, ImageWTYFileHeader* files,
+                          uint64_t limit, uint64_t* end)
+{
+    int fd = fileno(f);
+
+    for (;;)
+    {
+        /* Lowest non-empty entry still below the limit */
+        long lowest = -1;
+        for (uint32_t i = 0; i < hdr->num_files; i++)
+        {
+            if (files[i].stored_length == 0 || files[i].offset >= limit)
+                continue;
+            if (lowest < 0 || files[i].offset < files[lowest].offset)
+                lowest = (long)i;
+        }
+        if (lowest < 0)
+            break;
+
+        uint32_t old_offset = files[lowest].offset;
+        uint32_t length = files[lowest].stored_length;
+        uint64_t dest = align_offset(*end, PADDING_ALIGNMENT);
+
+        if (dest + length > UINT32_MAX)
+        {
+            fprintf(stderr, "Error: relocating '%s' would exceed the 32-bit image size\n",
+                    files[lowest].filename);
+            return 1;
+        }
+
+        fflush(f);
+        if (io_copy_range(fd, old_offset, fd, dest, length) != 0)
+            return 1;
+
+        for (uint32_t i = 0; i < hdr->num_files; i++)
+        {
+            if (files[i].offset != old_offset || files[i].stored_length != length)
+                continue;
+
+            files[i].offset = (uint32_t)dest;
+            uint64_t pos = FILE_HEADERS_START + (uint64_t)i * hdr->file_header_length;
+            if (patch_uint32_le(f, pos + FILE_HEADER_OFFSET_OFFSET, (uint32_t)dest) != 0)
+                return 1;
+            printf("Relocated: %s (0x%X -> 0x%llX)\n", files[i].filename, old_offset,
+                   (unsigned long long)dest);
+        }
+        *end = dest + length;
+    }
+
+    /* Empty entries occupy no bytes: point them past the header table */
+    for (uint32_t i = 0; i < hdr->num_files; i++)
+    {
+        if (files[i].stored_length == 0 && files[i].offset < limit)
+        {
+            files[i].offset = (uint32_t)limit;
+            uint64_t pos = FILE_HEADERS_START + (uint64_t)i * hdr->file_header_length;
+            if (patch_uint32_le(f, pos + FILE_HEADER_OFFSET_OFFSET, (uint32_t)limit) != 0)
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Derive a sub type string from a file name (e.g. "BOOT_FEX00000000").
+ *
+ * @param name    Entry file name.
+ * @param subtype Output buffer of at least 17 bytes.
+ */
+static void default_subtype(const char* name, char* subtype)
+{
+    size_t i = 0;
+    for (; i < 16 && name[i]; i++)
+    {
+        char c = name[i];
+        subtype[i] = (c == '.') ? '_' : (char)((c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c);
+    }
+    for (; i < 16; i++)
+        subtype[i] = '0';
+    subtype[16] = '\0';
+}
+
+/**
+ * @brief Add a new embedded file to an existing image.
+ *
+ * @param img_filename Path to the IMAGEWTY image to modify.
+ * @param new_file     Path to the file to add.
+ * @param maintype     Main type string, or NULL for the default.
+ * @param subtype      Sub type string, or NULL to derive it from the file name.
+ * @return 0 on success, non-zero on error.
+ */
+int add_entry(const char* img_filename, const char* new_file, const char* maintype,
+              const char* subtype)
+{
+    if (!img_filename || !new_file)
+    {
+        fprintf(stderr, "add_entry: invalid parameters\n");
+        return 1;
+    }
+
+    const char* name = strrchr(new_file, '/');
+    name = name ? name + 1 : new_file;
+    if (!*name || strlen(name) > 256)
+    {
+        fprintf(stderr, "Error: invalid entry name '%s'\n", name);
+        return 1;
+    }
+
+    struct stat st;
+    if (stat(new_file, &st) != 0)
+    {
+        fprintf(stderr, "Cannot stat '%s': %s\n", new_file, strerror(errno));
+        return 1;
+    }
+
+    ImageWTYHeader hdr;
+    ImageWTYFileHeader* files = NULL;
+    Arena session;
+    FILE* f = open_image_edit(img_filename, "r+b", &hdr, &files, &session);
+    if (!f)
+        return 1;
+
+    if (find_entry(files, hdr.num_files, name) >= 0)
+    {
+        fprintf(stderr, "Entry '%s' already exists in '%s' (use 'replace')\n", name,
+                img_filename);
+        arena_release(&session);
+        fclose(f);
+        return 1;
+    }
+
+    uint32_t fhl = hdr.file_header_length;
+    uint64_t table_end = FILE_HEADERS_START + (uint64_t)(hdr.num_files + 1) * fhl;
+    uint64_t end;
+    if (image_append_end(f, &hdr, files, &end) != 0)
+    {
+        arena_release(&session);
+        fclose(f);
+        return 1;
+    }
+    if (end < table_end)
+        end = table_end;
+
+    /* Make room for the new header (plus some slack) only if data is in the way;
+       otherwise only empty entries pointing below the table are re-pointed */
+    uint64_t limit = table_end;
+    for (uint32_t i = 0; i < hdr.num_files; i++)
+    {
+        if (files[i].stored_length > 0 && files[i].offset < table_end)
+        {
+            limit = table_end + EDIT_HEADER_SLACK * (uint64_t)fhl;
+            break;
+        }
+    }
+    int ret = relocate_below(f, &hdr, files, limit, &end);
+
+    /* Describe the new entry, using the first entry as a template */
+    ImageWTYFileHeader nfh;
+    memset(&nfh, 0, sizeof(nfh));
+    nfh.filename_length = hdr.num_files > 0 ? files[0].filename_length : 256;
+    nfh.header_size = hdr.num_files > 0 ? files[0].header_size : fhl;
+    snprintf(nfh.maintype, sizeof(nfh.maintype), "%s", maintype ? maintype : DEFAULT_MAINTYPE);
+    if (subtype)
+        snprintf(nfh.subtype, sizeof(nfh.subtype), "%s", subtype);
+    else
+        default_subtype(name, nfh.subtype);
+    snprintf(nfh.filename, sizeof(nfh.filename), "%s", name);
+
+    uint64_t stored_length, padding;
+    calculate_padding((uint64_t)st.st_size, &stored_length, &padding);
+    uint64_t dest = align_offset(end, PADDING_ALIGNMENT);
+
+    if (ret == 0 && dest + stored_length > UINT32_MAX)
+    {
+        fprintf(stderr, "Error: '%s' does not fit in a 32-bit IMAGEWTY image\n", new_file);
+        ret = 1;
+    }
+
+    uint32_t checksum = 0;
+    if (ret == 0)
+    {
+        fflush(f);
+        ret = write_entry_data(f, dest, new_file, (uint64_t)st.st_size, stored_length, &checksum);
+    }
+
+    nfh.original_length = (uint32_t)st.st_size;
+    nfh.stored_length = (uint32_t)stored_length;
+    nfh.offset = (uint32_t)dest;
+
+    if (ret == 0)
+        ret = write_file_header(f, &nfh, hdr.num_files, fhl);
+    if (ret == 0)
+        ret = patch_uint32_le(f, IMG_HEADER_NUM_FILES_OFFSET, hdr.num_files + 1);
+    if (ret == 0)
+        ret = patch_uint32_le(f, IMG_HEADER_TOTAL_SIZE_OFFSET, (uint32_t)(dest + stored_length));
+    if (ret == 0)
+        ret = patch_vfile_checksum(f, files, hdr.num_files, name, checksum);
+
+    if (ret == 0)
+        printf("Added: %s (%u bytes at 0x%X)\n", name, nfh.original_length, nfh.offset);
+
+    arena_release(&session);
+    if (fclose(f) != 0)
+    {
+        perror("Error closing image");
+        ret = 1;
+    }
+    return ret;
+}
+
+/**
+ * @brief Remove an embedded file from an existing image.
+ *
+ * @param img_filename Path to the IMAGEWTY image to modify.
+ * @param entry_name   Name of the embedded file to remove.
+ * @return 0 on success, non-zero on error.
+ */
+int remove_entry(const char* img_filename, const char* entry_name)
+{
+    if (!img_filename || !entry_name)
+    {
+        fprintf(stderr, "remove_entry: invalid parameters\n");
+        return 1;
+    }
+
+    ImageWTYHeader hdr;
+    ImageWTYFileHeader* files = NULL;
+    Arena session;
+    FILE* f = open_image_edit(img_filename, "r+b", &hdr, &files, &session);
+    if (!f)
+        return 1;
+
+    long idx = find_entry(files, hdr.num_files, entry_name);
+    if (idx < 0)
+    {
+        fprintf(stderr, "Entry '%s' not found in '%s'\n", entry_name, img_filename);
+        arena_release(&session);
+        fclose(f);
+        return 1;
+    }
+
+    uint32_t fhl = hdr.file_header_length;
+    uint8_t* buf = bufpool_get(fhl);
+    if (!buf)
+    {
+        arena_release(&session);
+        fclose(f);
+        return 1;
+    }
+
+    /* Shift the following raw headers down one slot (unknown bytes are preserved) */
+    int fd = fileno(f);
+    int ret = 0;
+    fflush(f);
+
+    for (uint32_t i = (uint32_t)idx + 1; i < hdr.num_files && ret == 0; i++)
+    {
+        off_t src = FILE_HEADERS_START + (off_t)i * fhl;
+        if (pread(fd, buf, fhl, src) != (ssize_t)fhl || pwrite(fd, buf, fhl, src - fhl) != fhl)
+        {
+            perror("Error moving file header");
+            ret = 1;
+        }
+    }
+    bufpool_put(buf);
+
+    if (ret == 0)
+        ret = io_write_zeros(fd, FILE_HEADERS_START + (uint64_t)(hdr.num_files - 1) * fhl, fhl);
+    if (ret == 0)
+        ret = patch_uint32_le(f, IMG_HEADER_NUM_FILES_OFFSET, hdr.num_files - 1);
+
+    /* Give back the tail of the image if the removed data was the last range,
+       unless bytes no entry describes (e.g. a vendor trailer) follow it */
+    uint64_t old_end = image_data_end(&hdr, files);
+    memmove(&files[idx], &files[idx + 1], (hdr.num_files - idx - 1) * sizeof(*files));
+    hdr.num_files--;
+    uint64_t new_end = image_data_end(&hdr, files);
+
+    struct stat st;
+    if (ret == 0 && fstat(fd, &st) != 0)
+    {
+        perror("Error reading image size");
+        ret = 1;
+    }
+    if (ret == 0 && new_end < old_end && (uint64_t)st.st_size == old_end)
+    {
+        ret = patch_uint32_le(f, IMG_HEADER_TOTAL_SIZE_OFFSET, (uint32_t)new_end);
+        fflush(f);
+        if (ret == 0 && ftruncate(fd, (off_t)new_end) != 0)
+        {
+            perror("Error truncating image");
+            ret = 1;
+        }
+    }
+
+    if (ret == 0)
+    {
+        printf("Removed: %s\n", entry_name);
+
+        char vname[sizeof(files->filename) + 1];
+        snprintf(vname, sizeof(vname), "V%s", entry_name);
+        if (find_entry(files, hdr.num_files, vname) >= 0 && is_checksum_vfile(vname))
+            printf("Note: checksum file '%s' is still present in the image\n", vname);
+    }
+
+    arena_release(&session);
+    if (fclose(f) != 0)
+    {
+        perror("Error closing image");
+        ret = 1;
+    }
+    return ret;
+}
+
+/**
+ * @brief Pack an image's payloads tightly behind the header table.
+ *
+ * @param img_filename Path to the IMAGEWTY image.
+ * @param output_file  Path of a new compacted image, or NULL to compact in place.
+ * @return 0 on success, non-zero on error.
+ */
+int compact_image(const char* img_filename, const char* output_file)
+{
+    if (!img_filename)
+    {
+        fprintf(stderr, "compact_image: img_filename is NULL\n");
+        return 1;
+    }
+
+    int in_place = (output_file == NULL);
+    ImageWTYHeader hdr;
+    ImageWTYFileHeader* files = NULL;
+    Arena session;
+    FILE* f = open_image_edit(img_filename, in_place ? "r+b" : "rb", &hdr, &files, &session);
+    if (!f)
+        return 1;
+
+    fseeko(f, 0, SEEK_END);
+    uint64_t old_size = (uint64_t)ftello(f);
+
+    uint32_t n = hdr.num_files;
+    uint64_t table_end = FILE_HEADERS_START + (uint64_t)n * hdr.file_header_length;
+    FileTable t;
+    uint32_t* order = arena_calloc(&session, n, sizeof(*order));
+    uint32_t* new_offset = arena_calloc(&session, n, sizeof(*new_offset));
+    int ret = (!order || !new_offset);
+    if (ret)
+        perror("Memory allocation failed");
+
+    /* Visit entries in current data order so every range moves towards the start */
+    if (!ret)
+        ret = file_table_build(&t, files, n, &session);
+    if (!ret)
+        ret = file_table_sort_by_offset(&t, order, &session);
+
+    /* Validate: no data inside the header table, no partial overlaps when in place */
+    uint64_t prev_end = table_end;
+    for (uint32_t k = 0; k < n && !ret; k++)
+    {
+        uint32_t i = order[k];
+        const char* name = file_table_str(&t, t.filename[i]);
+        int shared = k > 0 && t.offset[order[k - 1]] == t.offset[i] &&
+                     t.stored_length[order[k - 1]] == t.stored_length[i];
+
+        if (t.original_length[i] > t.stored_length[i])
+        {
+            fprintf(stderr, "Error: '%s' has original_length > stored_length\n", name);
+            ret = 1;
+        }
+        else if (t.stored_length[i] > 0 && t.offset[i] < table_end)
+        {
+            fprintf(stderr, "Error: '%s' overlaps the header table\n", name);
+            ret = 1;
+        }
+        else if (in_place && t.stored_length[i] > 0 && !shared && t.offset[i] < prev_end)
+        {
+            fprintf(stderr,
+                    "Error: '%s' partially overlaps another entry; compact into a new file "
+                    "instead\n",
+                    name);
+            ret = 1;
+        }
+        if (t.stored_length[i] > 0 && (uint64_t)t.offset[i] + t.stored_length[i] > prev_end)
+            prev_end = (uint64_t)t.offset[i] + t.stored_length[i];
+    }
+
+    /* The output file is only created once the image has passed validation */
+    FILE* out = in_place ? f : NULL;
+    if (!ret && !in_place)
+    {
+        out = fopen(output_file, "w+b");
+        if (!out)
+        {
+            fprintf(stderr, "Cannot create output file '%s': %s\n", output_file,
+                    strerror(errno));
+            ret = 1;
+        }
+    }
+    if (!out)
+    {
+        arena_release(&session);
+        fclose(f);
+        return 1;
+    }
+
+    int in_fd = fileno(f);
+    int out_fd = fileno(out);
+    uint64_t cursor = table_end;
+    uint64_t moved_ranges = 0, moved_bytes = 0;
+    fflush(f);
+
+    /* Out of place: start from a verbatim copy of the header region */
+    if (!ret && !in_place)
+        ret = io_copy_range(in_fd, 0, out_fd, 0, table_end);
+
+    for (uint32_t k = 0; k < n && !ret; k++)
+    {
+        uint32_t i = order[k];
+        uint32_t original_length = t.original_length[i];
+        uint64_t stored_length, padding;
+        calculate_padding(original_length, &stored_length, &padding);
+
+        /* Entries sharing the previous entry's range share its new location */
+        if (k > 0)
+        {
+            uint32_t prev = order[k - 1];
+            if (t.offset[prev] == t.offset[i] && t.stored_length[prev] == t.stored_length[i] &&
+                t.stored_length[i] > 0)
+            {
+                new_offset[i] = new_offset[prev];
+                continue;
+            }
+        }
+
+        new_offset[i] = (uint32_t)cursor;
+        if (original_length > 0 && (cursor != t.offset[i] || !in_place))
+        {
+            ret = io_copy_range(in_fd, t.offset[i], out_fd, cursor, original_length);
+            moved_ranges++;
+            moved_bytes += original_length;
+        }
+        if (!ret)
+            ret = io_write_zeros(out_fd, cursor + original_length, padding);
+        cursor += stored_length;
+    }
+
+    /* Bytes after the last entry that no entry describes (e.g. a vendor trailer)
+       follow the packed data; TOTAL_SIZE keeps covering as much of them as before */
+    uint64_t trailer = old_size > prev_end ? old_size - prev_end : 0;
+    uint64_t total_size =
+        cursor + (hdr.total_image_size > prev_end ? hdr.total_image_size - prev_end : 0);
+    if (!ret && trailer > 0 && (cursor != prev_end || !in_place))
+        ret = io_copy_range(in_fd, prev_end, out_fd, cursor, trailer);
+
+    /* Patch offsets and stored lengths in the header table */
+    for (uint32_t i = 0; i < n && !ret; i++)
+    {
+        uint64_t stored_length, padding;
+        calculate_padding(t.original_length[i], &stored_length, &padding);
+        uint64_t pos = FILE_HEADERS_START + (uint64_t)i * hdr.file_header_length;
+
+        if (new_offset[i] != t.offset[i] || !in_place)
+            ret = patch_uint32_le(out, pos + FILE_HEADER_OFFSET_OFFSET, new_offset[i]);
+        if (!ret && (stored_length != t.stored_length[i] || !in_place))
+            ret = patch_uint32_le(out, pos + FILE_HEADER_STORED_LENGTH_OFFSET,
+                                  (uint32_t)stored_length);
+    }
+
+    if (!ret)
+        ret = patch_uint32_le(out, IMG_HEADER_TOTAL_SIZE_OFFSET, (uint32_t)total_size);
+    if (!ret && (fflush(out) != 0 || ftruncate(out_fd, (off_t)(cursor + trailer)) != 0))
+    {
+        perror("Error truncating image");
+        ret = 1;
+    }
+
+    if (!ret)
+    {
+        printf("Compacted: %s (%llu -> %llu bytes, %llu ranges / %llu bytes moved)\n",
+               in_place ? img_filename : output_file, (unsigned long long)old_size,
+               (unsigned long long)(cursor + trailer), (unsigned long long)moved_ranges,
+               (unsigned long long)moved_bytes);
+    }
+
+    arena_release(&session);
+    if (!in_place && fclose(out) != 0)
+        ret = 1;
+    if (fclose(f) != 0)
+        ret = 1;
+
+    /* Do not leave a partial output behind */
+    if (ret && !in_place)
+        unlink(output_file);
+    return ret;
+}
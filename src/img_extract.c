@@ -2,75 +2,138 @@
  * @file img_extract.c
  * @brief Implements extraction of all files from an IMAGEWTY image.
  *
- * This module extracts files from an IMAGEWTY image into a dump folder,
- * writes an image.cfg with metadata, and verifies integrity using
- * V*.fex checksums.
+ * This module extracts files from an IMAGEWTY image into a dump folder
+ * (or a pax archive), writes an image.cfg with metadata, and verifies
+ * integrity using V*.fex checksums. Images read from a pipe, deflated
+ * images inside zip bundles and gzip/xz compressed images are extracted in
+ * a single forward pass in data offset order, unless only some entries are
+ * selected: those are read at their offsets.
  */
 
+#define _GNU_SOURCE
+
+#include "img_extract.h"
+
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "checksum.h"
 #include "config_file.h"
+#include "file_table.h"
+#include "img_bufpool.h"
 #include "img_header.h"
+#include "img_io.h"
+#include "img_lz4.h"
+#include "img_source.h"
+#include "img_tar.h"
+
+/** Size of the buffer a streamed image is read through */
+#define STREAM_BUFFER_SIZE (1024 * 1024)
+
+/** Largest header table accepted from a stream (it is buffered in memory) */
+#define STREAM_MAX_HEADER_TABLE (64 * 1024 * 1024)
 
 /**
- * @brief Extract all files from an IMAGEWTY image into a dump folder.
- *
- * After extraction, a config file (image.cfg) is generated and V*.fex
- * checksums are verified (without updating them).
+ * @brief Where extracted entries go.
+ */
+typedef struct
+{
+    const char* dump_dir; /**< Dump directory (when tar_fd is -1) */
+    int tar_fd;           /**< Archive output, or -1 to write a dump folder */
+    time_t mtime;         /**< Modification time recorded for archive members */
+    int compress;         /**< Store large dump folder entries as LZ4 frames */
+} ExtractTarget;
+
+/**
+ * @brief Fill an ExtractOptions structure with the default settings.
  *
- * @param img_filename Path to the IMAGEWTY image file.
- * @return 0 on success, non-zero on error.
+ * @param opts Options to initialize.
  */
-int extract_image(const char* img_filename)
+void extract_options_init(ExtractOptions* opts)
 {
-    if (!img_filename)
-    {
-        fprintf(stderr, "extract_image: img_filename is NULL\n");
-        return 1;
-    }
+    memset(opts, 0, sizeof(*opts));
+}
 
-    FILE* f = fopen(img_filename, "rb");
-    if (!f)
+/**
+ * @brief Check V*.fex entries against the checksums computed during extraction.
+ *
+ * Equivalent to verify_vfiles_checksums() on the dump folder, without
+ * reading the extracted files back.
+ *
+ * @param src       Image the stored checksums are read from, or NULL to take
+ *                  them from heads.
+ * @param heads     First four bytes (little-endian) of each entry, used when
+ *                  src is NULL.
+ * @param table     File table of the image.
+ * @param sums      Checksum of each entry's data.
+ * @param extracted Non-zero for entries whose checksum in sums is valid.
+ */
+static void verify_extracted_vfiles(ImageSource* src, const uint32_t* heads, const FileTable* table,
+                                    const uint32_t* sums, const uint8_t* extracted)
+{
+    for (uint32_t i = 0; i < table->count; i++)
     {
-        perror("Error opening image file");
-        return 1;
-    }
+        const char* vname = file_table_str(table, table->filename[i]);
+        if (!is_checksum_vfile(vname))
+            continue;
 
-    /* Read main image header */
-    ImageWTYHeader hdr;
-    read_image_header(f, &hdr);
+        const char* realname = vname + 1;
+        long t = file_table_find(table, realname);
+        if (t < 0 || !extracted[t])
+        {
+            if (extracted[i])
+                printf("[SKIP] %s: '%s' was not extracted\n", vname, realname);
+            continue;
+        }
+        /* heads only hold the stored checksum of entries read */
+        if (!src && !extracted[i])
+            continue;
 
-    if (strncmp(hdr.magic, IMAGEWTY_MAGIC, 8) != 0)
-    {
-        fprintf(stderr, "Error: '%s' is not a valid IMAGEWTY image.\n", img_filename);
-        fclose(f);
-        return 1;
-    }
+        uint32_t expected = 0;
+        uint8_t chk[4];
+        if (table->original_length[i] < 4 ||
+            (src && source_pread(src, chk, 4, table->offset[i]) != 0))
+        {
+            fprintf(stderr, "Failed to read checksum from '%s'\n", vname);
+            continue;
+        }
+        if (src)
+            expected = (uint32_t)chk[0] | ((uint32_t)chk[1] << 8) | ((uint32_t)chk[2] << 16) |
+                       ((uint32_t)chk[3] << 24);
+        else
+            expected = heads[i];
 
-    /* Read all file headers */
-    ImageWTYFileHeader* files = read_all_file_headers(f, hdr.num_files, hdr.file_header_length);
-    if (!files)
-    {
-        fprintf(stderr, "Error reading file headers from '%s'\n", img_filename);
-        fclose(f);
-        return 1;
+        if (sums[t] == expected)
+            printf("[OK]   %s checksum matches (%u)\n", realname, sums[t]);
+        else
+            printf("[FAIL] %s checksum mismatch: expected %u, got %u\n", realname, expected,
+                   sums[t]);
     }
+}
 
-    /* Create dump directory: <image>.dump */
-    char dump_dir[1024];
-    snprintf(dump_dir, sizeof(dump_dir), "%s.dump", basename((char*)img_filename));
+/**
+ * @brief Create the dump directory and write its image.cfg.
+ *
+ * @param dump_dir Dump directory path.
+ * @param hdr      Global header.
+ * @param files    File header array.
+ * @return 0 on success, non-zero if the directory cannot be created (a
+ *         failure to write image.cfg is reported but not fatal).
+ */
+static int prepare_dump_dir(const char* dump_dir, const ImageWTYHeader* hdr,
+                            const ImageWTYFileHeader* files)
+{
     if (mkdir(dump_dir, 0755) && errno != EEXIST)
     {
         perror("Error creating dump directory");
-        free(files);
-        fclose(f);
         return 1;
     }
 
@@ -87,7 +150,7 @@ int extract_image(const char* img_filename)
     {
         snprintf(cfg_path, sizeof(cfg_path), "%s%s", dump_dir, suffix);
 
-        if (write_image_config(cfg_path, &hdr, files, hdr.num_files) == 0)
+        if (write_image_config(cfg_path, hdr, files, hdr->num_files) == 0)
         {
             printf("image.cfg successfully written as '%s'\n", cfg_path);
         }
@@ -96,59 +159,855 @@ int extract_image(const char* img_filename)
             fprintf(stderr, "Failed to write image.cfg\n");
         }
     }
+    return 0;
+}
+
+/**
+ * @brief Prepare the extraction target: create the dump folder, or start
+ *        the archive with image.cfg.
+ *
+ * @param target Extraction target.
+ * @param hdr    Global header.
+ * @param files  File header array.
+ * @return 0 on success, non-zero on error.
+ */
+static int begin_target(const ExtractTarget* target, const ImageWTYHeader* hdr,
+                        const ImageWTYFileHeader* files)
+{
+    if (target->tar_fd < 0)
+        return prepare_dump_dir(target->dump_dir, hdr, files);
+
+    char* text = NULL;
+    size_t len = 0;
+    FILE* mf = open_memstream(&text, &len);
+    if (!mf)
+    {
+        perror("open_memstream");
+        return 1;
+    }
+    int ret = write_image_config_stream(mf, hdr, files, hdr->num_files);
+    if (fclose(mf) != 0)
+        ret = 1;
+    if (ret == 0)
+        ret = tar_write_file(target->tar_fd, "image.cfg", text, len, target->mtime);
+    free(text);
+
+    if (ret == 0)
+        printf("image.cfg written to archive\n");
+    else
+        fprintf(stderr, "Failed to write image.cfg\n");
+    return ret;
+}
+
+/**
+ * @brief Check whether an entry is stored LZ4 compressed in the dump folder.
+ *
+ * V*.fex files stay plain, so their checksums can be corrected in place.
+ *
+ * @param target Extraction target (dump folder mode).
+ * @param fh     Entry.
+ * @return Non-zero if the entry is written as <name>.lz4.
+ */
+static int entry_compressed(const ExtractTarget* target, const ImageWTYFileHeader* fh)
+{
+    return target->compress && fh->original_length >= LZ4_MIN_FILE_SIZE &&
+           !is_checksum_vfile(fh->filename);
+}
+
+/**
+ * @brief Create the output file of one entry in the dump directory.
+ *
+ * The file is <name>.lz4 for a compressed entry (see entry_compressed());
+ * the other form left over from an earlier extraction is removed, since a
+ * plain file takes precedence when the folder is read.
+ *
+ * @param target   Extraction target (dump folder mode).
+ * @param fh       Entry to create the file for.
+ * @param filepath Output: path of the file.
+ * @param size     Size of filepath.
+ * @return Open file, or NULL (with a message) if the entry must be skipped.
+ */
+static FILE* create_entry_file(const ExtractTarget* target, const ImageWTYFileHeader* fh,
+                               char* filepath, size_t size)
+{
+    char other[1024 + sizeof(LZ4_FILE_SUFFIX)];
+    int compress = entry_compressed(target, fh);
+    const char* suffix = compress ? LZ4_FILE_SUFFIX : "";
+    if (snprintf(filepath, size, "%s/%s%s", target->dump_dir, fh->filename, suffix) >= (int)size)
+    {
+        fprintf(stderr, "File path too long, skipping '%s'\n", fh->filename);
+        return NULL;
+    }
+
+    snprintf(other, sizeof(other), "%s/%s%s", target->dump_dir, fh->filename,
+             compress ? "" : LZ4_FILE_SUFFIX);
+    if (unlink(other) != 0 && errno != ENOENT)
+        fprintf(stderr, "Warning: cannot remove '%s': %s\n", other, strerror(errno));
+
+    FILE* of = fopen(filepath, "wb");
+    if (!of)
+        perror("Error creating output file");
+    return of;
+}
+
+/**
+ * @brief Record an entry that repeats an earlier entry's data as a hard link.
+ *
+ * @param target Extraction target (archive mode).
+ * @param fh     Entry to record.
+ * @param first  Earlier entry with the same data range (already archived).
+ * @return 0 on success, non-zero on error.
+ */
+static int archive_link(const ExtractTarget* target, const ImageWTYFileHeader* fh,
+                        const ImageWTYFileHeader* first)
+{
+    printf("Linking: %s -> %s\n", fh->filename, first->filename);
+    return tar_write_header(target->tar_fd, fh->filename, 0, TAR_TYPE_LINK, first->filename,
+                            target->mtime);
+}
+
+/**
+ * @brief Chunk sink for entry data: checksum, then append to the output.
+ */
+typedef struct
+{
+    int fd;           /**< Archive or entry file */
+    Lz4Writer* lz4;   /**< Frame the data is compressed into, or NULL */
+    ChecksumState st; /**< Running checksum of the entry data */
+} EntrySink;
 
-    /* Extract each file from the image */
-    for (uint32_t i = 0; i < hdr.num_files; i++)
+/**
+ * @brief Start the sink of one entry, plain or LZ4 compressed.
+ *
+ * @param sink     Sink to set up.
+ * @param fd       Archive or entry file, positioned where the data goes.
+ * @param fh       Entry.
+ * @param compress Non-zero to write an LZ4 frame.
+ * @return 0 on success, non-zero on error.
+ */
+static int sink_open(EntrySink* sink, int fd, const ImageWTYFileHeader* fh, int compress)
+{
+    sink->fd = fd;
+    sink->lz4 = NULL;
+    checksum_init(&sink->st);
+    if (compress)
     {
-        ImageWTYFileHeader* fh = &files[i];
-        char filepath[1024];
+        sink->lz4 = lz4_writer_open(fd, fh->original_length);
+        if (!sink->lz4)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Finish the sink of one entry, completing its LZ4 frame.
+ *
+ * @param sink     Sink.
+ * @param complete Non-zero if all data was passed in (else the frame is
+ *                 abandoned).
+ * @return 0 on success, non-zero if the frame cannot be completed.
+ */
+static int sink_close(EntrySink* sink, int complete)
+{
+    int ret = sink->lz4 && complete ? lz4_writer_finish(sink->lz4) : 0;
+    lz4_writer_free(sink->lz4);
+    sink->lz4 = NULL;
+    return ret;
+}
+
+/**
+ * @brief source_read_range() callback appending entry data to the output.
+ *
+ * @param data Chunk of data.
+ * @param len  Chunk length.
+ * @param ctx  EntrySink.
+ * @return 0 on success, non-zero to abort.
+ */
+static int entry_chunk(const uint8_t* data, size_t len, void* ctx)
+{
+    EntrySink* sink = ctx;
+    checksum_update(&sink->st, data, len);
+    if (sink->lz4)
+        return lz4_writer_write(sink->lz4, data, len);
+    return io_write_all(sink->fd, data, len);
+}
+
+/**
+ * @brief Copy the data of one entry to a new file, computing its checksum.
+ *
+ * @param src      Image (not standard input).
+ * @param fh       Entry to copy.
+ * @param out_fd   Output file, positioned at its start.
+ * @param compress Non-zero to write the data as an LZ4 frame.
+ * @param checksum Output: checksum of the entry data.
+ * @return 0 on success, non-zero on error.
+ */
+static int copy_entry(ImageSource* src, const ImageWTYFileHeader* fh, int out_fd, int compress,
+                      uint32_t* checksum)
+{
+    if (source_is_direct(src) && !compress)
+        return io_copy_range_checksum(src->fd, src->base + fh->offset, out_fd, 0,
+                                      fh->original_length, checksum);
+
+    EntrySink sink;
+    if (sink_open(&sink, out_fd, fh, compress) != 0)
+        return 1;
+    int ret = source_read_range(src, fh->offset, fh->original_length, entry_chunk, &sink);
+    if (sink_close(&sink, ret == 0) != 0)
+        ret = 1;
+    if (ret == 0)
+        *checksum = checksum_final(&sink.st);
+    return ret;
+}
 
-        if (snprintf(filepath, sizeof(filepath), "%s/%s", dump_dir, fh->filename) >=
-            (int)sizeof(filepath))
+/**
+ * @brief Mark the entries named in the extract options.
+ *
+ * @param opts     Extract options (with entry_count > 0).
+ * @param table    File table of the image.
+ * @param selected Output: non-zero for selected entries.
+ * @return 0 on success, non-zero if a name matches no entry.
+ */
+static int select_entries(const ExtractOptions* opts, const FileTable* table, uint8_t* selected)
+{
+    int ret = 0;
+    for (int k = 0; k < opts->entry_count; k++)
+    {
+        long i = file_table_find(table, opts->entries[k]);
+        if (i < 0)
         {
-            fprintf(stderr, "File path too long, skipping '%s'\n", fh->filename);
+            fprintf(stderr, "Error: no entry '%s' in image\n", opts->entries[k]);
+            ret = 1;
             continue;
         }
+        selected[i] = 1;
+    }
+    return ret;
+}
+
+/**
+ * @brief Archive the entries of a seekable image, reading it in offset order.
+ *
+ * @param src       Image.
+ * @param target    Extraction target (archive mode).
+ * @param files     File header array.
+ * @param table     File table of the image.
+ * @param selected  Non-zero for the entries to archive, or NULL for all.
+ * @param sums      Output: checksum of each entry's data.
+ * @param extracted Output: non-zero for archived entries.
+ * @param session   Arena of the extraction.
+ * @return 0 on success, non-zero on error (the archive is incomplete).
+ */
+static int archive_image(ImageSource* src, const ExtractTarget* target,
+                         const ImageWTYFileHeader* files, const FileTable* table,
+                         const uint8_t* selected, uint32_t* sums, uint8_t* extracted,
+                         Arena* session)
+{
+    uint32_t* order = arena_calloc(session, table->count, sizeof(*order));
+    long* shared = arena_calloc(session, table->count, sizeof(*shared));
+    if (!order || !shared)
+    {
+        perror("Memory allocation failed");
+        return 1;
+    }
+    if (file_table_sort_by_offset(table, order, session) != 0 ||
+        file_table_shared_ranges(table, shared, session) != 0)
+    {
+        return 1;
+    }
+
+    for (uint32_t k = 0; k < table->count; k++)
+    {
+        uint32_t i = order[k];
+        const ImageWTYFileHeader* fh = &files[i];
+        if (selected && !selected[i])
+            continue;
 
-        FILE* of = fopen(filepath, "wb");
-        if (!of)
+        if (shared[i] >= 0 && extracted[shared[i]])
         {
-            perror("Error creating output file");
+            if (archive_link(target, fh, &files[shared[i]]) != 0)
+                return 1;
+            sums[i] = sums[shared[i]];
+            extracted[i] = 1;
             continue;
         }
 
-        if (fseek(f, fh->offset, SEEK_SET) != 0)
+        printf("Archiving: %s (%u bytes)\n", fh->filename, fh->original_length);
+        EntrySink sink = {target->tar_fd, NULL, {0}};
+        checksum_init(&sink.st);
+        if (tar_write_header(target->tar_fd, fh->filename, fh->original_length, TAR_TYPE_FILE,
+                             NULL, target->mtime) != 0 ||
+            source_read_range(src, fh->offset, fh->original_length, entry_chunk, &sink) != 0 ||
+            tar_write_padding(target->tar_fd, fh->original_length) != 0)
         {
-            perror("Error seeking file data");
-            fclose(of);
-            continue;
+            fprintf(stderr, "Error archiving '%s'\n", fh->filename);
+            return 1;
+        }
+        sums[i] = checksum_final(&sink.st);
+        extracted[i] = 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Forward-only reader over an image that is read sequentially.
+ */
+typedef struct
+{
+    ImageSource* src; /**< Image */
+    uint64_t pos;     /**< Bytes consumed so far (image offset of the next byte) */
+    uint8_t* buf;     /**< STREAM_BUFFER_SIZE bytes */
+} ImageStream;
+
+/**
+ * @brief Read exactly len bytes from a stream.
+ *
+ * @param s   Stream.
+ * @param dst Destination buffer.
+ * @param len Number of bytes to read.
+ * @return 0 on success, non-zero on error or premature end of input.
+ */
+static int stream_read(ImageStream* s, uint8_t* dst, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t r = source_read(s->src, dst + done, len - done);
+        if (r <= 0)
+        {
+            fprintf(stderr, "Error reading image at offset %llu%s\n",
+                    (unsigned long long)(s->pos + done), r < 0 ? "" : ": unexpected end of input");
+            return 1;
         }
+        done += (size_t)r;
+    }
+    s->pos += len;
+    return 0;
+}
+
+/**
+ * @brief Discard bytes from a stream.
+ *
+ * @param s   Stream.
+ * @param len Number of bytes to discard.
+ * @return 0 on success, non-zero on error or premature end of input.
+ */
+static int stream_skip(ImageStream* s, uint64_t len)
+{
+    while (len > 0)
+    {
+        size_t n = len > STREAM_BUFFER_SIZE ? STREAM_BUFFER_SIZE : (size_t)len;
+        if (stream_read(s, s->buf, n) != 0)
+            return 1;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copy bytes from a stream to a sink, checksumming them on the way.
+ *
+ * @param s    Stream.
+ * @param sink Destination (its checksum covers the data copied).
+ * @param len  Number of bytes to copy.
+ * @param head Output: first four bytes of the data (little-endian), if len
+ *             is at least 4.
+ * @return 0 on success, 1 on a write error, 2 on a stream error.
+ */
+static int stream_copy(ImageStream* s, EntrySink* sink, uint64_t len, uint32_t* head)
+{
+    for (uint64_t done = 0; done < len;)
+    {
+        size_t n = len - done > STREAM_BUFFER_SIZE ? STREAM_BUFFER_SIZE : (size_t)(len - done);
+        if (stream_read(s, s->buf, n) != 0)
+            return 2;
+        if (done == 0 && n >= 4)
+            *head = (uint32_t)s->buf[0] | ((uint32_t)s->buf[1] << 8) |
+                    ((uint32_t)s->buf[2] << 16) | ((uint32_t)s->buf[3] << 24);
 
-        uint8_t* data = malloc(fh->original_length);
-        if (!data)
+        if (entry_chunk(s->buf, n, sink) != 0)
         {
+            /* Keep the stream position consistent for the next entry */
+            return stream_skip(s, len - done - n) ? 2 : 1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read the global header and the file header table from a stream.
+ *
+ * The header region is buffered and parsed through a memory stream, so the
+ * regular header readers can be used on it.
+ *
+ * @param s       Stream positioned at offset 0.
+ * @param hdr     Output: global header.
+ * @param files   Output: file header array (allocated from session).
+ * @param session Arena of the extraction.
+ * @return 0 on success, non-zero on error.
+ */
+static int read_stream_headers(ImageStream* s, ImageWTYHeader* hdr, ImageWTYFileHeader** files,
+                               Arena* session)
+{
+    uint8_t head[IMG_HEADER_HEADER_SIZE];
+    if (stream_read(s, head, sizeof(head)) != 0)
+        return 1;
+
+    FILE* mf = fmemopen(head, sizeof(head), "rb");
+    if (!mf)
+    {
+        perror("fmemopen");
+        return 1;
+    }
+    read_image_header(mf, hdr);
+    fclose(mf);
+
+    if (strncmp(hdr->magic, IMAGEWTY_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "Error: input is not a valid IMAGEWTY image.\n");
+        return 1;
+    }
+
+    uint64_t table_len = (uint64_t)hdr->num_files * hdr->file_header_length;
+    if (table_len > STREAM_MAX_HEADER_TABLE)
+    {
+        fprintf(stderr, "Error: header table of %llu bytes is too large to stream\n",
+                (unsigned long long)table_len);
+        return 1;
+    }
+
+    size_t region_len = FILE_HEADERS_START + (size_t)table_len;
+    uint8_t* region = arena_alloc(session, region_len);
+    if (!region)
+    {
+        perror("Memory allocation failed");
+        return 1;
+    }
+    memcpy(region, head, sizeof(head));
+    if (stream_read(s, region + FILE_HEADERS_START, (size_t)table_len) != 0)
+        return 1;
+
+    mf = fmemopen(region, region_len, "rb");
+    if (!mf)
+    {
+        perror("fmemopen");
+        return 1;
+    }
+    *files = read_all_file_headers(mf, hdr->num_files, hdr->file_header_length, session);
+    fclose(mf);
+    return *files ? 0 : 1;
+}
+
+/**
+ * @brief Extract one entry whose data is next in the stream.
+ *
+ * @param s        Stream positioned at or before the entry's data.
+ * @param target   Extraction target.
+ * @param fh       Entry to extract.
+ * @param checksum Output: checksum of the entry's data.
+ * @param head     Output: first four bytes of the entry's data.
+ * @return 0 on success, 1 if the entry failed, 2 if extraction cannot go on.
+ */
+static int stream_entry(ImageStream* s, const ExtractTarget* target,
+                        const ImageWTYFileHeader* fh, uint32_t* checksum, uint32_t* head)
+{
+    if (fh->original_length > 0 && stream_skip(s, fh->offset - s->pos) != 0)
+        return 2;
+
+    EntrySink sink;
+    if (target->tar_fd >= 0)
+    {
+        printf("Archiving: %s (%u bytes)\n", fh->filename, fh->original_length);
+        sink_open(&sink, target->tar_fd, fh, 0);
+        if (tar_write_header(target->tar_fd, fh->filename, fh->original_length, TAR_TYPE_FILE,
+                             NULL, target->mtime) != 0 ||
+            stream_copy(s, &sink, fh->original_length, head) != 0 ||
+            tar_write_padding(target->tar_fd, fh->original_length) != 0)
+        {
+            return 2;
+        }
+        *checksum = checksum_final(&sink.st);
+        return 0;
+    }
+
+    char filepath[1024];
+    int compress = entry_compressed(target, fh);
+    FILE* of = create_entry_file(target, fh, filepath, sizeof(filepath));
+    if (!of)
+        return 1;
+
+    printf("Extracting: %s (%u bytes)\n", filepath, fh->original_length);
+    int rc = sink_open(&sink, fileno(of), fh, compress);
+    if (rc == 0)
+    {
+        rc = stream_copy(s, &sink, fh->original_length, head);
+        if (sink_close(&sink, rc == 0) != 0 && rc == 0)
+            rc = 1;
+    }
+    if (rc == 0)
+    {
+        *checksum = checksum_final(&sink.st);
+        /* A compressed file is released to its end (its length differs) */
+        io_release_range(fileno(of), 0, compress ? 0 : fh->original_length, 1);
+    }
+    fclose(of);
+    return rc;
+}
+
+/**
+ * @brief Extract an entry that repeats the data of an entry extracted earlier.
+ *
+ * @param target   Extraction target.
+ * @param fh       Entry to extract.
+ * @param first    Earlier entry with the same data range.
+ * @param checksum Output: checksum of the entry's data.
+ * @return 0 on success, 1 if the entry failed, 2 if extraction cannot go on.
+ */
+static int repeat_entry(const ExtractTarget* target, const ImageWTYFileHeader* fh,
+                        const ImageWTYFileHeader* first, uint32_t* checksum)
+{
+    if (target->tar_fd >= 0)
+        return archive_link(target, fh, first) != 0 ? 2 : 0;
+
+    char filepath[1024];
+    char firstpath[1024];
+    int compress = entry_compressed(target, fh);
+    FILE* of = create_entry_file(target, fh, filepath, sizeof(filepath));
+    if (!of)
+        return 1;
+
+    printf("Extracting: %s (%u bytes)\n", filepath, fh->original_length);
+    Lz4Input in = {-1, 0, 0};
+    int rc = snprintf(firstpath, sizeof(firstpath), "%s/%s", target->dump_dir,
+                      first->filename) >= (int)sizeof(firstpath) ||
+             lz4_input_open(firstpath, &in) != 0;
+    if (rc == 0 && !in.compressed && !compress)
+    {
+        rc = io_copy_range_checksum(in.fd, 0, fileno(of), 0, fh->original_length, checksum) != 0;
+    }
+    else if (rc == 0)
+    {
+        /* The earlier copy is decompressed and/or compressed again */
+        EntrySink sink;
+        rc = sink_open(&sink, fileno(of), fh, compress) != 0;
+        if (rc == 0)
+        {
+            rc = lz4_input_read(&in, entry_chunk, &sink) != 0;
+            rc |= sink_close(&sink, rc == 0) != 0;
+        }
+        if (rc == 0)
+            *checksum = checksum_final(&sink.st);
+    }
+    if (in.fd >= 0)
+        lz4_input_close(&in);
+    fclose(of);
+    return rc;
+}
+
+/**
+ * @brief Extract an image in one forward pass.
+ *
+ * Entries are visited in data offset order: gaps between them are read and
+ * discarded, and an entry that repeats the data range of an earlier one
+ * (see repack --dedup) is copied from the file already written for it, or
+ * archived as a hard link to it. Any other overlap cannot be served from a
+ * stream and is reported.
+ *
+ * @param src    Image (e.g. standard input or a deflated zip member).
+ * @param target Extraction target.
+ * @return 0 on success, non-zero on error.
+ */
+static int extract_stream(ImageSource* src, const ExtractTarget* target)
+{
+    Arena session;
+    arena_init(&session);
+
+    ImageStream s = {src, 0, bufpool_get(STREAM_BUFFER_SIZE)};
+    ImageWTYHeader hdr;
+    ImageWTYFileHeader* files = NULL;
+    if (!s.buf || read_stream_headers(&s, &hdr, &files, &session) != 0 ||
+        begin_target(target, &hdr, files) != 0)
+    {
+        bufpool_put(s.buf);
+        arena_release(&session);
+        return 1;
+    }
+
+    FileTable table;
+    uint32_t n = hdr.num_files;
+    uint32_t* order = arena_calloc(&session, n, sizeof(*order));
+    long* shared = arena_calloc(&session, n, sizeof(*shared));
+    uint32_t* sums = arena_calloc(&session, n, sizeof(*sums));
+    uint32_t* heads = arena_calloc(&session, n, sizeof(*heads));
+    uint8_t* extracted = arena_calloc(&session, n, 1);
+    if (!order || !shared || !sums || !heads || !extracted ||
+        file_table_build(&table, files, n, &session) != 0 ||
+        file_table_sort_by_offset(&table, order, &session) != 0 ||
+        file_table_shared_ranges(&table, shared, &session) != 0)
+    {
+        if (!order || !shared || !sums || !heads || !extracted)
             perror("Memory allocation failed");
-            fclose(of);
-            continue;
+        bufpool_put(s.buf);
+        arena_release(&session);
+        return 1;
+    }
+
+    int ret = 0;
+    for (uint32_t k = 0; k < n && ret != 2; k++)
+    {
+        uint32_t i = order[k];
+        const ImageWTYFileHeader* fh = &files[i];
+        int rc;
+
+        if (shared[i] >= 0 && extracted[shared[i]])
+        {
+            /* Already read: served from the earlier copy */
+            rc = repeat_entry(target, fh, &files[shared[i]], &sums[i]);
+            heads[i] = heads[shared[i]];
         }
+        else if (fh->original_length > 0 && fh->offset < s.pos)
+        {
+            fprintf(stderr, "Error: '%s' overlaps data already read from the stream\n",
+                    fh->filename);
+            rc = 1;
+        }
+        else
+        {
+            rc = stream_entry(&s, target, fh, &sums[i], &heads[i]);
+        }
+
+        if (rc != 0)
+            fprintf(stderr, "Error extracting '%s'\n", fh->filename);
+        else
+            extracted[i] = 1;
+        if (rc > ret)
+            ret = rc;
+    }
 
-        if (fread(data, 1, fh->original_length, f) != fh->original_length)
+    /* Drain the rest so the producer does not see a broken pipe */
+    if (ret != 2 && src->kind == SOURCE_STDIN)
+    {
+        while (source_read(src, s.buf, STREAM_BUFFER_SIZE) > 0)
         {
-            perror("Error reading file data");
         }
+    }
+    bufpool_put(s.buf);
+
+    printf("\nVerifying extracted files using V*.fex checksums...\n");
+    verify_extracted_vfiles(NULL, heads, &table, sums, extracted);
 
-        printf("Extracting: %s (%u bytes)\n", filepath, fh->original_length);
-        fwrite(data, 1, fh->original_length, of);
-        free(data);
-        fclose(of);
+    arena_release(&session);
+    return ret != 0;
+}
+
+/**
+ * @brief Extract an image that can be read at any offset.
+ *
+ * Direct sources (see source_is_direct()) are copied with the img_io
+ * transfers; other sources are decompressed range by range.
+ *
+ * @param src          Image (not standard input).
+ * @param img_filename Name of the image, for messages.
+ * @param target       Extraction target.
+ * @param opts         Extract options (entry selection).
+ * @return 0 on success (individual entries that fail to extract into a dump
+ *         folder are reported but skipped), non-zero on error.
+ */
+static int extract_file(ImageSource* src, const char* img_filename, const ExtractTarget* target,
+                        const ExtractOptions* opts)
+{
+    FILE* f = source_fopen(src);
+    if (!f)
+        return 1;
+
+    /* Read main image header */
+    ImageWTYHeader hdr;
+    read_image_header(f, &hdr);
+
+    if (strncmp(hdr.magic, IMAGEWTY_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "Error: '%s' is not a valid IMAGEWTY image.\n", img_filename);
+        fclose(f);
+        return 1;
     }
 
-    free(files);
-    fclose(f);
+    /* Header table and per-entry state live in one arena for this image */
+    Arena session;
+    arena_init(&session);
+
+    /* Read all file headers */
+    ImageWTYFileHeader* files =
+        read_all_file_headers(f, hdr.num_files, hdr.file_header_length, &session);
+    if (!files)
+    {
+        fprintf(stderr, "Error reading file headers from '%s'\n", img_filename);
+        arena_release(&session);
+        fclose(f);
+        return 1;
+    }
+
+    FileTable table;
+    uint32_t* sums = arena_calloc(&session, hdr.num_files, sizeof(*sums));
+    uint8_t* extracted = arena_calloc(&session, hdr.num_files, 1);
+    uint8_t* selected = opts->entry_count > 0 ? arena_calloc(&session, hdr.num_files, 1) : NULL;
+    if (!sums || !extracted || (opts->entry_count > 0 && !selected) ||
+        file_table_build(&table, files, hdr.num_files, &session) != 0 ||
+        (selected && select_entries(opts, &table, selected) != 0) ||
+        begin_target(target, &hdr, files) != 0)
+    {
+        if (!sums || !extracted || (opts->entry_count > 0 && !selected))
+            perror("Memory allocation failed");
+        arena_release(&session);
+        fclose(f);
+        return 1;
+    }
+
+    int ret = 0;
+    if (target->tar_fd >= 0)
+    {
+        ret = archive_image(src, target, files, &table, selected, sums, extracted, &session);
+    }
+    else
+    {
+        /* Extract each file from the image */
+        for (uint32_t i = 0; i < hdr.num_files; i++)
+        {
+            ImageWTYFileHeader* fh = &files[i];
+            char filepath[1024];
+            if (selected && !selected[i])
+                continue;
+
+            FILE* of = create_entry_file(target, fh, filepath, sizeof(filepath));
+            if (!of)
+                continue;
+
+            printf("Extracting: %s (%u bytes)\n", filepath, fh->original_length);
+            if ((uint64_t)fh->offset + fh->original_length > src->size)
+                fprintf(stderr, "Error extracting '%s': data lies beyond the end of the image\n",
+                        fh->filename);
+            else if (copy_entry(src, fh, fileno(of), entry_compressed(target, fh), &sums[i]) != 0)
+                fprintf(stderr, "Error extracting '%s'\n", fh->filename);
+            else
+                extracted[i] = 1;
+
+            fclose(of);
+        }
+    }
 
     /* Verify integrity using V*.fex checksums (without updating them) */
     printf("\nVerifying extracted files using V*.fex checksums...\n");
-    verify_vfiles_checksums(dump_dir);
+    verify_extracted_vfiles(src, NULL, &table, sums, extracted);
 
-    return 0;
+    arena_release(&session);
+    fclose(f);
+    return ret;
+}
+
+/**
+ * @brief Extract all files from an IMAGEWTY image into a dump folder.
+ *
+ * After extraction, a config file (image.cfg) is generated and V*.fex
+ * checksums are verified (without updating them). Payload checksums are
+ * computed while the data is copied, so every payload is read only once.
+ *
+ * @param img_filename Path to the IMAGEWTY image file (possibly gzip or xz
+ *                     compressed), "-" to read the image from standard input
+ *                     (see EXTRACT_STDIN_DUMP_DIR), or "bundle.zip!/member"
+ *                     for an image inside a zip bundle.
+ * @param opts         Extract options, or NULL for the defaults.
+ * @return 0 on success, non-zero on error.
+ */
+int extract_image(const char* img_filename, const ExtractOptions* opts)
+{
+    if (!img_filename)
+    {
+        fprintf(stderr, "extract_image: img_filename is NULL\n");
+        return 1;
+    }
+
+    ExtractOptions defaults;
+    if (!opts)
+    {
+        extract_options_init(&defaults);
+        opts = &defaults;
+    }
+
+    ImageSource src;
+    if (source_open(&src, img_filename) != 0)
+        return 1;
+    if (src.kind == SOURCE_STDIN && opts->entry_count > 0)
+    {
+        fprintf(stderr, "Error: entries cannot be selected from an image on standard input\n");
+        source_close(&src);
+        return 1;
+    }
+    if (opts->compress && opts->tar_path)
+    {
+        fprintf(stderr, "Error: entries are only compressed in a dump folder, not an archive\n");
+        source_close(&src);
+        return 1;
+    }
+
+    char dump_dir[1024];
+    ExtractTarget target = {dump_dir, -1, src.mtime, opts->compress};
+
+    /* Dump directory: <image>.dump, named after the member for zip bundles
+       and without the compression suffix for gzip/xz images */
+    const char* name = img_filename;
+    if (src.kind == SOURCE_ZIP_STORED || src.kind == SOURCE_ZIP_DEFLATED)
+        name = strstr(img_filename, SOURCE_ZIP_SEPARATOR) + strlen(SOURCE_ZIP_SEPARATOR);
+    char stem[1000];
+    snprintf(stem, sizeof(stem), "%s", basename((char*)name));
+    char* ext = strrchr(stem, '.');
+    if ((src.kind == SOURCE_GZIP || src.kind == SOURCE_XZ) && ext && ext > stem)
+        *ext = '\0';
+    if (src.kind == SOURCE_STDIN)
+        snprintf(dump_dir, sizeof(dump_dir), "%s", EXTRACT_STDIN_DUMP_DIR);
+    else
+        snprintf(dump_dir, sizeof(dump_dir), "%s.dump", stem);
+
+    int to_stdout = opts->tar_path && strcmp(opts->tar_path, "-") == 0;
+    if (to_stdout)
+    {
+        target.tar_fd = io_claim_stdout();
+        if (target.tar_fd < 0)
+        {
+            source_close(&src);
+            return 1;
+        }
+    }
+    else if (opts->tar_path)
+    {
+        target.tar_fd = open(opts->tar_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (target.tar_fd < 0)
+        {
+            fprintf(stderr, "Cannot create archive '%s': %s\n", opts->tar_path,
+                    strerror(errno));
+            source_close(&src);
+            return 1;
+        }
+    }
+
+    /* A selection is read at its offsets; anything else not direct is streamed */
+    int ret = source_is_direct(&src) || opts->entry_count > 0
+                  ? extract_file(&src, img_filename, &target, opts)
+                  : extract_stream(&src, &target);
+    source_close(&src);
+
+    if (target.tar_fd >= 0)
+    {
+        if (ret == 0)
+            ret = tar_write_end(target.tar_fd);
+        if (to_stdout)
+        {
+            io_restore_stdout(target.tar_fd);
+        }
+        else if (close(target.tar_fd) != 0)
+        {
+            perror("Error closing archive");
+            ret = 1;
+        }
+    }
+    return ret;
 }
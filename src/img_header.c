@@ -10,6 +10,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "img_bufpool.h"
+
 /**
  * @brief Read a 32-bit unsigned integer from a file in little-endian format.
  *
@@ -128,11 +130,13 @@ void read_file_header(FILE* f, ImageWTYFileHeader* fh, uint32_t file_header_leng
  * @param f File pointer to IMAGEWTY file.
  * @param num_files Number of files in the image.
  * @param file_header_length Length of each file header in bytes.
- * @return Pointer to allocated array of ImageWTYFileHeader structures.
+ * @param arena Arena to allocate the array from.
+ * @return Pointer to the array of ImageWTYFileHeader structures.
  */
-ImageWTYFileHeader* read_all_file_headers(FILE* f, uint32_t num_files, uint32_t file_header_length)
+ImageWTYFileHeader* read_all_file_headers(FILE* f, uint32_t num_files, uint32_t file_header_length,
+                                          Arena* arena)
 {
-    ImageWTYFileHeader* files = malloc(sizeof(ImageWTYFileHeader) * num_files);
+    ImageWTYFileHeader* files = arena_alloc(arena, sizeof(ImageWTYFileHeader) * num_files);
     if (!files)
     {
         perror("Failed to allocate memory for file headers");
@@ -144,7 +148,6 @@ ImageWTYFileHeader* read_all_file_headers(FILE* f, uint32_t num_files, uint32_t
         if (fseek(f, FILE_HEADERS_START + i * file_header_length, SEEK_SET) != 0)
         {
             perror("Failed to seek to file header");
-            free(files);
             exit(EXIT_FAILURE);
         }
         read_file_header(f, &files[i], file_header_length);
@@ -152,3 +155,116 @@ ImageWTYFileHeader* read_all_file_headers(FILE* f, uint32_t num_files, uint32_t
 
     return files;
 }
+
+/**
+ * @brief Serialize the global IMAGEWTY header into its on-disk layout.
+ *
+ * @param hdr Pointer to ImageWTYHeader structure to serialize.
+ * @param buf Output buffer of IMG_HEADER_HEADER_SIZE bytes.
+ */
+void serialize_image_header(const ImageWTYHeader* hdr, uint8_t* buf)
+{
+    memset(buf, 0, IMG_HEADER_HEADER_SIZE);
+
+    memcpy(buf + 0x00, hdr->magic, 8);
+    memcpy(buf + 0x08, &hdr->header_version, 4);
+    memcpy(buf + 0x0C, &hdr->header_size, 4);
+    memcpy(buf + 0x10, &hdr->base_ram, 4);
+    memcpy(buf + 0x14, &hdr->format_version, 4);
+    memcpy(buf + 0x18, &hdr->total_image_size, 4);
+    memcpy(buf + 0x1C, &hdr->header_size_aligned, 4);
+    memcpy(buf + 0x20, &hdr->file_header_length, 4);
+    memcpy(buf + 0x24, &hdr->usb_product_id, 4);
+    memcpy(buf + 0x28, &hdr->usb_vendor_id, 4);
+    memcpy(buf + 0x2C, &hdr->hardware_id, 4);
+    memcpy(buf + 0x30, &hdr->firmware_id, 4);
+    memcpy(buf + 0x34, &hdr->unknown1, 4);
+    memcpy(buf + 0x38, &hdr->unknown2, 4);
+    memcpy(buf + 0x3C, &hdr->num_files, 4);
+    memcpy(buf + 0x40, &hdr->unknown3, 4);
+}
+
+/**
+ * @brief Serialize a single file header into its on-disk layout.
+ *
+ * @param fh Pointer to ImageWTYFileHeader structure to serialize.
+ * @param buf Output buffer of file_header_length bytes.
+ * @param file_header_length Length of each file header in bytes.
+ */
+void serialize_file_header(const ImageWTYFileHeader* fh, uint8_t* buf,
+                           uint32_t file_header_length)
+{
+    memset(buf, 0, file_header_length);
+
+    memcpy(buf + 0x00, &fh->filename_length, sizeof(fh->filename_length));
+    memcpy(buf + 0x04, &fh->header_size, sizeof(fh->header_size));
+    memcpy(buf + 0x08, fh->maintype, 8);
+    memcpy(buf + 0x10, fh->subtype, 16);
+    memcpy(buf + 0x20, &fh->unknown0, sizeof(fh->unknown0));
+    memcpy(buf + 0x24, fh->filename, 256);
+    memcpy(buf + 0x124, &fh->stored_length, sizeof(fh->stored_length));
+    memset(buf + 0x128, 0, 4); // pad1
+    memcpy(buf + 0x12C, &fh->original_length, sizeof(fh->original_length));
+    memset(buf + 0x130, 0, 4); // pad2
+    memcpy(buf + 0x134, &fh->offset, sizeof(fh->offset));
+}
+
+/**
+ * @brief Write the global IMAGEWTY header at the start of the image file.
+ *
+ * @param f File pointer to IMAGEWTY file.
+ * @param hdr Pointer to ImageWTYHeader structure to write.
+ * @return 0 on success, non-zero on error.
+ */
+int write_image_header(FILE* f, const ImageWTYHeader* hdr)
+{
+    uint8_t* buf = bufpool_get(IMG_HEADER_HEADER_SIZE);
+    if (!buf)
+        return 1;
+    serialize_image_header(hdr, buf);
+
+    int ret = 0;
+    if (fseek(f, 0, SEEK_SET) != 0 ||
+        fwrite(buf, 1, IMG_HEADER_HEADER_SIZE, f) != IMG_HEADER_HEADER_SIZE)
+    {
+        perror("Error writing global header");
+        ret = 1;
+    }
+    bufpool_put(buf);
+    return ret;
+}
+
+/**
+ * @brief Write a single file header into its slot of the header table.
+ *
+ * @param f File pointer to IMAGEWTY file.
+ * @param fh Pointer to ImageWTYFileHeader structure to write.
+ * @param index Index of the entry in the header table.
+ * @param file_header_length Length of each file header in bytes.
+ * @return 0 on success, non-zero on error.
+ */
+int write_file_header(FILE* f, const ImageWTYFileHeader* fh, uint32_t index,
+                      uint32_t file_header_length)
+{
+    uint8_t* buf = bufpool_get(file_header_length);
+    if (!buf)
+        return 1;
+    serialize_file_header(fh, buf, file_header_length);
+
+    if (fseek(f, FILE_HEADERS_START + (long)index * file_header_length, SEEK_SET) != 0)
+    {
+        perror("Error seeking to file header position");
+        bufpool_put(buf);
+        return 1;
+    }
+
+    if (fwrite(buf, 1, file_header_length, f) != file_header_length)
+    {
+        perror("Error writing file header");
+        bufpool_put(buf);
+        return 1;
+    }
+
+    bufpool_put(buf);
+    return 0;
+}
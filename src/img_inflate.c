@@ -0,0 +1,679 @@
+/**
+ * @file img_inflate.c
+ * @brief Random-access inflation of raw deflate streams (zip members and gzip files).
+ *
+ * Checkpoints follow zlib's zran example: inflate() runs with Z_BLOCK so it
+ * stops at every deflate block boundary, where the decoder state is fully
+ * described by the compressed bit position and the last 32 KiB of output.
+ * Resuming primes the leftover bits of the current byte with inflatePrime()
+ * and restores the history with inflateSetDictionary().
+ */
+
+#define _GNU_SOURCE
+
+#include "img_inflate.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/** Size of the compressed input buffer */
+#define INFLATE_INPUT_SIZE (256 * 1024)
+
+/** Size of the buffer output is discarded into while skipping forward */
+#define INFLATE_SKIP_SIZE (256 * 1024)
+
+/** Magic number of checkpoint index files */
+#define INFLATE_INDEX_MAGIC "IWTYZIX1"
+
+/** Size of the fixed part of a gzip member header */
+#define GZIP_HEADER_SIZE 10
+
+/** Size of a gzip member trailer (CRC-32 and size modulo 4 GiB) */
+#define GZIP_TRAILER_SIZE 8
+
+/** gzip compression method: deflate */
+#define GZIP_METHOD_DEFLATE 8
+
+/** gzip header flags */
+#define GZIP_FLAG_HCRC 0x02
+#define GZIP_FLAG_EXTRA 0x04
+#define GZIP_FLAG_NAME 0x08
+#define GZIP_FLAG_COMMENT 0x10
+
+/**
+ * @brief Decoder state at a deflate block boundary.
+ */
+typedef struct
+{
+    uint64_t out;    /**< Uncompressed offset */
+    uint64_t in;     /**< Compressed bytes consumed, relative to the stream start */
+    uint32_t bits;   /**< Unused bits of the last consumed byte (0..7) */
+    uint8_t* window; /**< Last INFLATE_WINDOW_SIZE bytes of output (zero-filled before 0) */
+} Checkpoint;
+
+/**
+ * @brief Fixed-size head of a checkpoint index file.
+ */
+typedef struct
+{
+    char magic[8];        /**< INFLATE_INDEX_MAGIC */
+    uint64_t data_offset; /**< DeflateStream.data_offset of the stream */
+    uint64_t comp_size;   /**< DeflateStream.comp_size of the stream */
+    uint64_t size;        /**< Uncompressed size of the stream */
+    uint32_t crc;         /**< DeflateStream.crc of the stream */
+    uint32_t span;        /**< INFLATE_CHECKPOINT_SPAN when written */
+    uint64_t count;       /**< Number of checkpoint records that follow */
+} IndexHeader;
+
+/**
+ * @brief One checkpoint as stored in an index file (followed by its window).
+ */
+typedef struct
+{
+    uint64_t out;  /**< Uncompressed offset */
+    uint64_t in;   /**< Compressed bytes consumed */
+    uint32_t bits; /**< Unused bits of the last consumed byte */
+    uint32_t pad;  /**< Always 0 */
+} IndexRecord;
+
+/**
+ * @brief Decoder and checkpoints of one deflate stream.
+ */
+struct Inflater
+{
+    int fd;                               /**< File holding the stream */
+    DeflateStream stream;                 /**< Stream being read */
+    z_stream strm;                        /**< Raw deflate decoder */
+    int active;                           /**< strm is positioned at out */
+    uint64_t in;                          /**< Compressed bytes fed to strm */
+    uint64_t out;                         /**< Uncompressed offset of the decoder */
+    uint32_t crc;                         /**< CRC-32 of the output so far */
+    int crc_valid;                        /**< The decoder started at offset 0 */
+    uint8_t* input;                       /**< INFLATE_INPUT_SIZE bytes of compressed input */
+    uint8_t* skip;                        /**< INFLATE_SKIP_SIZE bytes of discarded output */
+    uint8_t history[INFLATE_WINDOW_SIZE]; /**< Ring of the last output bytes */
+    size_t history_pos;                   /**< Next write position in history */
+    Checkpoint* points;                   /**< Checkpoints in ascending offset order */
+    size_t count;                         /**< Number of checkpoints */
+    size_t capacity;                      /**< Allocated checkpoints */
+    int dirty;                            /**< Index file is out of date */
+    char* index_path;                     /**< Index file, or NULL */
+};
+
+/**
+ * @brief Read exactly len bytes at an absolute offset.
+ *
+ * @param fd  File descriptor.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @param off File offset.
+ * @return 0 on success, non-zero on error or premature end of file.
+ */
+static int read_at(int fd, void* buf, size_t len, uint64_t off)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t r = pread(fd, (uint8_t*)buf + done, len - done, (off_t)(off + done));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+        {
+            fprintf(stderr, "Error reading compressed data: %s\n",
+                    r < 0 ? strerror(errno) : "unexpected end of file");
+            return 1;
+        }
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+/**
+ * @brief Append a checkpoint at the decoder's current position.
+ *
+ * @param z Reader.
+ * @return 0 on success, non-zero if out of memory.
+ */
+static int add_checkpoint(Inflater* z)
+{
+    if (z->count == z->capacity)
+    {
+        size_t cap = z->capacity ? 2 * z->capacity : 64;
+        Checkpoint* grown = realloc(z->points, cap * sizeof(*grown));
+        if (!grown)
+            return 1;
+        z->points = grown;
+        z->capacity = cap;
+    }
+
+    Checkpoint* cp = &z->points[z->count];
+    cp->window = malloc(INFLATE_WINDOW_SIZE);
+    if (!cp->window)
+        return 1;
+    cp->out = z->out;
+    cp->in = z->in - z->strm.avail_in;
+    cp->bits = (uint32_t)z->strm.data_type & 7;
+
+    /* Unroll the history ring, oldest byte first */
+    size_t tail = INFLATE_WINDOW_SIZE - z->history_pos;
+    memcpy(cp->window, z->history + z->history_pos, tail);
+    memcpy(cp->window + tail, z->history, z->history_pos);
+    z->count++;
+    return 0;
+}
+
+/**
+ * @brief Account for freshly inflated output: history, CRC and checkpoints.
+ *
+ * @param z    Reader.
+ * @param data Output produced by the last inflate() call.
+ * @param len  Length of the output.
+ */
+static void consume_output(Inflater* z, const uint8_t* data, size_t len)
+{
+    if (z->crc_valid)
+        z->crc = (uint32_t)crc32(z->crc, data, (uInt)len);
+
+    if (len >= INFLATE_WINDOW_SIZE)
+    {
+        memcpy(z->history, data + len - INFLATE_WINDOW_SIZE, INFLATE_WINDOW_SIZE);
+        z->history_pos = 0;
+    }
+    else
+    {
+        size_t first = INFLATE_WINDOW_SIZE - z->history_pos;
+        if (first > len)
+            first = len;
+        memcpy(z->history + z->history_pos, data, first);
+        memcpy(z->history, data + first, len - first);
+        z->history_pos = (z->history_pos + len) % INFLATE_WINDOW_SIZE;
+    }
+    z->out += len;
+
+    /* At a block boundary (bit 7) that is not the end of the stream (bit 6) */
+    uint64_t last = z->count ? z->points[z->count - 1].out : 0;
+    if ((z->strm.data_type & 128) && !(z->strm.data_type & 64) && z->out < z->stream.size &&
+        z->out >= last + INFLATE_CHECKPOINT_SPAN)
+    {
+        /* A missing checkpoint only costs speed */
+        if (add_checkpoint(z) == 0)
+            z->dirty = 1;
+    }
+}
+
+/**
+ * @brief Check the end of the stream once inflate() has reached it.
+ *
+ * @param z Reader.
+ * @return 0 if the stream is consistent, non-zero otherwise.
+ */
+static int finish_stream(Inflater* z)
+{
+    uint64_t consumed = z->in - z->strm.avail_in;
+    if (consumed != z->stream.comp_size)
+    {
+        fprintf(stderr, "Error: %llu bytes of unexpected data after the deflate stream\n",
+                (unsigned long long)(z->stream.comp_size - consumed));
+        return 1;
+    }
+    if (z->stream.size != INFLATE_SIZE_UNKNOWN && z->out != z->stream.size)
+    {
+        fprintf(stderr, "Error: data inflates to %llu bytes, expected %llu\n",
+                (unsigned long long)z->out, (unsigned long long)z->stream.size);
+        return 1;
+    }
+    if (z->crc_valid && z->crc != z->stream.crc)
+    {
+        fprintf(stderr, "Error: CRC-32 mismatch in compressed data\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Inflate the next bytes at the decoder position.
+ *
+ * @param z        Reader (active).
+ * @param dst      Destination buffer.
+ * @param len      Maximum number of bytes to produce.
+ * @param produced Output: number of bytes produced (0 only at the end of the stream).
+ * @return 0 on success, non-zero on error.
+ */
+static int inflate_some(Inflater* z, uint8_t* dst, size_t len, size_t* produced)
+{
+    z_stream* strm = &z->strm;
+    if (len > UINT32_MAX)
+        len = UINT32_MAX;
+    strm->next_out = dst;
+    strm->avail_out = (uInt)len;
+
+    while (strm->avail_out == len)
+    {
+        /* With all input fed, inflate() still runs to report the stream end */
+        uint64_t left = z->stream.comp_size - z->in;
+        if (strm->avail_in == 0 && left > 0)
+        {
+            size_t n = left > INFLATE_INPUT_SIZE ? INFLATE_INPUT_SIZE : (size_t)left;
+            if (read_at(z->fd, z->input, n, z->stream.data_offset + z->in) != 0)
+                return 1;
+            strm->next_in = z->input;
+            strm->avail_in = (uInt)n;
+            z->in += n;
+        }
+
+        uint8_t* start = strm->next_out;
+        int rc = inflate(strm, Z_BLOCK);
+        if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+        {
+            fprintf(stderr, "Error: corrupt deflate data (%s)\n", strm->msg ? strm->msg : "?");
+            z->active = 0;
+            return 1;
+        }
+        if (rc == Z_BUF_ERROR && strm->avail_in == 0 && z->in == z->stream.comp_size)
+        {
+            fprintf(stderr, "Error: compressed data ends early\n");
+            z->active = 0;
+            return 1;
+        }
+        consume_output(z, start, (size_t)(strm->next_out - start));
+
+        if (rc == Z_STREAM_END)
+        {
+            z->active = 0;
+            if (finish_stream(z) != 0)
+                return 1;
+            break;
+        }
+    }
+    *produced = len - strm->avail_out;
+    return 0;
+}
+
+/**
+ * @brief Position the decoder at a checkpoint (index count for the stream start).
+ *
+ * @param z Reader.
+ * @param k Checkpoint index, or z->count for offset 0.
+ * @return 0 on success, non-zero on error.
+ */
+static int restart_at(Inflater* z, size_t k)
+{
+    z_stream* strm = &z->strm;
+    if (inflateReset(strm) != Z_OK)
+        return 1;
+    strm->avail_in = 0;
+    z->active = 0;
+
+    if (k == z->count)
+    {
+        z->in = 0;
+        z->out = 0;
+        z->crc = (uint32_t)crc32(0L, Z_NULL, 0);
+        z->crc_valid = 1;
+        memset(z->history, 0, sizeof(z->history));
+        z->history_pos = 0;
+        z->active = 1;
+        return 0;
+    }
+
+    const Checkpoint* cp = &z->points[k];
+    if (cp->bits)
+    {
+        uint8_t byte;
+        if (cp->in == 0 || read_at(z->fd, &byte, 1, z->stream.data_offset + cp->in - 1) != 0 ||
+            inflatePrime(strm, (int)cp->bits, byte >> (8 - cp->bits)) != Z_OK)
+        {
+            return 1;
+        }
+    }
+    size_t dict = cp->out < INFLATE_WINDOW_SIZE ? (size_t)cp->out : INFLATE_WINDOW_SIZE;
+    if (dict && inflateSetDictionary(strm, cp->window + INFLATE_WINDOW_SIZE - dict,
+                                     (uInt)dict) != Z_OK)
+    {
+        return 1;
+    }
+
+    z->in = cp->in;
+    z->out = cp->out;
+    z->crc_valid = 0;
+    memcpy(z->history, cp->window, INFLATE_WINDOW_SIZE);
+    z->history_pos = 0;
+    z->active = 1;
+    return 0;
+}
+
+/**
+ * @brief Load checkpoints from an index file that matches the stream.
+ *
+ * A missing, stale or damaged index is ignored.
+ *
+ * @param z Reader.
+ */
+static void load_index(Inflater* z)
+{
+    FILE* f = fopen(z->index_path, "rb");
+    if (!f)
+        return;
+
+    IndexHeader h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, INFLATE_INDEX_MAGIC, 8) != 0 ||
+        h.data_offset != z->stream.data_offset || h.comp_size != z->stream.comp_size ||
+        h.size == INFLATE_SIZE_UNKNOWN ||
+        (z->stream.size != INFLATE_SIZE_UNKNOWN && h.size != z->stream.size) ||
+        h.crc != z->stream.crc || h.span != INFLATE_CHECKPOINT_SPAN)
+    {
+        fclose(f);
+        return;
+    }
+    z->stream.size = h.size;
+
+    for (uint64_t i = 0; i < h.count; i++)
+    {
+        IndexRecord r;
+        uint64_t last = z->count ? z->points[z->count - 1].out : 0;
+        if (fread(&r, sizeof(r), 1, f) != 1 || r.out <= last || r.out >= z->stream.size ||
+            r.in > z->stream.comp_size || r.bits > 7 || add_checkpoint(z) != 0)
+        {
+            break;
+        }
+        Checkpoint* cp = &z->points[z->count - 1];
+        cp->out = r.out;
+        cp->in = r.in;
+        cp->bits = r.bits;
+        if (fread(cp->window, INFLATE_WINDOW_SIZE, 1, f) != 1)
+        {
+            free(cp->window);
+            z->count--;
+            break;
+        }
+    }
+    fclose(f);
+}
+
+/**
+ * @brief Write all checkpoints to the index file (atomically replaced).
+ *
+ * @param z Reader (with a known size).
+ */
+static void save_index(const Inflater* z)
+{
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", z->index_path) >= (int)sizeof(tmp))
+        return;
+    FILE* f = fopen(tmp, "wb");
+    if (!f)
+    {
+        fprintf(stderr, "Warning: cannot write inflate index '%s': %s\n", tmp, strerror(errno));
+        return;
+    }
+
+    IndexHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INFLATE_INDEX_MAGIC, 8);
+    h.data_offset = z->stream.data_offset;
+    h.comp_size = z->stream.comp_size;
+    h.size = z->stream.size;
+    h.crc = z->stream.crc;
+    h.span = INFLATE_CHECKPOINT_SPAN;
+    h.count = z->count;
+
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (size_t i = 0; ok && i < z->count; i++)
+    {
+        IndexRecord r = {z->points[i].out, z->points[i].in, z->points[i].bits, 0};
+        ok = fwrite(&r, sizeof(r), 1, f) == 1 &&
+             fwrite(z->points[i].window, INFLATE_WINDOW_SIZE, 1, f) == 1;
+    }
+    if (fclose(f) != 0)
+        ok = 0;
+    if (!ok || rename(tmp, z->index_path) != 0)
+    {
+        fprintf(stderr, "Warning: cannot write inflate index '%s'\n", z->index_path);
+        unlink(tmp);
+    }
+}
+
+/**
+ * @brief Check for the gzip magic bytes.
+ *
+ * @param head First bytes of a file.
+ * @param len  Number of bytes in head.
+ * @return Non-zero if the file starts like a gzip file.
+ */
+int inflater_is_gzip(const uint8_t* head, size_t len)
+{
+    return len >= 3 && head[0] == 0x1F && head[1] == 0x8B && head[2] == GZIP_METHOD_DEFLATE;
+}
+
+/**
+ * @brief Locate the deflate stream of a gzip file.
+ *
+ * @param fd     File descriptor.
+ * @param stream Output: the deflate stream.
+ * @return 0 on success, non-zero on error.
+ */
+int inflater_gzip_stream(int fd, DeflateStream* stream)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        perror("Error reading gzip file");
+        return 1;
+    }
+    uint64_t file_size = (uint64_t)st.st_size;
+
+    uint8_t head[GZIP_HEADER_SIZE];
+    if (file_size < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE ||
+        read_at(fd, head, sizeof(head), 0) != 0 || !inflater_is_gzip(head, sizeof(head)))
+    {
+        fprintf(stderr, "Error: not a gzip file\n");
+        return 1;
+    }
+
+    uint8_t flags = head[3];
+    uint64_t pos = GZIP_HEADER_SIZE;
+    uint8_t buf[2];
+    if (flags & GZIP_FLAG_EXTRA)
+    {
+        if (read_at(fd, buf, 2, pos) != 0)
+            return 1;
+        pos += 2 + (uint64_t)(buf[0] | buf[1] << 8);
+    }
+    /* File name and comment are zero-terminated */
+    for (uint8_t flag = GZIP_FLAG_NAME; flag <= GZIP_FLAG_COMMENT; flag <<= 1)
+    {
+        if (!(flags & flag))
+            continue;
+        do
+        {
+            if (pos >= file_size || read_at(fd, buf, 1, pos++) != 0)
+                return 1;
+        } while (buf[0] != 0);
+    }
+    if (flags & GZIP_FLAG_HCRC)
+        pos += 2;
+
+    uint8_t trailer[GZIP_TRAILER_SIZE];
+    if (pos > file_size - GZIP_TRAILER_SIZE ||
+        read_at(fd, trailer, sizeof(trailer), file_size - GZIP_TRAILER_SIZE) != 0)
+    {
+        fprintf(stderr, "Error: gzip file is truncated\n");
+        return 1;
+    }
+
+    stream->data_offset = pos;
+    stream->comp_size = file_size - GZIP_TRAILER_SIZE - pos;
+    stream->size = INFLATE_SIZE_UNKNOWN;
+    stream->crc = (uint32_t)trailer[0] | (uint32_t)trailer[1] << 8 | (uint32_t)trailer[2] << 16 |
+                  (uint32_t)trailer[3] << 24;
+    return 0;
+}
+
+/**
+ * @brief Start reading a deflate stream.
+ *
+ * @param fd         File descriptor.
+ * @param stream     Stream to read.
+ * @param index_path Checkpoint index file, or NULL.
+ * @return Reader, or NULL on error.
+ */
+Inflater* inflater_open(int fd, const DeflateStream* stream, const char* index_path)
+{
+    Inflater* z = calloc(1, sizeof(*z));
+    if (!z)
+    {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+    z->fd = fd;
+    z->stream = *stream;
+    z->input = malloc(INFLATE_INPUT_SIZE);
+    z->skip = malloc(INFLATE_SKIP_SIZE);
+    z->index_path = index_path ? strdup(index_path) : NULL;
+    if (!z->input || !z->skip || (index_path && !z->index_path))
+    {
+        perror("Memory allocation failed");
+        inflater_close(z);
+        return NULL;
+    }
+
+    /* Negative window bits: raw deflate data without a zlib header */
+    if (inflateInit2(&z->strm, -15) != Z_OK)
+    {
+        fprintf(stderr, "Error: cannot initialize inflate\n");
+        inflater_close(z);
+        return NULL;
+    }
+
+    if (z->index_path)
+        load_index(z);
+    return z;
+}
+
+/**
+ * @brief Uncompressed size of the stream.
+ *
+ * @param z Reader.
+ * @return Size, or INFLATE_SIZE_UNKNOWN until inflater_scan() has run.
+ */
+uint64_t inflater_size(const Inflater* z)
+{
+    return z->stream.size;
+}
+
+/**
+ * @brief Inflate the whole stream once, recording every checkpoint.
+ *
+ * @param z Reader.
+ * @return 0 on success, non-zero on error.
+ */
+int inflater_scan(Inflater* z)
+{
+    if (restart_at(z, z->count) != 0)
+        return 1;
+
+    size_t n;
+    do
+    {
+        if (inflate_some(z, z->skip, INFLATE_SKIP_SIZE, &n) != 0)
+            return 1;
+    } while (z->active);
+
+    if (z->stream.size == INFLATE_SIZE_UNKNOWN)
+    {
+        z->stream.size = z->out;
+        z->dirty = 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read uncompressed bytes.
+ *
+ * @param z   Reader.
+ * @param off Uncompressed offset.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @return 0 on success, non-zero on error.
+ */
+int inflater_read(Inflater* z, uint64_t off, void* buf, size_t len)
+{
+    if (z->stream.size == INFLATE_SIZE_UNKNOWN || off > z->stream.size ||
+        len > z->stream.size - off)
+    {
+        fprintf(stderr, "Error: read past the end of the compressed data\n");
+        return 1;
+    }
+
+    uint8_t* dst = buf;
+    while (len > 0)
+    {
+        /* Latest checkpoint at or before off (z->count stands for offset 0) */
+        size_t lo = 0;
+        size_t hi = z->count;
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if (z->points[mid].out <= off)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        size_t k = lo ? lo - 1 : z->count;
+        uint64_t from = lo ? z->points[k].out : 0;
+
+        if ((!z->active || off < z->out || from > z->out) && restart_at(z, k) != 0)
+        {
+            fprintf(stderr, "Error: cannot resume inflating at offset %llu\n",
+                    (unsigned long long)from);
+            return 1;
+        }
+
+        size_t n = 1;
+        while (z->out < off && n > 0)
+        {
+            uint64_t gap = off - z->out;
+            size_t chunk = gap > INFLATE_SKIP_SIZE ? INFLATE_SKIP_SIZE : (size_t)gap;
+            if (inflate_some(z, z->skip, chunk, &n) != 0)
+                return 1;
+        }
+        if (n > 0 && inflate_some(z, dst, len, &n) != 0)
+            return 1;
+        if (n == 0)
+        {
+            fprintf(stderr, "Error: compressed data ends before offset %llu\n",
+                    (unsigned long long)(off + len));
+            return 1;
+        }
+        dst += n;
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Release a reader, saving new checkpoints to its index file.
+ *
+ * @param z Reader (NULL is ignored).
+ */
+void inflater_close(Inflater* z)
+{
+    if (!z)
+        return;
+    if (z->index_path && z->dirty && z->stream.size != INFLATE_SIZE_UNKNOWN)
+        save_index(z);
+    inflateEnd(&z->strm);
+    for (size_t i = 0; i < z->count; i++)
+        free(z->points[i].window);
+    free(z->points);
+    free(z->index_path);
+    free(z->input);
+    free(z->skip);
+    free(z);
+}
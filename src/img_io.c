@@ -0,0 +1,729 @@
+/**
+ * @file img_io.c
+ * @brief Range copy helpers built on io_uring, FICLONE, copy_file_range(),
+ *        O_DIRECT and pread()/pwrite(), plus page-cache hints.
+ */
+
+#define _GNU_SOURCE
+
+#include "img_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include <linux/fs.h>
+
+#include "checksum.h"
+#include "img_bufpool.h"
+#include "img_pipeline.h"
+#include "img_uring.h"
+
+/** Size of the bounce buffer used by the pread()/pwrite() fallback */
+#define IO_BUFFER_SIZE (1024 * 1024)
+
+/** Selected backend; IO_BACKEND_AUTO until set */
+static IoBackend io_backend = IO_BACKEND_AUTO;
+
+/** Non-zero when transfers should bypass the page cache */
+static int io_direct = 0;
+
+/** Non-zero when used ranges should be dropped from the page cache */
+static int io_drop_cache = 0;
+
+/** Size of the bounce buffer of one O_DIRECT transfer (a chunk plus alignment slack) */
+#define DIRECT_BUFFER_SIZE (IO_DIRECT_CHUNK_SIZE + IO_DIRECT_ALIGNMENT)
+
+/**
+ * @brief Round a value up to a multiple of IO_DIRECT_ALIGNMENT.
+ *
+ * @param x Value.
+ * @return Rounded value.
+ */
+static uint64_t direct_align_up(uint64_t x)
+{
+    return (x + IO_DIRECT_ALIGNMENT - 1) & ~(uint64_t)(IO_DIRECT_ALIGNMENT - 1);
+}
+
+/**
+ * @brief Parse a backend name ("auto", "sync" or "uring").
+ *
+ * @param name    Backend name.
+ * @param backend Output: parsed backend.
+ * @return 0 on success, non-zero if the name is unknown.
+ */
+int io_backend_from_name(const char* name, IoBackend* backend)
+{
+    if (strcmp(name, "auto") == 0)
+        *backend = IO_BACKEND_AUTO;
+    else if (strcmp(name, "sync") == 0)
+        *backend = IO_BACKEND_SYNC;
+    else if (strcmp(name, "uring") == 0)
+        *backend = IO_BACKEND_URING;
+    else
+        return 1;
+    return 0;
+}
+
+/**
+ * @brief Select the data transfer backend for the rest of the process.
+ *
+ * @param backend Backend to use.
+ * @return 0 on success, non-zero if io_uring was requested but is unavailable.
+ */
+int io_set_backend(IoBackend backend)
+{
+    if (backend == IO_BACKEND_URING && !uring_available())
+    {
+        fprintf(stderr, "io_uring is not available on this system\n");
+        return 1;
+    }
+    io_backend = backend;
+    return 0;
+}
+
+/**
+ * @brief Enable or disable O_DIRECT transfers for the rest of the process.
+ *
+ * @param enable Non-zero to enable direct mode.
+ */
+void io_set_direct(int enable)
+{
+    io_direct = enable;
+}
+
+/**
+ * @brief Drop copied data from the page cache once it has been used.
+ *
+ * @param enable Non-zero to drop used ranges.
+ */
+void io_set_drop_cache(int enable)
+{
+    io_drop_cache = enable;
+}
+
+/**
+ * @brief Announce a sequential read of a range.
+ *
+ * @param fd  File descriptor.
+ * @param off Start of the range.
+ * @param len Length of the range (0 = to end of file).
+ */
+void io_advise_sequential(int fd, uint64_t off, uint64_t len)
+{
+    posix_fadvise(fd, (off_t)off, (off_t)len, POSIX_FADV_SEQUENTIAL);
+
+    uint64_t ahead = (len == 0 || len > 2 * IO_READAHEAD_WINDOW) ? 2 * IO_READAHEAD_WINDOW : len;
+    posix_fadvise(fd, (off_t)off, (off_t)ahead, POSIX_FADV_WILLNEED);
+}
+
+/**
+ * @brief Release a range that is no longer needed from the page cache.
+ *
+ * @param fd      File descriptor.
+ * @param off     Start of the range.
+ * @param len     Length of the range (0 = to end of file).
+ * @param written Non-zero if the range was written.
+ */
+void io_release_range(int fd, uint64_t off, uint64_t len, int written)
+{
+    if (!io_drop_cache)
+        return;
+
+    if (written)
+    {
+        sync_file_range(fd, (off_t)off, (off_t)len,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                            SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+    posix_fadvise(fd, (off_t)off, (off_t)len, POSIX_FADV_DONTNEED);
+}
+
+/**
+ * @brief Open a second, O_DIRECT descriptor for the file behind fd.
+ *
+ * The caller's descriptor is left untouched, so stdio and unaligned I/O on
+ * it keep working.
+ *
+ * @param fd    Open file descriptor.
+ * @param flags Access mode for the new descriptor (O_RDONLY or O_WRONLY).
+ * @return New descriptor, or -1 if direct I/O is not possible.
+ */
+static int reopen_direct(int fd, int flags)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    return open(path, flags | O_DIRECT);
+}
+
+/**
+ * @brief Read an aligned window around a range with O_DIRECT.
+ *
+ * Reads [off, off + len) widened to IO_DIRECT_ALIGNMENT boundaries into
+ * buf. Reads past end of file are allowed as long as the requested range
+ * itself is covered.
+ *
+ * @param fd  O_DIRECT file descriptor.
+ * @param buf Aligned buffer of DIRECT_BUFFER_SIZE bytes.
+ * @param off Offset of the wanted data.
+ * @param len Length of the wanted data (at most IO_DIRECT_CHUNK_SIZE).
+ * @return Pointer to the wanted data inside buf, or NULL on error.
+ */
+static uint8_t* read_direct_window(int fd, uint8_t* buf, uint64_t off, size_t len)
+{
+    uint64_t window = off & ~(uint64_t)(IO_DIRECT_ALIGNMENT - 1);
+    size_t delta = (size_t)(off - window);
+    size_t want = (size_t)direct_align_up(delta + len);
+    size_t have = 0;
+
+    while (have < delta + len)
+    {
+        ssize_t r = pread(fd, buf + have, want - have, (off_t)(window + have));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+        {
+            fprintf(stderr, "Error reading data: %s\n",
+                    r < 0 ? strerror(errno) : "unexpected end of file");
+            return NULL;
+        }
+        have += (size_t)r;
+        /* A short read is only legitimate at end of file, after which nothing follows */
+        if (have % IO_DIRECT_ALIGNMENT != 0)
+            break;
+    }
+
+    if (have < delta + len)
+    {
+        fprintf(stderr, "Error reading data: unexpected end of file\n");
+        return NULL;
+    }
+    return buf + delta;
+}
+
+/**
+ * @brief Copy a range with a user-space bounce buffer.
+ *
+ * Copies front-to-back when the destination lies before the source and
+ * back-to-front otherwise, which makes overlapping moves within one file
+ * safe. A checksummed copy always runs front-to-back.
+ *
+ * @param in_fd   Source file descriptor.
+ * @param in_off  Source offset.
+ * @param out_fd  Destination file descriptor.
+ * @param out_off Destination offset.
+ * @param len     Number of bytes to copy.
+ * @param sum     Checksum to update with the copied data, or NULL.
+ * @return 0 on success, non-zero on error.
+ */
+static int copy_buffered(int in_fd, uint64_t in_off, int out_fd, uint64_t out_off, uint64_t len,
+                         ChecksumState* sum)
+{
+    uint8_t* buf = bufpool_get(IO_BUFFER_SIZE);
+    if (!buf)
+        return 1;
+
+    int backwards = !sum && out_off > in_off;
+    uint64_t done = 0;
+
+    while (done < len)
+    {
+        size_t n = (len - done) > IO_BUFFER_SIZE ? IO_BUFFER_SIZE : (size_t)(len - done);
+        uint64_t pos = backwards ? len - done - n : done;
+
+        ssize_t r = pread(in_fd, buf, n, (off_t)(in_off + pos));
+        if (r != (ssize_t)n)
+        {
+            fprintf(stderr, "Error reading data: %s\n", r < 0 ? strerror(errno) : "short read");
+            bufpool_put(buf);
+            return 1;
+        }
+        if (sum)
+            checksum_update(sum, buf, n);
+        if (pwrite(out_fd, buf, n, (off_t)(out_off + pos)) != (ssize_t)n)
+        {
+            perror("Error writing data");
+            bufpool_put(buf);
+            return 1;
+        }
+        done += n;
+    }
+
+    bufpool_put(buf);
+    return 0;
+}
+
+/**
+ * @brief Copy a range between two files with O_DIRECT.
+ *
+ * The destination head up to the first aligned offset and the tail shorter
+ * than one block are copied through the page cache; everything in between
+ * is read and written directly in IO_DIRECT_CHUNK_SIZE blocks. The checksum,
+ * if requested, is taken from each window while it is in memory.
+ *
+ * @param in_fd   Source file descriptor.
+ * @param in_off  Source offset.
+ * @param out_fd  Destination file descriptor.
+ * @param out_off Destination offset.
+ * @param len     Number of bytes to copy.
+ * @param sum     Checksum to update with the copied data, or NULL.
+ * @return 0 on success, 1 on error, -1 if direct I/O is not supported.
+ */
+static int copy_direct(int in_fd, uint64_t in_off, int out_fd, uint64_t out_off, uint64_t len,
+                       ChecksumState* sum)
+{
+    int din = reopen_direct(in_fd, O_RDONLY);
+    int dout = din >= 0 ? reopen_direct(out_fd, O_WRONLY) : -1;
+    if (din < 0 || dout < 0)
+    {
+        if (din >= 0)
+            close(din);
+        return -1;
+    }
+
+    uint8_t* direct_buf = bufpool_get(DIRECT_BUFFER_SIZE);
+    if (!direct_buf)
+    {
+        close(din);
+        close(dout);
+        return 1;
+    }
+
+    uint64_t head = (IO_DIRECT_ALIGNMENT - out_off % IO_DIRECT_ALIGNMENT) % IO_DIRECT_ALIGNMENT;
+    if (head > len)
+        head = len;
+
+    int ret = copy_buffered(in_fd, in_off, out_fd, out_off, head, sum);
+    uint64_t pos = head;
+
+    while (ret == 0 && len - pos >= IO_DIRECT_ALIGNMENT)
+    {
+        uint64_t n = len - pos > IO_DIRECT_CHUNK_SIZE ? IO_DIRECT_CHUNK_SIZE : len - pos;
+        n &= ~(uint64_t)(IO_DIRECT_ALIGNMENT - 1);
+
+        uint8_t* data = read_direct_window(din, direct_buf, in_off + pos, (size_t)n);
+        if (!data)
+        {
+            ret = 1;
+            break;
+        }
+        if (sum)
+            checksum_update(sum, data, (size_t)n);
+
+        /* The write buffer must be aligned as well */
+        if (data != direct_buf)
+            memmove(direct_buf, data, (size_t)n);
+
+        if (pwrite(dout, direct_buf, (size_t)n, (off_t)(out_off + pos)) != (ssize_t)n)
+        {
+            perror("Error writing data");
+            ret = 1;
+            break;
+        }
+        pos += n;
+    }
+
+    if (ret == 0)
+        ret = copy_buffered(in_fd, in_off + pos, out_fd, out_off + pos, len - pos, sum);
+
+    bufpool_put(direct_buf);
+    close(din);
+    close(dout);
+    return ret;
+}
+
+/**
+ * @brief Copy a byte range with the selected transfer method.
+ *
+ * @param in_fd   Source file descriptor.
+ * @param in_off  Source offset.
+ * @param out_fd  Destination file descriptor.
+ * @param out_off Destination offset.
+ * @param len     Number of bytes to copy.
+ * @return 0 on success, non-zero on error.
+ */
+static int copy_range(int in_fd, uint64_t in_off, int out_fd, uint64_t out_off, uint64_t len)
+{
+    /* copy_file_range() rejects overlapping ranges within the same file */
+    if (in_fd == out_fd && in_off < out_off + len && out_off < in_off + len)
+        return copy_buffered(in_fd, in_off, out_fd, out_off, len, NULL);
+
+    if (io_direct && in_fd != out_fd)
+    {
+        int ret = copy_direct(in_fd, in_off, out_fd, out_off, len, NULL);
+        if (ret >= 0)
+            return ret;
+    }
+
+    /* Only an explicit --io=uring bypasses the in-kernel copy */
+    if (in_fd != out_fd && io_backend == IO_BACKEND_URING)
+        return uring_copy_range(in_fd, in_off, out_fd, out_off, len);
+
+    loff_t src = (loff_t)in_off;
+    loff_t dst = (loff_t)out_off;
+    uint64_t remaining = len;
+
+    while (remaining > 0)
+    {
+        ssize_t n = copy_file_range(in_fd, &src, out_fd, &dst, remaining, 0);
+        if (n > 0)
+        {
+            remaining -= (uint64_t)n;
+            continue;
+        }
+        if (n == 0)
+        {
+            fprintf(stderr, "Error copying data: unexpected end of file\n");
+            return 1;
+        }
+        if (errno == EINTR)
+            continue;
+
+        /* Not supported for this pair of files: finish with overlapped reads/writes */
+        if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP ||
+            errno == EBADF)
+        {
+            if (in_fd != out_fd && io_backend == IO_BACKEND_AUTO && uring_available())
+                return uring_copy_range(in_fd, (uint64_t)src, out_fd, (uint64_t)dst, remaining);
+            if (in_fd != out_fd)
+                return pipeline_copy_range(in_fd, (uint64_t)src, out_fd, (uint64_t)dst,
+                                           remaining, NULL);
+            return copy_buffered(in_fd, (uint64_t)src, out_fd, (uint64_t)dst, remaining, NULL);
+        }
+
+        perror("Error copying data");
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Copy a byte range between two files (or within one file).
+ *
+ * @param in_fd   Source file descriptor.
+ * @param in_off  Source offset.
+ * @param out_fd  Destination file descriptor.
+ * @param out_off Destination offset.
+ * @param len     Number of bytes to copy.
+ * @return 0 on success, non-zero on error.
+ */
+int io_copy_range(int in_fd, uint64_t in_off, int out_fd, uint64_t out_off, uint64_t len)
+{
+    if (len == 0 || (in_fd == out_fd && in_off == out_off))
+        return 0;
+
+    io_advise_sequential(in_fd, in_off, len);
+
+    int ret = copy_range(in_fd, in_off, out_fd, out_off, len);
+    if (ret == 0)
+    {
+        io_release_range(in_fd, in_off, len, 0);
+        io_release_range(out_fd, out_off, len, 1);
+    }
+    return ret;
+}
+
+/**
+ * @brief Copy a byte range between two different files and checksum it on the way.
+ *
+ * @param in_fd    Source file descriptor.
+ * @param in_off   Source offset.
+ * @param out_fd   Destination file descriptor (must differ from in_fd).
+ * @param out_off  Destination offset.
+ * @param len      Number of bytes to copy.
+ * @param checksum Output: V*.fex checksum of the copied data.
+ * @return 0 on success, non-zero on error.
+ */
+int io_copy_range_checksum(int in_fd, uint64_t in_off, int out_fd, uint64_t out_off,
+                           uint64_t len, uint32_t* checksum)
+{
+    *checksum = 0;
+    if (len == 0)
+        return 0;
+
+    io_advise_sequential(in_fd, in_off, len);
+
+    int ret = -1;
+    if (io_direct)
+    {
+        /* O_DIRECT transfers keep their own aligned path and sum each window */
+        ChecksumState st;
+        checksum_init(&st);
+        ret = copy_direct(in_fd, in_off, out_fd, out_off, len, &st);
+        if (ret >= 0)
+            *checksum = checksum_final(&st);
+    }
+    if (ret < 0)
+        ret = pipeline_copy_range(in_fd, in_off, out_fd, out_off, len, checksum);
+
+    if (ret == 0)
+    {
+        io_release_range(in_fd, in_off, len, 0);
+        io_release_range(out_fd, out_off, len, 1);
+    }
+    return ret;
+}
+
+/**
+ * @brief Read a byte range and pass it to a callback in chunks.
+ *
+ * @param fd  Source file descriptor.
+ * @param off Source offset.
+ * @param len Number of bytes to read.
+ * @param cb  Callback receiving the data in order.
+ * @param ctx Context passed to the callback.
+ * @return 0 on success, non-zero on error or if the callback aborted.
+ */
+int io_read_range(int fd, uint64_t off, uint64_t len, IoReadCallback cb, void* ctx)
+{
+    io_advise_sequential(fd, off, len);
+
+    int din = io_direct && len > 0 ? reopen_direct(fd, O_RDONLY) : -1;
+    if (din >= 0)
+    {
+        uint8_t* direct_buf = bufpool_get(DIRECT_BUFFER_SIZE);
+        int ret = direct_buf ? 0 : 1;
+        for (uint64_t pos = 0; ret == 0 && pos < len;)
+        {
+            size_t n =
+                len - pos > IO_DIRECT_CHUNK_SIZE ? IO_DIRECT_CHUNK_SIZE : (size_t)(len - pos);
+            const uint8_t* data = read_direct_window(din, direct_buf, off + pos, n);
+            ret = data ? cb(data, n, ctx) : 1;
+            pos += n;
+        }
+        bufpool_put(direct_buf);
+        close(din);
+        return ret;
+    }
+
+    uint8_t* buf = bufpool_get(IO_BUFFER_SIZE);
+    if (!buf)
+        return 1;
+
+    int ret = 0;
+    for (uint64_t pos = 0; ret == 0 && pos < len;)
+    {
+        size_t n = len - pos > IO_BUFFER_SIZE ? IO_BUFFER_SIZE : (size_t)(len - pos);
+        ssize_t r = pread(fd, buf, n, (off_t)(off + pos));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+        {
+            fprintf(stderr, "Error reading data: %s\n",
+                    r < 0 ? strerror(errno) : "unexpected end of file");
+            ret = 1;
+            break;
+        }
+        ret = cb(buf, (size_t)r, ctx);
+        pos += (uint64_t)r;
+
+        /* Entering a new window: request the one after it */
+        if (pos % IO_READAHEAD_WINDOW < (uint64_t)r && pos + IO_READAHEAD_WINDOW < len)
+        {
+            posix_fadvise(fd, (off_t)(off + pos + IO_READAHEAD_WINDOW), IO_READAHEAD_WINDOW,
+                          POSIX_FADV_WILLNEED);
+        }
+    }
+
+    if (ret == 0)
+        io_release_range(fd, off, len, 0);
+    bufpool_put(buf);
+    return ret;
+}
+
+/**
+ * @brief Write a run of zero bytes at an absolute offset.
+ *
+ * @param fd  Destination file descriptor.
+ * @param off Destination offset.
+ * @param len Number of zero bytes to write.
+ * @return 0 on success, non-zero on error.
+ */
+int io_write_zeros(int fd, uint64_t off, uint64_t len)
+{
+    static const uint8_t zeros[4096];
+
+    while (len > 0)
+    {
+        size_t n = len > sizeof(zeros) ? sizeof(zeros) : (size_t)len;
+        if (pwrite(fd, zeros, n, (off_t)off) != (ssize_t)n)
+        {
+            perror("Error writing padding");
+            return 1;
+        }
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Write a buffer to a stream at its current position.
+ *
+ * @param fd  Destination file descriptor.
+ * @param buf Data to write.
+ * @param len Number of bytes.
+ * @return 0 on success, non-zero on error.
+ */
+int io_write_all(int fd, const void* buf, size_t len)
+{
+    const uint8_t* p = buf;
+    while (len > 0)
+    {
+        ssize_t w = write(fd, p, len);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+        {
+            perror("Error writing output stream");
+            return 1;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+/**
+ * @brief Append a byte range of a file to a stream.
+ *
+ * @param in_fd  Source file descriptor.
+ * @param in_off Source offset.
+ * @param out_fd Destination file descriptor.
+ * @param len    Number of bytes to send.
+ * @return 0 on success, non-zero on error or if the source is too short.
+ */
+int io_send_range(int in_fd, uint64_t in_off, int out_fd, uint64_t len)
+{
+    io_advise_sequential(in_fd, in_off, len);
+
+    off_t pos = (off_t)in_off;
+    uint64_t done = 0;
+    while (done < len)
+    {
+        uint64_t left = len - done;
+        ssize_t n = sendfile(out_fd, in_fd, &pos, left > IO_BUFFER_SIZE ? IO_BUFFER_SIZE : left);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS) && done == 0)
+            break;
+        if (n <= 0)
+        {
+            fprintf(stderr, "Error sending data: %s\n", n < 0 ? strerror(errno) : "short read");
+            return 1;
+        }
+        done += (uint64_t)n;
+    }
+    if (done == len)
+    {
+        io_release_range(in_fd, in_off, len, 0);
+        return 0;
+    }
+
+    /* No sendfile() for this pair: bounce through a buffer */
+    uint8_t* buf = bufpool_get(IO_BUFFER_SIZE);
+    if (!buf)
+        return 1;
+    int ret = 0;
+    while (done < len && ret == 0)
+    {
+        size_t n = (len - done) > IO_BUFFER_SIZE ? IO_BUFFER_SIZE : (size_t)(len - done);
+        ssize_t r = pread(in_fd, buf, n, (off_t)(in_off + done));
+        if (r != (ssize_t)n)
+        {
+            fprintf(stderr, "Error reading data: %s\n", r < 0 ? strerror(errno) : "short read");
+            ret = 1;
+        }
+        else
+        {
+            ret = io_write_all(out_fd, buf, n);
+            done += n;
+        }
+    }
+    bufpool_put(buf);
+    if (ret == 0)
+        io_release_range(in_fd, in_off, len, 0);
+    return ret;
+}
+
+/**
+ * @brief Append a run of zero bytes to a stream.
+ *
+ * @param fd  Destination file descriptor.
+ * @param len Number of zero bytes.
+ * @return 0 on success, non-zero on error.
+ */
+int io_send_zeros(int fd, uint64_t len)
+{
+    static const uint8_t zeros[4096];
+
+    while (len > 0)
+    {
+        size_t n = len > sizeof(zeros) ? sizeof(zeros) : (size_t)len;
+        if (io_write_all(fd, zeros, n) != 0)
+            return 1;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reserve standard output for data.
+ *
+ * @return Descriptor of the original standard output, or -1 on error.
+ */
+int io_claim_stdout(void)
+{
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+    {
+        perror("Cannot redirect standard output");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Undo io_claim_stdout().
+ *
+ * @param fd Descriptor returned by io_claim_stdout() (closed).
+ */
+void io_restore_stdout(int fd)
+{
+    fflush(stdout);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+}
+
+/**
+ * @brief Make out_fd a copy of the first size bytes of in_fd.
+ *
+ * @param in_fd  Source file descriptor.
+ * @param out_fd Destination file descriptor (opened for writing, empty).
+ * @param size   Number of bytes to copy.
+ * @return 0 on success, non-zero on error.
+ */
+int io_clone_file(int in_fd, int out_fd, uint64_t size)
+{
+    if (ioctl(out_fd, FICLONE, in_fd) == 0)
+    {
+        if (ftruncate(out_fd, (off_t)size) != 0)
+        {
+            perror("Error resizing cloned image");
+            return 1;
+        }
+        return 0;
+    }
+
+    return io_copy_range(in_fd, 0, out_fd, 0, size);
+}
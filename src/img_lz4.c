@@ -0,0 +1,1424 @@
+/**
+ * @file img_lz4.c
+ * @brief LZ4 frame compression of dump folder entries.
+ *
+ * Blocks use the LZ4 block format with a greedy single-probe hash match
+ * finder; a block that does not shrink is stored as is. The frame header
+ * sets the block independence, content size and block checksum flags, so
+ * every block carries an xxHash32 of its stored bytes that the decoding
+ * threads check (frames without block checksums are read as well). There
+ * is no content checksum, which would have to be computed serially. The
+ * block index is a skippable
+ * frame whose payload is the offset of every block header (relative to the
+ * start of the file), the block count and LZ4_INDEX_TAG, so it can be found
+ * from the end of the file.
+ *
+ * Decoding follows the ring scheme of img_pipeline.c: block k is decoded
+ * into slot k % depth, workers claim blocks in order and may run at most
+ * depth blocks ahead of the consumer, which hands them out in order.
+ *
+ * Frames written by other tools are read as well: linked blocks (the lz4
+ * default) are decoded serially behind a window of the previous output,
+ * a missing content size is found by decoding the frame once when it is
+ * opened, and a content checksum is checked. Only frames that need a
+ * dictionary are refused.
+ */
+
+#define _GNU_SOURCE
+
+#include "img_lz4.h"
+#include "img_bufpool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Magic number of an LZ4 frame */
+#define LZ4_FRAME_MAGIC 0x184D2204u
+
+/** Magic number of the skippable frame holding the block index */
+#define LZ4_INDEX_MAGIC 0x184D2A51u
+
+/** Last four bytes of the block index ("IDX4") */
+#define LZ4_INDEX_TAG 0x34584449u
+
+/** Frame header length written: magic, FLG, BD, content size, header checksum */
+#define LZ4_HEADER_SIZE 15
+
+/** Longest frame header: magic, FLG, BD, content size, dictionary ID, checksum */
+#define LZ4_HEADER_MAX 19
+
+/** FLG byte written: version 01, independent blocks, block checksums, content size */
+#define LZ4_FLG 0x78
+
+/** FLG bit of independent blocks */
+#define LZ4_FLG_INDEPENDENT 0x20
+
+/** FLG bit of block checksums */
+#define LZ4_FLG_BLOCK_CHECKSUM 0x10
+
+/** FLG bit of a recorded content size */
+#define LZ4_FLG_CONTENT_SIZE 0x08
+
+/** FLG bit of a content checksum after the end mark */
+#define LZ4_FLG_CONTENT_CHECKSUM 0x04
+
+/** FLG bit of a dictionary ID (dictionaries are not supported) */
+#define LZ4_FLG_DICT_ID 0x01
+
+/** FLG bits that must be set as in LZ4_FLG (version, dictionary ID, reserved) */
+#define LZ4_FLG_FIXED_MASK 0xC3
+
+/** Uncompressed size of a frame that does not record it */
+#define LZ4_SIZE_UNKNOWN UINT64_MAX
+
+/** BD byte written: 4 MiB maximum block size */
+#define LZ4_BD 0x70
+
+/** Block size field flag of a block stored uncompressed */
+#define LZ4_BLOCK_STORED 0x80000000u
+
+/** log2 of the match finder hash table size */
+#define LZ4_HASH_LOG 16
+
+/** Shortest match the format can encode */
+#define LZ4_MIN_MATCH 4
+
+/** A block always ends with at least this many literals */
+#define LZ4_LAST_LITERALS 5
+
+/** No match may start within this many bytes of the block end */
+#define LZ4_MF_LIMIT 12
+
+/** Largest match distance the format can encode */
+#define LZ4_MAX_DISTANCE 65535
+
+/** xxHash32 primes */
+#define XXH_PRIME1 2654435761u
+#define XXH_PRIME2 2246822519u
+#define XXH_PRIME3 3266489917u
+#define XXH_PRIME4 668265263u
+#define XXH_PRIME5 374761393u
+
+/**
+ * @brief Running xxHash32 (content checksums).
+ */
+typedef struct
+{
+    uint32_t v[4];   /**< Lane accumulators */
+    uint64_t total;  /**< Bytes fed in so far */
+    uint8_t buf[16]; /**< Bytes of an incomplete stripe */
+    size_t fill;     /**< Bytes in buf */
+} Xxh32State;
+
+/**
+ * @brief Writer of one LZ4 frame.
+ */
+struct Lz4Writer
+{
+    int fd;            /**< Output file descriptor */
+    uint64_t size;     /**< Announced uncompressed size */
+    uint64_t received; /**< Uncompressed bytes passed in so far */
+    uint64_t pos;      /**< Frame offset of the next byte written */
+    uint8_t* block;    /**< LZ4_BLOCK_SIZE bytes collecting the next block */
+    size_t fill;       /**< Bytes in block */
+    uint8_t* out;      /**< Compressed block (LZ4_BLOCK_SIZE bytes) */
+    uint32_t* table;   /**< Match finder hash table */
+    uint64_t* offsets; /**< Frame offset of every block written */
+    uint64_t blocks;   /**< Number of blocks written */
+};
+
+/**
+ * @brief One buffer of the decoder ring.
+ */
+typedef struct
+{
+    uint8_t* in;         /**< Block as stored (block_max bytes) */
+    uint8_t* out;        /**< Decoded block (block_max bytes) */
+    size_t history;      /**< Bytes of earlier output right before out (linked blocks) */
+    const uint8_t* data; /**< Block data: in out, or in in for a stored block */
+    size_t len;          /**< Bytes of block data */
+    int ready;           /**< Set once data is valid */
+} Lz4Slot;
+
+/**
+ * @brief State shared by the decoding threads and the consumer.
+ */
+typedef struct
+{
+    int fd;                 /**< Frame file descriptor */
+    uint64_t start;         /**< Offset of the first block header */
+    int linked;             /**< Blocks may refer to data of earlier blocks */
+    int content_sum;        /**< A content checksum follows the end mark */
+    Xxh32State xs;          /**< Running content checksum (consumer side) */
+    const uint64_t* bounds; /**< Offset of each block, then of the end mark */
+    uint64_t blocks;        /**< Number of blocks */
+    size_t block_max;       /**< Maximum uncompressed block size */
+    size_t block_sum;       /**< Bytes of checksum after each block (0 or 4) */
+    Lz4Slot* slots;         /**< Ring buffers */
+    uint64_t depth;         /**< Number of slots */
+    uint64_t claimed;       /**< Blocks taken by workers */
+    uint64_t drained;       /**< Blocks handed to the consumer */
+    int failed;             /**< Set by any side on error */
+    pthread_mutex_t lock;   /**< Protects the fields above and Lz4Slot.ready */
+    pthread_cond_t cond;    /**< Signalled on every state change */
+} Lz4Decoder;
+
+/**
+ * @brief Load 32 bits in host order (for match finding only).
+ *
+ * @param p Source.
+ * @return Value.
+ */
+static uint32_t load32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief Load 64 bits in host order (for match finding only).
+ *
+ * @param p Source.
+ * @return Value.
+ */
+static uint64_t load64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief Decode a little-endian 32-bit value.
+ *
+ * @param p Source.
+ * @return Value.
+ */
+static uint32_t get_le32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Decode a little-endian 64-bit value.
+ *
+ * @param p Source.
+ * @return Value.
+ */
+static uint64_t get_le64(const uint8_t* p)
+{
+    return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+/**
+ * @brief Encode a little-endian 32-bit value.
+ *
+ * @param p Destination.
+ * @param v Value.
+ */
+static void put_le32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/**
+ * @brief Encode a little-endian 64-bit value.
+ *
+ * @param p Destination.
+ * @param v Value.
+ */
+static void put_le64(uint8_t* p, uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+/**
+ * @brief Rotate a 32-bit value left.
+ *
+ * @param v Value.
+ * @param r Rotation (1 to 31).
+ * @return Rotated value.
+ */
+static uint32_t rotl32(uint32_t v, int r)
+{
+    return (v << r) | (v >> (32 - r));
+}
+
+/**
+ * @brief One xxHash32 lane step.
+ *
+ * @param acc Lane accumulator.
+ * @param in  Next four input bytes.
+ * @return New accumulator.
+ */
+static uint32_t xxh32_round(uint32_t acc, uint32_t in)
+{
+    return rotl32(acc + in * XXH_PRIME2, 13) * XXH_PRIME1;
+}
+
+/**
+ * @brief Start an xxHash32 with seed 0.
+ *
+ * @param xs State to initialize.
+ */
+static void xxh32_init(Xxh32State* xs)
+{
+    memset(xs, 0, sizeof(*xs));
+    xs->v[0] = XXH_PRIME1 + XXH_PRIME2;
+    xs->v[1] = XXH_PRIME2;
+    xs->v[3] = 0u - XXH_PRIME1;
+}
+
+/**
+ * @brief Feed data to an xxHash32.
+ *
+ * @param xs  State.
+ * @param p   Data.
+ * @param len Length.
+ */
+static void xxh32_update(Xxh32State* xs, const uint8_t* p, size_t len)
+{
+    const uint8_t* end = p + len;
+    xs->total += len;
+
+    if (xs->fill > 0)
+    {
+        size_t n = 16 - xs->fill < len ? 16 - xs->fill : len;
+        memcpy(xs->buf + xs->fill, p, n);
+        xs->fill += n;
+        p += n;
+        if (xs->fill < 16)
+            return;
+        for (int i = 0; i < 4; i++)
+            xs->v[i] = xxh32_round(xs->v[i], get_le32(xs->buf + 4 * i));
+        xs->fill = 0;
+    }
+
+    for (; end - p >= 16; p += 16)
+    {
+        xs->v[0] = xxh32_round(xs->v[0], get_le32(p));
+        xs->v[1] = xxh32_round(xs->v[1], get_le32(p + 4));
+        xs->v[2] = xxh32_round(xs->v[2], get_le32(p + 8));
+        xs->v[3] = xxh32_round(xs->v[3], get_le32(p + 12));
+    }
+    memcpy(xs->buf, p, (size_t)(end - p));
+    xs->fill = (size_t)(end - p);
+}
+
+/**
+ * @brief Finish an xxHash32.
+ *
+ * @param xs State.
+ * @return Hash of all data fed in.
+ */
+static uint32_t xxh32_final(const Xxh32State* xs)
+{
+    const uint8_t* p = xs->buf;
+    const uint8_t* end = p + xs->fill;
+    uint32_t h;
+
+    if (xs->total >= 16)
+        h = rotl32(xs->v[0], 1) + rotl32(xs->v[1], 7) + rotl32(xs->v[2], 12) +
+            rotl32(xs->v[3], 18);
+    else
+        h = XXH_PRIME5;
+
+    h += (uint32_t)xs->total;
+    for (; end - p >= 4; p += 4)
+        h = rotl32(h + get_le32(p) * XXH_PRIME3, 17) * XXH_PRIME4;
+    for (; p < end; p++)
+        h = rotl32(h + *p * XXH_PRIME5, 11) * XXH_PRIME1;
+
+    h ^= h >> 15;
+    h *= XXH_PRIME2;
+    h ^= h >> 13;
+    h *= XXH_PRIME3;
+    h ^= h >> 16;
+    return h;
+}
+
+/**
+ * @brief xxHash32 with seed 0 of one buffer (frame header and block checksums).
+ *
+ * @param p   Data.
+ * @param len Length.
+ * @return Hash.
+ */
+static uint32_t xxh32(const uint8_t* p, size_t len)
+{
+    Xxh32State xs;
+    xxh32_init(&xs);
+    xxh32_update(&xs, p, len);
+    return xxh32_final(&xs);
+}
+
+/**
+ * @brief Hash table slot of four bytes of input.
+ *
+ * @param v Four bytes of input.
+ * @return Slot index.
+ */
+static uint32_t hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+/**
+ * @brief Append a length continuation (255 bytes, then the remainder).
+ *
+ * @param op  Output position.
+ * @param len Length beyond the 15 held by the token.
+ * @return New output position.
+ */
+static uint8_t* put_length(uint8_t* op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/**
+ * @brief Append one sequence: literals, then an optional match.
+ *
+ * @param op       Output position.
+ * @param oend     End of the output buffer.
+ * @param lit      Literals.
+ * @param lit_len  Number of literals.
+ * @param distance Match distance (ignored without a match).
+ * @param match    Match length (0 for the final literal-only sequence).
+ * @return New output position, or NULL if the output buffer is too small.
+ */
+static uint8_t* put_sequence(uint8_t* op, const uint8_t* oend, const uint8_t* lit,
+                             size_t lit_len, size_t distance, size_t match)
+{
+    /* Token, literal length bytes, literals, distance, match length bytes */
+    size_t need = 1 + lit_len / 255 + 1 + lit_len + 2 + match / 255 + 1;
+    if (need > (size_t)(oend - op))
+        return NULL;
+
+    size_t ml = match ? match - LZ4_MIN_MATCH : 0;
+    uint8_t* token = op++;
+    *token = (uint8_t)(((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15));
+    if (lit_len >= 15)
+        op = put_length(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match)
+    {
+        *op++ = (uint8_t)distance;
+        *op++ = (uint8_t)(distance >> 8);
+        if (ml >= 15)
+            op = put_length(op, ml - 15);
+    }
+    return op;
+}
+
+/**
+ * @brief Compress one block.
+ *
+ * @param src   Block data.
+ * @param len   Block length (at most LZ4_BLOCK_SIZE).
+ * @param dst   Output buffer.
+ * @param cap   Output buffer size.
+ * @param table Hash table of 1 << LZ4_HASH_LOG entries.
+ * @return Compressed length, or 0 if it would not fit in cap.
+ */
+static size_t compress_block(const uint8_t* src, size_t len, uint8_t* dst, size_t cap,
+                             uint32_t* table)
+{
+    const uint8_t* end = src + len;
+    const uint8_t* anchor = src;
+    uint8_t* op = dst;
+    const uint8_t* oend = dst + cap;
+
+    memset(table, 0, sizeof(*table) << LZ4_HASH_LOG);
+
+    if (len > LZ4_MF_LIMIT)
+    {
+        const uint8_t* mflimit = end - LZ4_MF_LIMIT;
+        const uint8_t* matchlimit = end - LZ4_LAST_LITERALS;
+        const uint8_t* ip = src + 1;
+        unsigned misses = 0;
+
+        while (ip < mflimit)
+        {
+            uint32_t seq = load32(ip);
+            uint32_t h = hash4(seq);
+            const uint8_t* ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+
+            if (ip - ref > LZ4_MAX_DISTANCE || load32(ref) != seq || ref >= ip)
+            {
+                /* Skip faster through data that does not compress */
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1])
+            {
+                ip--;
+                ref--;
+            }
+
+            const uint8_t* mp = ip + LZ4_MIN_MATCH;
+            const uint8_t* rp = ref + LZ4_MIN_MATCH;
+            while (mp + 8 <= matchlimit && load64(mp) == load64(rp))
+            {
+                mp += 8;
+                rp += 8;
+            }
+            while (mp < matchlimit && *mp == *rp)
+            {
+                mp++;
+                rp++;
+            }
+
+            op = put_sequence(op, oend, anchor, (size_t)(ip - anchor), (size_t)(ip - ref),
+                              (size_t)(mp - ip));
+            if (!op)
+                return 0;
+            ip = anchor = mp;
+
+            if (ip < mflimit)
+                table[hash4(load32(ip - 2))] = (uint32_t)(ip - 2 - src);
+        }
+    }
+
+    op = put_sequence(op, oend, anchor, (size_t)(end - anchor), 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+/**
+ * @brief Decompress one block.
+ *
+ * @param src     Compressed block.
+ * @param src_len Compressed length.
+ * @param dst     Output buffer.
+ * @param history Bytes of earlier output right before dst that matches may
+ *                refer to (linked blocks; 0 for independent blocks).
+ * @param cap     Output buffer size.
+ * @param out_len Output: decompressed length.
+ * @return 0 on success, non-zero if the block is corrupt.
+ */
+static int decompress_block(const uint8_t* src, size_t src_len, uint8_t* dst, size_t history,
+                            size_t cap, size_t* out_len)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + cap;
+
+    for (;;)
+    {
+        if (ip >= iend)
+            return 1;
+        unsigned token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15)
+        {
+            unsigned b;
+            do
+            {
+                if (ip >= iend)
+                    return 1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+            return 1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return 1;
+        size_t distance = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (distance == 0 || distance > (size_t)(op - dst) + history)
+            return 1;
+
+        size_t match = token & 15;
+        if (match == 15)
+        {
+            unsigned b;
+            do
+            {
+                if (ip >= iend)
+                    return 1;
+                b = *ip++;
+                match += b;
+            } while (b == 255);
+        }
+        match += LZ4_MIN_MATCH;
+        if (match > (size_t)(oend - op))
+            return 1;
+
+        /* Overlapping matches repeat a period of distance bytes: copy in
+           non-overlapping steps that double once a whole period is out */
+        const uint8_t* ref = op - distance;
+        while (match > 0)
+        {
+            size_t n = (size_t)(op - ref);
+            if (n > match)
+                n = match;
+            memcpy(op, ref, n);
+            op += n;
+            match -= n;
+        }
+    }
+
+    *out_len = (size_t)(op - dst);
+    return 0;
+}
+
+/**
+ * @brief Start an LZ4 frame.
+ *
+ * @param fd   Output file descriptor.
+ * @param size Number of bytes that will be written.
+ * @return Writer, or NULL on error.
+ */
+Lz4Writer* lz4_writer_open(int fd, uint64_t size)
+{
+    Lz4Writer* w = calloc(1, sizeof(*w));
+    if (!w)
+    {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+    w->fd = fd;
+    w->size = size;
+    w->block = bufpool_get(LZ4_BLOCK_SIZE);
+    w->out = w->block ? bufpool_get(LZ4_BLOCK_SIZE) : NULL;
+    if (!w->out)
+    {
+        lz4_writer_free(w);
+        return NULL;
+    }
+    w->table = malloc(sizeof(*w->table) << LZ4_HASH_LOG);
+    w->offsets = malloc(sizeof(*w->offsets) * (size / LZ4_BLOCK_SIZE + 1));
+    if (!w->table || !w->offsets)
+    {
+        perror("Memory allocation failed");
+        lz4_writer_free(w);
+        return NULL;
+    }
+
+    uint8_t hdr[LZ4_HEADER_SIZE];
+    put_le32(hdr, LZ4_FRAME_MAGIC);
+    hdr[4] = LZ4_FLG;
+    hdr[5] = LZ4_BD;
+    put_le64(hdr + 6, size);
+    hdr[14] = (uint8_t)(xxh32(hdr + 4, 10) >> 8);
+    if (io_write_all(fd, hdr, sizeof(hdr)) != 0)
+    {
+        lz4_writer_free(w);
+        return NULL;
+    }
+    w->pos = sizeof(hdr);
+    return w;
+}
+
+/**
+ * @brief Compress and write one block.
+ *
+ * @param w    Writer.
+ * @param data Block data.
+ * @param len  Block length (1 to LZ4_BLOCK_SIZE).
+ * @return 0 on success, non-zero on error.
+ */
+static int write_block(Lz4Writer* w, const uint8_t* data, size_t len)
+{
+    uint8_t head[4], sum[4];
+    size_t clen = compress_block(data, len, w->out, len - 1, w->table);
+    if (clen > 0)
+    {
+        put_le32(head, (uint32_t)clen);
+        data = w->out;
+    }
+    else
+    {
+        clen = len;
+        put_le32(head, (uint32_t)len | LZ4_BLOCK_STORED);
+    }
+    put_le32(sum, xxh32(data, clen));
+
+    int ret = io_write_all(w->fd, head, 4);
+    if (ret == 0)
+        ret = io_write_all(w->fd, data, clen);
+    if (ret == 0)
+        ret = io_write_all(w->fd, sum, 4);
+
+    w->offsets[w->blocks++] = w->pos;
+    w->pos += 4 + clen + 4;
+    return ret;
+}
+
+/**
+ * @brief Compress data into the frame.
+ *
+ * @param w    Writer.
+ * @param data Data to append.
+ * @param len  Number of bytes.
+ * @return 0 on success, non-zero on error.
+ */
+int lz4_writer_write(Lz4Writer* w, const void* data, size_t len)
+{
+    if (len > w->size - w->received)
+    {
+        fprintf(stderr, "Error: more data than announced for the LZ4 frame\n");
+        return 1;
+    }
+    w->received += len;
+
+    const uint8_t* p = data;
+    while (len > 0)
+    {
+        /* Whole blocks are compressed straight from the caller's buffer */
+        if (w->fill == 0 && len >= LZ4_BLOCK_SIZE)
+        {
+            if (write_block(w, p, LZ4_BLOCK_SIZE) != 0)
+                return 1;
+            p += LZ4_BLOCK_SIZE;
+            len -= LZ4_BLOCK_SIZE;
+            continue;
+        }
+
+        size_t n = LZ4_BLOCK_SIZE - w->fill;
+        if (n > len)
+            n = len;
+        memcpy(w->block + w->fill, p, n);
+        w->fill += n;
+        p += n;
+        len -= n;
+        if (w->fill == LZ4_BLOCK_SIZE)
+        {
+            w->fill = 0;
+            if (write_block(w, w->block, LZ4_BLOCK_SIZE) != 0)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Write the last block, the end mark and the block index.
+ *
+ * @param w Writer.
+ * @return 0 on success, non-zero on error.
+ */
+int lz4_writer_finish(Lz4Writer* w)
+{
+    if (w->received != w->size)
+    {
+        fprintf(stderr, "Error: LZ4 frame got %llu of %llu bytes\n",
+                (unsigned long long)w->received, (unsigned long long)w->size);
+        return 1;
+    }
+    if (w->fill > 0 && write_block(w, w->block, w->fill) != 0)
+        return 1;
+    w->fill = 0;
+
+    /* End mark, then the index frame */
+    size_t index_len = 4 + 4 + (size_t)w->blocks * 8 + 8;
+    uint8_t* buf = malloc(4 + index_len);
+    if (!buf)
+    {
+        perror("Memory allocation failed");
+        return 1;
+    }
+    put_le32(buf, 0);
+    put_le32(buf + 4, LZ4_INDEX_MAGIC);
+    put_le32(buf + 8, (uint32_t)(index_len - 8));
+    for (uint64_t k = 0; k < w->blocks; k++)
+        put_le64(buf + 12 + k * 8, w->offsets[k]);
+    put_le32(buf + 12 + w->blocks * 8, (uint32_t)w->blocks);
+    put_le32(buf + 16 + w->blocks * 8, LZ4_INDEX_TAG);
+
+    int ret = io_write_all(w->fd, buf, 4 + index_len);
+    free(buf);
+    return ret;
+}
+
+/**
+ * @brief Release a writer.
+ *
+ * @param w Writer (NULL is ignored).
+ */
+void lz4_writer_free(Lz4Writer* w)
+{
+    if (!w)
+        return;
+    bufpool_put(w->block);
+    bufpool_put(w->out);
+    free(w->table);
+    free(w->offsets);
+    free(w);
+}
+
+/**
+ * @brief Read exactly len bytes at an absolute offset.
+ *
+ * @param fd  File descriptor.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @param off File offset.
+ * @return 0 on success, non-zero on error or premature end of file.
+ */
+static int read_full(int fd, void* buf, size_t len, uint64_t off)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t r = pread(fd, (uint8_t*)buf + done, len - done, (off_t)(off + done));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+        {
+            fprintf(stderr, "Error reading LZ4 frame: %s\n",
+                    r < 0 ? strerror(errno) : "unexpected end of file");
+            return 1;
+        }
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read and check the frame header.
+ *
+ * Sets the frame fields of the decoder: start, linked, content_sum,
+ * block_max and block_sum.
+ *
+ * @param d    Decoder (fd set).
+ * @param size Output: uncompressed size, or LZ4_SIZE_UNKNOWN if the frame
+ *             does not record it.
+ * @return 0 on success, non-zero on error.
+ */
+static int read_header(Lz4Decoder* d, uint64_t* size)
+{
+    uint8_t hdr[LZ4_HEADER_MAX];
+    if (read_full(d->fd, hdr, 7, 0) != 0)
+        return 1;
+
+    if (get_le32(hdr) != LZ4_FRAME_MAGIC)
+    {
+        fprintf(stderr, "Error: not an LZ4 frame\n");
+        return 1;
+    }
+    unsigned flg = hdr[4];
+    unsigned bd_id = (hdr[5] >> 4) & 7;
+    if ((flg & LZ4_FLG_FIXED_MASK) != (LZ4_FLG & LZ4_FLG_FIXED_MASK) || (hdr[5] & 0x8F) != 0 ||
+        bd_id < 4)
+    {
+        fprintf(stderr, "Error: unsupported LZ4 frame (%s)\n",
+                flg & LZ4_FLG_DICT_ID ? "needs a dictionary" : "unknown version or flags");
+        return 1;
+    }
+
+    size_t len = flg & LZ4_FLG_CONTENT_SIZE ? 15 : 7;
+    if (len > 7 && read_full(d->fd, hdr + 7, len - 7, 7) != 0)
+        return 1;
+    if (hdr[len - 1] != (uint8_t)(xxh32(hdr + 4, len - 5) >> 8))
+    {
+        fprintf(stderr, "Error: corrupt LZ4 frame header\n");
+        return 1;
+    }
+
+    *size = flg & LZ4_FLG_CONTENT_SIZE ? get_le64(hdr + 6) : LZ4_SIZE_UNKNOWN;
+    d->start = len;
+    d->linked = !(flg & LZ4_FLG_INDEPENDENT);
+    d->content_sum = (flg & LZ4_FLG_CONTENT_CHECKSUM) != 0;
+    d->block_max = (size_t)1 << (8 + 2 * bd_id);
+    d->block_sum = flg & LZ4_FLG_BLOCK_CHECKSUM ? 4 : 0;
+    return 0;
+}
+
+/**
+ * @brief Take the block offsets from the index frame at the end of the file.
+ *
+ * @param d         Decoder (fd and frame fields set); d->blocks is
+ *                  set on success.
+ * @param file_size File size.
+ * @param bounds    Output: offset of each block, then of the end mark
+ *                  (allocated; free() it).
+ * @return 0 on success, non-zero if there is no usable index.
+ */
+static int load_index(Lz4Decoder* d, uint64_t file_size, uint64_t** bounds)
+{
+    int fd = d->fd;
+    uint64_t overhead = 4 + d->block_sum;
+    uint8_t tail[8];
+    if (file_size < d->start + 4 + 16 || read_full(fd, tail, 8, file_size - 8) != 0 ||
+        get_le32(tail + 4) != LZ4_INDEX_TAG)
+    {
+        return 1;
+    }
+
+    uint64_t n = get_le32(tail);
+    uint64_t index_len = 8 + n * 8 + 8;
+    if (index_len > file_size - d->start - 4)
+        return 1;
+    uint64_t index_off = file_size - index_len;
+
+    uint8_t* buf = malloc((size_t)index_len);
+    uint64_t* b = malloc(sizeof(*b) * (size_t)(n + 1));
+    if (!buf || !b || read_full(fd, buf, (size_t)index_len, index_off) != 0 ||
+        get_le32(buf) != LZ4_INDEX_MAGIC || get_le32(buf + 4) != index_len - 8)
+    {
+        free(buf);
+        free(b);
+        return 1;
+    }
+
+    /* Blocks must follow each other from the header to the end mark */
+    uint64_t prev = d->start;
+    for (uint64_t k = 0; k <= n; k++)
+    {
+        b[k] = k < n ? get_le64(buf + 8 + k * 8) : index_off - 4 - (d->content_sum ? 4 : 0);
+        if (k == 0 ? b[k] != prev
+                   : b[k] <= prev + overhead || b[k] - prev > d->block_max + overhead)
+        {
+            free(buf);
+            free(b);
+            return 1;
+        }
+        prev = b[k];
+    }
+    free(buf);
+
+    *bounds = b;
+    d->blocks = n;
+    return 0;
+}
+
+/**
+ * @brief Find the block offsets by walking the block headers.
+ *
+ * @param d         Decoder (fd and frame fields set); d->blocks is
+ *                  set on success.
+ * @param file_size File size.
+ * @param bounds    Output: offset of each block, then of the end mark
+ *                  (allocated; free() it).
+ * @return 0 on success, non-zero on error.
+ */
+static int scan_blocks(Lz4Decoder* d, uint64_t file_size, uint64_t** bounds)
+{
+    int fd = d->fd;
+    uint64_t* b = NULL;
+    uint64_t n = 0, cap = 0;
+    uint64_t pos = d->start;
+
+    for (;;)
+    {
+        if (n == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            uint64_t* grown = realloc(b, sizeof(*b) * (size_t)cap);
+            if (!grown)
+            {
+                perror("Memory allocation failed");
+                free(b);
+                return 1;
+            }
+            b = grown;
+        }
+        b[n] = pos;
+
+        uint8_t field[4];
+        if (read_full(fd, field, 4, pos) != 0)
+        {
+            free(b);
+            return 1;
+        }
+        uint32_t v = get_le32(field);
+        if (v == 0)
+            break;
+
+        uint64_t len = 4 + (v & ~LZ4_BLOCK_STORED) + d->block_sum;
+        if (len == 4 + d->block_sum || len > 4 + d->block_max + d->block_sum ||
+            pos + len > file_size)
+        {
+            fprintf(stderr, "Error: corrupt or truncated LZ4 block at offset %llu\n",
+                    (unsigned long long)pos);
+            free(b);
+            return 1;
+        }
+        pos += len;
+        n++;
+    }
+
+    *bounds = b;
+    d->blocks = n;
+    return 0;
+}
+
+/**
+ * @brief Read and decode one block into a ring slot.
+ *
+ * @param d Decoder.
+ * @param k Block index.
+ * @param s Slot to fill.
+ * @return 0 on success, non-zero on error.
+ */
+static int decode_block(const Lz4Decoder* d, uint64_t k, Lz4Slot* s)
+{
+    uint64_t span = d->bounds[k + 1] - d->bounds[k];
+    uint8_t head[4], sum[4];
+    if (read_full(d->fd, head, 4, d->bounds[k]) != 0)
+        return 1;
+
+    uint32_t v = get_le32(head);
+    size_t len = v & ~LZ4_BLOCK_STORED;
+    if (len > d->block_max || span != 4 + (uint64_t)len + d->block_sum)
+    {
+        fprintf(stderr, "Error: LZ4 block %llu does not match the block index\n",
+                (unsigned long long)k);
+        return 1;
+    }
+    if (read_full(d->fd, s->in, len, d->bounds[k] + 4) != 0 ||
+        (d->block_sum && read_full(d->fd, sum, 4, d->bounds[k] + 4 + len) != 0))
+    {
+        return 1;
+    }
+    if (d->block_sum && get_le32(sum) != xxh32(s->in, len))
+    {
+        fprintf(stderr, "Error: LZ4 block %llu fails its checksum\n", (unsigned long long)k);
+        return 1;
+    }
+    if (v & LZ4_BLOCK_STORED)
+    {
+        s->data = s->in;
+        s->len = len;
+        return 0;
+    }
+
+    if (decompress_block(s->in, len, s->out, s->history, d->block_max, &s->len) != 0)
+    {
+        fprintf(stderr, "Error: corrupt LZ4 block %llu\n", (unsigned long long)k);
+        return 1;
+    }
+    s->data = s->out;
+    return 0;
+}
+
+/**
+ * @brief Mark the decode as failed and wake everyone.
+ *
+ * @param d Decoder.
+ */
+static void decoder_fail(Lz4Decoder* d)
+{
+    pthread_mutex_lock(&d->lock);
+    d->failed = 1;
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+}
+
+/**
+ * @brief Decoding thread: claim blocks in order and decode them into the ring.
+ *
+ * @param arg Decoder.
+ * @return Always NULL (errors are reported through Lz4Decoder.failed).
+ */
+static void* decoder_main(void* arg)
+{
+    Lz4Decoder* d = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&d->lock);
+        while (!d->failed && d->claimed < d->blocks && d->claimed - d->drained == d->depth)
+            pthread_cond_wait(&d->cond, &d->lock);
+        if (d->failed || d->claimed == d->blocks)
+        {
+            pthread_mutex_unlock(&d->lock);
+            break;
+        }
+        uint64_t k = d->claimed++;
+        pthread_mutex_unlock(&d->lock);
+
+        Lz4Slot* s = &d->slots[k % d->depth];
+        if (decode_block(d, k, s) != 0)
+        {
+            decoder_fail(d);
+            break;
+        }
+
+        pthread_mutex_lock(&d->lock);
+        s->ready = 1;
+        pthread_cond_broadcast(&d->cond);
+        pthread_mutex_unlock(&d->lock);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Hand a decoded block to the consumer, checking the total size.
+ *
+ * @param d         Decoder (its content checksum is updated).
+ * @param s         Slot holding the block.
+ * @param size      Announced uncompressed size, or LZ4_SIZE_UNKNOWN.
+ * @param delivered Bytes handed out so far (updated).
+ * @param cb        Consumer.
+ * @param ctx       Passed to cb.
+ * @return 0 on success, non-zero on error.
+ */
+static int deliver(Lz4Decoder* d, const Lz4Slot* s, uint64_t size, uint64_t* delivered,
+                   IoReadCallback cb, void* ctx)
+{
+    if (s->len > size - *delivered)
+    {
+        fprintf(stderr, "Error: LZ4 frame holds more than its recorded size\n");
+        return 1;
+    }
+    *delivered += s->len;
+    if (d->content_sum)
+        xxh32_update(&d->xs, s->data, s->len);
+    return cb(s->data, s->len, ctx);
+}
+
+/**
+ * @brief Check the decoded size and the content checksum once all blocks are out.
+ *
+ * @param d         Decoder.
+ * @param size      Announced uncompressed size, or LZ4_SIZE_UNKNOWN.
+ * @param delivered Bytes handed out.
+ * @return 0 on success, non-zero on error.
+ */
+static int finish_frame(const Lz4Decoder* d, uint64_t size, uint64_t delivered)
+{
+    if (size != LZ4_SIZE_UNKNOWN && delivered != size)
+    {
+        fprintf(stderr, "Error: LZ4 frame holds %llu bytes instead of its recorded %llu\n",
+                (unsigned long long)delivered, (unsigned long long)size);
+        return 1;
+    }
+
+    uint8_t sum[4];
+    if (d->content_sum && (read_full(d->fd, sum, 4, d->bounds[d->blocks] + 4) != 0 ||
+                           get_le32(sum) != xxh32_final(&d->xs)))
+    {
+        fprintf(stderr, "Error: LZ4 frame fails its content checksum\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode a frame of linked blocks, one block after the other.
+ *
+ * Matches may reach up to LZ4_MAX_DISTANCE bytes back into earlier blocks,
+ * so each block is decoded right behind the tail of the previous output
+ * and the blocks cannot be spread over threads.
+ *
+ * @param d    Decoder (fd, bounds, blocks and block_max set).
+ * @param size Announced uncompressed size, or LZ4_SIZE_UNKNOWN.
+ * @param cb   Consumer.
+ * @param ctx  Passed to cb.
+ * @return 0 on success, non-zero on error.
+ */
+static int decode_linked(Lz4Decoder* d, uint64_t size, IoReadCallback cb, void* ctx)
+{
+    Lz4Slot s;
+    memset(&s, 0, sizeof(s));
+    uint8_t* window = bufpool_get(LZ4_MAX_DISTANCE + d->block_max);
+    s.in = window ? bufpool_get(d->block_max) : NULL;
+    if (!s.in)
+    {
+        bufpool_put(window);
+        return 1;
+    }
+    s.out = window + LZ4_MAX_DISTANCE;
+
+    uint64_t delivered = 0;
+    int ret = 0;
+    for (uint64_t k = 0; k < d->blocks && ret == 0; k++)
+    {
+        ret = decode_block(d, k, &s);
+        if (ret != 0)
+            break;
+
+        /* Stored blocks become history as well */
+        if (s.data != s.out)
+        {
+            memcpy(s.out, s.data, s.len);
+            s.data = s.out;
+        }
+        ret = deliver(d, &s, size, &delivered, cb, ctx);
+
+        /* Keep the last LZ4_MAX_DISTANCE bytes of output right before out */
+        size_t keep = s.history + s.len < LZ4_MAX_DISTANCE ? s.history + s.len : LZ4_MAX_DISTANCE;
+        memmove(s.out - keep, s.out + s.len - keep, keep);
+        s.history = keep;
+    }
+
+    bufpool_put(s.in);
+    bufpool_put(window);
+    return ret == 0 ? finish_frame(d, size, delivered) : ret;
+}
+
+/**
+ * @brief Decode all blocks of a frame, in parallel when worthwhile.
+ *
+ * @param d    Decoder (fd, bounds, blocks and block_max set).
+ * @param size Announced uncompressed size, or LZ4_SIZE_UNKNOWN.
+ * @param cb   Consumer.
+ * @param ctx  Passed to cb.
+ * @return 0 on success, non-zero on error.
+ */
+static int decode_frame(Lz4Decoder* d, uint64_t size, IoReadCallback cb, void* ctx)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t threads = LZ4_DECODE_THREADS;
+    if (cpus > 0 && (uint64_t)cpus < threads)
+        threads = (uint64_t)cpus;
+    if (threads > d->blocks)
+        threads = d->blocks;
+    d->depth = threads > 1 ? threads + 2 : 1;
+
+    d->slots = calloc((size_t)d->depth, sizeof(*d->slots));
+    int ret = d->slots ? 0 : 1;
+    for (uint64_t i = 0; i < d->depth && ret == 0; i++)
+    {
+        d->slots[i].in = bufpool_get(d->block_max);
+        d->slots[i].out = d->slots[i].in ? bufpool_get(d->block_max) : NULL;
+        if (!d->slots[i].out)
+            ret = 1;
+    }
+    if (!d->slots)
+        perror("Memory allocation failed");
+    if (ret != 0)
+        threads = 0;
+
+    pthread_t workers[LZ4_DECODE_THREADS];
+    uint64_t started = 0;
+    if (threads > 1)
+    {
+        if (pthread_mutex_init(&d->lock, NULL) != 0)
+        {
+            threads = 1;
+        }
+        else if (pthread_cond_init(&d->cond, NULL) != 0)
+        {
+            pthread_mutex_destroy(&d->lock);
+            threads = 1;
+        }
+        while (threads > 1 && started < threads &&
+               pthread_create(&workers[started], NULL, decoder_main, d) == 0)
+        {
+            started++;
+        }
+        if (threads > 1 && started == 0)
+        {
+            pthread_cond_destroy(&d->cond);
+            pthread_mutex_destroy(&d->lock);
+        }
+    }
+
+    uint64_t delivered = 0;
+    if (ret == 0 && started == 0)
+    {
+        /* Serial decode through the first slot */
+        for (uint64_t k = 0; k < d->blocks && ret == 0; k++)
+        {
+            ret = decode_block(d, k, &d->slots[0]) != 0 ||
+                  deliver(d, &d->slots[0], size, &delivered, cb, ctx) != 0;
+        }
+    }
+    else if (ret == 0)
+    {
+        for (uint64_t k = 0; k < d->blocks; k++)
+        {
+            Lz4Slot* s = &d->slots[k % d->depth];
+            pthread_mutex_lock(&d->lock);
+            while (!d->failed && !s->ready)
+                pthread_cond_wait(&d->cond, &d->lock);
+            int failed = d->failed;
+            pthread_mutex_unlock(&d->lock);
+            if (failed)
+            {
+                ret = 1;
+                break;
+            }
+
+            if (deliver(d, s, size, &delivered, cb, ctx) != 0)
+            {
+                decoder_fail(d);
+                ret = 1;
+                break;
+            }
+
+            pthread_mutex_lock(&d->lock);
+            s->ready = 0;
+            d->drained = k + 1;
+            pthread_cond_broadcast(&d->cond);
+            pthread_mutex_unlock(&d->lock);
+        }
+
+        for (uint64_t i = 0; i < started; i++)
+            pthread_join(workers[i], NULL);
+        pthread_cond_destroy(&d->cond);
+        pthread_mutex_destroy(&d->lock);
+    }
+
+    for (uint64_t i = 0; d->slots && i < d->depth; i++)
+    {
+        bufpool_put(d->slots[i].in);
+        bufpool_put(d->slots[i].out);
+    }
+    free(d->slots);
+    return ret == 0 ? finish_frame(d, size, delivered) : ret;
+}
+
+/**
+ * @brief lz4_input_read() callback counting the decoded bytes.
+ *
+ * @param data Chunk of data (unused).
+ * @param len  Chunk length.
+ * @param ctx  uint64_t byte counter.
+ * @return Always 0.
+ */
+static int count_chunk(const uint8_t* data, size_t len, void* ctx)
+{
+    (void)data;
+    *(uint64_t*)ctx += len;
+    return 0;
+}
+
+/**
+ * @brief Open a dump folder entry, or its LZ4 compressed form.
+ *
+ * @param path Path of the entry as it would be stored uncompressed.
+ * @param in   Output: opened entry.
+ * @return 0 on success, non-zero on error.
+ */
+int lz4_input_open(const char* path, Lz4Input* in)
+{
+    memset(in, 0, sizeof(*in));
+    struct stat st;
+
+    in->fd = open(path, O_RDONLY);
+    if (in->fd >= 0)
+    {
+        if (fstat(in->fd, &st) != 0)
+        {
+            fprintf(stderr, "Cannot stat file '%s': %s\n", path, strerror(errno));
+            lz4_input_close(in);
+            return 1;
+        }
+        in->size = (uint64_t)st.st_size;
+        return 0;
+    }
+
+    char lz4_path[1024 + sizeof(LZ4_FILE_SUFFIX)];
+    int err = errno;
+    if (err == ENOENT)
+    {
+        snprintf(lz4_path, sizeof(lz4_path), "%s%s", path, LZ4_FILE_SUFFIX);
+        in->fd = open(lz4_path, O_RDONLY);
+    }
+    if (in->fd < 0)
+    {
+        fprintf(stderr, "Cannot open file '%s': %s\n", path, strerror(err));
+        return 1;
+    }
+
+    Lz4Decoder d;
+    memset(&d, 0, sizeof(d));
+    d.fd = in->fd;
+    in->compressed = 1;
+    if (read_header(&d, &in->size) != 0)
+    {
+        fprintf(stderr, "Cannot read '%s'\n", lz4_path);
+        lz4_input_close(in);
+        return 1;
+    }
+
+    /* Frames that do not record their size (plain lz4 without --content-size)
+       are decoded once to learn it */
+    uint64_t counted = 0;
+    if (in->size == LZ4_SIZE_UNKNOWN)
+    {
+        if (lz4_input_read(in, count_chunk, &counted) != 0)
+        {
+            fprintf(stderr, "Cannot read '%s'\n", lz4_path);
+            lz4_input_close(in);
+            return 1;
+        }
+        in->size = counted;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read all data of an entry, decompressing it if needed.
+ *
+ * @param in  Opened entry.
+ * @param cb  Consumer of the data.
+ * @param ctx Passed to cb.
+ * @return 0 on success, non-zero on error.
+ */
+int lz4_input_read(const Lz4Input* in, IoReadCallback cb, void* ctx)
+{
+    if (!in->compressed)
+        return in->size > 0 ? io_read_range(in->fd, 0, in->size, cb, ctx) : 0;
+
+    struct stat st;
+    Lz4Decoder d;
+    memset(&d, 0, sizeof(d));
+    d.fd = in->fd;
+
+    uint64_t size;
+    uint64_t* bounds = NULL;
+    if (fstat(in->fd, &st) != 0)
+    {
+        perror("Error reading LZ4 frame");
+        return 1;
+    }
+    if (read_header(&d, &size) != 0 ||
+        (load_index(&d, (uint64_t)st.st_size, &bounds) != 0 &&
+         scan_blocks(&d, (uint64_t)st.st_size, &bounds) != 0))
+    {
+        return 1;
+    }
+    if (size == LZ4_SIZE_UNKNOWN)
+        size = in->size;
+
+    d.bounds = bounds;
+    xxh32_init(&d.xs);
+    int ret = d.linked ? decode_linked(&d, size, cb, ctx) : decode_frame(&d, size, cb, ctx);
+    free(bounds);
+    return ret;
+}
+
+/**
+ * @brief Close an entry opened with lz4_input_open().
+ *
+ * @param in Entry.
+ */
+void lz4_input_close(Lz4Input* in)
+{
+    if (in->fd >= 0)
+        close(in->fd);
+    in->fd = -1;
+}
@@ -0,0 +1,1058 @@
+/**
+ * @file img_mount.c
+ * @brief Read-only FUSE view of an IMAGEWTY image, served on /dev/fuse.
+ *
+ * Node IDs are fixed: the root directory is FUSE_ROOT_ID, the synthesized
+ * image.cfg is MOUNT_CFG_ID and entry i of the file header table is
+ * MOUNT_FIRST_ENTRY_ID + i, so no lookup counts need to be kept. Requests
+ * are handled one at a time in the calling thread.
+ */
+
+#define _GNU_SOURCE
+
+#include "img_mount.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fuse.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "config_file.h"
+#include "file_table.h"
+#include "img_bufpool.h"
+#include "img_header.h"
+#include "img_source.h"
+
+/** Device the kernel FUSE protocol is spoken on */
+#define FUSE_DEVICE "/dev/fuse"
+
+/** Size of the buffer requests are read into (nothing is ever written to the view) */
+#define MOUNT_REQUEST_SIZE (64 * 1024)
+
+/** Oldest protocol minor version accepted (reply layouts are stable since 7.12) */
+#define MOUNT_MIN_MINOR 12
+
+/** Node ID of the synthesized image.cfg */
+#define MOUNT_CFG_ID 2
+
+/** Node ID of the first file header table entry */
+#define MOUNT_FIRST_ENTRY_ID 3
+
+/** Name of the synthesized config file */
+#define MOUNT_CFG_NAME "image.cfg"
+
+/** Smallest read size worth splicing for (the kernel's default largest read) */
+#define MOUNT_SPLICE_MIN_READ (128 * 1024)
+
+/** Block size reported in attributes and by statfs */
+#define MOUNT_BLOCK_SIZE 4096
+
+/**
+ * @brief One block of decoded image data.
+ */
+typedef struct
+{
+    uint8_t* data; /**< MOUNT_CACHE_BLOCK_SIZE bytes, or NULL until first used */
+    uint64_t off;  /**< Image offset of the block */
+    size_t len;    /**< Number of valid bytes (0 for an empty slot) */
+    uint64_t used; /**< Tick of the last use (least recently used is replaced) */
+} CacheBlock;
+
+/**
+ * @brief State of one mounted image.
+ */
+typedef struct
+{
+    ImageSource* src;                     /**< Image */
+    const ImageWTYFileHeader* files;      /**< File header array */
+    FileTable table;                      /**< Name lookup over files */
+    uint8_t* listed;                      /**< Non-zero for entries shown in the view */
+    uint32_t listed_count;                /**< Number of entries shown */
+    char* cfg;                            /**< Text of the synthesized image.cfg */
+    size_t cfg_len;                       /**< Length of cfg */
+    uid_t uid;                            /**< Owner of every file */
+    gid_t gid;                            /**< Group of every file */
+    int fd;                               /**< /dev/fuse connection */
+    int helper;                           /**< Mounted through fusermount */
+    int pipe[2];                          /**< Pipe reads are spliced through, or -1 */
+    size_t page;                          /**< Page size */
+    size_t max_read;                      /**< Largest read answered (whole pages) */
+    uint8_t* req;                         /**< MOUNT_REQUEST_SIZE bytes of request */
+    uint8_t* out;                         /**< MOUNT_MAX_READ bytes of reply data */
+    CacheBlock cache[MOUNT_CACHE_BLOCKS]; /**< Decoded data of compressed images */
+    uint64_t tick;                        /**< Cache use counter */
+} MountFs;
+
+/** Signal that asked for the view to be detached (0 while serving) */
+static volatile sig_atomic_t stop_signal;
+
+/**
+ * @brief Record a request to stop serving.
+ *
+ * @param sig Signal number.
+ */
+static void on_stop_signal(int sig)
+{
+    stop_signal = sig;
+}
+
+/**
+ * @brief Send a reply to the kernel.
+ *
+ * A reply to a request that was interrupted in the meantime is refused
+ * with ENOENT, which is not an error.
+ *
+ * @param fs     Mounted image.
+ * @param unique ID of the request.
+ * @param error  0, or a positive errno value.
+ * @param data   Reply data (ignored with an error).
+ * @param len    Length of data.
+ */
+static void send_reply(MountFs* fs, uint64_t unique, int error, const void* data, size_t len)
+{
+    if (error)
+        len = 0;
+    struct fuse_out_header oh = {(uint32_t)(sizeof(oh) + len), -error, unique};
+    struct iovec iov[2] = {{&oh, sizeof(oh)}, {(void*)data, len}};
+    if (writev(fs->fd, iov, len ? 2 : 1) < 0 && errno != ENOENT)
+        perror("Error replying to the kernel");
+}
+
+/**
+ * @brief Tell whether an entry name can be shown as a file of the view.
+ *
+ * @param name Entry name.
+ * @return Non-zero if the name is usable.
+ */
+static int usable_name(const char* name)
+{
+    return name[0] != '\0' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0 &&
+           strchr(name, '/') == NULL && strcmp(name, MOUNT_CFG_NAME) != 0;
+}
+
+/**
+ * @brief Fill the attributes of a node.
+ *
+ * @param fs Mounted image.
+ * @param id Node ID.
+ * @param a  Output: attributes.
+ * @return 0 on success, ENOENT if there is no such node.
+ */
+static int node_attr(const MountFs* fs, uint64_t id, struct fuse_attr* a)
+{
+    memset(a, 0, sizeof(*a));
+    a->mode = S_IFREG | 0444;
+    a->nlink = 1;
+    if (id == FUSE_ROOT_ID)
+    {
+        a->mode = S_IFDIR | 0555;
+        a->nlink = 2;
+    }
+    else if (id == MOUNT_CFG_ID)
+    {
+        a->size = fs->cfg_len;
+    }
+    else if (id >= MOUNT_FIRST_ENTRY_ID && id - MOUNT_FIRST_ENTRY_ID < fs->table.count &&
+             fs->listed[id - MOUNT_FIRST_ENTRY_ID])
+    {
+        a->size = fs->files[id - MOUNT_FIRST_ENTRY_ID].original_length;
+    }
+    else
+    {
+        return ENOENT;
+    }
+
+    a->ino = id;
+    a->blocks = (a->size + 511) / 512;
+    a->atime = a->mtime = a->ctime = (uint64_t)fs->src->mtime;
+    a->uid = fs->uid;
+    a->gid = fs->gid;
+    a->blksize = MOUNT_BLOCK_SIZE;
+    return 0;
+}
+
+/**
+ * @brief Answer FUSE_INIT: check the protocol version and set the limits.
+ *
+ * @param fs     Mounted image.
+ * @param in     Request header.
+ * @param arg    Request argument.
+ * @param arglen Length of arg.
+ * @return 0 on success, non-zero if the kernel protocol is not supported.
+ */
+static int handle_init(MountFs* fs, const struct fuse_in_header* in, const void* arg,
+                       size_t arglen)
+{
+    const struct fuse_init_in* init = arg;
+    if (arglen < offsetof(struct fuse_init_in, flags2) || init->major != FUSE_KERNEL_VERSION ||
+        init->minor < MOUNT_MIN_MINOR)
+    {
+        fprintf(stderr, "Error: unsupported FUSE protocol version %u.%u\n",
+                arglen >= 8 ? init->major : 0, arglen >= 8 ? init->minor : 0);
+        send_reply(fs, in->unique, EPROTO, NULL, 0);
+        return 1;
+    }
+
+    struct fuse_init_out out;
+    memset(&out, 0, sizeof(out));
+    out.major = FUSE_KERNEL_VERSION;
+    out.minor = FUSE_KERNEL_MINOR_VERSION;
+    out.max_readahead = init->max_readahead;
+    out.flags = init->flags & (FUSE_ASYNC_READ | FUSE_MAX_PAGES | FUSE_PARALLEL_DIROPS);
+    out.max_write = MOUNT_BLOCK_SIZE;
+    out.time_gran = 1;
+    out.max_pages = (uint16_t)(fs->max_read / fs->page);
+    send_reply(fs, in->unique, 0, &out,
+               init->minor < 23 ? FUSE_COMPAT_22_INIT_OUT_SIZE : sizeof(out));
+    return 0;
+}
+
+/**
+ * @brief Answer FUSE_LOOKUP of a name in the root directory.
+ *
+ * @param fs     Mounted image.
+ * @param in     Request header.
+ * @param arg    Request argument (NUL-terminated name).
+ * @param arglen Length of arg.
+ */
+static void handle_lookup(MountFs* fs, const struct fuse_in_header* in, const char* arg,
+                          size_t arglen)
+{
+    if (in->nodeid != FUSE_ROOT_ID)
+    {
+        send_reply(fs, in->unique, ENOTDIR, NULL, 0);
+        return;
+    }
+    if (!memchr(arg, '\0', arglen))
+    {
+        send_reply(fs, in->unique, EINVAL, NULL, 0);
+        return;
+    }
+
+    uint64_t id = 0;
+    if (strcmp(arg, MOUNT_CFG_NAME) == 0)
+    {
+        id = MOUNT_CFG_ID;
+    }
+    else
+    {
+        long i = file_table_find(&fs->table, arg);
+        if (i >= 0 && fs->listed[i])
+            id = MOUNT_FIRST_ENTRY_ID + (uint64_t)i;
+    }
+
+    struct fuse_entry_out out;
+    memset(&out, 0, sizeof(out));
+    if (id == 0 || node_attr(fs, id, &out.attr) != 0)
+    {
+        send_reply(fs, in->unique, ENOENT, NULL, 0);
+        return;
+    }
+    out.nodeid = id;
+    out.entry_valid = MOUNT_ATTR_TIMEOUT;
+    out.attr_valid = MOUNT_ATTR_TIMEOUT;
+    send_reply(fs, in->unique, 0, &out, sizeof(out));
+}
+
+/**
+ * @brief Answer FUSE_GETATTR.
+ *
+ * @param fs Mounted image.
+ * @param in Request header.
+ */
+static void handle_getattr(MountFs* fs, const struct fuse_in_header* in)
+{
+    struct fuse_attr_out out;
+    memset(&out, 0, sizeof(out));
+    int err = node_attr(fs, in->nodeid, &out.attr);
+    out.attr_valid = MOUNT_ATTR_TIMEOUT;
+    send_reply(fs, in->unique, err, &out, sizeof(out));
+}
+
+/**
+ * @brief Answer FUSE_OPEN and FUSE_OPENDIR.
+ *
+ * Files are opened with FOPEN_KEEP_CACHE: their data never changes, so
+ * pages read through an earlier open stay valid.
+ *
+ * @param fs     Mounted image.
+ * @param in     Request header.
+ * @param arg    Request argument.
+ * @param arglen Length of arg.
+ */
+static void handle_open(MountFs* fs, const struct fuse_in_header* in, const void* arg,
+                        size_t arglen)
+{
+    const struct fuse_open_in* open_in = arg;
+    int dir = in->opcode == FUSE_OPENDIR;
+    struct fuse_attr attr;
+    int err = node_attr(fs, in->nodeid, &attr);
+    if (err == 0 && arglen < sizeof(*open_in))
+        err = EINVAL;
+    else if (err == 0 && dir != (in->nodeid == FUSE_ROOT_ID))
+        err = dir ? ENOTDIR : EISDIR;
+    else if (err == 0 && (open_in->flags & O_ACCMODE) != O_RDONLY)
+        err = EROFS;
+
+    struct fuse_open_out out;
+    memset(&out, 0, sizeof(out));
+    out.open_flags = dir ? 0 : FOPEN_KEEP_CACHE;
+    send_reply(fs, in->unique, err, &out, sizeof(out));
+}
+
+/**
+ * @brief Take a cached block of decoded data, decoding it if needed.
+ *
+ * @param fs    Mounted image.
+ * @param start Image offset of the block (multiple of MOUNT_CACHE_BLOCK_SIZE).
+ * @return Block, or NULL on error.
+ */
+static CacheBlock* cache_block(MountFs* fs, uint64_t start)
+{
+    CacheBlock* victim = &fs->cache[0];
+    for (int i = 0; i < MOUNT_CACHE_BLOCKS; i++)
+    {
+        CacheBlock* b = &fs->cache[i];
+        if (b->len > 0 && b->off == start)
+        {
+            b->used = ++fs->tick;
+            return b;
+        }
+        if (b->used < victim->used)
+            victim = b;
+    }
+
+    if (!victim->data && !(victim->data = bufpool_get(MOUNT_CACHE_BLOCK_SIZE)))
+        return NULL;
+    uint64_t left = fs->src->size - start;
+    victim->len = left < MOUNT_CACHE_BLOCK_SIZE ? (size_t)left : MOUNT_CACHE_BLOCK_SIZE;
+    victim->off = start;
+    victim->used = ++fs->tick;
+    if (source_pread(fs->src, victim->data, victim->len, start) != 0)
+    {
+        victim->len = 0;
+        victim->used = 0;
+        return NULL;
+    }
+    return victim;
+}
+
+/**
+ * @brief Copy image data through the block cache.
+ *
+ * @param fs  Mounted image (compressed source).
+ * @param off Image offset.
+ * @param dst Destination buffer.
+ * @param len Number of bytes (within the image).
+ * @return 0 on success, non-zero on error.
+ */
+static int read_cached(MountFs* fs, uint64_t off, uint8_t* dst, size_t len)
+{
+    while (len > 0)
+    {
+        uint64_t start = off - off % MOUNT_CACHE_BLOCK_SIZE;
+        CacheBlock* b = cache_block(fs, start);
+        if (!b)
+            return 1;
+        size_t at = (size_t)(off - start);
+        size_t n = b->len - at < len ? b->len - at : len;
+        memcpy(dst, b->data + at, n);
+        dst += n;
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Discard whatever is left in the splice pipe.
+ *
+ * @param fs Mounted image.
+ */
+static void drain_pipe(MountFs* fs)
+{
+    uint8_t scrap[MOUNT_BLOCK_SIZE];
+    while (read(fs->pipe[0], scrap, sizeof(scrap)) > 0)
+    {
+    }
+}
+
+/**
+ * @brief Reply to a read with image data spliced from the image file.
+ *
+ * The header and the data are queued in the pipe, which then moves to the
+ * connection in one splice, so the data pages are never copied into this
+ * process. If the image file cannot be spliced from, splicing is turned off
+ * for the rest of the session.
+ *
+ * @param fs     Mounted image (direct source, pipe open).
+ * @param unique ID of the request.
+ * @param off    Image offset.
+ * @param len    Number of bytes (within the image).
+ * @return 0 if the reply was sent or is no longer wanted, non-zero to fall back
+ *         to a buffered reply.
+ */
+static int splice_reply(MountFs* fs, uint64_t unique, uint64_t off, size_t len)
+{
+    struct fuse_out_header oh = {(uint32_t)(sizeof(oh) + len), 0, unique};
+    if (write(fs->pipe[1], &oh, sizeof(oh)) != (ssize_t)sizeof(oh))
+    {
+        drain_pipe(fs);
+        return 1;
+    }
+
+    loff_t in_off = (loff_t)(fs->src->base + off);
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = splice(fs->src->fd, &in_off, fs->pipe[1], NULL, len - done, SPLICE_F_MOVE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+            {
+                close(fs->pipe[0]);
+                close(fs->pipe[1]);
+                fs->pipe[0] = fs->pipe[1] = -1;
+            }
+            else
+            {
+                drain_pipe(fs);
+            }
+            return 1;
+        }
+        done += (size_t)n;
+    }
+
+    if (splice(fs->pipe[0], NULL, fs->fd, NULL, sizeof(oh) + len, SPLICE_F_MOVE) < 0)
+    {
+        /* ENOENT: the request was interrupted and needs no reply */
+        int err = errno;
+        drain_pipe(fs);
+        return err != ENOENT;
+    }
+    return 0;
+}
+
+/**
+ * @brief Answer FUSE_READ on a file.
+ *
+ * @param fs     Mounted image.
+ * @param in     Request header.
+ * @param arg    Request argument.
+ * @param arglen Length of arg.
+ */
+static void handle_read(MountFs* fs, const struct fuse_in_header* in, const void* arg,
+                        size_t arglen)
+{
+    const struct fuse_read_in* rd = arg;
+    struct fuse_attr attr;
+    int err = node_attr(fs, in->nodeid, &attr);
+    if (err == 0 && arglen < sizeof(*rd))
+        err = EINVAL;
+    else if (err == 0 && in->nodeid == FUSE_ROOT_ID)
+        err = EISDIR;
+    if (err != 0)
+    {
+        send_reply(fs, in->unique, err, NULL, 0);
+        return;
+    }
+
+    uint64_t off = rd->offset;
+    size_t len = 0;
+    if (off < attr.size)
+    {
+        uint64_t left = attr.size - off;
+        len = rd->size < fs->max_read ? rd->size : fs->max_read;
+        if (left < len)
+            len = (size_t)left;
+    }
+
+    if (in->nodeid == MOUNT_CFG_ID)
+    {
+        send_reply(fs, in->unique, 0, len ? fs->cfg + off : NULL, len);
+        return;
+    }
+
+    /* Image offset of the data */
+    off += fs->files[in->nodeid - MOUNT_FIRST_ENTRY_ID].offset;
+    if (len > 0 && (off > fs->src->size || len > fs->src->size - off))
+    {
+        send_reply(fs, in->unique, EIO, NULL, 0);
+        return;
+    }
+    if (len > 0 && fs->pipe[0] >= 0 && splice_reply(fs, in->unique, off, len) == 0)
+        return;
+
+    if (len > 0 && (source_is_direct(fs->src) ? source_pread(fs->src, fs->out, len, off)
+                                              : read_cached(fs, off, fs->out, len)) != 0)
+        err = EIO;
+    send_reply(fs, in->unique, err, fs->out, len);
+}
+
+/**
+ * @brief Answer FUSE_READDIR on the root directory.
+ *
+ * Directory offsets are slots: 0 is ".", 1 is "..", 2 is image.cfg and
+ * MOUNT_FIRST_ENTRY_ID + i is entry i (slots of entries that are not
+ * listed produce nothing).
+ *
+ * @param fs     Mounted image.
+ * @param in     Request header.
+ * @param arg    Request argument.
+ * @param arglen Length of arg.
+ */
+static void handle_readdir(MountFs* fs, const struct fuse_in_header* in, const void* arg,
+                           size_t arglen)
+{
+    const struct fuse_read_in* rd = arg;
+    if (in->nodeid != FUSE_ROOT_ID || arglen < sizeof(*rd))
+    {
+        send_reply(fs, in->unique, in->nodeid != FUSE_ROOT_ID ? ENOTDIR : EINVAL, NULL, 0);
+        return;
+    }
+
+    size_t cap = rd->size < fs->max_read ? rd->size : fs->max_read;
+    size_t used = 0;
+    uint64_t end = MOUNT_FIRST_ENTRY_ID + (uint64_t)fs->table.count;
+    for (uint64_t slot = rd->offset; slot < end; slot++)
+    {
+        const char* name = ".";
+        uint64_t id = FUSE_ROOT_ID;
+        if (slot == 1)
+        {
+            name = "..";
+        }
+        else if (slot == MOUNT_CFG_ID)
+        {
+            name = MOUNT_CFG_NAME;
+            id = MOUNT_CFG_ID;
+        }
+        else if (slot >= MOUNT_FIRST_ENTRY_ID)
+        {
+            if (!fs->listed[slot - MOUNT_FIRST_ENTRY_ID])
+                continue;
+            name = fs->files[slot - MOUNT_FIRST_ENTRY_ID].filename;
+            id = slot;
+        }
+
+        size_t namelen = strlen(name);
+        size_t rec = FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + namelen);
+        if (used + rec > cap)
+            break;
+        struct fuse_dirent* de = (struct fuse_dirent*)(fs->out + used);
+        memset(de, 0, rec);
+        de->ino = id;
+        de->off = slot + 1;
+        de->namelen = (uint32_t)namelen;
+        de->type = id == FUSE_ROOT_ID ? S_IFDIR >> 12 : S_IFREG >> 12;
+        memcpy(de->name, name, namelen);
+        used += rec;
+    }
+    send_reply(fs, in->unique, 0, fs->out, used);
+}
+
+/**
+ * @brief Answer FUSE_STATFS.
+ *
+ * @param fs Mounted image.
+ * @param in Request header.
+ */
+static void handle_statfs(MountFs* fs, const struct fuse_in_header* in)
+{
+    struct fuse_statfs_out out;
+    memset(&out, 0, sizeof(out));
+    out.st.bsize = MOUNT_BLOCK_SIZE;
+    out.st.frsize = MOUNT_BLOCK_SIZE;
+    out.st.blocks = (fs->src->size + MOUNT_BLOCK_SIZE - 1) / MOUNT_BLOCK_SIZE;
+    out.st.files = fs->listed_count + 2;
+    out.st.namelen = 255;
+    send_reply(fs, in->unique, 0, &out, sizeof(out));
+}
+
+/**
+ * @brief Handle one request.
+ *
+ * @param fs  Mounted image (request in fs->req).
+ * @param len Length of the request.
+ * @return 0 to go on serving, non-zero on a fatal error.
+ */
+static int dispatch(MountFs* fs, size_t len)
+{
+    const struct fuse_in_header* in = (const struct fuse_in_header*)fs->req;
+    if (len < sizeof(*in) || in->len != len)
+    {
+        fprintf(stderr, "Error: malformed request from the kernel\n");
+        return 1;
+    }
+    const uint8_t* arg = fs->req + sizeof(*in);
+    size_t arglen = len - sizeof(*in);
+
+    switch (in->opcode)
+    {
+    case FUSE_INIT:
+        return handle_init(fs, in, arg, arglen);
+    case FUSE_LOOKUP:
+        handle_lookup(fs, in, (const char*)arg, arglen);
+        break;
+    case FUSE_GETATTR:
+        handle_getattr(fs, in);
+        break;
+    case FUSE_OPEN:
+    case FUSE_OPENDIR:
+        handle_open(fs, in, arg, arglen);
+        break;
+    case FUSE_READ:
+        handle_read(fs, in, arg, arglen);
+        break;
+    case FUSE_READDIR:
+        handle_readdir(fs, in, arg, arglen);
+        break;
+    case FUSE_STATFS:
+        handle_statfs(fs, in);
+        break;
+    case FUSE_RELEASE:
+    case FUSE_RELEASEDIR:
+    case FUSE_FLUSH:
+    case FUSE_DESTROY:
+        send_reply(fs, in->unique, 0, NULL, 0);
+        break;
+    case FUSE_FORGET:
+    case FUSE_BATCH_FORGET:
+    case FUSE_INTERRUPT:
+        /* No reply */
+        break;
+    default:
+        send_reply(fs, in->unique, ENOSYS, NULL, 0);
+        break;
+    }
+    return 0;
+}
+
+/**
+ * @brief Run fusermount3 (or fusermount) with the given arguments.
+ *
+ * @param args Arguments after the program name (NULL-terminated).
+ * @param env  "NAME=value" to add to the environment, or NULL.
+ * @return Process ID of the helper, or -1 on error.
+ */
+static pid_t spawn_fusermount(char* const* args, const char* env)
+{
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        if (pid < 0)
+            perror("fork");
+        return pid;
+    }
+
+    char* argv[8] = {"fusermount3"};
+    for (int i = 0; i < 6 && args[i]; i++)
+        argv[i + 1] = args[i];
+    if (env)
+        putenv((char*)env);
+    execvp(argv[0], argv);
+    argv[0] = "fusermount";
+    execvp(argv[0], argv);
+    _exit(127);
+}
+
+/**
+ * @brief Mount through the setuid fusermount helper (unprivileged users).
+ *
+ * The helper mounts the filesystem and passes the /dev/fuse descriptor
+ * back over a socket named by _FUSE_COMMFD.
+ *
+ * @param fs         Mounted image (fd set on success).
+ * @param source     Name shown as the mount source.
+ * @param mountpoint Mount point.
+ * @return 0 on success, non-zero on error.
+ */
+static int helper_mount(MountFs* fs, const char* source, const char* mountpoint)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    {
+        perror("socketpair");
+        return 1;
+    }
+
+    /* Commas and backslashes in the source are escaped for fusermount */
+    char opts[1200] = "ro,nosuid,nodev,default_permissions,subtype=" MOUNT_FS_SUBTYPE ",fsname=";
+    size_t n = strlen(opts);
+    for (const char* p = source; *p && n + 3 < sizeof(opts); p++)
+    {
+        if (*p == ',' || *p == '\\')
+            opts[n++] = '\\';
+        opts[n++] = *p;
+    }
+    opts[n] = '\0';
+
+    char env[32];
+    snprintf(env, sizeof(env), "_FUSE_COMMFD=%d", sv[1]);
+    char* args[] = {"-o", opts, "--", (char*)mountpoint, NULL};
+    pid_t pid = spawn_fusermount(args, env);
+    close(sv[1]);
+    if (pid < 0)
+    {
+        close(sv[0]);
+        return 1;
+    }
+
+    /* One byte of data carries the descriptor */
+    char byte;
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    struct iovec iov = {&byte, 1};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    ssize_t r;
+    while ((r = recvmsg(sv[0], &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+    {
+    }
+    close(sv[0]);
+    waitpid(pid, NULL, 0);
+
+    struct cmsghdr* cm = r > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+    {
+        fprintf(stderr, "Error: cannot mount on '%s' (mounting needs root or fusermount3)\n",
+                mountpoint);
+        return 1;
+    }
+    memcpy(&fs->fd, CMSG_DATA(cm), sizeof(int));
+    fs->helper = 1;
+    return 0;
+}
+
+/**
+ * @brief Open /dev/fuse and mount the view.
+ *
+ * mount(2) is tried first; without the privilege for it, the fusermount
+ * helper mounts instead.
+ *
+ * @param fs         Mounted image (fd set on success).
+ * @param source     Name shown as the mount source.
+ * @param mountpoint Mount point.
+ * @return 0 on success, non-zero on error.
+ */
+static int fuse_mount(MountFs* fs, const char* source, const char* mountpoint)
+{
+    fs->fd = open(FUSE_DEVICE, O_RDWR | O_CLOEXEC);
+    if (fs->fd < 0 && errno != EACCES && errno != EPERM)
+    {
+        fprintf(stderr, "Error: FUSE is not available (%s: %s)\n", FUSE_DEVICE, strerror(errno));
+        return 1;
+    }
+    if (fs->fd >= 0)
+    {
+        char opts[128];
+        snprintf(opts, sizeof(opts),
+                 "fd=%d,rootmode=%o,user_id=%u,group_id=%u,default_permissions", fs->fd,
+                 (unsigned)S_IFDIR, (unsigned)fs->uid, (unsigned)fs->gid);
+        if (mount(source, mountpoint, "fuse." MOUNT_FS_SUBTYPE, MS_RDONLY | MS_NOSUID | MS_NODEV,
+                  opts) == 0)
+            return 0;
+
+        int err = errno;
+        close(fs->fd);
+        fs->fd = -1;
+        if (err != EPERM)
+        {
+            fprintf(stderr, "Error: cannot mount on '%s': %s\n", mountpoint, strerror(err));
+            return 1;
+        }
+    }
+    return helper_mount(fs, source, mountpoint);
+}
+
+/**
+ * @brief Detach the view (lazily, so busy files do not keep it mounted).
+ *
+ * @param fs         Mounted image.
+ * @param mountpoint Mount point.
+ */
+static void fuse_unmount(const MountFs* fs, const char* mountpoint)
+{
+    if (!fs->helper)
+    {
+        if (umount2(mountpoint, MNT_DETACH) != 0 && errno != EINVAL)
+            fprintf(stderr, "Error unmounting '%s': %s\n", mountpoint, strerror(errno));
+        return;
+    }
+
+    char* args[] = {"-u", "-z", "--", (char*)mountpoint, NULL};
+    pid_t pid = spawn_fusermount(args, NULL);
+    if (pid > 0)
+        waitpid(pid, NULL, 0);
+}
+
+/**
+ * @brief Serve requests until the view is unmounted or a stop signal arrives.
+ *
+ * The stop signals are blocked except while waiting for a request, so one
+ * arriving during a request is seen before the next wait.
+ *
+ * @param fs        Mounted image.
+ * @param unmounted Output: set if the view was unmounted from outside.
+ * @return 0 on success, non-zero on error.
+ */
+static int serve(MountFs* fs, int* unmounted)
+{
+    static const int signals[] = {SIGINT, SIGTERM, SIGHUP};
+    struct sigaction sa, old[3];
+    sigset_t block, orig;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop_signal;
+    sigemptyset(&sa.sa_mask);
+    sigemptyset(&block);
+    for (int i = 0; i < 3; i++)
+        sigaddset(&block, signals[i]);
+    sigprocmask(SIG_BLOCK, &block, &orig);
+    for (int i = 0; i < 3; i++)
+        sigaction(signals[i], &sa, &old[i]);
+
+    stop_signal = 0;
+    *unmounted = 0;
+    int ret = 0;
+    while (!stop_signal)
+    {
+        struct pollfd p = {fs->fd, POLLIN, 0};
+        if (ppoll(&p, 1, NULL, &orig) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            ret = 1;
+            break;
+        }
+
+        ssize_t n = read(fs->fd, fs->req, MOUNT_REQUEST_SIZE);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == ENOENT)
+                continue;
+            if (errno == ENODEV)
+            {
+                *unmounted = 1;
+                break;
+            }
+            perror("Error reading from the kernel");
+            ret = 1;
+            break;
+        }
+        if (dispatch(fs, (size_t)n) != 0)
+        {
+            ret = 1;
+            break;
+        }
+    }
+
+    for (int i = 0; i < 3; i++)
+        sigaction(signals[i], &old[i], NULL);
+    sigprocmask(SIG_SETMASK, &orig, NULL);
+    return ret;
+}
+
+/**
+ * @brief Work out which entries are listed and synthesize image.cfg.
+ *
+ * @param fs      Mounted image (src and files set).
+ * @param hdr     Global header.
+ * @param session Arena for the lookup table.
+ * @return 0 on success, non-zero on error.
+ */
+static int build_view(MountFs* fs, const ImageWTYHeader* hdr, Arena* session)
+{
+    uint32_t n = hdr->num_files;
+    fs->listed = arena_calloc(session, n ? n : 1, 1);
+    if (!fs->listed || file_table_build(&fs->table, fs->files, n, session) != 0)
+    {
+        if (!fs->listed)
+            perror("Memory allocation failed");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const ImageWTYFileHeader* fh = &fs->files[i];
+        if (!usable_name(fh->filename) || file_table_find(&fs->table, fh->filename) != (long)i)
+        {
+            fprintf(stderr, "Warning: entry %u ('%s') is not listed: its name is unusable or "
+                            "repeats an earlier entry\n",
+                    i, fh->filename);
+            continue;
+        }
+        if ((uint64_t)fh->offset + fh->original_length > fs->src->size)
+            fprintf(stderr, "Warning: '%s' lies beyond the end of the image; reading it fails\n",
+                    fh->filename);
+        fs->listed[i] = 1;
+        fs->listed_count++;
+    }
+
+    FILE* mf = open_memstream(&fs->cfg, &fs->cfg_len);
+    if (!mf)
+    {
+        perror("open_memstream");
+        return 1;
+    }
+    int ret = write_image_config_stream(mf, hdr, fs->files, n);
+    if (fclose(mf) != 0)
+        ret = 1;
+    if (ret != 0)
+        fprintf(stderr, "Failed to write image.cfg\n");
+    return ret;
+}
+
+/**
+ * @brief Open the pipe read replies are spliced through.
+ *
+ * The pipe must hold a whole reply: the header and the data pages of the
+ * largest read, which may straddle one more page than it covers. If the
+ * pipe cannot grow that far (pipe-max-size is 1 MiB by default), the
+ * largest read is reduced to fit, down to the kernel's default of 128 KiB;
+ * below that, reads are answered from a buffer.
+ *
+ * @param fs Mounted image (page and max_read set).
+ */
+static void open_splice_pipe(MountFs* fs)
+{
+    if (pipe2(fs->pipe, O_CLOEXEC) != 0)
+    {
+        fs->pipe[0] = fs->pipe[1] = -1;
+        return;
+    }
+
+    int size = fcntl(fs->pipe[1], F_SETPIPE_SZ, (int)(fs->max_read + 2 * fs->page));
+    if (size < 0)
+        size = fcntl(fs->pipe[1], F_SETPIPE_SZ, MOUNT_MAX_READ);
+    if (size >= (int)(MOUNT_SPLICE_MIN_READ + 2 * fs->page) &&
+        fcntl(fs->pipe[0], F_SETFL, O_NONBLOCK) == 0)
+    {
+        if ((size_t)size < fs->max_read + 2 * fs->page)
+            fs->max_read = (size_t)size - 2 * fs->page;
+        return;
+    }
+    close(fs->pipe[0]);
+    close(fs->pipe[1]);
+    fs->pipe[0] = fs->pipe[1] = -1;
+}
+
+/**
+ * @brief Mount an image read-only and serve it until it is unmounted.
+ *
+ * @param img_filename Path to the IMAGEWTY image file (possibly gzip or xz
+ *                     compressed), or "bundle.zip!/member".
+ * @param mountpoint   Existing directory to mount the view on.
+ * @return 0 once unmounted, non-zero on error.
+ */
+int mount_image(const char* img_filename, const char* mountpoint)
+{
+    struct stat st;
+    if (strcmp(img_filename, "-") == 0)
+    {
+        fprintf(stderr, "Error: an image on standard input cannot be mounted\n");
+        return 1;
+    }
+    if (stat(mountpoint, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        fprintf(stderr, "Error: mount point '%s' is not a directory\n", mountpoint);
+        return 1;
+    }
+
+    ImageSource src;
+    if (source_open(&src, img_filename) != 0)
+        return 1;
+    FILE* f = source_fopen(&src);
+    if (!f)
+    {
+        source_close(&src);
+        return 1;
+    }
+
+    ImageWTYHeader hdr;
+    read_image_header(f, &hdr);
+    if (strncmp(hdr.magic, IMAGEWTY_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "Error: '%s' is not a valid IMAGEWTY image.\n", img_filename);
+        fclose(f);
+        source_close(&src);
+        return 1;
+    }
+
+    Arena session;
+    arena_init(&session);
+    MountFs fs;
+    memset(&fs, 0, sizeof(fs));
+    fs.src = &src;
+    fs.fd = -1;
+    fs.pipe[0] = fs.pipe[1] = -1;
+    fs.uid = getuid();
+    fs.gid = getgid();
+    long page = sysconf(_SC_PAGESIZE);
+    fs.page = page > 0 ? (size_t)page : MOUNT_BLOCK_SIZE;
+    fs.max_read = MOUNT_MAX_READ;
+    fs.files = read_all_file_headers(f, hdr.num_files, hdr.file_header_length, &session);
+    fclose(f);
+    if (!fs.files)
+        fprintf(stderr, "Error reading file headers from '%s'\n", img_filename);
+
+    int ret = 1;
+    fs.req = bufpool_get(MOUNT_REQUEST_SIZE);
+    fs.out = bufpool_get(MOUNT_MAX_READ);
+    if (fs.files && fs.req && fs.out && build_view(&fs, &hdr, &session) == 0)
+    {
+        if (source_is_direct(&src))
+            open_splice_pipe(&fs);
+        ret = fuse_mount(&fs, img_filename, mountpoint);
+    }
+
+    if (ret == 0)
+    {
+        printf("Mounted '%s' on '%s' (%u files, read-only); press Ctrl-C or unmount to stop\n",
+               img_filename, mountpoint, fs.listed_count + 1);
+        fflush(stdout);
+
+        int unmounted = 0;
+        ret = serve(&fs, &unmounted);
+        if (!unmounted)
+            fuse_unmount(&fs, mountpoint);
+        printf("Unmounted '%s'\n", mountpoint);
+    }
+
+    if (fs.fd >= 0)
+        close(fs.fd);
+    if (fs.pipe[0] >= 0)
+    {
+        close(fs.pipe[0]);
+        close(fs.pipe[1]);
+    }
+    for (int i = 0; i < MOUNT_CACHE_BLOCKS; i++)
+        bufpool_put(fs.cache[i].data);
+    bufpool_put(fs.req);
+    bufpool_put(fs.out);
+    free(fs.cfg);
+    arena_release(&session);
+    source_close(&src);
+    return ret;
+}
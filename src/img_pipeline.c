@@ -0,0 +1,320 @@
+/**
+ * @file img_pipeline.c
+ * @brief Two-stage reader/writer pipeline for payload transfers.
+ *
+ * Chunk k of a transfer always lives in ring slot k % PIPELINE_DEPTH. The
+ * reader may run at most PIPELINE_DEPTH chunks ahead of the writer; both
+ * stages only touch the shared counters under the pipeline lock, and a
+ * slot's contents belong to whichever side the counters say owns it.
+ */
+
+#define _GNU_SOURCE
+
+#include "img_pipeline.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "img_bufpool.h"
+
+/**
+ * @brief One buffer of the ring.
+ */
+typedef struct
+{
+    uint8_t* data; /**< PIPELINE_CHUNK_SIZE bytes */
+    size_t len;    /**< Bytes of valid data */
+    uint32_t sum;  /**< Checksum of the data, valid if summed is set */
+    int summed;    /**< Set once the reader has computed sum */
+} PipelineSlot;
+
+/**
+ * @brief State shared by the reader thread and the writer.
+ */
+typedef struct
+{
+    int in_fd;                          /**< Source file descriptor */
+    uint64_t in_off;                    /**< Source offset */
+    uint64_t len;                       /**< Number of bytes to transfer */
+    uint64_t chunks;                    /**< Number of chunks in the transfer */
+    int want_sum;                       /**< Compute chunk checksums */
+    PipelineSlot slots[PIPELINE_DEPTH]; /**< Ring buffers */
+    uint64_t filled;                    /**< Chunks published by the reader */
+    uint64_t drained;                   /**< Chunks released by the writer */
+    int writer_waiting;                 /**< Writer is blocked on an empty ring */
+    int failed;                         /**< Set by either stage on error */
+    pthread_mutex_t lock;               /**< Protects the fields above */
+    pthread_cond_t cond;                /**< Signalled on every state change */
+} Pipeline;
+
+/**
+ * @brief Checksum one chunk on its own.
+ *
+ * All chunks but the last are a multiple of 4 bytes long, so the checksum
+ * of a range is the (wrapping) sum of its chunk checksums.
+ *
+ * @param data Chunk data.
+ * @param len  Chunk length.
+ * @return Checksum of the chunk.
+ */
+static uint32_t chunk_checksum(const uint8_t* data, size_t len)
+{
+    ChecksumState st;
+    checksum_init(&st);
+    checksum_update(&st, data, len);
+    return checksum_final(&st);
+}
+
+/**
+ * @brief Read exactly len bytes at an absolute offset.
+ *
+ * @param fd  Source file descriptor.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @param off Source offset.
+ * @return 0 on success, non-zero on error or premature end of file.
+ */
+static int read_full(int fd, uint8_t* buf, size_t len, uint64_t off)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t r = pread(fd, buf + done, len - done, (off_t)(off + done));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+        {
+            fprintf(stderr, "Error reading data: %s\n",
+                    r < 0 ? strerror(errno) : "unexpected end of file");
+            return 1;
+        }
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+/**
+ * @brief Write exactly len bytes at an absolute offset.
+ *
+ * @param fd  Destination file descriptor.
+ * @param buf Source buffer.
+ * @param len Number of bytes to write.
+ * @param off Destination offset.
+ * @return 0 on success, non-zero on error.
+ */
+static int write_full(int fd, const uint8_t* buf, size_t len, uint64_t off)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t w = pwrite(fd, buf + done, len - done, (off_t)(off + done));
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+        {
+            perror("Error writing data");
+            return 1;
+        }
+        done += (size_t)w;
+    }
+    return 0;
+}
+
+/**
+ * @brief Mark the transfer as failed and wake the other stage.
+ *
+ * @param p Pipeline state.
+ */
+static void pipeline_fail(Pipeline* p)
+{
+    pthread_mutex_lock(&p->lock);
+    p->failed = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/**
+ * @brief Length of chunk k of a transfer.
+ *
+ * @param p Pipeline state.
+ * @param k Chunk index.
+ * @return Number of bytes in the chunk.
+ */
+static size_t chunk_length(const Pipeline* p, uint64_t k)
+{
+    uint64_t left = p->len - k * PIPELINE_CHUNK_SIZE;
+    return left > PIPELINE_CHUNK_SIZE ? PIPELINE_CHUNK_SIZE : (size_t)left;
+}
+
+/**
+ * @brief Reader stage: fill ring slots from the source range in order.
+ *
+ * @param arg Pipeline state.
+ * @return Always NULL (errors are reported through Pipeline.failed).
+ */
+static void* reader_main(void* arg)
+{
+    Pipeline* p = arg;
+
+    for (uint64_t k = 0; k < p->chunks; k++)
+    {
+        pthread_mutex_lock(&p->lock);
+        while (!p->failed && k - p->drained == PIPELINE_DEPTH)
+            pthread_cond_wait(&p->cond, &p->lock);
+        int failed = p->failed;
+        pthread_mutex_unlock(&p->lock);
+        if (failed)
+            break;
+
+        PipelineSlot* s = &p->slots[k % PIPELINE_DEPTH];
+        s->len = chunk_length(p, k);
+        s->summed = 0;
+        if (read_full(p->in_fd, s->data, s->len, p->in_off + k * PIPELINE_CHUNK_SIZE) != 0)
+        {
+            pipeline_fail(p);
+            break;
+        }
+
+        /* Sum here unless that would keep an idle writer waiting */
+        pthread_mutex_lock(&p->lock);
+        int hurry = p->writer_waiting;
+        pthread_mutex_unlock(&p->lock);
+        if (p->want_sum && !hurry)
+        {
+            s->sum = chunk_checksum(s->data, s->len);
+            s->summed = 1;
+        }
+
+        pthread_mutex_lock(&p->lock);
+        p->filled = k + 1;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Copy chunk by chunk in the calling thread (single chunk or no thread).
+ *
+ * @param p       Pipeline state.
+ * @param out_fd  Destination file descriptor.
+ * @param out_off Destination offset.
+ * @param sum     Checksum accumulator.
+ * @return 0 on success, non-zero on error.
+ */
+static int copy_serial(Pipeline* p, int out_fd, uint64_t out_off, uint32_t* sum)
+{
+    PipelineSlot* s = &p->slots[0];
+
+    for (uint64_t k = 0; k < p->chunks; k++)
+    {
+        uint64_t pos = k * PIPELINE_CHUNK_SIZE;
+        s->len = chunk_length(p, k);
+        if (read_full(p->in_fd, s->data, s->len, p->in_off + pos) != 0 ||
+            write_full(out_fd, s->data, s->len, out_off + pos) != 0)
+        {
+            return 1;
+        }
+        if (p->want_sum)
+            *sum += chunk_checksum(s->data, s->len);
+    }
+    return 0;
+}
+
+/**
+ * @brief Copy a byte range between two different files through the pipeline.
+ *
+ * @param in_fd    Source file descriptor.
+ * @param in_off   Source offset.
+ * @param out_fd   Destination file descriptor (must differ from in_fd).
+ * @param out_off  Destination offset.
+ * @param len      Number of bytes to copy.
+ * @param checksum Optional output: V*.fex checksum of the copied data.
+ * @return 0 on success, non-zero on error.
+ */
+int pipeline_copy_range(int in_fd, uint64_t in_off, int out_fd, uint64_t out_off, uint64_t len,
+                        uint32_t* checksum)
+{
+    uint8_t* ring_buf = bufpool_get((size_t)PIPELINE_DEPTH * PIPELINE_CHUNK_SIZE);
+    if (!ring_buf)
+        return 1;
+
+    Pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.in_fd = in_fd;
+    p.in_off = in_off;
+    p.len = len;
+    p.chunks = (len + PIPELINE_CHUNK_SIZE - 1) / PIPELINE_CHUNK_SIZE;
+    p.want_sum = checksum != NULL;
+    for (int i = 0; i < PIPELINE_DEPTH; i++)
+        p.slots[i].data = ring_buf + (size_t)i * PIPELINE_CHUNK_SIZE;
+
+    uint32_t sum = 0;
+    int ret = 0;
+    pthread_t reader;
+
+    if (p.chunks < 2 || pthread_mutex_init(&p.lock, NULL) != 0)
+    {
+        ret = copy_serial(&p, out_fd, out_off, &sum);
+    }
+    else if (pthread_cond_init(&p.cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&p.lock);
+        ret = copy_serial(&p, out_fd, out_off, &sum);
+    }
+    else if (pthread_create(&reader, NULL, reader_main, &p) != 0)
+    {
+        pthread_cond_destroy(&p.cond);
+        pthread_mutex_destroy(&p.lock);
+        ret = copy_serial(&p, out_fd, out_off, &sum);
+    }
+    else
+    {
+        /* Writer stage: drain the ring in order */
+        for (uint64_t k = 0; k < p.chunks; k++)
+        {
+            pthread_mutex_lock(&p.lock);
+            while (!p.failed && p.filled == k)
+            {
+                p.writer_waiting = 1;
+                pthread_cond_wait(&p.cond, &p.lock);
+            }
+            p.writer_waiting = 0;
+            int failed = p.failed;
+            pthread_mutex_unlock(&p.lock);
+            if (failed)
+            {
+                ret = 1;
+                break;
+            }
+
+            PipelineSlot* s = &p.slots[k % PIPELINE_DEPTH];
+            if (write_full(out_fd, s->data, s->len, out_off + k * PIPELINE_CHUNK_SIZE) != 0)
+            {
+                pipeline_fail(&p);
+                ret = 1;
+                break;
+            }
+            if (p.want_sum)
+                sum += s->summed ? s->sum : chunk_checksum(s->data, s->len);
+
+            pthread_mutex_lock(&p.lock);
+            p.drained = k + 1;
+            pthread_cond_broadcast(&p.cond);
+            pthread_mutex_unlock(&p.lock);
+        }
+
+        pthread_join(reader, NULL);
+        pthread_cond_destroy(&p.cond);
+        pthread_mutex_destroy(&p.lock);
+    }
+
+    bufpool_put(ring_buf);
+    if (checksum)
+        *checksum = sum;
+    return ret;
+}
@@ -11,19 +11,65 @@
  * @note All operations assume the standard IMAGEWTY file format and header sizes.
  */
 
+#define _GNU_SOURCE
+
 #include "img_repack.h"
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "checksum.h"
 #include "config_file.h"
+#include "file_table.h"
+#include "img_cache.h"
+#include "img_bufpool.h"
 #include "img_header.h"
+#include "img_io.h"
+#include "img_lz4.h"
+#include "img_tar.h"
+#include "manifest.h"
+#include "sha256.h"
+
+/** Returned by repack_incremental() when the previous image cannot be reused */
+#define INCREMENTAL_FALLBACK 2
+
+/** Returned by write_full_image() when a V*.fex fix requires a new layout */
+#define REPACK_RELAYOUT 3
+
+/** Largest image.cfg accepted from an archive (it is parsed in memory) */
+#define TAR_CONFIG_MAX_SIZE (16 * 1024 * 1024)
+
+/** Size of the buffer payloads of a streamed archive are copied through */
+#define TAR_STREAM_BUFFER_SIZE (1024 * 1024)
+
+/**
+ * @brief Data range of one entry inside an archive.
+ */
+typedef struct
+{
+    uint64_t offset; /**< Archive offset of the data */
+    uint64_t size;   /**< Data size */
+} TarPayload;
+
+/**
+ * @brief Where payload data is read from: a dump folder or an archive.
+ */
+typedef struct
+{
+    const char* dump_folder;   /**< Dump directory, or NULL for an archive */
+    int tar_fd;                /**< Archive input (seekable archives) */
+    const TarPayload* members; /**< Data range of each entry (seekable archives) */
+    const uint32_t* heads;     /**< First four bytes of each entry (streamed archives) */
+} PayloadSource;
 
 /**
  * @brief Calculate aligned stored length and padding for a file.
@@ -42,233 +88,2277 @@ void calculate_padding(uint64_t original_length, uint64_t* stored_length, uint64
 }
 
 /**
- * @brief Repack a directory dump into a new IMAGEWTY file.
+ * @brief Fill a RepackOptions structure with the default settings.
  *
- * The function follows the IMAGEWTY format standard:
- *  - Updates virtual files if needed.
- *  - Loads global header and file headers from image.cfg.
- *  - Writes global header.
- *  - Writes file headers (1024 bytes each by default).
- *  - Copies actual file data with proper padding.
+ * @param opts Options to initialize.
+ */
+void repack_options_init(RepackOptions* opts)
+{
+    memset(opts, 0, sizeof(*opts));
+    opts->alignment = PADDING_ALIGNMENT;
+}
+
+/**
+ * @brief Check that a payload alignment is acceptable for repack.
  *
- * @param dump_folder Path to the extracted dump directory.
- * @param output_file Path to the resulting IMAGEWTY file.
- * @return 0 on success, non-zero on error.
+ * @param alignment Requested alignment in bytes.
+ * @return 0 if valid, non-zero otherwise.
  */
-int repack_image(const char* dump_folder, const char* output_file)
+int validate_alignment(uint64_t alignment)
 {
-    if (!dump_folder || !output_file)
+    if (alignment < PADDING_ALIGNMENT || alignment > MAX_PAYLOAD_ALIGNMENT ||
+        (alignment & (alignment - 1)) != 0)
     {
-        fprintf(stderr, "repack_image: invalid parameters\n");
+        fprintf(stderr,
+                "Invalid alignment %llu: must be a power of two between %d and %d bytes\n",
+                (unsigned long long)alignment, PADDING_ALIGNMENT, MAX_PAYLOAD_ALIGNMENT);
         return 1;
     }
+    return 0;
+}
 
-    // Update virtual files if necessary
-    update_vfiles_if_needed(dump_folder);
+/**
+ * @brief Round an offset up to a multiple of the given alignment.
+ *
+ * @param offset Offset in bytes.
+ * @param alignment Alignment in bytes (power of two).
+ * @return Aligned offset.
+ */
+uint64_t align_offset(uint64_t offset, uint32_t alignment)
+{
+    return (offset + alignment - 1) & ~((uint64_t)alignment - 1);
+}
 
-    // Load global header and file headers from image.cfg
-    char cfg_path[1024];
-    snprintf(cfg_path, sizeof(cfg_path), "%s/image.cfg", dump_folder);
+/**
+ * @brief Build the file table of a layout and find its shared data ranges.
+ *
+ * @param table Output: file table of the layout.
+ * @param hdr Global header.
+ * @param files File headers with computed offsets.
+ * @param session Arena of the repack session.
+ * @return For each entry, the index of the earlier entry whose data range it
+ *         repeats or -1 (see file_table_shared_ranges()), or NULL on error.
+ */
+static long* find_shared_ranges(FileTable* table, const ImageWTYHeader* hdr,
+                                const ImageWTYFileHeader* files, Arena* session)
+{
+    long* shared = arena_alloc(session, (size_t)hdr->num_files * sizeof(*shared));
+    if (!shared)
+    {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+    if (file_table_build(table, files, hdr->num_files, session) != 0 ||
+        file_table_shared_ranges(table, shared, session) != 0)
+    {
+        return NULL;
+    }
+    return shared;
+}
 
-    ImageWTYHeader hdr;
-    ImageWTYFileHeader* files = NULL;
+/**
+ * @brief Find the entries whose checksum a V*.fex entry of the layout holds.
+ *
+ * Only these payloads need to be summed while they are written; the others
+ * keep the plain copy path (copy_file_range, reflink). An entry sharing its
+ * range with a target (--dedup) marks the earlier entry it repeats.
+ *
+ * @param table File table of the layout.
+ * @param shared Shared ranges from find_shared_ranges().
+ * @param session Arena of the repack session.
+ * @return Per-entry flags, or NULL on error.
+ */
+static uint8_t* find_checksum_targets(const FileTable* table, const long* shared,
+                                      Arena* session)
+{
+    uint8_t* targets = arena_calloc(session, table->count, sizeof(*targets));
+    if (!targets)
+    {
+        perror("Memory allocation failed");
+        return NULL;
+    }
 
-    if (load_image_config(cfg_path, &hdr, &files) != 0 || !files)
+    for (uint32_t i = 0; i < table->count; i++)
     {
-        fprintf(stderr, "Failed to load image.cfg from '%s'\n", cfg_path);
+        const char* vname = file_table_str(table, table->filename[i]);
+        long t = is_checksum_vfile(vname) ? file_table_find(table, vname + 1) : -1;
+        if (t >= 0)
+            targets[shared[t] >= 0 ? shared[t] : t] = 1;
+    }
+    return targets;
+}
+
+/**
+ * @brief Check a computed layout against the constraints the loader relies on.
+ *
+ * PhoenixSuit reads each payload from its offset using stored_length, so
+ * every entry must start on a PADDING_ALIGNMENT boundary, carry a stored
+ * length padded exactly as calculate_padding() does, stay clear of the
+ * header table and of other entries, and fit in the 32-bit size fields.
+ * The only permitted overlap is an exact repeat of an earlier entry's range
+ * (see RepackOptions.dedup).
+ *
+ * @param hdr Global header.
+ * @param files File headers with computed offsets.
+ * @param session Arena of the repack session.
+ * @return 0 if the layout is valid, non-zero otherwise.
+ */
+static int check_loader_layout(const ImageWTYHeader* hdr, const ImageWTYFileHeader* files,
+                               Arena* session)
+{
+    uint64_t table_end =
+        IMG_HEADER_HEADER_SIZE + (uint64_t)hdr->num_files * hdr->file_header_length;
+    uint64_t prev_end = table_end;
+
+    FileTable t;
+    long* shared = find_shared_ranges(&t, hdr, files, session);
+    if (!shared)
         return 1;
+
+    for (uint32_t i = 0; i < t.count; i++)
+    {
+        uint64_t stored_length, padding;
+        calculate_padding(t.original_length[i], &stored_length, &padding);
+
+        if (shared[i] >= 0)
+            continue;
+
+        if (t.offset[i] % PADDING_ALIGNMENT != 0 || t.stored_length[i] != stored_length ||
+            t.offset[i] < prev_end || (uint64_t)t.offset[i] + t.stored_length[i] > UINT32_MAX)
+        {
+            fprintf(stderr, "Layout check failed for '%s' (offset 0x%X, stored %u)\n",
+                    file_table_str(&t, t.filename[i]), t.offset[i], t.stored_length[i]);
+            return 1;
+        }
+        prev_end = (uint64_t)t.offset[i] + t.stored_length[i];
     }
+    return 0;
+}
 
-    // Open output file
-    FILE* out = fopen(output_file, "wb");
-    if (!out)
+/**
+ * @brief Get the size of an entry's data in a payload source.
+ *
+ * @param src Payload source.
+ * @param files File headers.
+ * @param i Index of the entry.
+ * @param size Output: data size in bytes.
+ * @return 0 on success, non-zero on error.
+ */
+static int source_size(const PayloadSource* src, const ImageWTYFileHeader* files, uint32_t i,
+                       uint64_t* size)
+{
+    if (src->members)
     {
-        fprintf(stderr, "Cannot create output file '%s': %s\n", output_file, strerror(errno));
-        free(files);
-        return 1;
+        *size = src->members[i].size;
+        return 0;
     }
 
-    // ------------------------------------------------------------------
-    // Write Global Header
-    // ------------------------------------------------------------------
-    uint8_t gh_buf[IMG_HEADER_HEADER_SIZE];
-    memset(gh_buf, 0, sizeof(gh_buf));
-
-    memcpy(gh_buf + 0x00, hdr.magic, 8);
-    memcpy(gh_buf + 0x08, &hdr.header_version, 4);
-    memcpy(gh_buf + 0x0C, &hdr.header_size, 4);
-    memcpy(gh_buf + 0x10, &hdr.base_ram, 4);
-    memcpy(gh_buf + 0x14, &hdr.format_version, 4);
-    memcpy(gh_buf + 0x18, &hdr.total_image_size, 4);
-    memcpy(gh_buf + 0x1C, &hdr.header_size_aligned, 4);
-    memcpy(gh_buf + 0x20, &hdr.file_header_length, 4);
-    memcpy(gh_buf + 0x24, &hdr.usb_product_id, 4);
-    memcpy(gh_buf + 0x28, &hdr.usb_vendor_id, 4);
-    memcpy(gh_buf + 0x2C, &hdr.hardware_id, 4);
-    memcpy(gh_buf + 0x30, &hdr.firmware_id, 4);
-    memcpy(gh_buf + 0x34, &hdr.unknown1, 4);
-    memcpy(gh_buf + 0x38, &hdr.unknown2, 4);
-    memcpy(gh_buf + 0x3C, &hdr.num_files, 4);
-    memcpy(gh_buf + 0x40, &hdr.unknown3, 4);
-
-    if (fwrite(gh_buf, 1, sizeof(gh_buf), out) != sizeof(gh_buf))
-    {
-        perror("Error writing global header");
-        free(files);
-        fclose(out);
+    char filepath[1024];
+    snprintf(filepath, sizeof(filepath), "%s/%s", src->dump_folder, files[i].filename);
+
+    struct stat st;
+    if (stat(filepath, &st) == 0)
+    {
+        *size = (uint64_t)st.st_size;
+        return 0;
+    }
+    if (errno != ENOENT)
+    {
+        fprintf(stderr, "Cannot stat file '%s': %s\n", filepath, strerror(errno));
         return 1;
     }
 
-    // ------------------------------------------------------------------
-    // Update stored_length and offset for each file
-    // ------------------------------------------------------------------
-    uint64_t offset = IMG_HEADER_HEADER_SIZE + (hdr.num_files * hdr.file_header_length);
+    /* Only an entry stored as <name>.lz4 needs its frame header read */
+    Lz4Input in;
+    if (lz4_input_open(filepath, &in) != 0)
+        return 1;
+    *size = in.size;
+    lz4_input_close(&in);
+    return 0;
+}
 
-    for (uint32_t i = 0; i < hdr.num_files; i++)
-    {
-        ImageWTYFileHeader* fh = &files[i];
+/**
+ * @brief io_read_range() callback feeding a SHA-256 context.
+ *
+ * @param data Chunk of data.
+ * @param len Chunk length.
+ * @param ctx Sha256Context to update.
+ * @return Always 0.
+ */
+static int sha256_chunk(const uint8_t* data, size_t len, void* ctx)
+{
+    sha256_update((Sha256Context*)ctx, data, len);
+    return 0;
+}
 
-        char filepath[1024];
-        snprintf(filepath, sizeof(filepath), "%s/%s", dump_folder, fh->filename);
+/**
+ * @brief Chunk sink writing decompressed entry data into the image.
+ */
+typedef struct
+{
+    int fd;           /**< Output image */
+    uint64_t off;     /**< Image offset of the next byte */
+    ChecksumState st; /**< Running checksum of the data */
+    int want_sum;     /**< Update st */
+} PayloadSink;
+
+/**
+ * @brief lz4_input_read() callback writing entry data at its image offset.
+ *
+ * @param data Chunk of data.
+ * @param len Chunk length.
+ * @param ctx PayloadSink.
+ * @return 0 on success, non-zero on a write error.
+ */
+static int payload_chunk(const uint8_t* data, size_t len, void* ctx)
+{
+    PayloadSink* sink = ctx;
+    if (sink->want_sum)
+        checksum_update(&sink->st, data, len);
 
-        FILE* in = fopen(filepath, "rb");
-        if (!in)
+    while (len > 0)
+    {
+        ssize_t w = pwrite(sink->fd, data, len, (off_t)sink->off);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
         {
-            fprintf(stderr, "Cannot open file '%s': %s\n", filepath, strerror(errno));
-            free(files);
-            fclose(out);
+            perror("Error writing image");
             return 1;
         }
+        data += w;
+        len -= (size_t)w;
+        sink->off += (uint64_t)w;
+    }
+    return 0;
+}
 
-        fseek(in, 0, SEEK_END);
-        uint64_t original_length = ftell(in);
-        rewind(in);
-        fclose(in);
-
-        uint64_t stored_length, padding;
-        calculate_padding(original_length, &stored_length, &padding);
-
-        fh->original_length = original_length;
-        fh->stored_length = stored_length;
-        fh->offset = offset;
+/**
+ * @brief lz4_input_read() callback appending entry data to a stream.
+ *
+ * @param data Chunk of data.
+ * @param len Chunk length.
+ * @param ctx Pointer to the output file descriptor.
+ * @return 0 on success, non-zero on a write error.
+ */
+static int stream_chunk(const uint8_t* data, size_t len, void* ctx)
+{
+    return io_write_all(*(const int*)ctx, data, len);
+}
 
-        offset += stored_length;
+/**
+ * @brief Open an entry of a dump folder (plain or LZ4 compressed).
+ *
+ * @param dump_folder Dump directory.
+ * @param fh File header of the entry.
+ * @param in Output: opened entry.
+ * @return 0 on success, non-zero on error (including a size that no longer
+ *         matches the layout).
+ */
+static int open_dump_entry(const char* dump_folder, const ImageWTYFileHeader* fh, Lz4Input* in)
+{
+    char filepath[1024];
+    snprintf(filepath, sizeof(filepath), "%s/%s", dump_folder, fh->filename);
+    if (lz4_input_open(filepath, in) != 0)
+        return 1;
+    if (in->size != fh->original_length)
+    {
+        fprintf(stderr, "'%s' changed size during the repack\n", filepath);
+        lz4_input_close(in);
+        return 1;
     }
+    return 0;
+}
 
-    // ------------------------------------------------------------------
-    // Write File Headers
-    // ------------------------------------------------------------------
-    for (uint32_t i = 0; i < hdr.num_files; i++)
+/**
+ * @brief Hash an entry's data once, caching the digest.
+ *
+ * @param src Payload source.
+ * @param files File headers.
+ * @param i Index of the entry.
+ * @param digest Digest cache slot for the entry.
+ * @param hashed Flag telling whether the cache slot is valid.
+ * @return 0 on success, non-zero on error.
+ */
+static int hash_entry(const PayloadSource* src, const ImageWTYFileHeader* files, uint32_t i,
+                      uint8_t* digest, uint8_t* hashed)
+{
+    if (*hashed)
+        return 0;
+
+    if (src->members)
     {
-        ImageWTYFileHeader* fh = &files[i];
-        uint8_t* fh_buf = malloc(hdr.file_header_length);
-        if (!fh_buf)
+        Sha256Context ctx;
+        sha256_init(&ctx);
+        if (io_read_range(src->tar_fd, src->members[i].offset, src->members[i].size,
+                          sha256_chunk, &ctx) != 0)
         {
-            perror("Memory allocation failed for file header");
-            free(files);
-            fclose(out);
             return 1;
         }
-        memset(fh_buf, 0, hdr.file_header_length);
-
-        memcpy(fh_buf + 0x00, &fh->filename_length, sizeof(fh->filename_length));
-        memcpy(fh_buf + 0x04, &fh->header_size, sizeof(fh->header_size));
-        memcpy(fh_buf + 0x08, fh->maintype, 8);
-        memcpy(fh_buf + 0x10, fh->subtype, 16);
-        memcpy(fh_buf + 0x20, &fh->unknown0, sizeof(fh->unknown0));
-        memcpy(fh_buf + 0x24, fh->filename, 256);
-        memcpy(fh_buf + 0x124, &fh->stored_length, sizeof(fh->stored_length));
-        memset(fh_buf + 0x128, 0, 4); // pad1
-        memcpy(fh_buf + 0x12C, &fh->original_length, sizeof(fh->original_length));
-        memset(fh_buf + 0x130, 0, 4); // pad2
-        memcpy(fh_buf + 0x134, &fh->offset, sizeof(fh->offset));
-
-        if (fseek(out, IMG_HEADER_HEADER_SIZE + i * hdr.file_header_length, SEEK_SET) != 0)
-        {
-            perror("Error seeking to file header position");
-            free(fh_buf);
-            free(files);
-            fclose(out);
+        sha256_final(&ctx, digest);
+    }
+    else
+    {
+        char filepath[1024];
+        snprintf(filepath, sizeof(filepath), "%s/%s", src->dump_folder, files[i].filename);
+
+        Lz4Input in;
+        if (lz4_input_open(filepath, &in) != 0)
+            return 1;
+        Sha256Context ctx;
+        sha256_init(&ctx);
+        int ret = lz4_input_read(&in, sha256_chunk, &ctx);
+        lz4_input_close(&in);
+        if (ret != 0)
             return 1;
+        sha256_final(&ctx, digest);
+    }
+
+    *hashed = 1;
+    return 0;
+}
+
+/**
+ * @brief Find an earlier entry with byte-identical contents.
+ *
+ * Sizes are compared first; contents are hashed only when sizes match.
+ * Archive entries backed by the same member (hard links) match without
+ * hashing.
+ *
+ * @param src Payload source.
+ * @param files File headers (entries before i already have their layout).
+ * @param i Index of the entry to look up.
+ * @param digests Per-entry digest cache.
+ * @param hashed Per-entry flags telling which digests are valid.
+ * @return Index of the earlier entry, -1 if none, -2 on error.
+ */
+static long find_duplicate(const PayloadSource* src, const ImageWTYFileHeader* files, uint32_t i,
+                           uint8_t (*digests)[SHA256_DIGEST_SIZE], uint8_t* hashed)
+{
+    for (uint32_t j = 0; j < i; j++)
+    {
+        if (files[j].original_length != files[i].original_length)
+            continue;
+        if (src->members && src->members[j].offset == src->members[i].offset)
+            return (long)j;
+
+        if (hash_entry(src, files, i, digests[i], &hashed[i]) != 0 ||
+            hash_entry(src, files, j, digests[j], &hashed[j]) != 0)
+        {
+            return -2;
         }
+        if (memcmp(digests[i], digests[j], SHA256_DIGEST_SIZE) == 0)
+            return (long)j;
+    }
+    return -1;
+}
 
-        if (fwrite(fh_buf, 1, hdr.file_header_length, out) != hdr.file_header_length)
+/**
+ * @brief Compute stored lengths, offsets and the total image size.
+ *
+ * Every payload is placed after the header table in image.cfg order, with
+ * offsets rounded up to the requested alignment. With opts->dedup, entries
+ * identical to an earlier one reuse its offset instead. The resulting total
+ * size is stored in hdr->total_image_size.
+ *
+ * @param src Payload source.
+ * @param hdr Global header (total_image_size is updated).
+ * @param files File headers (lengths and offsets are updated).
+ * @param opts Repack options.
+ * @param session Arena of the repack session (scratch arrays).
+ * @return 0 on success, non-zero on error.
+ */
+static int compute_layout(const PayloadSource* src, ImageWTYHeader* hdr,
+                          ImageWTYFileHeader* files, const RepackOptions* opts, Arena* session)
+{
+    /* Content hashes for --dedup, computed only for files whose size repeats */
+    uint8_t(*digests)[SHA256_DIGEST_SIZE] = NULL;
+    uint8_t* hashed = NULL;
+    if (opts->dedup)
+    {
+        digests = arena_calloc(session, hdr->num_files, sizeof(*digests));
+        hashed = arena_calloc(session, hdr->num_files, 1);
+        if (!digests || !hashed)
         {
-            perror("Error writing file header");
-            free(fh_buf);
-            free(files);
-            fclose(out);
+            perror("Memory allocation failed");
             return 1;
         }
-
-        free(fh_buf);
     }
 
-    // ------------------------------------------------------------------
-    // Write file data with padding
-    // ------------------------------------------------------------------
-    for (uint32_t i = 0; i < hdr.num_files; i++)
+    int ret = 0;
+    uint64_t offset = IMG_HEADER_HEADER_SIZE + (hdr->num_files * hdr->file_header_length);
+    uint64_t end = offset;
+    offset = align_offset(offset, opts->alignment);
+
+    for (uint32_t i = 0; i < hdr->num_files; i++)
     {
         ImageWTYFileHeader* fh = &files[i];
-        char filepath[1024];
-        snprintf(filepath, sizeof(filepath), "%s/%s", dump_folder, fh->filename);
 
-        FILE* in = fopen(filepath, "rb");
-        if (!in)
+        uint64_t original_length;
+        if (source_size(src, files, i, &original_length) != 0)
         {
-            fprintf(stderr, "Cannot open file '%s'\n", filepath);
-            free(files);
-            fclose(out);
-            return 1;
+            ret = 1;
+            break;
         }
 
-        if (fseek(out, fh->offset, SEEK_SET) != 0)
-        {
-            perror("Error seeking in output file");
-            fclose(in);
-            free(files);
-            fclose(out);
-            return 1;
-        }
+        uint64_t stored_length, padding;
+        calculate_padding(original_length, &stored_length, &padding);
 
-        uint8_t* buf = malloc(fh->original_length);
-        size_t read_bytes = fread(buf, 1, fh->original_length, in);
-        if (read_bytes != fh->original_length)
+        if (offset + stored_length > UINT32_MAX)
         {
-            fprintf(stderr, "Error reading file %s: read %zu bytes instead of %u\n", filepath,
-                    read_bytes, fh->original_length);
-            free(buf);
-            fclose(in);
-            free(files);
-            fclose(out);
-            return 1;
+            fprintf(stderr, "Error: '%s' does not fit in a 32-bit IMAGEWTY image\n",
+                    fh->filename);
+            ret = 1;
+            break;
         }
 
-        fwrite(buf, 1, fh->original_length, out);
-        free(buf);
-        fclose(in);
+        fh->original_length = original_length;
+        fh->stored_length = stored_length;
 
-        // Write padding
-        if (fh->stored_length > fh->original_length)
+        /* Point identical payloads at the data of the first copy */
+        if (opts->dedup && original_length > 0)
         {
-            uint8_t zero_buf[PADDING_ALIGNMENT] = {0};
-            uint64_t pad_remaining = fh->stored_length - fh->original_length;
-            while (pad_remaining > 0)
+            long dup = find_duplicate(src, files, i, digests, hashed);
+            if (dup == -2)
+            {
+                ret = 1;
+                break;
+            }
+            if (dup >= 0)
             {
-                uint64_t write_now =
-                    pad_remaining > PADDING_ALIGNMENT ? PADDING_ALIGNMENT : pad_remaining;
-                fwrite(zero_buf, 1, write_now, out);
-                pad_remaining -= write_now;
+                fh->offset = files[dup].offset;
+                continue;
             }
         }
 
-        printf("Packed: %s (original: %u, stored: %u)\n", fh->filename, fh->original_length,
-               fh->stored_length);
+        fh->offset = offset;
+
+        if (offset + stored_length > end)
+            end = offset + stored_length;
+        offset = align_offset(offset + stored_length, opts->alignment);
+    }
+
+    if (ret != 0)
+        return ret;
+
+    hdr->total_image_size = (uint32_t)end;
+    return check_loader_layout(hdr, files, session);
+}
+
+/**
+ * @brief Allocate the final size of the output file before writing data.
+ *
+ * Reserving all blocks at once avoids extent fragmentation and repeated
+ * metadata updates while a multi-GB image grows, and reports a full disk
+ * before any data is written. Filesystems without fallocate() support are
+ * simply written to incrementally.
+ *
+ * @param out Output file.
+ * @param size Final image size in bytes.
+ * @return 0 on success (or if unsupported), non-zero on error.
+ */
+static int preallocate_output(FILE* out, uint64_t size)
+{
+    if (size == 0 || fallocate(fileno(out), 0, 0, (off_t)size) == 0)
+        return 0;
+
+    if (errno == EOPNOTSUPP || errno == ENOSYS)
+        return 0;
+
+    fprintf(stderr, "Cannot reserve %llu bytes for output image: %s\n",
+            (unsigned long long)size, strerror(errno));
+    return 1;
+}
+
+/**
+ * @brief Build the path of the manifest written next to an image.
+ *
+ * @param image_path Path to the image.
+ * @param out Output buffer.
+ * @param size Size of the output buffer.
+ */
+static void manifest_path_for(const char* image_path, char* out, size_t size)
+{
+    snprintf(out, size, "%s.manifest", image_path);
+}
+
+/**
+ * @brief Load the manifest of a previously repacked image.
+ *
+ * A manifest older than its image is ignored, since the image was modified
+ * afterwards (e.g. by 'replace') and no longer matches it.
+ *
+ * @param image_path Path to the previous image.
+ * @param m Manifest to populate (empty if none is usable).
+ * @return 0 if a usable manifest was loaded, non-zero otherwise.
+ */
+static int load_base_manifest(const char* image_path, FileManifest* m)
+{
+    char path[1100];
+    manifest_path_for(image_path, path, sizeof(path));
+
+    m->entries = NULL;
+    m->count = 0;
+
+    struct stat img_st, man_st;
+    if (stat(image_path, &img_st) != 0 || stat(path, &man_st) != 0)
+        return 1;
+
+    if (img_st.st_mtim.tv_sec > man_st.st_mtim.tv_sec ||
+        (img_st.st_mtim.tv_sec == man_st.st_mtim.tv_sec &&
+         img_st.st_mtim.tv_nsec > man_st.st_mtim.tv_nsec))
+    {
+        printf("Note: '%s' was modified after its manifest was written\n", image_path);
+        return 1;
     }
+    return manifest_load(path, m);
+}
 
-    free(files);
-    fclose(out);
+/**
+ * @brief Describe every payload of the image in a manifest.
+ *
+ * @param dump_folder Path to the extracted dump directory.
+ * @param hdr Global header.
+ * @param files File headers.
+ * @param cache Previous manifest whose hashes may be reused (may be NULL).
+ * @param out Manifest to fill in (one record per entry, in table order).
+ * @return 0 on success, non-zero on error.
+ */
+static int describe_payloads(const char* dump_folder, const ImageWTYHeader* hdr,
+                             const ImageWTYFileHeader* files, const FileManifest* cache,
+                             FileManifest* out)
+{
+    out->count = 0;
+    out->entries = calloc(hdr->num_files ? hdr->num_files : 1, sizeof(ManifestEntry));
+    if (!out->entries)
+    {
+        perror("Memory allocation failed");
+        return 1;
+    }
 
-    printf("Repack completed successfully: %s\n", output_file);
+    for (uint32_t i = 0; i < hdr->num_files; i++)
+    {
+        if (manifest_describe_file(dump_folder, files[i].filename, cache, &out->entries[i],
+                                   NULL) != 0)
+        {
+            manifest_free(out);
+            return 1;
+        }
+        out->count++;
+    }
     return 0;
 }
+
+/**
+ * @brief Check whether a payload differs from the one recorded in a manifest.
+ *
+ * @param base Manifest of the previous image.
+ * @param cur Record describing the current file.
+ * @return Non-zero if the file is new or its size or hash changed.
+ */
+static int payload_changed(const FileManifest* base, const ManifestEntry* cur)
+{
+    const ManifestEntry* old = manifest_find(base, cur->filename);
+    return !old || old->size != cur->size ||
+           memcmp(old->digest, cur->digest, SHA256_DIGEST_SIZE) != 0;
+}
+
+/**
+ * @brief Check whether an entry's data range overlaps any other entry.
+ *
+ * @param files File headers.
+ * @param num_files Number of entries.
+ * @param i Index of the entry to check.
+ * @return Non-zero if another entry uses part of the same range.
+ */
+static int range_overlaps_other(const ImageWTYFileHeader* files, uint32_t num_files, uint32_t i)
+{
+    uint64_t start = files[i].offset;
+    uint64_t end = start + files[i].stored_length;
+
+    for (uint32_t j = 0; j < num_files; j++)
+    {
+        if (j == i || files[j].stored_length == 0)
+            continue;
+        if (files[j].offset < end && start < (uint64_t)files[j].offset + files[j].stored_length)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Bring the checksums of V*.fex files with changed targets up to date.
+ *
+ * Unlike update_vfiles_if_needed(), only the payloads that changed since
+ * the previous manifest are read (along with V*.fex files that were edited
+ * themselves). Records of rewritten V*.fex files are refreshed.
+ *
+ * @param dump_folder Path to the extracted dump directory.
+ * @param base Previous manifest.
+ * @param manifest Manifest of the current dump folder (updated).
+ * @return 0 on success, non-zero on error.
+ */
+static int update_changed_vfiles(const char* dump_folder, const FileManifest* base,
+                                 FileManifest* manifest)
+{
+    for (uint32_t i = 0; i < manifest->count; i++)
+    {
+        ManifestEntry* ve = &manifest->entries[i];
+        if (!is_checksum_vfile(ve->filename))
+            continue;
+
+        const ManifestEntry* target = manifest_find(manifest, ve->filename + 1);
+        if (!target || (!payload_changed(base, target) && !payload_changed(base, ve)))
+            continue;
+
+        update_vfile_if_needed(dump_folder, ve->filename);
+
+        char name[sizeof(ve->filename)];
+        memcpy(name, ve->filename, sizeof(name));
+        if (manifest_describe_file(dump_folder, name, NULL, ve, NULL) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copy one entry's data into the image and zero its padding.
+ *
+ * A dump folder entry stored as <name>.lz4 is decompressed on the way.
+ *
+ * @param src Payload source.
+ * @param files File headers with the final offsets and lengths.
+ * @param i Index of the entry.
+ * @param out_fd Output image file descriptor.
+ * @param checksum Optional output: V*.fex checksum of the payload, computed
+ *                 while copying (see io_copy_range_checksum()).
+ * @return 0 on success, non-zero on error.
+ */
+static int write_payload(const PayloadSource* src, const ImageWTYFileHeader* files, uint32_t i,
+                         int out_fd, uint32_t* checksum)
+{
+    const ImageWTYFileHeader* fh = &files[i];
+    int in_fd = src->tar_fd;
+    uint64_t in_off = 0;
+    Lz4Input in = {-1, 0, 0};
+
+    if (src->members)
+    {
+        in_off = src->members[i].offset;
+    }
+    else
+    {
+        if (open_dump_entry(src->dump_folder, fh, &in) != 0)
+            return 1;
+        in_fd = in.fd;
+    }
+
+    int ret;
+    if (in.compressed)
+    {
+        /* Decoded in parallel and written at the entry's offset */
+        PayloadSink sink = {out_fd, fh->offset, {0}, checksum != NULL};
+        checksum_init(&sink.st);
+        ret = lz4_input_read(&in, payload_chunk, &sink);
+        if (ret == 0 && checksum)
+            *checksum = checksum_final(&sink.st);
+    }
+    else
+    {
+        ret = checksum ? io_copy_range_checksum(in_fd, in_off, out_fd, fh->offset,
+                                                fh->original_length, checksum)
+                       : io_copy_range(in_fd, in_off, out_fd, fh->offset, fh->original_length);
+    }
+    if (!src->members)
+        lz4_input_close(&in);
+
+    if (ret == 0)
+    {
+        ret = io_write_zeros(out_fd, (uint64_t)fh->offset + fh->original_length,
+                             fh->stored_length - fh->original_length);
+    }
+    return ret;
+}
+
+/**
+ * @brief Open the previous image and check that its file table can be reused.
+ *
+ * @param base_path Path to the previous image.
+ * @param hdr Global header loaded from image.cfg.
+ * @param files File headers loaded from image.cfg.
+ * @param base_files Output: file headers of the previous image.
+ * @param session Arena the previous image's header table is allocated from.
+ * @return Open FILE* of the previous image, or NULL if it cannot be reused.
+ */
+static FILE* open_incremental_base(const char* base_path, const ImageWTYHeader* hdr,
+                                   const ImageWTYFileHeader* files,
+                                   ImageWTYFileHeader** base_files, Arena* session)
+{
+    struct stat st;
+    if (stat(base_path, &st) != 0 || (uint64_t)st.st_size < IMG_HEADER_HEADER_SIZE)
+        return NULL;
+
+    FILE* base = fopen(base_path, "rb");
+    if (!base)
+        return NULL;
+
+    ImageWTYHeader base_hdr;
+    read_image_header(base, &base_hdr);
+    if (strncmp(base_hdr.magic, IMAGEWTY_MAGIC, 8) != 0 ||
+        base_hdr.num_files != hdr->num_files ||
+        base_hdr.file_header_length != hdr->file_header_length)
+    {
+        printf("Note: file table of '%s' differs from image.cfg\n", base_path);
+        fclose(base);
+        return NULL;
+    }
+
+    *base_files =
+        read_all_file_headers(base, base_hdr.num_files, base_hdr.file_header_length, session);
+    for (uint32_t i = 0; i < hdr->num_files; i++)
+    {
+        if (strcmp((*base_files)[i].filename, files[i].filename) != 0)
+        {
+            printf("Note: file table of '%s' differs from image.cfg\n", base_path);
+            *base_files = NULL;
+            fclose(base);
+            return NULL;
+        }
+    }
+    return base;
+}
+
+/**
+ * @brief Update a previous image instead of writing a new one from scratch.
+ *
+ * Payloads whose size and SHA-256 match the previous image's manifest keep
+ * their data range untouched. Changed payloads are rewritten in place when
+ * they still fit in their old range (and do not share it with another
+ * entry), and are appended at the end of the image otherwise. The header
+ * table is then rewritten. If the output is a different file, the previous
+ * image is first cloned to it (as a reflink where the filesystem allows).
+ *
+ * @param dump_folder Path to the extracted dump directory.
+ * @param output_file Path to the resulting IMAGEWTY file.
+ * @param opts Repack options (opts->incremental_base is the previous image).
+ * @param hdr Global header loaded from image.cfg (total_image_size is updated).
+ * @param files File headers loaded from image.cfg (layout is filled in).
+ * @param base_manifest Manifest of the previous image.
+ * @param manifest Output: manifest of the current dump folder.
+ * @param session Arena of the repack session.
+ * @return 0 on success, INCREMENTAL_FALLBACK if a full repack is needed,
+ *         any other value on error.
+ */
+static int repack_incremental(const char* dump_folder, const char* output_file,
+                              const RepackOptions* opts, ImageWTYHeader* hdr,
+                              ImageWTYFileHeader* files, const FileManifest* base_manifest,
+                              FileManifest* manifest, Arena* session)
+{
+    const char* base_path = opts->incremental_base;
+    ImageWTYFileHeader* base_files = NULL;
+    PayloadSource src = {dump_folder, -1, NULL, NULL};
+
+    FILE* base = open_incremental_base(base_path, hdr, files, &base_files, session);
+    if (!base)
+        return INCREMENTAL_FALLBACK;
+
+    /* The manifest must describe what the previous image actually contains */
+    for (uint32_t i = 0; i < hdr->num_files; i++)
+    {
+        const ManifestEntry* old = manifest_find(base_manifest, files[i].filename);
+        if (!old || old->size != base_files[i].original_length)
+        {
+            printf("Note: manifest of '%s' does not match the image\n", base_path);
+            fclose(base);
+            return INCREMENTAL_FALLBACK;
+        }
+    }
+
+    if (describe_payloads(dump_folder, hdr, files, base_manifest, manifest) != 0 ||
+        update_changed_vfiles(dump_folder, base_manifest, manifest) != 0)
+    {
+        fclose(base);
+        return 1;
+    }
+
+    // ------------------------------------------------------------------
+    // Layout: keep unchanged ranges, reuse or append ranges of changed files
+    // ------------------------------------------------------------------
+    uint64_t end = IMG_HEADER_HEADER_SIZE + (uint64_t)hdr->num_files * hdr->file_header_length;
+    for (uint32_t i = 0; i < hdr->num_files; i++)
+    {
+        uint64_t range_end = (uint64_t)base_files[i].offset + base_files[i].stored_length;
+        if (range_end > end)
+            end = range_end;
+    }
+
+    uint8_t* changed = arena_calloc(session, hdr->num_files, 1);
+    if (!changed)
+    {
+        perror("Memory allocation failed");
+        fclose(base);
+        return 1;
+    }
+
+    uint32_t num_changed = 0;
+    for (uint32_t i = 0; i < hdr->num_files; i++)
+    {
+        ImageWTYFileHeader* fh = &files[i];
+        const ManifestEntry* cur = &manifest->entries[i];
+
+        fh->original_length = (uint32_t)cur->size;
+        if (!payload_changed(base_manifest, cur))
+        {
+            fh->offset = base_files[i].offset;
+            fh->stored_length = base_files[i].stored_length;
+            continue;
+        }
+
+        uint64_t stored_length, padding;
+        calculate_padding(cur->size, &stored_length, &padding);
+        fh->stored_length = (uint32_t)stored_length;
+        changed[i] = 1;
+        num_changed++;
+
+        if (stored_length <= base_files[i].stored_length &&
+            !range_overlaps_other(base_files, hdr->num_files, i))
+        {
+            fh->offset = base_files[i].offset;
+            continue;
+        }
+
+        uint64_t offset = align_offset(end, opts->alignment);
+        if (offset + stored_length > UINT32_MAX)
+        {
+            fprintf(stderr, "Error: '%s' does not fit in a 32-bit IMAGEWTY image\n",
+                    fh->filename);
+            fclose(base);
+            return 1;
+        }
+        fh->offset = (uint32_t)offset;
+        end = offset + stored_length;
+    }
+    hdr->total_image_size = (uint32_t)end;
+
+    // ------------------------------------------------------------------
+    // Open the output: the previous image itself, or a clone of it
+    // ------------------------------------------------------------------
+    struct stat base_st, out_st;
+    int in_place = fstat(fileno(base), &base_st) == 0 && stat(output_file, &out_st) == 0 &&
+                   base_st.st_dev == out_st.st_dev && base_st.st_ino == out_st.st_ino;
+
+    FILE* out = fopen(output_file, in_place ? "r+b" : "w+b");
+    if (!out)
+    {
+        fprintf(stderr, "Cannot open output file '%s': %s\n", output_file, strerror(errno));
+        fclose(base);
+        return 1;
+    }
+
+    int ret = 0;
+    if (!in_place)
+        ret = io_clone_file(fileno(base), fileno(out), (uint64_t)base_st.st_size);
+    fclose(base);
+
+    if (ret == 0 && end > (uint64_t)base_st.st_size)
+        ret = preallocate_output(out, end);
+
+    // ------------------------------------------------------------------
+    // Rewrite changed payloads first, then the header table
+    // ------------------------------------------------------------------
+    for (uint32_t i = 0; ret == 0 && i < hdr->num_files; i++)
+    {
+        const ImageWTYFileHeader* fh = &files[i];
+        if (!changed[i])
+        {
+            printf("Reused: %s\n", fh->filename);
+            continue;
+        }
+
+        ret = write_payload(&src, files, i, fileno(out), NULL);
+        if (ret == 0)
+        {
+            printf("Packed: %s (original: %u, stored: %u, offset: 0x%X)\n", fh->filename,
+                   fh->original_length, fh->stored_length, fh->offset);
+        }
+    }
+
+    if (ret == 0)
+        ret = write_image_header(out, hdr);
+    for (uint32_t i = 0; ret == 0 && i < hdr->num_files; i++)
+        ret = write_file_header(out, &files[i], i, hdr->file_header_length);
+
+    if (ret == 0 && (fflush(out) != 0 || ftruncate(fileno(out), (off_t)end) != 0))
+    {
+        perror("Error finalizing output image");
+        ret = 1;
+    }
+    if (fclose(out) != 0 && ret == 0)
+    {
+        perror("Error closing output image");
+        ret = 1;
+    }
+    if (ret != 0)
+        return ret;
+
+    printf("Incremental repack completed: %s (%u bytes, %u of %u entries rewritten)\n",
+           output_file, hdr->total_image_size, num_changed, hdr->num_files);
+    return 0;
+}
+
+/**
+ * @brief Bring V*.fex checksums up to date from the checksums computed while writing.
+ *
+ * Replaces the update_vfiles_if_needed() pass over the dump folder: a stale
+ * V-file is corrected both in the dump folder and in the written image, so
+ * no payload has to be read twice. The first four bytes are overwritten in
+ * place, which keeps the computed layout valid. Archives are only read, so
+ * for them just the image is corrected.
+ *
+ * @param src Payload source.
+ * @param out_fd Output image file descriptor (written to only).
+ * @param table File table of the layout.
+ * @param sums Checksum of each entry's data.
+ * @return 0 on success, REPACK_RELAYOUT if a V-file range shared with another
+ *         entry (--dedup) had to change, 1 on error (including a shared
+ *         V-file read from an archive, which cannot be laid out again).
+ */
+static int fix_vfiles_in_image(const PayloadSource* src, int out_fd, const FileTable* table,
+                               const uint32_t* sums)
+{
+    int ret = 0;
+
+    for (uint32_t i = 0; i < table->count; i++)
+    {
+        const char* vname = file_table_str(table, table->filename[i]);
+        if (!is_checksum_vfile(vname))
+            continue;
+
+        const char* realname = vname + 1;
+        long t = file_table_find(table, realname);
+        if (t < 0)
+            continue;
+
+        char vfile_path[1024];
+        uint8_t chk[4];
+        int vfd = -1;
+        uint32_t expected;
+
+        if (src->heads)
+        {
+            if (table->original_length[i] < 4)
+            {
+                fprintf(stderr, "Failed to read checksum from '%s'\n", vname);
+                continue;
+            }
+            expected = src->heads[i];
+        }
+        else
+        {
+            if (src->members)
+            {
+                snprintf(vfile_path, sizeof(vfile_path), "%s", vname);
+                if (src->members[i].size < 4 ||
+                    pread(src->tar_fd, chk, 4, (off_t)src->members[i].offset) != 4)
+                {
+                    fprintf(stderr, "Failed to read checksum from '%s'\n", vfile_path);
+                    continue;
+                }
+            }
+            else
+            {
+                snprintf(vfile_path, sizeof(vfile_path), "%s/%s", src->dump_folder, vname);
+                vfd = open(vfile_path, O_RDWR);
+                if (vfd < 0)
+                {
+                    fprintf(stderr, "Cannot open '%s'\n", vfile_path);
+                    continue;
+                }
+                if (pread(vfd, chk, 4, 0) != 4)
+                {
+                    fprintf(stderr, "Failed to read checksum from '%s'\n", vfile_path);
+                    close(vfd);
+                    continue;
+                }
+            }
+            expected = (uint32_t)chk[0] | ((uint32_t)chk[1] << 8) | ((uint32_t)chk[2] << 16) |
+                       ((uint32_t)chk[3] << 24);
+        }
+        uint32_t actual = sums[t];
+
+        if (actual == expected)
+        {
+            printf("[OK]   %s checksum matches (%u)\n", realname, actual);
+            if (vfd >= 0)
+                close(vfd);
+            continue;
+        }
+
+        printf("[FIX]  %s checksum mismatch: expected %u, got %u -> updating...\n", realname,
+               expected, actual);
+
+        uint8_t newbuf[4] = {(uint8_t)(actual & 0xFF), (uint8_t)((actual >> 8) & 0xFF),
+                             (uint8_t)((actual >> 16) & 0xFF), (uint8_t)((actual >> 24) & 0xFF)};
+
+        if (vfd >= 0)
+        {
+            if (pwrite(vfd, newbuf, 4, 0) != 4)
+            {
+                fprintf(stderr, "Cannot write '%s': %s\n", vfile_path, strerror(errno));
+                close(vfd);
+                return 1;
+            }
+            close(vfd);
+            printf("       Updated checksum in %s to %u\n", vname, actual);
+        }
+
+        // Entries deduplicated onto this range would change with it
+        for (uint32_t j = 0; j < table->count; j++)
+        {
+            if (j != i && table->offset[j] == table->offset[i] &&
+                table->stored_length[j] == table->stored_length[i])
+            {
+                ret = REPACK_RELAYOUT;
+            }
+        }
+        if (ret == REPACK_RELAYOUT && !src->dump_folder)
+        {
+            fprintf(stderr, "%s shares its data with another entry and cannot be corrected; "
+                            "repack without --dedup\n",
+                    vname);
+            return 1;
+        }
+        if (ret != REPACK_RELAYOUT && pwrite(out_fd, newbuf, 4, table->offset[i]) != 4)
+        {
+            perror("Error patching image");
+            return 1;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Write a complete image from a computed layout.
+ *
+ * @param src Payload source.
+ * @param output_file Path to the resulting IMAGEWTY file.
+ * @param hdr Global header with the computed total size.
+ * @param files File headers with computed offsets.
+ * @param fix_vfiles If non-zero, checksum the payloads V*.fex files refer to
+ *                   while copying them and correct stale V*.fex files
+ *                   afterwards (see fix_vfiles_in_image()).
+ * @param session Arena of the repack session.
+ * @return 0 on success, REPACK_RELAYOUT if the layout must be recomputed
+ *         and the image written again, 1 on error.
+ */
+static int write_full_image(const PayloadSource* src, const char* output_file,
+                            const ImageWTYHeader* hdr, const ImageWTYFileHeader* files,
+                            int fix_vfiles, Arena* session)
+{
+    struct timespec start, done;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Open output file
+    FILE* out = fopen(output_file, "wb");
+    if (!out)
+    {
+        fprintf(stderr, "Cannot create output file '%s': %s\n", output_file, strerror(errno));
+        return 1;
+    }
+
+    // Reserve the full image size upfront (fails fast with ENOSPC)
+    if (preallocate_output(out, hdr->total_image_size) != 0)
+    {
+        fclose(out);
+        return 1;
+    }
+
+    // ------------------------------------------------------------------
+    // Write Global Header
+    // ------------------------------------------------------------------
+    if (write_image_header(out, hdr) != 0)
+    {
+        fclose(out);
+        return 1;
+    }
+
+    // ------------------------------------------------------------------
+    // Write File Headers
+    // ------------------------------------------------------------------
+    for (uint32_t i = 0; i < hdr->num_files; i++)
+    {
+        if (write_file_header(out, &files[i], i, hdr->file_header_length) != 0)
+        {
+            fclose(out);
+            return 1;
+        }
+    }
+
+    // ------------------------------------------------------------------
+    // Write file data with padding (fd-level copies, see img_io.h)
+    // ------------------------------------------------------------------
+    if (fflush(out) != 0)
+    {
+        perror("Error writing headers");
+        fclose(out);
+        return 1;
+    }
+
+    FileTable table;
+    long* shared = find_shared_ranges(&table, hdr, files, session);
+    uint32_t* sums = NULL;
+    uint8_t* targets = NULL;
+    if (!shared || (fix_vfiles && !(sums = arena_calloc(session, hdr->num_files, sizeof(*sums)))))
+    {
+        if (shared)
+            perror("Memory allocation failed");
+        fclose(out);
+        return 1;
+    }
+    if (sums && !(targets = find_checksum_targets(&table, shared, session)))
+    {
+        fclose(out);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < hdr->num_files; i++)
+    {
+        const ImageWTYFileHeader* fh = &files[i];
+
+        // Shared payloads (--dedup) are written only once
+        if (shared[i] >= 0)
+        {
+            printf("Shared: %s (same data as %s at 0x%X)\n", fh->filename,
+                   files[shared[i]].filename, fh->offset);
+            if (sums)
+                sums[i] = sums[shared[i]];
+            continue;
+        }
+
+        if (write_payload(src, files, i, fileno(out), targets && targets[i] ? &sums[i] : NULL) != 0)
+        {
+            fclose(out);
+            return 1;
+        }
+
+        printf("Packed: %s (original: %u, stored: %u)\n", fh->filename, fh->original_length,
+               fh->stored_length);
+    }
+
+    int ret = 0;
+    if (sums)
+    {
+        printf("\nChecking V*.fex checksums...\n");
+        ret = fix_vfiles_in_image(src, fileno(out), &table, sums);
+    }
+
+    if (fclose(out) != 0)
+    {
+        perror("Error closing output image");
+        return 1;
+    }
+    if (ret != 0)
+        return ret;
+
+    // Remember the achieved throughput for 'repack --plan' estimates
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    cache_record_throughput(hdr->total_image_size, (double)(done.tv_sec - start.tv_sec) +
+                                                       (done.tv_nsec - start.tv_nsec) / 1e9);
+
+    printf("Repack completed successfully: %s (%u bytes)\n", output_file, hdr->total_image_size);
+    return 0;
+}
+
+/**
+ * @brief Write a complete image to a non-seekable stream, strictly in order.
+ *
+ * The header, the header table and then every payload in offset order are
+ * emitted with zero fill for padding and gaps, up to total_image_size.
+ * Nothing can be patched afterwards, so V*.fex files must already be
+ * correct when this is called.
+ *
+ * @param dump_folder Path to the extracted dump directory.
+ * @param out_fd Output stream.
+ * @param hdr Global header with the computed total size.
+ * @param files File headers with computed offsets.
+ * @param session Arena of the repack session.
+ * @return 0 on success, 1 on error.
+ */
+static int write_stream_image(const char* dump_folder, int out_fd, const ImageWTYHeader* hdr,
+                              const ImageWTYFileHeader* files, Arena* session)
+{
+    FileTable table;
+    long* shared = find_shared_ranges(&table, hdr, files, session);
+    uint32_t* order = arena_calloc(session, hdr->num_files, sizeof(*order));
+    if (!shared || !order || file_table_sort_by_offset(&table, order, session) != 0)
+    {
+        if (shared && !order)
+            perror("Memory allocation failed");
+        return 1;
+    }
+
+    uint8_t* buf = bufpool_get(hdr->file_header_length > IMG_HEADER_HEADER_SIZE
+                                   ? hdr->file_header_length
+                                   : IMG_HEADER_HEADER_SIZE);
+    if (!buf)
+        return 1;
+
+    // Global header and header table
+    serialize_image_header(hdr, buf);
+    int ret = io_write_all(out_fd, buf, IMG_HEADER_HEADER_SIZE);
+    for (uint32_t i = 0; i < hdr->num_files && ret == 0; i++)
+    {
+        serialize_file_header(&files[i], buf, hdr->file_header_length);
+        ret = io_write_all(out_fd, buf, hdr->file_header_length);
+    }
+    bufpool_put(buf);
+    uint64_t pos = FILE_HEADERS_START + (uint64_t)hdr->num_files * hdr->file_header_length;
+
+    // Payloads in offset order; zero fill covers padding and alignment gaps
+    for (uint32_t k = 0; k < hdr->num_files && ret == 0; k++)
+    {
+        uint32_t i = order[k];
+        const ImageWTYFileHeader* fh = &files[i];
+        if (shared[i] >= 0)
+        {
+            printf("Shared: %s (same data as %s at 0x%X)\n", fh->filename,
+                   files[shared[i]].filename, fh->offset);
+            continue;
+        }
+        if (fh->original_length == 0)
+            continue;
+        if (fh->offset < pos)
+        {
+            fprintf(stderr, "Layout error: '%s' starts before the end of earlier data\n",
+                    fh->filename);
+            ret = 1;
+            break;
+        }
+
+        Lz4Input in;
+        if (open_dump_entry(dump_folder, fh, &in) != 0)
+        {
+            ret = 1;
+            break;
+        }
+        ret = io_send_zeros(out_fd, fh->offset - pos);
+        if (ret == 0)
+            ret = in.compressed ? lz4_input_read(&in, stream_chunk, &out_fd)
+                                : io_send_range(in.fd, 0, out_fd, fh->original_length);
+        lz4_input_close(&in);
+        pos = (uint64_t)fh->offset + fh->original_length;
+
+        if (ret == 0)
+            printf("Packed: %s (original: %u, stored: %u)\n", fh->filename, fh->original_length,
+                   fh->stored_length);
+    }
+
+    if (ret == 0 && pos < hdr->total_image_size)
+        ret = io_send_zeros(out_fd, hdr->total_image_size - pos);
+    if (ret == 0)
+        printf("Repack completed successfully: <stdout> (%u bytes)\n", hdr->total_image_size);
+    return ret;
+}
+
+/**
+ * @brief Repack to standard output.
+ *
+ * Standard output carries the image, so progress messages are sent to
+ * standard error for the duration. Stale V*.fex files are corrected in the
+ * dump folder before the layout is computed, since the stream cannot be
+ * patched once written.
+ *
+ * @param dump_folder Path to the extracted dump directory.
+ * @param opts Repack options.
+ * @param hdr Global header loaded from image.cfg.
+ * @param files File headers loaded from image.cfg.
+ * @param session Arena of the repack session.
+ * @return 0 on success, non-zero on error.
+ */
+static int repack_to_stdout(const char* dump_folder, const RepackOptions* opts,
+                            ImageWTYHeader* hdr, ImageWTYFileHeader* files, Arena* session)
+{
+    int out_fd = io_claim_stdout();
+    if (out_fd < 0)
+        return 1;
+
+    printf("Checking V*.fex checksums...\n");
+    update_vfiles_if_needed(dump_folder);
+
+    PayloadSource src = {dump_folder, -1, NULL, NULL};
+    int ret = compute_layout(&src, hdr, files, opts, session);
+    if (ret == 0)
+        ret = write_stream_image(dump_folder, out_fd, hdr, files, session);
+
+    io_restore_stdout(out_fd);
+    return ret;
+}
+
+/**
+ * @brief Compute the build cache key of a repack.
+ *
+ * Hashes image.cfg, the serialized header table and the content digest of
+ * every payload: together they determine every byte of the output image.
+ *
+ * @param dump_folder Path to the extracted dump directory.
+ * @param hdr Global header with the computed layout.
+ * @param files File headers with the computed layout.
+ * @param manifest Payload records (one per entry, in table order).
+ * @param key_hex Output: hex-encoded key (SHA256_HEX_SIZE bytes).
+ * @return 0 on success, non-zero on error.
+ */
+static int compute_cache_key(const char* dump_folder, const ImageWTYHeader* hdr,
+                             const ImageWTYFileHeader* files, const FileManifest* manifest,
+                             char* key_hex)
+{
+    char cfg_path[1024];
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    snprintf(cfg_path, sizeof(cfg_path), "%s/image.cfg", dump_folder);
+    if (sha256_file(cfg_path, digest) != 0)
+        return 1;
+
+    uint8_t* buf = bufpool_get(hdr->file_header_length > IMG_HEADER_HEADER_SIZE
+                                   ? hdr->file_header_length
+                                   : IMG_HEADER_HEADER_SIZE);
+    if (!buf)
+        return 1;
+
+    Sha256Context ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, (const uint8_t*)"imagewty-build 1", 16);
+    sha256_update(&ctx, digest, sizeof(digest));
+
+    serialize_image_header(hdr, buf);
+    sha256_update(&ctx, buf, IMG_HEADER_HEADER_SIZE);
+    for (uint32_t i = 0; i < hdr->num_files; i++)
+    {
+        serialize_file_header(&files[i], buf, hdr->file_header_length);
+        sha256_update(&ctx, buf, hdr->file_header_length);
+        sha256_update(&ctx, manifest->entries[i].digest, SHA256_DIGEST_SIZE);
+    }
+    bufpool_put(buf);
+
+    sha256_final(&ctx, digest);
+    sha256_to_hex(digest, key_hex);
+    return 0;
+}
+
+/**
+ * @brief Full repack through the build cache.
+ *
+ * Payload digests come from the dump folder's hash cache, so only files
+ * modified since the last run are read before the key is known. On a hit
+ * the cached image is copied (reflinked where possible) to the output; on a
+ * miss the image is written normally and then added to the cache.
+ *
+ * @param dump_folder Path to the extracted dump directory.
+ * @param output_file Path to the resulting IMAGEWTY file.
+ * @param opts Repack options (opts->cache_dir is the cache directory).
+ * @param hdr Global header loaded from image.cfg (layout is filled in).
+ * @param files File headers loaded from image.cfg (layout is filled in).
+ * @param manifest Output: manifest of the current dump folder.
+ * @param session Arena of the repack session.
+ * @return 0 on success, non-zero on error.
+ */
+static int repack_cached(const char* dump_folder, const char* output_file,
+                         const RepackOptions* opts, ImageWTYHeader* hdr,
+                         ImageWTYFileHeader* files, FileManifest* manifest, Arena* session)
+{
+    char hashes_path[1100];
+    snprintf(hashes_path, sizeof(hashes_path), "%s/%s", dump_folder, CACHE_DUMP_HASHES_FILE);
+
+    FileManifest known;
+    manifest_load(hashes_path, &known);
+
+    int ret = describe_payloads(dump_folder, hdr, files, &known, manifest);
+    if (ret == 0)
+        ret = update_changed_vfiles(dump_folder, &known, manifest);
+    manifest_free(&known);
+    if (ret != 0)
+        return ret;
+
+    /* Losing the hash cache only costs rehashing on the next run */
+    manifest_save(hashes_path, manifest);
+
+    char key[SHA256_HEX_SIZE];
+    PayloadSource src = {dump_folder, -1, NULL, NULL};
+    if (compute_layout(&src, hdr, files, opts, session) != 0 ||
+        compute_cache_key(dump_folder, hdr, files, manifest, key) != 0)
+    {
+        return 1;
+    }
+
+    if (cache_fetch(opts->cache_dir, key, output_file) == 0)
+    {
+        printf("Cache hit: %s (%u bytes, key %.16s)\n", output_file, hdr->total_image_size, key);
+        return 0;
+    }
+
+    ret = write_full_image(&src, output_file, hdr, files, 0, session);
+    if (ret == 0 && cache_store(opts->cache_dir, key, output_file) == 0)
+        printf("Stored in cache: key %.16s\n", key);
+    return ret;
+}
+
+/**
+ * @brief Print a string as a JSON string literal.
+ *
+ * @param out Output stream.
+ * @param str String to print.
+ */
+static void print_json_string(FILE* out, const char* str)
+{
+    fputc('"', out);
+    for (const unsigned char* p = (const unsigned char*)str; *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            fprintf(out, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(out, "\\u%04x", *p);
+        else
+            fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+/**
+ * @brief Print the planned layout and I/O estimate of a repack as JSON.
+ *
+ * @param output_file Path of the image that would be written.
+ * @param opts Repack options.
+ * @param hdr Global header with the computed layout.
+ * @param files File headers with the computed layout.
+ * @param session Arena of the repack session.
+ * @return 0 on success, non-zero on error.
+ */
+static int print_plan(const char* output_file, const RepackOptions* opts,
+                      const ImageWTYHeader* hdr, const ImageWTYFileHeader* files, Arena* session)
+{
+    uint64_t read_bytes = 0;
+    FileTable table;
+    long* shared = find_shared_ranges(&table, hdr, files, session);
+    if (!shared)
+        return 1;
+
+    printf("{\n  \"output\": ");
+    print_json_string(stdout, output_file);
+    printf(",\n  \"header_size\": %d,\n", IMG_HEADER_HEADER_SIZE);
+    printf("  \"file_header_length\": %u,\n", hdr->file_header_length);
+    printf("  \"num_files\": %u,\n", hdr->num_files);
+    printf("  \"alignment\": %u,\n", opts->alignment);
+    printf("  \"total_image_size\": %u,\n", hdr->total_image_size);
+    printf("  \"files\": [");
+
+    for (uint32_t i = 0; i < hdr->num_files; i++)
+    {
+        const ImageWTYFileHeader* fh = &files[i];
+
+        printf("%s\n    {\"filename\": ", i ? "," : "");
+        print_json_string(stdout, fh->filename);
+        printf(", \"maintype\": ");
+        print_json_string(stdout, fh->maintype);
+        printf(", \"subtype\": ");
+        print_json_string(stdout, fh->subtype);
+        printf(", \"offset\": %u, \"original_length\": %u, \"stored_length\": %u, "
+               "\"padding\": %u, \"shared_with\": ",
+               fh->offset, fh->original_length, fh->stored_length,
+               fh->stored_length - fh->original_length);
+        if (shared[i] >= 0)
+            print_json_string(stdout, files[shared[i]].filename);
+        else
+            printf("null");
+        printf("}");
+
+        if (shared[i] < 0)
+            read_bytes += fh->original_length;
+    }
+    printf("\n  ],\n");
+
+    double bytes_per_sec;
+    uint32_t samples;
+    int measured = cache_load_throughput(&bytes_per_sec, &samples) == 0;
+
+    printf("  \"io\": {\n");
+    printf("    \"read_bytes\": %llu,\n", (unsigned long long)read_bytes);
+    printf("    \"write_bytes\": %u,\n", hdr->total_image_size);
+    if (measured)
+    {
+        printf("    \"throughput_bytes_per_sec\": %.0f,\n", bytes_per_sec);
+        printf("    \"throughput_samples\": %u,\n", samples);
+        printf("    \"estimated_seconds\": %.2f,\n", hdr->total_image_size / bytes_per_sec);
+    }
+    else
+    {
+        printf("    \"throughput_bytes_per_sec\": null,\n");
+        printf("    \"throughput_samples\": 0,\n");
+        printf("    \"estimated_seconds\": null,\n");
+    }
+
+    /* Free space where the output would be written */
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%s", output_file);
+    char* slash = strrchr(dir, '/');
+    if (slash)
+        *(slash == dir ? slash + 1 : slash) = '\0';
+    else
+        snprintf(dir, sizeof(dir), ".");
+
+    struct statvfs vfs;
+    if (statvfs(dir, &vfs) == 0)
+    {
+        printf("    \"output_available_bytes\": %llu\n",
+               (unsigned long long)vfs.f_bavail * vfs.f_frsize);
+    }
+    else
+    {
+        printf("    \"output_available_bytes\": null\n");
+    }
+    printf("  }\n}\n");
+    return 0;
+}
+
+/**
+ * @brief Strip leading "./" components from an archive member name.
+ *
+ * @param name Member name.
+ * @return Name without the prefix (inside name).
+ */
+static const char* member_name(const char* name)
+{
+    while (strncmp(name, "./", 2) == 0)
+        name += 2;
+    return name;
+}
+
+/**
+ * @brief Map an archive member name to the entry name it stands for.
+ *
+ * @param name Member name.
+ * @param prefix Directory of image.cfg in the archive ("" or ending in '/').
+ * @return Entry name (inside name), or NULL if the member lies elsewhere.
+ */
+static const char* entry_name(const char* name, const char* prefix)
+{
+    name = member_name(name);
+    size_t len = strlen(prefix);
+    return strncmp(name, prefix, len) == 0 ? name + len : NULL;
+}
+
+/**
+ * @brief Check whether a member is image.cfg and get its directory.
+ *
+ * Archives may hold the dump folder itself (e.g. "d.dump/image.cfg") or
+ * its contents; the entries are looked up next to image.cfg.
+ *
+ * @param name Member name.
+ * @param prefix Output: directory of image.cfg ("" or ending in '/').
+ * @param size Size of prefix.
+ * @return 0 if the member is image.cfg, non-zero otherwise.
+ */
+static int config_prefix(const char* name, char* prefix, size_t size)
+{
+    name = member_name(name);
+    const char* base = strrchr(name, '/');
+    base = base ? base + 1 : name;
+    if (strcmp(base, "image.cfg") != 0 || (size_t)(base - name) >= size)
+        return 1;
+
+    memcpy(prefix, name, (size_t)(base - name));
+    prefix[base - name] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Find the next entry with a given name that has no data yet.
+ *
+ * Entries are matched in table order, so members with a repeated name fill
+ * the entries with that name one after the other.
+ *
+ * @param table File table of image.cfg.
+ * @param found Per-entry flags telling which entries have data.
+ * @param name Entry name.
+ * @return Entry index, or -1 if there is none left.
+ */
+static long claim_entry(const FileTable* table, const uint8_t* found, const char* name)
+{
+    long first = file_table_find(table, name);
+    if (first < 0)
+        return -1;
+
+    for (uint32_t i = (uint32_t)first; i < table->count; i++)
+    {
+        if (table->filename[i].off == table->filename[first].off && !found[i])
+            return (long)i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Parse image.cfg read from an archive.
+ *
+ * @param text Contents of image.cfg.
+ * @param len Length of text.
+ * @param hdr Output: global header.
+ * @param files Output: file headers (allocated from session).
+ * @param session Arena of the repack session.
+ * @return 0 on success, non-zero on error.
+ */
+static int parse_archive_config(char* text, size_t len, ImageWTYHeader* hdr,
+                                ImageWTYFileHeader** files, Arena* session)
+{
+    FILE* mf = len > 0 ? fmemopen(text, len, "r") : NULL;
+    int ret = !mf || load_image_config_stream(mf, hdr, files, session) != 0 || !*files;
+    if (mf)
+        fclose(mf);
+
+    if (ret)
+        fprintf(stderr, "Failed to load image.cfg from the archive\n");
+    return ret;
+}
+
+/**
+ * @brief Archive member recorded while indexing a seekable archive.
+ */
+typedef struct
+{
+    char* name;       /**< Member name */
+    char* linkname;   /**< Hard link target, or NULL */
+    TarPayload range; /**< Data range in the archive */
+} IndexedMember;
+
+/**
+ * @brief Repack from a seekable archive.
+ *
+ * The headers are indexed in one pass (data is seeked over), then the image
+ * is laid out in image.cfg order exactly like a dump folder and payloads are
+ * copied straight from their archive ranges, checksummed on the way.
+ *
+ * @param r Reader positioned at the start of the archive.
+ * @param output_file Path to the resulting IMAGEWTY file.
+ * @param opts Repack options.
+ * @param session Arena of the repack session.
+ * @return 0 on success, non-zero on error.
+ */
+static int repack_tar_indexed(TarReader* r, const char* output_file, const RepackOptions* opts,
+                              Arena* session)
+{
+    IndexedMember* members = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    long cfg = -1;
+    char prefix[TAR_NAME_MAX];
+
+    TarMember* m = arena_alloc(session, sizeof(*m));
+    if (!m)
+    {
+        perror("Memory allocation failed");
+        return 1;
+    }
+
+    int rc;
+    while ((rc = tar_next(r, m)) == 0)
+    {
+        if (m->type != TAR_TYPE_FILE && m->type != TAR_TYPE_LINK)
+            continue;
+
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            IndexedMember* grown = realloc(members, capacity * sizeof(*grown));
+            if (!grown)
+            {
+                perror("Memory allocation failed");
+                free(members);
+                return 1;
+            }
+            members = grown;
+        }
+
+        IndexedMember* im = &members[count];
+        im->name = arena_alloc(session, strlen(m->name) + 1);
+        im->linkname = m->type == TAR_TYPE_LINK ? arena_alloc(session, strlen(m->linkname) + 1)
+                                                : NULL;
+        if (!im->name || (m->type == TAR_TYPE_LINK && !im->linkname))
+        {
+            perror("Memory allocation failed");
+            free(members);
+            return 1;
+        }
+        strcpy(im->name, m->name);
+        if (im->linkname)
+            strcpy(im->linkname, m->linkname);
+        im->range.offset = m->data_offset;
+        im->range.size = m->size;
+
+        if (cfg < 0 && !im->linkname && config_prefix(im->name, prefix, sizeof(prefix)) == 0)
+            cfg = (long)count;
+        count++;
+    }
+
+    ImageWTYHeader hdr;
+    ImageWTYFileHeader* files = NULL;
+    char* text = NULL;
+    if (rc < 0 || cfg < 0)
+    {
+        if (rc == 1)
+            fprintf(stderr, "No image.cfg found in the archive\n");
+        free(members);
+        return 1;
+    }
+    if (members[cfg].range.size > TAR_CONFIG_MAX_SIZE ||
+        !(text = arena_alloc(session, (size_t)members[cfg].range.size)) ||
+        pread(r->fd, text, (size_t)members[cfg].range.size, (off_t)members[cfg].range.offset) !=
+            (ssize_t)members[cfg].range.size ||
+        parse_archive_config(text, (size_t)members[cfg].range.size, &hdr, &files, session) != 0)
+    {
+        if (!files)
+            fprintf(stderr, "Cannot read image.cfg from the archive\n");
+        free(members);
+        return 1;
+    }
+
+    // Attach every member to the entry of the same name (hard links share
+    // their target's range)
+    FileTable table;
+    TarPayload* ranges = arena_calloc(session, hdr.num_files, sizeof(*ranges));
+    uint8_t* found = arena_calloc(session, hdr.num_files, 1);
+    int ret = !ranges || !found || file_table_build(&table, files, hdr.num_files, session) != 0;
+    if (ret && (!ranges || !found))
+        perror("Memory allocation failed");
+
+    for (size_t k = 0; k < count && ret == 0; k++)
+    {
+        if ((long)k == cfg)
+            continue;
+
+        const char* name = entry_name(members[k].name, prefix);
+        long i = name ? claim_entry(&table, found, name) : -1;
+        if (i < 0)
+        {
+            printf("Ignoring '%s': not listed in image.cfg\n", members[k].name);
+            continue;
+        }
+
+        ranges[i] = members[k].range;
+        if (members[k].linkname)
+        {
+            const char* target = entry_name(members[k].linkname, prefix);
+            long t = target ? file_table_find(&table, target) : -1;
+            if (t < 0 || !found[t])
+            {
+                fprintf(stderr, "Hard link '%s' points to unknown member '%s'\n",
+                        members[k].name, members[k].linkname);
+                ret = 1;
+                break;
+            }
+            ranges[i] = ranges[t];
+        }
+        found[i] = 1;
+    }
+    free(members);
+
+    for (uint32_t i = 0; i < hdr.num_files && ret == 0; i++)
+    {
+        if (!found[i])
+        {
+            fprintf(stderr, "'%s' is listed in image.cfg but missing from the archive\n",
+                    files[i].filename);
+            ret = 1;
+        }
+    }
+    if (ret != 0)
+        return ret;
+
+    PayloadSource src = {NULL, r->fd, ranges, NULL};
+    ret = compute_layout(&src, &hdr, files, opts, session);
+    if (ret == 0)
+        ret = write_full_image(&src, output_file, &hdr, files, 1, session);
+    return ret;
+}
+
+/**
+ * @brief Copy the data of the current archive member into the image.
+ *
+ * @param r Reader positioned at the member's data.
+ * @param len Number of bytes to copy.
+ * @param out_fd Output image file descriptor.
+ * @param offset Image offset of the payload.
+ * @param buf Copy buffer (TAR_STREAM_BUFFER_SIZE bytes).
+ * @param checksum Output: V*.fex checksum of the data.
+ * @param head Output: first four bytes of the data (little-endian), if any.
+ * @param digest Optional output: SHA-256 of the data.
+ * @return 0 on success, non-zero on error.
+ */
+static int stream_payload(TarReader* r, uint64_t len, int out_fd, uint64_t offset, uint8_t* buf,
+                          uint32_t* checksum, uint32_t* head, uint8_t* digest)
+{
+    ChecksumState st;
+    Sha256Context sha;
+    checksum_init(&st);
+    sha256_init(&sha);
+
+    if (lseek(out_fd, (off_t)offset, SEEK_SET) < 0)
+    {
+        perror("Error seeking in output image");
+        return 1;
+    }
+
+    for (uint64_t done = 0; done < len;)
+    {
+        size_t n =
+            len - done > TAR_STREAM_BUFFER_SIZE ? TAR_STREAM_BUFFER_SIZE : (size_t)(len - done);
+        if (tar_read_data(r, buf, n) != 0 || io_write_all(out_fd, buf, n) != 0)
+            return 1;
+
+        checksum_update(&st, buf, n);
+        if (digest)
+            sha256_update(&sha, buf, n);
+        if (done == 0 && n >= 4)
+            *head = (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) |
+                    ((uint32_t)buf[3] << 24);
+        done += n;
+    }
+    io_release_range(out_fd, offset, len, 1);
+
+    *checksum = checksum_final(&st);
+    if (digest)
+        sha256_final(&sha, digest);
+    return 0;
+}
+
+/**
+ * @brief Repack from an archive read as a stream, in the order given.
+ *
+ * image.cfg must be the first file in the archive (as written by extract
+ * --tar). Payloads are placed one after the other in archive order as they
+ * arrive, and the header table is written last, in the same order so that
+ * offsets rise along the table as the loader expects (for archives written
+ * by extract --tar this is the image.cfg order, hard links aside). A hard
+ * link repeats its target's data (or shares its range with --dedup); with
+ * --dedup a payload identical to an earlier one is dropped again and
+ * shares that range.
+ *
+ * @param r Reader positioned at the start of the archive.
+ * @param output_file Path to the resulting IMAGEWTY file (must be seekable).
+ * @param opts Repack options.
+ * @param session Arena of the repack session.
+ * @return 0 on success, non-zero on error.
+ */
+static int repack_tar_stream(TarReader* r, const char* output_file, const RepackOptions* opts,
+                             Arena* session)
+{
+    char prefix[TAR_NAME_MAX];
+    TarMember* m = arena_alloc(session, sizeof(*m));
+    if (!m)
+    {
+        perror("Memory allocation failed");
+        return 1;
+    }
+
+    int rc;
+    while ((rc = tar_next(r, m)) == 0 && m->type == TAR_TYPE_DIR)
+    {
+    }
+    if (rc != 0 || m->type != TAR_TYPE_FILE ||
+        config_prefix(m->name, prefix, sizeof(prefix)) != 0 || m->size > TAR_CONFIG_MAX_SIZE)
+    {
+        if (rc == 0)
+            fprintf(stderr, "image.cfg must be the first file of an archive read from a pipe\n");
+        return 1;
+    }
+
+    ImageWTYHeader hdr;
+    ImageWTYFileHeader* files = NULL;
+    char* text = arena_alloc(session, (size_t)m->size);
+    if (!text || tar_read_data(r, text, (size_t)m->size) != 0 ||
+        parse_archive_config(text, (size_t)m->size, &hdr, &files, session) != 0)
+    {
+        return 1;
+    }
+
+    FileTable table;
+    uint32_t n = hdr.num_files;
+    uint8_t* found = arena_calloc(session, n, 1);
+    uint32_t* sums = arena_calloc(session, n, sizeof(*sums));
+    uint32_t* heads = arena_calloc(session, n, sizeof(*heads));
+    uint32_t* order = arena_calloc(session, n, sizeof(*order));
+    uint8_t(*digests)[SHA256_DIGEST_SIZE] =
+        opts->dedup ? arena_calloc(session, n, sizeof(*digests)) : NULL;
+    if (!found || !sums || !heads || !order || (opts->dedup && !digests))
+    {
+        perror("Memory allocation failed");
+        return 1;
+    }
+    if (file_table_build(&table, files, n, session) != 0)
+        return 1;
+
+    int out_fd = open(output_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0)
+    {
+        fprintf(stderr, "Cannot create output file '%s': %s\n", output_file, strerror(errno));
+        return 1;
+    }
+    uint8_t* buf = bufpool_get(TAR_STREAM_BUFFER_SIZE);
+    int ret = buf ? 0 : 1;
+
+    uint64_t end = IMG_HEADER_HEADER_SIZE + (uint64_t)n * hdr.file_header_length;
+    uint64_t offset = align_offset(end, opts->alignment);
+    uint32_t placed = 0;
+
+    while (ret == 0 && (rc = tar_next(r, m)) == 0)
+    {
+        if (m->type != TAR_TYPE_FILE && m->type != TAR_TYPE_LINK)
+            continue;
+
+        const char* name = entry_name(m->name, prefix);
+        long i = name ? claim_entry(&table, found, name) : -1;
+        if (i < 0)
+        {
+            printf("Ignoring '%s': not listed in image.cfg\n", m->name);
+            continue;
+        }
+        ImageWTYFileHeader* fh = &files[i];
+
+        long shared = -1;
+        long target = -1;
+        uint64_t original_length = m->size;
+        if (m->type == TAR_TYPE_LINK)
+        {
+            const char* target_name = entry_name(m->linkname, prefix);
+            long t = target_name ? file_table_find(&table, target_name) : -1;
+            if (t < 0 || !found[t])
+            {
+                fprintf(stderr, "Hard link '%s' points to unknown member '%s'\n", m->name,
+                        m->linkname);
+                ret = 1;
+                break;
+            }
+            original_length = files[t].original_length;
+            sums[i] = sums[t];
+            heads[i] = heads[t];
+            if (digests)
+                memcpy(digests[i], digests[t], SHA256_DIGEST_SIZE);
+            target = t;
+            shared = opts->dedup ? t : -1;
+        }
+
+        uint64_t stored_length, padding;
+        calculate_padding(original_length, &stored_length, &padding);
+        if (offset + stored_length > UINT32_MAX)
+        {
+            fprintf(stderr, "Error: '%s' does not fit in a 32-bit IMAGEWTY image\n",
+                    fh->filename);
+            ret = 1;
+            break;
+        }
+        fh->original_length = (uint32_t)original_length;
+        fh->stored_length = (uint32_t)stored_length;
+        fh->offset = (uint32_t)offset;
+        found[i] = 1;
+        order[placed++] = (uint32_t)i;
+
+        if (m->type == TAR_TYPE_LINK && shared < 0)
+        {
+            ret = io_copy_range(out_fd, files[target].offset, out_fd, offset, original_length);
+        }
+        else if (m->type == TAR_TYPE_FILE)
+        {
+            ret = stream_payload(r, original_length, out_fd, offset, buf, &sums[i], &heads[i],
+                                 digests ? digests[i] : NULL);
+
+            // --dedup: drop a payload identical to an earlier one again
+            for (uint32_t j = 0; digests && ret == 0 && original_length > 0 && j < n; j++)
+            {
+                if ((long)j != i && found[j] && files[j].original_length == original_length &&
+                    memcmp(digests[j], digests[i], SHA256_DIGEST_SIZE) == 0)
+                {
+                    shared = (long)j;
+                    if (ftruncate(out_fd, (off_t)offset) != 0)
+                        ret = 1;
+                    break;
+                }
+            }
+        }
+        if (ret != 0)
+            break;
+
+        if (shared >= 0)
+        {
+            fh->offset = files[shared].offset;
+            printf("Shared: %s (same data as %s at 0x%X)\n", fh->filename,
+                   files[shared].filename, fh->offset);
+            continue;
+        }
+
+        printf("Packed: %s (original: %u, stored: %u)\n", fh->filename, fh->original_length,
+               fh->stored_length);
+        if (offset + stored_length > end)
+            end = offset + stored_length;
+        offset = align_offset(offset + stored_length, opts->alignment);
+    }
+    bufpool_put(buf);
+    if (ret == 0 && rc < 0)
+        ret = 1;
+
+    for (uint32_t i = 0; i < n && ret == 0; i++)
+    {
+        if (!found[i])
+        {
+            fprintf(stderr, "'%s' is listed in image.cfg but missing from the archive\n",
+                    files[i].filename);
+            ret = 1;
+        }
+    }
+
+    // The header table follows the placement order
+    ImageWTYFileHeader* table_files = arena_alloc(session, (size_t)n * sizeof(*table_files));
+    uint32_t* table_sums = arena_alloc(session, (size_t)n * sizeof(*table_sums));
+    uint32_t* table_heads = arena_alloc(session, (size_t)n * sizeof(*table_heads));
+    if (ret == 0 && (!table_files || !table_sums || !table_heads))
+    {
+        perror("Memory allocation failed");
+        ret = 1;
+    }
+    int reordered = 0;
+    for (uint32_t k = 0; k < n && ret == 0; k++)
+    {
+        table_files[k] = files[order[k]];
+        table_sums[k] = sums[order[k]];
+        table_heads[k] = heads[order[k]];
+        reordered |= order[k] != k;
+    }
+    if (reordered)
+        printf("Note: the header table follows the archive order, not image.cfg\n");
+    files = table_files;
+
+    // Headers go in last, once every offset is known
+    hdr.total_image_size = (uint32_t)end;
+    if (ret == 0 && ftruncate(out_fd, (off_t)end) != 0)
+    {
+        perror("Error sizing output image");
+        ret = 1;
+    }
+    if (ret == 0)
+        ret = check_loader_layout(&hdr, files, session);
+    if (ret == 0)
+    {
+        FileTable layout;
+        PayloadSource src = {NULL, -1, NULL, table_heads};
+        printf("\nChecking V*.fex checksums...\n");
+        ret = file_table_build(&layout, files, n, session) != 0 ||
+              fix_vfiles_in_image(&src, out_fd, &layout, table_sums) != 0;
+    }
+
+    uint8_t* hbuf = ret == 0 ? bufpool_get(hdr.file_header_length > IMG_HEADER_HEADER_SIZE
+                                                ? hdr.file_header_length
+                                                : IMG_HEADER_HEADER_SIZE)
+                             : NULL;
+    if (ret == 0 && (!hbuf || lseek(out_fd, 0, SEEK_SET) != 0))
+        ret = 1;
+    if (ret == 0)
+    {
+        serialize_image_header(&hdr, hbuf);
+        ret = io_write_all(out_fd, hbuf, IMG_HEADER_HEADER_SIZE);
+        for (uint32_t i = 0; i < n && ret == 0; i++)
+        {
+            serialize_file_header(&files[i], hbuf, hdr.file_header_length);
+            ret = io_write_all(out_fd, hbuf, hdr.file_header_length);
+        }
+    }
+    bufpool_put(hbuf);
+
+    if (close(out_fd) != 0)
+    {
+        perror("Error closing output image");
+        ret = 1;
+    }
+    if (ret == 0)
+        printf("Repack completed successfully: %s (%u bytes)\n", output_file,
+               hdr.total_image_size);
+    return ret;
+}
+
+/**
+ * @brief Repack from a tar/pax archive instead of a dump folder.
+ *
+ * @param archive Path to the archive, or "-" for standard input.
+ * @param output_file Path to the resulting IMAGEWTY file.
+ * @param opts Repack options.
+ * @return 0 on success, non-zero on error.
+ */
+static int repack_from_tar(const char* archive, const char* output_file,
+                           const RepackOptions* opts)
+{
+    int from_stdin = strcmp(archive, "-") == 0;
+    int fd = from_stdin ? STDIN_FILENO : open(archive, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot open archive '%s': %s\n", archive, strerror(errno));
+        return 1;
+    }
+
+    Arena session;
+    arena_init(&session);
+
+    TarReader r;
+    tar_reader_init(&r, fd);
+    int ret = r.seekable ? repack_tar_indexed(&r, output_file, opts, &session)
+                         : repack_tar_stream(&r, output_file, opts, &session);
+
+    arena_release(&session);
+    if (!from_stdin)
+        close(fd);
+    return ret;
+}
+
+/**
+ * @brief Repack a directory dump into a new IMAGEWTY file.
+ *
+ * The function follows the IMAGEWTY format standard:
+ *  - Updates virtual files if needed.
+ *  - Loads global header and file headers from image.cfg.
+ *  - Computes offsets and the total image size, and preallocates the output.
+ *  - Writes global header.
+ *  - Writes file headers (1024 bytes each by default).
+ *  - Copies actual file data with proper padding.
+ *
+ * With opts->incremental_base, a previous image is updated instead where
+ * possible (see repack_incremental()), and a manifest of the dump folder is
+ * written next to the output for the next run. With opts->cache_dir, full
+ * repacks go through the build cache (see repack_cached()). With
+ * opts->plan, nothing is written and the layout is printed as JSON.
+ *
+ * @param dump_folder Path to the extracted dump directory.
+ * @param output_file Path to the resulting IMAGEWTY file.
+ * @param opts Repack options, or NULL for the defaults.
+ * @return 0 on success, non-zero on error.
+ */
+int repack_image(const char* dump_folder, const char* output_file, const RepackOptions* opts)
+{
+    if (!dump_folder || !output_file)
+    {
+        fprintf(stderr, "repack_image: invalid parameters\n");
+        return 1;
+    }
+
+    RepackOptions defaults;
+    if (!opts)
+    {
+        repack_options_init(&defaults);
+        opts = &defaults;
+    }
+    if (validate_alignment(opts->alignment) != 0)
+        return 1;
+
+    if (opts->from_tar)
+    {
+        if (opts->incremental_base || opts->cache_dir || opts->plan ||
+            strcmp(output_file, "-") == 0)
+        {
+            fprintf(stderr, "--from-tar needs an output file and cannot be combined with "
+                            "--incremental, --cache or --plan\n");
+            return 1;
+        }
+        return repack_from_tar(dump_folder, output_file, opts);
+    }
+
+    // Load global header and file headers from image.cfg
+    char cfg_path[1024];
+    snprintf(cfg_path, sizeof(cfg_path), "%s/image.cfg", dump_folder);
+
+    // Header tables and scratch arrays of this repack all live in one arena
+    Arena session;
+    arena_init(&session);
+
+    ImageWTYHeader hdr;
+    ImageWTYFileHeader* files = NULL;
+    PayloadSource src = {dump_folder, -1, NULL, NULL};
+
+    if (load_image_config(cfg_path, &hdr, &files, &session) != 0 || !files)
+    {
+        fprintf(stderr, "Failed to load image.cfg from '%s'\n", cfg_path);
+        arena_release(&session);
+        return 1;
+    }
+
+    // Dry run: report the layout without touching the dump folder or output
+    if (opts->plan)
+    {
+        int ret = compute_layout(&src, &hdr, files, opts, &session);
+        if (ret == 0)
+            ret = print_plan(output_file, opts, &hdr, files, &session);
+        arena_release(&session);
+        return ret;
+    }
+
+    // Streaming output: everything is emitted once, in order
+    if (strcmp(output_file, "-") == 0)
+    {
+        int ret = 1;
+        if (opts->incremental_base || opts->cache_dir)
+            fprintf(stderr, "--incremental and --cache need an output file, not '-'\n");
+        else
+            ret = repack_to_stdout(dump_folder, opts, &hdr, files, &session);
+        arena_release(&session);
+        return ret;
+    }
+
+    FileManifest base_manifest = {NULL, 0};
+    FileManifest manifest = {NULL, 0};
+    char manifest_path[1100];
+    int ret = INCREMENTAL_FALLBACK;
+
+    if (opts->incremental_base)
+    {
+        // A stale manifest must never outlive a failed or partial update
+        manifest_path_for(output_file, manifest_path, sizeof(manifest_path));
+        int have_base = load_base_manifest(opts->incremental_base, &base_manifest) == 0;
+        unlink(manifest_path);
+
+        if (have_base)
+        {
+            ret = repack_incremental(dump_folder, output_file, opts, &hdr, files,
+                                     &base_manifest, &manifest, &session);
+        }
+        if (ret == INCREMENTAL_FALLBACK)
+            printf("Previous image '%s' cannot be reused; doing a full repack\n",
+                   opts->incremental_base);
+    }
+
+    if (ret == INCREMENTAL_FALLBACK && opts->cache_dir)
+    {
+        manifest_free(&manifest);
+        ret = repack_cached(dump_folder, output_file, opts, &hdr, files, &manifest, &session);
+    }
+    else if (ret == INCREMENTAL_FALLBACK)
+    {
+        // Compute the complete layout before touching the output file; stale
+        // V*.fex files are fixed from checksums taken while writing
+        ret = compute_layout(&src, &hdr, files, opts, &session);
+        if (ret == 0)
+            ret = write_full_image(&src, output_file, &hdr, files, 1, &session);
+
+        // A fixed V-file that was deduplicated needs a fresh layout
+        if (ret == REPACK_RELAYOUT)
+        {
+            printf("Checksum files changed; writing the image again\n");
+            ret = compute_layout(&src, &hdr, files, opts, &session);
+            if (ret == 0)
+                ret = write_full_image(&src, output_file, &hdr, files, 1, &session);
+        }
+
+        if (ret == 0 && opts->incremental_base)
+        {
+            manifest_free(&manifest);
+            ret = describe_payloads(dump_folder, &hdr, files, &base_manifest, &manifest);
+        }
+    }
+
+    if (ret == 0 && opts->incremental_base)
+        ret = manifest_save(manifest_path, &manifest);
+
+    manifest_free(&base_manifest);
+    manifest_free(&manifest);
+    arena_release(&session);
+    return ret;
+}
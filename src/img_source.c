@@ -0,0 +1,481 @@
+/**
+ * @file img_source.c
+ * @brief Read access to images in plain or compressed files, on standard input or in zip
+ *        bundles.
+ */
+
+#define _GNU_SOURCE
+
+#include "img_source.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "img_bufpool.h"
+#include "img_zip.h"
+#include "sha256.h"
+
+/** Size of the chunks decompressed ranges are handed to callbacks in */
+#define SOURCE_CHUNK_SIZE (1024 * 1024)
+
+/** Directory for inflate checkpoint indexes (NULL = none) */
+static const char* index_dir = NULL;
+
+/**
+ * @brief Keep inflate checkpoint indexes of deflated zip members in a directory.
+ *
+ * @param dir Existing directory, or NULL to keep checkpoints in memory only.
+ */
+void source_set_index_dir(const char* dir)
+{
+    index_dir = dir;
+}
+
+/**
+ * @brief Build the index file path of a zip member.
+ *
+ * @param archive Archive path.
+ * @param member  Member name.
+ * @param st      Status of the archive.
+ * @param path    Output: index file path.
+ * @param size    Size of path.
+ * @return 0 on success, non-zero if no index should be used.
+ */
+static int index_path_for(const char* archive, const char* member, const struct stat* st,
+                          char* path, size_t size)
+{
+    char real[PATH_MAX];
+    if (!realpath(archive, real))
+        return 1;
+
+    char key[PATH_MAX + 128];
+    int len = snprintf(key, sizeof(key), "%s\n%s\n%llu\n%lld", real, member,
+                       (unsigned long long)st->st_size, (long long)st->st_mtime);
+    if (len < 0 || (size_t)len >= sizeof(key))
+        return 1;
+
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_HEX_SIZE];
+    sha256_buffer(key, (size_t)len, digest);
+    sha256_to_hex(digest, hex);
+    return snprintf(path, size, "%s/%s.zidx", index_dir, hex) >= (int)size;
+}
+
+/**
+ * @brief Open a member of a zip archive.
+ *
+ * @param src     Source to initialize.
+ * @param archive Archive path.
+ * @param member  Member name.
+ * @return 0 on success, non-zero on error.
+ */
+static int open_zip_member(ImageSource* src, const char* archive, const char* member)
+{
+    src->fd = open(archive, O_RDONLY);
+    struct stat st;
+    if (src->fd < 0 || fstat(src->fd, &st) != 0)
+    {
+        fprintf(stderr, "Cannot open '%s': %s\n", archive, strerror(errno));
+        return 1;
+    }
+    src->mtime = st.st_mtime;
+
+    ZipEntry entry;
+    int rc = zip_find_entry(src->fd, member, &entry);
+    if (rc != 0)
+    {
+        if (rc > 0)
+            fprintf(stderr, "No member '%s' in '%s'\n", member, archive);
+        return 1;
+    }
+    src->size = entry.size;
+
+    if (entry.method == ZIP_METHOD_STORED)
+    {
+        src->kind = SOURCE_ZIP_STORED;
+        src->base = entry.data_offset;
+        return 0;
+    }
+
+    char path[PATH_MAX];
+    int indexed = index_dir && index_path_for(archive, member, &st, path, sizeof(path)) == 0;
+    DeflateStream stream = {entry.data_offset, entry.comp_size, entry.size, entry.crc};
+    src->kind = SOURCE_ZIP_DEFLATED;
+    src->inflater = inflater_open(src->fd, &stream, indexed ? path : NULL);
+    return src->inflater ? 0 : 1;
+}
+
+/**
+ * @brief Set up decompression of a gzip or xz file, if the file is one.
+ *
+ * @param src  Source with fd open on the file.
+ * @param path File path (for the gzip index and messages).
+ * @return 0 on success (also for uncompressed files), non-zero on error.
+ */
+static int open_compressed(ImageSource* src, const char* path)
+{
+    uint8_t head[8];
+    ssize_t got = pread(src->fd, head, sizeof(head), 0);
+    if (got <= 0)
+        return 0;
+
+    if (xz_is_xz(head, (size_t)got))
+    {
+        src->kind = SOURCE_XZ;
+        src->xz = xz_open(src->fd);
+        if (!src->xz)
+            return 1;
+        src->size = xz_size(src->xz);
+        if (xz_block_count(src->xz) == 1 && src->size > XZ_SINGLE_BLOCK_NOTE_SIZE)
+        {
+            fprintf(stderr,
+                    "Note: '%s' is a single xz block, so every seek decompresses from the start;\n"
+                    "      recompress with 'xz -T0' or 'xz --block-size=4MiB' for fast access\n",
+                    path);
+        }
+        return 0;
+    }
+
+    if (!inflater_is_gzip(head, (size_t)got))
+        return 0;
+
+    DeflateStream stream;
+    char index[PATH_MAX];
+    if (inflater_gzip_stream(src->fd, &stream) != 0 ||
+        snprintf(index, sizeof(index), "%s%s", path, SOURCE_INDEX_SUFFIX) >= (int)sizeof(index))
+    {
+        fprintf(stderr, "Cannot read gzip image '%s'\n", path);
+        return 1;
+    }
+    src->kind = SOURCE_GZIP;
+    src->inflater = inflater_open(src->fd, &stream, index);
+    if (!src->inflater)
+        return 1;
+
+    if (inflater_size(src->inflater) == INFLATE_SIZE_UNKNOWN)
+    {
+        fprintf(stderr, "Indexing '%s' (written to '%s')...\n", path, index);
+        if (inflater_scan(src->inflater) != 0)
+        {
+            fprintf(stderr, "Cannot read gzip image '%s'\n", path);
+            return 1;
+        }
+    }
+    src->size = inflater_size(src->inflater);
+    return 0;
+}
+
+/**
+ * @brief Open an image.
+ *
+ * @param src  Source to initialize.
+ * @param path Image file (plain, gzip or xz), "-" for standard input, or
+ *             "archive.zip!/member".
+ * @return 0 on success, non-zero on error.
+ */
+int source_open(ImageSource* src, const char* path)
+{
+    memset(src, 0, sizeof(*src));
+    src->fd = -1;
+
+    if (strcmp(path, "-") == 0)
+    {
+        src->kind = SOURCE_STDIN;
+        src->fd = STDIN_FILENO;
+        src->size = UINT64_MAX;
+        src->mtime = time(NULL);
+        return 0;
+    }
+
+    const char* sep = strstr(path, SOURCE_ZIP_SEPARATOR);
+    if (sep && access(path, F_OK) != 0)
+    {
+        char* archive = strndup(path, (size_t)(sep - path));
+        if (!archive)
+        {
+            perror("Memory allocation failed");
+            return 1;
+        }
+        int ret = open_zip_member(src, archive, sep + strlen(SOURCE_ZIP_SEPARATOR));
+        free(archive);
+        if (ret != 0)
+            source_close(src);
+        return ret;
+    }
+
+    src->kind = SOURCE_FILE;
+    src->fd = open(path, O_RDONLY);
+    struct stat st;
+    if (src->fd < 0 || fstat(src->fd, &st) != 0)
+    {
+        fprintf(stderr, "Cannot open image '%s': %s\n", path, strerror(errno));
+        source_close(src);
+        return 1;
+    }
+    src->size = (uint64_t)st.st_size;
+    src->mtime = st.st_mtime;
+    if (open_compressed(src, path) != 0)
+    {
+        source_close(src);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Close an image opened with source_open().
+ *
+ * @param src Source.
+ */
+void source_close(ImageSource* src)
+{
+    inflater_close(src->inflater);
+    src->inflater = NULL;
+    xz_close(src->xz);
+    src->xz = NULL;
+    if (src->fd >= 0 && src->kind != SOURCE_STDIN)
+        close(src->fd);
+    src->fd = -1;
+}
+
+/**
+ * @brief Tell whether the image is a byte range of src->fd.
+ *
+ * @param src Source.
+ * @return Non-zero for plain files and stored zip members.
+ */
+int source_is_direct(const ImageSource* src)
+{
+    return src->kind == SOURCE_FILE || src->kind == SOURCE_ZIP_STORED;
+}
+
+/**
+ * @brief Check that a range lies inside a randomly accessible image.
+ *
+ * @param src Source.
+ * @param off Image offset.
+ * @param len Range length.
+ * @return 0 if the range can be read, non-zero (with a message) otherwise.
+ */
+static int check_range(const ImageSource* src, uint64_t off, uint64_t len)
+{
+    if (src->kind == SOURCE_STDIN)
+    {
+        fprintf(stderr, "Error: an image on standard input can only be read sequentially\n");
+        return 1;
+    }
+    if (off > src->size || len > src->size - off)
+    {
+        fprintf(stderr, "Error: range 0x%llX + %llu exceeds image size %llu\n",
+                (unsigned long long)off, (unsigned long long)len,
+                (unsigned long long)src->size);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read exactly len bytes at an image offset.
+ *
+ * @param src Source (not standard input).
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @param off Image offset.
+ * @return 0 on success, non-zero on error or if the range exceeds the image.
+ */
+int source_pread(ImageSource* src, void* buf, size_t len, uint64_t off)
+{
+    if (check_range(src, off, len) != 0)
+        return 1;
+    if (src->inflater)
+        return inflater_read(src->inflater, off, buf, len);
+    if (src->xz)
+        return xz_read(src->xz, off, buf, len);
+
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t r = pread(src->fd, (uint8_t*)buf + done, len - done,
+                          (off_t)(src->base + off + done));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+        {
+            fprintf(stderr, "Error reading image: %s\n",
+                    r < 0 ? strerror(errno) : "unexpected end of file");
+            return 1;
+        }
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read the next bytes of the image.
+ *
+ * @param src Source.
+ * @param buf Destination buffer.
+ * @param len Maximum number of bytes to read.
+ * @return Number of bytes read, 0 at the end of the image, -1 on error.
+ */
+ssize_t source_read(ImageSource* src, void* buf, size_t len)
+{
+    if (src->kind == SOURCE_STDIN)
+    {
+        ssize_t r;
+        while ((r = read(src->fd, buf, len)) < 0 && errno == EINTR)
+        {
+        }
+        if (r < 0)
+            perror("Error reading image");
+        else
+            src->pos += (uint64_t)r;
+        return r;
+    }
+
+    uint64_t left = src->size - src->pos;
+    if (len > left)
+        len = (size_t)left;
+    if (len > SSIZE_MAX)
+        len = SSIZE_MAX;
+    if (len > 0 && source_pread(src, buf, len, src->pos) != 0)
+        return -1;
+    src->pos += len;
+    return (ssize_t)len;
+}
+
+/**
+ * @brief Stream an image range through a callback, chunk by chunk.
+ *
+ * @param src Source (not standard input).
+ * @param off Image offset.
+ * @param len Number of bytes.
+ * @param cb  Callback invoked for each chunk, in order.
+ * @param ctx Context passed to the callback.
+ * @return 0 on success, non-zero on error or if the callback failed.
+ */
+int source_read_range(ImageSource* src, uint64_t off, uint64_t len, IoReadCallback cb,
+                      void* ctx)
+{
+    if (check_range(src, off, len) != 0)
+        return 1;
+    if (source_is_direct(src))
+        return io_read_range(src->fd, src->base + off, len, cb, ctx);
+
+    uint8_t* buf = bufpool_get(SOURCE_CHUNK_SIZE);
+    if (!buf)
+        return 1;
+
+    int ret = 0;
+    for (uint64_t pos = 0; pos < len && ret == 0; pos += SOURCE_CHUNK_SIZE)
+    {
+        size_t n = len - pos > SOURCE_CHUNK_SIZE ? SOURCE_CHUNK_SIZE : (size_t)(len - pos);
+        ret = source_pread(src, buf, n, off + pos);
+        if (ret == 0)
+            ret = cb(buf, n, ctx);
+    }
+    bufpool_put(buf);
+    return ret;
+}
+
+/**
+ * @brief State of a stdio stream opened with source_fopen().
+ */
+typedef struct
+{
+    ImageSource* src; /**< Image */
+    uint64_t pos;     /**< Stream position */
+} SourceCookie;
+
+/**
+ * @brief fopencookie() read function.
+ *
+ * @param cookie SourceCookie.
+ * @param buf    Destination buffer.
+ * @param size   Maximum number of bytes to read.
+ * @return Number of bytes read, 0 at the end of the image, -1 on error.
+ */
+static ssize_t cookie_read(void* cookie, char* buf, size_t size)
+{
+    SourceCookie* sc = cookie;
+    if (sc->pos >= sc->src->size)
+        return 0;
+    if (size > sc->src->size - sc->pos)
+        size = (size_t)(sc->src->size - sc->pos);
+    if (source_pread(sc->src, buf, size, sc->pos) != 0)
+        return -1;
+    sc->pos += size;
+    return (ssize_t)size;
+}
+
+/**
+ * @brief fopencookie() seek function.
+ *
+ * @param cookie SourceCookie.
+ * @param offset Requested offset (updated to the new position).
+ * @param whence SEEK_SET, SEEK_CUR or SEEK_END.
+ * @return 0 on success, -1 on error.
+ */
+static int cookie_seek(void* cookie, off64_t* offset, int whence)
+{
+    SourceCookie* sc = cookie;
+    int64_t from = whence == SEEK_SET   ? 0
+                   : whence == SEEK_CUR ? (int64_t)sc->pos
+                   : whence == SEEK_END ? (int64_t)sc->src->size
+                                        : -1;
+    if (from < 0 || from + *offset < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    sc->pos = (uint64_t)(from + *offset);
+    *offset = (off64_t)sc->pos;
+    return 0;
+}
+
+/**
+ * @brief fopencookie() close function.
+ *
+ * @param cookie SourceCookie.
+ * @return Always 0.
+ */
+static int cookie_close(void* cookie)
+{
+    free(cookie);
+    return 0;
+}
+
+/**
+ * @brief Open a seekable stdio stream over the image.
+ *
+ * @param src Source (not standard input); must outlive the stream.
+ * @return Stream, or NULL on error.
+ */
+FILE* source_fopen(ImageSource* src)
+{
+    if (check_range(src, 0, 0) != 0)
+        return NULL;
+
+    SourceCookie* sc = malloc(sizeof(*sc));
+    if (!sc)
+    {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+    sc->src = src;
+    sc->pos = 0;
+
+    cookie_io_functions_t io = {cookie_read, NULL, cookie_seek, cookie_close};
+    FILE* f = fopencookie(sc, "rb", io);
+    if (!f)
+    {
+        perror("fopencookie");
+        free(sc);
+    }
+    return f;
+}
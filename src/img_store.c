@@ -0,0 +1,744 @@
+/**
+ * @file img_store.c
+ * @brief Deduplicating chunk store for IMAGEWTY images.
+ *
+ * Store layout:
+ *  - `<store>/chunks/<xx>/<sha256>` : unique chunk payloads
+ *  - `<store>/images/<id>`          : one manifest per stored image
+ *
+ * A manifest is a small text file listing the regions of the image (the
+ * header region, one region per embedded entry and one per range no entry
+ * covers, such as alignment gaps or vendor trailers) together with the
+ * chunks that make up each region, and the SHA-256 of the whole image,
+ * which is checked when the image is rebuilt. The image ID is the SHA-256
+ * of the manifest itself.
+ */
+
+#define _GNU_SOURCE
+
+#include "img_store.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "img_bufpool.h"
+#include "img_header.h"
+#include "sha256.h"
+
+/** Manifest format identifier (first line of every manifest) */
+#define STORE_MANIFEST_MAGIC "IMAGEWTY-STORE 2"
+
+/** Identifier of manifests written before gaps and the image hash were recorded */
+#define STORE_MANIFEST_MAGIC_V1 "IMAGEWTY-STORE 1"
+
+/** Content-defined chunking parameters (bytes) */
+#define CDC_MIN_SIZE (16 * 1024)
+#define CDC_AVG_BITS 16 /* 64 KiB average chunk */
+#define CDC_MAX_SIZE (256 * 1024)
+
+/** Normalized chunking masks: harder to cut before the average, easier after */
+#define CDC_MASK_SMALL (~0ULL << (64 - (CDC_AVG_BITS + 2)))
+#define CDC_MASK_LARGE (~0ULL << (64 - (CDC_AVG_BITS - 2)))
+
+/**
+ * @brief Running state while adding one image to the store.
+ */
+typedef struct
+{
+    const char* store_dir; /**< Root of the store */
+    FILE* manifest;        /**< Manifest being built (memory stream) */
+    uint8_t* buf;          /**< Chunker window of CDC_MAX_SIZE bytes */
+    uint64_t chunks;       /**< Number of chunks referenced */
+    uint64_t new_chunks;   /**< Number of chunks written to the store */
+    uint64_t new_bytes;    /**< Bytes written to the store */
+} StoreContext;
+
+static uint64_t gear[256];
+static int gear_ready = 0;
+
+/**
+ * @brief Fill the gear table with fixed pseudo-random values (splitmix64).
+ *
+ * The table must be identical across runs, otherwise chunk boundaries and
+ * therefore deduplication would not be stable.
+ */
+static void init_gear_table(void)
+{
+    if (gear_ready)
+        return;
+
+    uint64_t x = 0x494D414745575459ULL; /* "IMAGEWTY" */
+    for (int i = 0; i < 256; i++)
+    {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        gear[i] = z ^ (z >> 31);
+    }
+    gear_ready = 1;
+}
+
+/**
+ * @brief Find the next content-defined cut point (FastCDC).
+ *
+ * @param data Input window.
+ * @param len  Number of bytes available in the window.
+ * @return Length of the next chunk (at most CDC_MAX_SIZE).
+ */
+static size_t cdc_cut(const uint8_t* data, size_t len)
+{
+    if (len <= CDC_MIN_SIZE)
+        return len;
+    if (len > CDC_MAX_SIZE)
+        len = CDC_MAX_SIZE;
+
+    size_t normal = (size_t)1 << CDC_AVG_BITS;
+    if (normal > len)
+        normal = len;
+
+    uint64_t hash = 0;
+    size_t i = CDC_MIN_SIZE;
+
+    for (; i < normal; i++)
+    {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & CDC_MASK_SMALL))
+            return i + 1;
+    }
+    for (; i < len; i++)
+    {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & CDC_MASK_LARGE))
+            return i + 1;
+    }
+    return len;
+}
+
+/**
+ * @brief Resolve the store directory from the environment.
+ *
+ * @return Store directory path (never NULL).
+ */
+static const char* store_directory(void)
+{
+    const char* dir = getenv(STORE_ENV_VAR);
+    return (dir && *dir) ? dir : STORE_DEFAULT_DIR;
+}
+
+/**
+ * @brief Create a directory, accepting one that already exists.
+ *
+ * @param path Directory path.
+ * @return 0 on success, non-zero on error.
+ */
+static int ensure_dir(const char* path)
+{
+    if (mkdir(path, 0755) && errno != EEXIST)
+    {
+        fprintf(stderr, "Cannot create directory '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Build the path of a chunk file from its hex digest.
+ *
+ * @param out       Output buffer for the path.
+ * @param size      Size of the output buffer.
+ * @param store_dir Store directory.
+ * @param hex       Chunk digest (hex).
+ */
+static void chunk_path(char* out, size_t size, const char* store_dir, const char* hex)
+{
+    snprintf(out, size, "%s/chunks/%.2s/%s", store_dir, hex, hex);
+}
+
+/**
+ * @brief Store one chunk unless an identical chunk is already present.
+ *
+ * New chunks are written to a temporary file and renamed into place so an
+ * interrupted run never leaves a truncated chunk behind.
+ *
+ * @param ctx  Store context.
+ * @param data Chunk bytes.
+ * @param len  Chunk length.
+ * @return 0 on success, non-zero on error.
+ */
+static int store_chunk(StoreContext* ctx, const uint8_t* data, size_t len)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_HEX_SIZE];
+    sha256_buffer(data, len, digest);
+    sha256_to_hex(digest, hex);
+
+    fprintf(ctx->manifest, "chunk %s %zu\n", hex, len);
+    ctx->chunks++;
+
+    char path[1024];
+    chunk_path(path, sizeof(path), ctx->store_dir, hex);
+    if (access(path, F_OK) == 0)
+        return 0; /* Already stored: hash-only ingest */
+
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%s/chunks/%.2s", ctx->store_dir, hex);
+    if (ensure_dir(dir) != 0)
+        return 1;
+
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid());
+
+    FILE* cf = fopen(tmp, "wb");
+    if (!cf)
+    {
+        fprintf(stderr, "Cannot create chunk '%s': %s\n", tmp, strerror(errno));
+        return 1;
+    }
+    if (fwrite(data, 1, len, cf) != len || fclose(cf) != 0)
+    {
+        fprintf(stderr, "Error writing chunk '%s'\n", tmp);
+        unlink(tmp);
+        return 1;
+    }
+    if (rename(tmp, path) != 0)
+    {
+        fprintf(stderr, "Cannot rename chunk '%s': %s\n", tmp, strerror(errno));
+        unlink(tmp);
+        return 1;
+    }
+
+    ctx->new_chunks++;
+    ctx->new_bytes += len;
+    return 0;
+}
+
+/**
+ * @brief Chunk a byte range of the image and record it as a manifest region.
+ *
+ * @param ctx    Store context.
+ * @param img    Open image file.
+ * @param offset Start of the range.
+ * @param length Length of the range.
+ * @param name   Region name written to the manifest (informational).
+ * @return 0 on success, non-zero on error.
+ */
+static int store_region(StoreContext* ctx, FILE* img, uint64_t offset, uint64_t length,
+                        const char* name)
+{
+    fprintf(ctx->manifest, "region %" PRIu64 " %" PRIu64 " %s\n", offset, length, name);
+
+    if (length == 0)
+        return 0;
+
+    if (fseeko(img, (off_t)offset, SEEK_SET) != 0)
+    {
+        perror("Error seeking image region");
+        return 1;
+    }
+
+    uint64_t remaining = length;
+    size_t buffered = 0;
+
+    while (remaining > 0 || buffered > 0)
+    {
+        /* Top up the window so the chunker always sees up to CDC_MAX_SIZE bytes */
+        size_t want = CDC_MAX_SIZE - buffered;
+        if (want > remaining)
+            want = (size_t)remaining;
+        if (want > 0)
+        {
+            if (fread(ctx->buf + buffered, 1, want, img) != want)
+            {
+                fprintf(stderr, "Error reading region '%s' from image\n", name);
+                return 1;
+            }
+            buffered += want;
+            remaining -= want;
+        }
+
+        size_t cut = cdc_cut(ctx->buf, buffered);
+        if (store_chunk(ctx, ctx->buf, cut) != 0)
+            return 1;
+
+        memmove(ctx->buf, ctx->buf + cut, buffered - cut);
+        buffered -= cut;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Byte range of the image covered by the header or an entry.
+ */
+typedef struct
+{
+    uint64_t start; /**< First byte */
+    uint64_t end;   /**< One past the last byte */
+} StoreSpan;
+
+/**
+ * @brief qsort() comparator ordering spans by start offset.
+ *
+ * @param a First StoreSpan.
+ * @param b Second StoreSpan.
+ * @return Negative, zero or positive.
+ */
+static int span_compare(const void* a, const void* b)
+{
+    const StoreSpan* x = a;
+    const StoreSpan* y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/**
+ * @brief Record every range of the image that neither the header nor an
+ *        entry covers as a "gap" region.
+ *
+ * @param ctx        Store context.
+ * @param img        Open image file.
+ * @param files      File header array.
+ * @param num_files  Number of entries.
+ * @param header_len Length of the header region.
+ * @param image_size Size of the image file.
+ * @param session    Arena for scratch memory.
+ * @return 0 on success, non-zero on error.
+ */
+static int store_gaps(StoreContext* ctx, FILE* img, const ImageWTYFileHeader* files,
+                      uint32_t num_files, uint64_t header_len, uint64_t image_size,
+                      Arena* session)
+{
+    StoreSpan* spans = arena_calloc(session, (size_t)num_files + 1, sizeof(*spans));
+    if (!spans)
+    {
+        perror("Memory allocation failed");
+        return 1;
+    }
+    spans[0].end = header_len;
+    for (uint32_t i = 0; i < num_files; i++)
+    {
+        spans[i + 1].start = files[i].offset;
+        spans[i + 1].end = (uint64_t)files[i].offset + files[i].stored_length;
+    }
+    qsort(spans, (size_t)num_files + 1, sizeof(*spans), span_compare);
+
+    uint64_t covered = 0;
+    for (uint32_t i = 0; i <= num_files && covered < image_size; i++)
+    {
+        uint64_t start = spans[i].start < image_size ? spans[i].start : image_size;
+        if (start > covered && store_region(ctx, img, covered, start - covered, "gap") != 0)
+            return 1;
+        if (spans[i].end > covered)
+            covered = spans[i].end;
+    }
+    if (covered < image_size)
+        return store_region(ctx, img, covered, image_size - covered, "gap");
+    return 0;
+}
+
+/**
+ * @brief Write a manifest into the store under its image ID.
+ *
+ * The manifest goes to a temporary file that is renamed into place, so an
+ * interrupted run never leaves a truncated manifest behind.
+ *
+ * @param path Final manifest path.
+ * @param data Manifest text.
+ * @param len  Length of data.
+ * @return 0 on success, non-zero on error.
+ */
+static int write_manifest(const char* path, const char* data, size_t len)
+{
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid());
+
+    FILE* mf = fopen(tmp, "wb");
+    if (!mf)
+    {
+        fprintf(stderr, "Cannot create manifest '%s': %s\n", tmp, strerror(errno));
+        return 1;
+    }
+    int ok = fwrite(data, 1, len, mf) == len;
+    if (fclose(mf) != 0)
+        ok = 0;
+    if (!ok || rename(tmp, path) != 0)
+    {
+        fprintf(stderr, "Cannot write manifest '%s': %s\n", path, strerror(errno));
+        unlink(tmp);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Add an IMAGEWTY image to the chunk store.
+ *
+ * @param img_filename Path to the IMAGEWTY image file.
+ * @return 0 on success, non-zero on error.
+ */
+int store_add_image(const char* img_filename)
+{
+    if (!img_filename)
+    {
+        fprintf(stderr, "store_add_image: img_filename is NULL\n");
+        return 1;
+    }
+
+    const char* store_dir = store_directory();
+    char path[1024];
+
+    if (ensure_dir(store_dir) != 0)
+        return 1;
+    snprintf(path, sizeof(path), "%s/chunks", store_dir);
+    if (ensure_dir(path) != 0)
+        return 1;
+    snprintf(path, sizeof(path), "%s/images", store_dir);
+    if (ensure_dir(path) != 0)
+        return 1;
+
+    FILE* f = fopen(img_filename, "rb");
+    if (!f)
+    {
+        perror("Error opening image file");
+        return 1;
+    }
+
+    ImageWTYHeader hdr;
+    read_image_header(f, &hdr);
+    if (strncmp(hdr.magic, IMAGEWTY_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "Error: '%s' is not a valid IMAGEWTY image.\n", img_filename);
+        fclose(f);
+        return 1;
+    }
+
+    Arena session;
+    arena_init(&session);
+    ImageWTYFileHeader* files =
+        read_all_file_headers(f, hdr.num_files, hdr.file_header_length, &session);
+
+    fseeko(f, 0, SEEK_END);
+    uint64_t image_size = (uint64_t)ftello(f);
+
+    /* Hash of the whole image, checked against the rebuilt image */
+    uint8_t image_digest[SHA256_DIGEST_SIZE];
+    char image_hex[SHA256_HEX_SIZE];
+    if (!files || sha256_file(img_filename, image_digest) != 0)
+    {
+        fprintf(stderr, "Error reading '%s'\n", img_filename);
+        arena_release(&session);
+        fclose(f);
+        return 1;
+    }
+    sha256_to_hex(image_digest, image_hex);
+
+    char* manifest_data = NULL;
+    size_t manifest_len = 0;
+    StoreContext ctx = {0};
+    ctx.store_dir = store_dir;
+    ctx.manifest = open_memstream(&manifest_data, &manifest_len);
+    ctx.buf = bufpool_get(CDC_MAX_SIZE);
+    if (!ctx.manifest || !ctx.buf)
+    {
+        perror("Memory allocation failed");
+        if (ctx.manifest)
+            fclose(ctx.manifest);
+        free(manifest_data);
+        bufpool_put(ctx.buf);
+        arena_release(&session);
+        fclose(f);
+        return 1;
+    }
+
+    init_gear_table();
+    fprintf(ctx.manifest, "%s\n", STORE_MANIFEST_MAGIC);
+    fprintf(ctx.manifest, "image_size %" PRIu64 "\n", image_size);
+    fprintf(ctx.manifest, "sha256 %s\n", image_hex);
+
+    /* Header region: global header plus the complete file header table */
+    uint64_t header_len = FILE_HEADERS_START + (uint64_t)hdr.num_files * hdr.file_header_length;
+    int ret = store_region(&ctx, f, 0, header_len, "header");
+
+    /* One region per entry, covering the stored (padded) length */
+    for (uint32_t i = 0; i < hdr.num_files && ret == 0; i++)
+    {
+        ImageWTYFileHeader* fh = &files[i];
+        ret = store_region(&ctx, f, fh->offset, fh->stored_length, fh->filename);
+    }
+    if (ret == 0)
+        ret = store_gaps(&ctx, f, files, hdr.num_files, header_len, image_size, &session);
+
+    fclose(ctx.manifest);
+    bufpool_put(ctx.buf);
+    arena_release(&session);
+    fclose(f);
+
+    if (ret != 0)
+    {
+        free(manifest_data);
+        return 1;
+    }
+
+    /* The image ID is the hash of its manifest */
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    char id[SHA256_HEX_SIZE];
+    sha256_buffer(manifest_data, manifest_len, digest);
+    sha256_to_hex(digest, id);
+
+    snprintf(path, sizeof(path), "%s/images/%s", store_dir, id);
+    ret = write_manifest(path, manifest_data, manifest_len);
+    free(manifest_data);
+    if (ret != 0)
+        return 1;
+
+    printf("Stored: %s\n", img_filename);
+    printf("  Image ID : %s\n", id);
+    printf("  Chunks   : %" PRIu64 " (%" PRIu64 " new, %" PRIu64 " bytes written)\n", ctx.chunks,
+           ctx.new_chunks, ctx.new_bytes);
+    return 0;
+}
+
+/**
+ * @brief Resolve a full or abbreviated image ID to its manifest path.
+ *
+ * @param store_dir Store directory.
+ * @param image_id  Full image ID or a unique prefix.
+ * @param out       Output buffer for the manifest path.
+ * @param size      Size of the output buffer.
+ * @return 0 on success, non-zero if no unique match exists.
+ */
+static int resolve_manifest(const char* store_dir, const char* image_id, char* out, size_t size)
+{
+    char images_dir[512];
+    snprintf(images_dir, sizeof(images_dir), "%s/images", store_dir);
+
+    DIR* dir = opendir(images_dir);
+    if (!dir)
+    {
+        fprintf(stderr, "Failed to open directory '%s': %s\n", images_dir, strerror(errno));
+        return 1;
+    }
+
+    size_t prefix_len = strlen(image_id);
+    int matches = 0;
+    struct dirent* entry;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.' || strncmp(entry->d_name, image_id, prefix_len) != 0)
+            continue;
+        snprintf(out, size, "%s/%s", images_dir, entry->d_name);
+        matches++;
+    }
+    closedir(dir);
+
+    if (matches == 0)
+    {
+        fprintf(stderr, "No stored image matches ID '%s'\n", image_id);
+        return 1;
+    }
+    if (matches > 1)
+    {
+        fprintf(stderr, "Image ID '%s' is ambiguous (%d matches)\n", image_id, matches);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copy one stored chunk into the output image, verifying its hash.
+ *
+ * @param store_dir Store directory.
+ * @param hex       Chunk digest (hex).
+ * @param len       Expected chunk length.
+ * @param buf       Scratch buffer of at least CDC_MAX_SIZE bytes.
+ * @param out       Output image, positioned where the chunk belongs.
+ * @return 0 on success, non-zero on error.
+ */
+static int restore_chunk(const char* store_dir, const char* hex, size_t len, uint8_t* buf,
+                         FILE* out)
+{
+    if (len > CDC_MAX_SIZE)
+    {
+        fprintf(stderr, "Invalid chunk length %zu for %s\n", len, hex);
+        return 1;
+    }
+
+    char path[1024];
+    chunk_path(path, sizeof(path), store_dir, hex);
+
+    FILE* cf = fopen(path, "rb");
+    if (!cf)
+    {
+        fprintf(stderr, "Missing chunk '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+    size_t got = fread(buf, 1, len, cf);
+    fclose(cf);
+
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    char actual[SHA256_HEX_SIZE];
+    sha256_buffer(buf, got, digest);
+    sha256_to_hex(digest, actual);
+
+    if (got != len || strcmp(actual, hex) != 0)
+    {
+        fprintf(stderr, "Corrupted chunk '%s'\n", path);
+        return 1;
+    }
+
+    if (fwrite(buf, 1, len, out) != len)
+    {
+        perror("Error writing output image");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Rebuild an image from the chunk store.
+ *
+ * @param image_id    Full image ID or a unique prefix of it.
+ * @param output_file Path where the rebuilt image will be written.
+ * @return 0 on success, non-zero on error.
+ */
+int store_get_image(const char* image_id, const char* output_file)
+{
+    if (!image_id || !output_file)
+    {
+        fprintf(stderr, "store_get_image: invalid parameters\n");
+        return 1;
+    }
+
+    const char* store_dir = store_directory();
+    char manifest_path[1024];
+    if (resolve_manifest(store_dir, image_id, manifest_path, sizeof(manifest_path)) != 0)
+        return 1;
+
+    FILE* mf = fopen(manifest_path, "r");
+    if (!mf)
+    {
+        fprintf(stderr, "Cannot open manifest '%s': %s\n", manifest_path, strerror(errno));
+        return 1;
+    }
+
+    char line[1024];
+    size_t magic_len = strlen(STORE_MANIFEST_MAGIC);
+    int v1 = 0;
+    int valid = fgets(line, sizeof(line), mf) != NULL;
+    if (valid)
+        v1 = strncmp(line, STORE_MANIFEST_MAGIC_V1, magic_len) == 0;
+    if (!valid || (!v1 && strncmp(line, STORE_MANIFEST_MAGIC, magic_len) != 0))
+    {
+        fprintf(stderr, "'%s' is not a valid store manifest\n", manifest_path);
+        fclose(mf);
+        return 1;
+    }
+
+    FILE* out = fopen(output_file, "wb");
+    uint8_t* buf = out ? bufpool_get(CDC_MAX_SIZE) : NULL;
+    if (!out || !buf)
+    {
+        if (!out)
+            fprintf(stderr, "Cannot create output file '%s': %s\n", output_file,
+                    strerror(errno));
+        else
+            fclose(out);
+        bufpool_put(buf);
+        fclose(mf);
+        return 1;
+    }
+
+    uint64_t image_size = 0;
+    char expected[SHA256_HEX_SIZE] = "";
+    int ret = 0;
+
+    while (ret == 0 && fgets(line, sizeof(line), mf))
+    {
+        uint64_t a, b;
+        char hex[SHA256_HEX_SIZE];
+        size_t len;
+        int name_pos = 0;
+
+        if (sscanf(line, "image_size %" SCNu64, &a) == 1)
+        {
+            image_size = a;
+        }
+        else if (sscanf(line, "sha256 %64s", hex) == 1)
+        {
+            snprintf(expected, sizeof(expected), "%s", hex);
+        }
+        else if (sscanf(line, "region %" SCNu64 " %" SCNu64 " %n", &a, &b, &name_pos) == 2)
+        {
+            /* Regions are written at their original offsets */
+            if (fseeko(out, (off_t)a, SEEK_SET) != 0)
+            {
+                perror("Error seeking in output file");
+                ret = 1;
+            }
+            else if (b > 0 && name_pos > 0 && strcmp(line + name_pos, "header\n") != 0 &&
+                     strcmp(line + name_pos, "gap\n") != 0)
+            {
+                printf("Restoring: %s", line + name_pos);
+            }
+        }
+        else if (sscanf(line, "chunk %64s %zu", hex, &len) == 2)
+        {
+            ret = restore_chunk(store_dir, hex, len, buf, out);
+        }
+    }
+
+    /* Restore trailing gaps (if any) so the image has its original size */
+    if (ret == 0 && (fflush(out) != 0 || ftruncate(fileno(out), (off_t)image_size) != 0))
+    {
+        perror("Error setting output image size");
+        ret = 1;
+    }
+
+    bufpool_put(buf);
+    fclose(mf);
+    if (fclose(out) != 0)
+        ret = 1;
+
+    /* Chunk hashes only cover the chunks: check the image as a whole */
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    char actual[SHA256_HEX_SIZE];
+    if (ret == 0 && expected[0] != '\0')
+    {
+        if (sha256_file(output_file, digest) != 0)
+        {
+            fprintf(stderr, "Cannot read back '%s'\n", output_file);
+            ret = 1;
+        }
+        else
+        {
+            sha256_to_hex(digest, actual);
+            if (strcmp(actual, expected) != 0)
+            {
+                fprintf(stderr, "Error: rebuilt image does not match the stored image (SHA-256 %s, "
+                                "expected %s)\n",
+                        actual, expected);
+                ret = 1;
+            }
+        }
+    }
+    else if (ret == 0)
+    {
+        fprintf(stderr, "Warning: %s records no image checksum; gaps between entries are "
+                        "restored as zeros and the result is not checked\n",
+                v1 ? "this older manifest" : "the manifest");
+    }
+
+    if (ret == 0)
+        printf("Image rebuilt successfully: %s\n", output_file);
+    else
+        unlink(output_file);
+    return ret;
+}
@@ -0,0 +1,494 @@
+/**
+ * @file img_tar.c
+ * @brief Minimal pax (POSIX.1-2001 tar) archive writer and reader.
+ */
+
+#define _GNU_SOURCE
+
+#include "img_tar.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "img_io.h"
+
+/** Largest value of an 11-digit octal header field */
+#define TAR_OCTAL_MAX 077777777777ULL
+
+/** Size of the pax record buffer (two long names plus a size record) */
+#define TAR_PAX_BUFFER_SIZE 1024
+
+/** Largest extension header (pax records or GNU long name) the reader accepts */
+#define TAR_MAX_EXTENSION_SIZE (64 * 1024)
+
+/** Size of the buffer data skipped in a pipe is read into */
+#define TAR_SKIP_BUFFER_SIZE (64 * 1024)
+
+/**
+ * @brief Store a number in an octal header field (NUL-terminated).
+ *
+ * @param field Header field.
+ * @param width Field width including the terminating NUL.
+ * @param value Value to store.
+ */
+static void put_octal(char* field, size_t width, uint64_t value)
+{
+    field[width - 1] = '\0';
+    for (size_t i = width - 1; i-- > 0; value >>= 3)
+        field[i] = (char)('0' + (value & 7));
+}
+
+/**
+ * @brief Append one "LEN key=value\n" record to a pax header.
+ *
+ * @param buf   Record buffer.
+ * @param used  Bytes used in buf (updated).
+ * @param key   Record key.
+ * @param value Record value.
+ * @return 0 on success, non-zero if the buffer is full.
+ */
+static int add_pax_record(char* buf, size_t* used, const char* key, const char* value)
+{
+    size_t base = strlen(key) + strlen(value) + 3; /* ' ', '=' and '\n' */
+    size_t len = base + 1;
+    while (len != base + (size_t)snprintf(NULL, 0, "%zu", len))
+        len = base + (size_t)snprintf(NULL, 0, "%zu", len);
+
+    if (*used + len + 1 > TAR_PAX_BUFFER_SIZE)
+        return 1;
+    *used += (size_t)snprintf(buf + *used, TAR_PAX_BUFFER_SIZE - *used, "%zu %s=%s\n", len, key,
+                              value);
+    return 0;
+}
+
+/**
+ * @brief Build and write one ustar header block.
+ *
+ * @param fd       Archive output.
+ * @param name     Member name (truncated to the ustar field).
+ * @param size     Data size (at most TAR_OCTAL_MAX).
+ * @param type     Member type.
+ * @param linkname Link target or NULL (truncated to the ustar field).
+ * @param mtime    Modification time.
+ * @return 0 on success, non-zero on error.
+ */
+static int write_ustar_block(int fd, const char* name, uint64_t size, char type,
+                             const char* linkname, time_t mtime)
+{
+    char block[TAR_BLOCK_SIZE];
+    memset(block, 0, sizeof(block));
+
+    strncpy(block, name, 100);
+    put_octal(block + 100, 8, 0644);
+    put_octal(block + 108, 8, 0);
+    put_octal(block + 116, 8, 0);
+    put_octal(block + 124, 12, size);
+    put_octal(block + 136, 12, mtime > 0 ? (uint64_t)mtime : 0);
+    block[156] = type;
+    if (linkname)
+        strncpy(block + 157, linkname, 100);
+    memcpy(block + 257, "ustar", 6);
+    memcpy(block + 263, "00", 2);
+
+    /* The checksum is computed with its own field filled with spaces */
+    memset(block + 148, ' ', 8);
+    unsigned sum = 0;
+    for (size_t i = 0; i < sizeof(block); i++)
+        sum += (unsigned char)block[i];
+    snprintf(block + 148, 8, "%06o", sum);
+
+    return io_write_all(fd, block, sizeof(block));
+}
+
+/**
+ * @brief Write the header of one archive member.
+ *
+ * @param fd       Archive output.
+ * @param name     Member name.
+ * @param size     Data size (0 for links).
+ * @param type     TAR_TYPE_FILE or TAR_TYPE_LINK.
+ * @param linkname Link target for TAR_TYPE_LINK, else NULL.
+ * @param mtime    Modification time recorded for the member.
+ * @return 0 on success, non-zero on error.
+ */
+int tar_write_header(int fd, const char* name, uint64_t size, char type, const char* linkname,
+                     time_t mtime)
+{
+    char pax[TAR_PAX_BUFFER_SIZE];
+    size_t used = 0;
+    int ret = 0;
+
+    if (strlen(name) > 100)
+        ret |= add_pax_record(pax, &used, "path", name);
+    if (linkname && strlen(linkname) > 100)
+        ret |= add_pax_record(pax, &used, "linkpath", linkname);
+    if (size > TAR_OCTAL_MAX)
+    {
+        char num[24];
+        snprintf(num, sizeof(num), "%llu", (unsigned long long)size);
+        ret |= add_pax_record(pax, &used, "size", num);
+    }
+    if (ret)
+    {
+        fprintf(stderr, "Archive member name too long: '%s'\n", name);
+        return 1;
+    }
+
+    if (used > 0)
+    {
+        char pax_name[100];
+        snprintf(pax_name, sizeof(pax_name), "PaxHeaders/%s", name);
+        if (write_ustar_block(fd, pax_name, used, TAR_TYPE_PAX, NULL, mtime) != 0 ||
+            io_write_all(fd, pax, used) != 0 || tar_write_padding(fd, used) != 0)
+        {
+            return 1;
+        }
+    }
+
+    return write_ustar_block(fd, name, size > TAR_OCTAL_MAX ? 0 : size, type, linkname, mtime);
+}
+
+/**
+ * @brief Pad member data to the next block boundary.
+ *
+ * @param fd   Archive output.
+ * @param size Data size of the member.
+ * @return 0 on success, non-zero on error.
+ */
+int tar_write_padding(int fd, uint64_t size)
+{
+    uint64_t rem = size % TAR_BLOCK_SIZE;
+    return rem ? io_send_zeros(fd, TAR_BLOCK_SIZE - rem) : 0;
+}
+
+/**
+ * @brief Write a complete regular-file member from memory.
+ *
+ * @param fd    Archive output.
+ * @param name  Member name.
+ * @param data  Member data.
+ * @param size  Data size.
+ * @param mtime Modification time recorded for the member.
+ * @return 0 on success, non-zero on error.
+ */
+int tar_write_file(int fd, const char* name, const void* data, uint64_t size, time_t mtime)
+{
+    if (tar_write_header(fd, name, size, TAR_TYPE_FILE, NULL, mtime) != 0 ||
+        io_write_all(fd, data, (size_t)size) != 0)
+    {
+        return 1;
+    }
+    return tar_write_padding(fd, size);
+}
+
+/**
+ * @brief Write the end-of-archive marker (two zero blocks).
+ *
+ * @param fd Archive output.
+ * @return 0 on success, non-zero on error.
+ */
+int tar_write_end(int fd)
+{
+    return io_send_zeros(fd, 2 * TAR_BLOCK_SIZE);
+}
+
+/**
+ * @brief Start reading an archive at the current position of a descriptor.
+ *
+ * @param r  Reader to initialize.
+ * @param fd Archive input (a regular file or a pipe).
+ */
+void tar_reader_init(TarReader* r, int fd)
+{
+    struct stat st;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+
+    r->fd = fd;
+    r->pos = pos > 0 ? (uint64_t)pos : 0;
+    r->pending = 0;
+    r->seekable = pos >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/**
+ * @brief Read exactly len bytes from the archive.
+ *
+ * @param r   Reader.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @return 0 on success, non-zero on error or premature end of input.
+ */
+static int read_exact(TarReader* r, void* buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = read(r->fd, (uint8_t*)buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            fprintf(stderr, "Error reading archive at offset %llu: %s\n",
+                    (unsigned long long)(r->pos + done),
+                    n < 0 ? strerror(errno) : "unexpected end of input");
+            return 1;
+        }
+        done += (size_t)n;
+    }
+    r->pos += len;
+    return 0;
+}
+
+/**
+ * @brief Skip bytes of the archive.
+ *
+ * @param r   Reader.
+ * @param len Number of bytes to skip.
+ * @return 0 on success, non-zero on error or premature end of input.
+ */
+static int skip_bytes(TarReader* r, uint64_t len)
+{
+    if (len == 0)
+        return 0;
+    if (r->seekable)
+    {
+        if (lseek(r->fd, (off_t)len, SEEK_CUR) < 0)
+        {
+            perror("Error seeking in archive");
+            return 1;
+        }
+        r->pos += len;
+        return 0;
+    }
+
+    char buf[TAR_SKIP_BUFFER_SIZE];
+    while (len > 0)
+    {
+        size_t n = len > sizeof(buf) ? sizeof(buf) : (size_t)len;
+        if (read_exact(r, buf, n) != 0)
+            return 1;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Parse a numeric header field (octal, or GNU base-256).
+ *
+ * @param field Header field.
+ * @param width Field width.
+ * @return Parsed value.
+ */
+static uint64_t parse_number(const char* field, size_t width)
+{
+    uint64_t v = 0;
+    if ((unsigned char)field[0] & 0x80)
+    {
+        v = (unsigned char)field[0] & 0x7F;
+        for (size_t i = 1; i < width; i++)
+            v = (v << 8) | (unsigned char)field[i];
+        return v;
+    }
+
+    size_t i = 0;
+    while (i < width && field[i] == ' ')
+        i++;
+    for (; i < width && field[i] >= '0' && field[i] <= '7'; i++)
+        v = (v << 3) | (uint64_t)(field[i] - '0');
+    return v;
+}
+
+/**
+ * @brief Copy a header string field that may lack a terminating NUL.
+ *
+ * @param dst   Destination (TAR_NAME_MAX bytes).
+ * @param field Header field.
+ * @param width Field width.
+ */
+static void copy_field(char* dst, const char* field, size_t width)
+{
+    size_t len = strnlen(field, width);
+    memcpy(dst, field, len);
+    dst[len] = '\0';
+}
+
+/**
+ * @brief Apply the records of a pax extended header to a member.
+ *
+ * @param m    Member the header describes.
+ * @param data Record data (NUL-terminated).
+ * @param len  Length of the record data.
+ * @return 0 on success, non-zero on malformed records.
+ */
+static int apply_pax_records(TarMember* m, char* data, size_t len)
+{
+    size_t pos = 0;
+    while (pos < len)
+    {
+        char* end;
+        unsigned long rec_len = strtoul(data + pos, &end, 10);
+        if (end == data + pos || *end != ' ' || rec_len < 5 || rec_len > len - pos ||
+            data[pos + rec_len - 1] != '\n')
+        {
+            return 1;
+        }
+
+        char* key = end + 1;
+        char* eq = memchr(key, '=', (size_t)(data + pos + rec_len - 1 - key));
+        if (!eq)
+            return 1;
+        *eq = '\0';
+        char* value = eq + 1;
+        size_t value_len = (size_t)(data + pos + rec_len - 1 - value);
+
+        if (strcmp(key, "path") == 0 || strcmp(key, "linkpath") == 0)
+        {
+            if (value_len >= TAR_NAME_MAX)
+                return 1;
+            char* dst = key[0] == 'p' ? m->name : m->linkname;
+            memcpy(dst, value, value_len);
+            dst[value_len] = '\0';
+        }
+        else if (strcmp(key, "size") == 0)
+        {
+            m->size = strtoull(value, NULL, 10);
+        }
+        pos += rec_len;
+    }
+    return 0;
+}
+
+/**
+ * @brief Advance to the next member.
+ *
+ * @param r Reader.
+ * @param m Output: the member.
+ * @return 0 for a member, 1 at the end of the archive, -1 on error.
+ */
+int tar_next(TarReader* r, TarMember* m)
+{
+    /* Overrides collected from extension headers for the next member */
+    char name[TAR_NAME_MAX] = "";
+    char linkname[TAR_NAME_MAX] = "";
+    char* pax = NULL;
+    size_t pax_len = 0;
+
+    for (;;)
+    {
+        if (skip_bytes(r, r->pending) != 0)
+            break;
+        r->pending = 0;
+
+        uint8_t block[TAR_BLOCK_SIZE];
+        if (read_exact(r, block, sizeof(block)) != 0)
+            break;
+
+        unsigned sum = 0;
+        int zero = 1;
+        for (size_t i = 0; i < sizeof(block); i++)
+        {
+            sum += (i >= 148 && i < 156) ? ' ' : block[i];
+            zero &= block[i] == 0;
+        }
+        if (zero)
+        {
+            free(pax);
+            return 1;
+        }
+        if (sum != parse_number((const char*)block + 148, 8))
+        {
+            fprintf(stderr, "Bad tar header checksum at offset %llu\n",
+                    (unsigned long long)(r->pos - TAR_BLOCK_SIZE));
+            break;
+        }
+
+        const char* h = (const char*)block;
+        memset(m, 0, sizeof(*m));
+        m->type = h[156] == '\0' ? TAR_TYPE_FILE : h[156];
+        m->size = parse_number(h + 124, 12);
+        m->data_offset = r->pos;
+        r->pending = (m->size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+
+        if (m->type == TAR_TYPE_PAX || m->type == TAR_TYPE_GNU_LONGNAME ||
+            m->type == TAR_TYPE_GNU_LONGLINK)
+        {
+            if (m->size > TAR_MAX_EXTENSION_SIZE)
+            {
+                fprintf(stderr, "Tar extension header too large\n");
+                break;
+            }
+            char* data = malloc((size_t)m->size + 1);
+            if (!data || tar_read_data(r, data, (size_t)m->size) != 0)
+            {
+                free(data);
+                break;
+            }
+            data[m->size] = '\0';
+
+            if (m->type == TAR_TYPE_PAX)
+            {
+                free(pax);
+                pax = data;
+                pax_len = (size_t)m->size;
+                continue;
+            }
+            snprintf(m->type == TAR_TYPE_GNU_LONGNAME ? name : linkname, TAR_NAME_MAX, "%s",
+                     data);
+            free(data);
+            continue;
+        }
+        if (m->type == TAR_TYPE_PAX_GLOBAL)
+            continue;
+
+        /* ustar splits long names into prefix and name */
+        if (memcmp(h + 257, "ustar", 5) == 0 && h[345] != '\0')
+        {
+            char prefix[156];
+            char base[101];
+            copy_field(prefix, h + 345, 155);
+            copy_field(base, h, 100);
+            snprintf(m->name, TAR_NAME_MAX, "%s/%s", prefix, base);
+        }
+        else
+        {
+            copy_field(m->name, h, 100);
+        }
+        copy_field(m->linkname, h + 157, 100);
+
+        if (name[0])
+            memcpy(m->name, name, sizeof(name));
+        if (linkname[0])
+            memcpy(m->linkname, linkname, sizeof(linkname));
+        if (pax && apply_pax_records(m, pax, pax_len) != 0)
+        {
+            fprintf(stderr, "Malformed pax header for '%s'\n", m->name);
+            break;
+        }
+        free(pax);
+
+        r->pending = (m->size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+        return 0;
+    }
+
+    free(pax);
+    return -1;
+}
+
+/**
+ * @brief Read data of the current member.
+ *
+ * @param r   Reader.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @return 0 on success, non-zero on error or premature end of input.
+ */
+int tar_read_data(TarReader* r, void* buf, size_t len)
+{
+    if (len > r->pending || read_exact(r, buf, len) != 0)
+        return 1;
+    r->pending -= len;
+    return 0;
+}
@@ -0,0 +1,404 @@
+/**
+ * @file img_uring.c
+ * @brief io_uring data transfer backend built on the raw system calls.
+ *
+ * A copy is split into URING_CHUNK_SIZE chunks. Every chunk owns one
+ * registered buffer and is submitted as a READ_FIXED SQE linked
+ * (IOSQE_IO_LINK) to a WRITE_FIXED SQE, so the kernel starts the write as
+ * soon as the read completes without a round trip to user space. Up to
+ * URING_QUEUE_DEPTH chunks are in flight; a buffer is reused once the
+ * write of its chunk has completed.
+ *
+ * Short transfers (a short read cancels the linked write) are completed
+ * synchronously with pread()/pwrite() from the same buffer.
+ */
+
+#define _GNU_SOURCE
+
+#include "img_uring.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+#include "img_bufpool.h"
+
+/**
+ * @brief Mapped io_uring instance.
+ */
+typedef struct
+{
+    int fd;                    /**< Ring file descriptor */
+    unsigned sq_entries;       /**< Number of SQ entries */
+    unsigned* sq_head;         /**< SQ head (advanced by the kernel) */
+    unsigned* sq_tail;         /**< SQ tail (advanced by us) */
+    unsigned* sq_mask;         /**< SQ index mask */
+    unsigned* sq_array;        /**< SQ index array */
+    struct io_uring_sqe* sqes; /**< Submission queue entries */
+    unsigned* cq_head;         /**< CQ head (advanced by us) */
+    unsigned* cq_tail;         /**< CQ tail (advanced by the kernel) */
+    unsigned* cq_mask;         /**< CQ index mask */
+    struct io_uring_cqe* cqes; /**< Completion queue entries */
+    void* sq_ring;             /**< SQ ring mapping */
+    size_t sq_ring_size;       /**< Size of the SQ ring mapping */
+    void* cq_ring;             /**< CQ ring mapping (may equal sq_ring) */
+    size_t cq_ring_size;       /**< Size of the CQ ring mapping */
+    size_t sqes_size;          /**< Size of the SQE array mapping */
+    unsigned sq_local_tail;    /**< SQ tail including SQEs not yet published */
+    unsigned to_submit;        /**< SQEs queued but not yet consumed by the kernel */
+    uint8_t* buffers;          /**< URING_QUEUE_DEPTH chunk buffers */
+    int fixed;                 /**< Buffers registered with the kernel */
+} UringRing;
+
+/**
+ * @brief State of one in-flight chunk.
+ */
+typedef struct
+{
+    int busy;         /**< Chunk is in flight */
+    uint32_t len;     /**< Chunk length */
+    uint64_t in_off;  /**< Source offset */
+    uint64_t out_off; /**< Destination offset */
+    int32_t read_res; /**< Result of the read SQE */
+} UringSlot;
+
+static UringRing ring = {.fd = -1};
+
+/** 0 = not tried yet, 1 = ready, -1 = unavailable */
+static int ring_state = 0;
+
+/**
+ * @brief Map the rings of a freshly created io_uring instance.
+ *
+ * @param p Parameters returned by io_uring_setup().
+ * @return 0 on success, non-zero on error.
+ */
+static int ring_map(const struct io_uring_params* p)
+{
+    ring.sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+
+    int single = (p->features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring.cq_ring_size > ring.sq_ring_size)
+        ring.sq_ring_size = ring.cq_ring_size;
+
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED)
+        return 1;
+
+    if (single)
+    {
+        ring.cq_ring = ring.sq_ring;
+        ring.cq_ring_size = ring.sq_ring_size;
+    }
+    else
+    {
+        ring.cq_ring = mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (ring.cq_ring == MAP_FAILED)
+            return 1;
+    }
+
+    ring.sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED)
+        return 1;
+
+    uint8_t* sq = ring.sq_ring;
+    uint8_t* cq = ring.cq_ring;
+    ring.sq_entries = p->sq_entries;
+    ring.sq_head = (unsigned*)(sq + p->sq_off.head);
+    ring.sq_tail = (unsigned*)(sq + p->sq_off.tail);
+    ring.sq_mask = (unsigned*)(sq + p->sq_off.ring_mask);
+    ring.sq_array = (unsigned*)(sq + p->sq_off.array);
+    ring.cq_head = (unsigned*)(cq + p->cq_off.head);
+    ring.cq_tail = (unsigned*)(cq + p->cq_off.tail);
+    ring.cq_mask = (unsigned*)(cq + p->cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*)(cq + p->cq_off.cqes);
+    return 0;
+}
+
+/**
+ * @brief Create the ring and register the chunk buffers.
+ *
+ * If the buffers cannot be registered (e.g. RLIMIT_MEMLOCK is too low),
+ * plain READ/WRITE SQEs are used on the same buffers instead.
+ *
+ * @return 0 on success, non-zero if io_uring is unavailable.
+ */
+static int ring_setup(void)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    ring.sq_ring = MAP_FAILED;
+    ring.cq_ring = MAP_FAILED;
+    ring.sqes = MAP_FAILED;
+
+    ring.fd = (int)syscall(__NR_io_uring_setup, URING_QUEUE_DEPTH * 2, &p);
+    if (ring.fd < 0)
+        return 1;
+
+    if (ring_map(&p) != 0 ||
+        !(ring.buffers = bufpool_get((size_t)URING_QUEUE_DEPTH * URING_CHUNK_SIZE)))
+    {
+        uring_shutdown();
+        return 1;
+    }
+
+    struct iovec iov[URING_QUEUE_DEPTH];
+    for (int i = 0; i < URING_QUEUE_DEPTH; i++)
+    {
+        iov[i].iov_base = ring.buffers + (size_t)i * URING_CHUNK_SIZE;
+        iov[i].iov_len = URING_CHUNK_SIZE;
+    }
+    ring.fixed = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, iov,
+                         URING_QUEUE_DEPTH) == 0;
+    ring.sq_local_tail = *ring.sq_tail;
+    ring.to_submit = 0;
+    return 0;
+}
+
+/**
+ * @brief Check whether io_uring can be used, creating the ring if needed.
+ *
+ * @return Non-zero if the ring is ready.
+ */
+int uring_available(void)
+{
+    if (ring_state == 0)
+        ring_state = ring_setup() == 0 ? 1 : -1;
+    return ring_state == 1;
+}
+
+/**
+ * @brief Tear down the ring and release its buffers.
+ */
+void uring_shutdown(void)
+{
+    if (ring.sqes != MAP_FAILED && ring.sqes)
+        munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_ring != MAP_FAILED && ring.cq_ring && ring.cq_ring != ring.sq_ring)
+        munmap(ring.cq_ring, ring.cq_ring_size);
+    if (ring.sq_ring != MAP_FAILED && ring.sq_ring)
+        munmap(ring.sq_ring, ring.sq_ring_size);
+    if (ring.fd >= 0)
+        close(ring.fd);
+    bufpool_put(ring.buffers);
+
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+    ring_state = 0;
+}
+
+/**
+ * @brief Queue one read or write SQE for a chunk.
+ *
+ * The caller guarantees that the SQ has room (at most two SQEs per free
+ * slot are ever queued).
+ *
+ * @param write   Non-zero for a write, zero for a read.
+ * @param fd      File descriptor.
+ * @param slot    Chunk slot index (selects the buffer).
+ * @param len     Transfer length.
+ * @param off     File offset.
+ * @param flags   SQE flags (e.g. IOSQE_IO_LINK).
+ */
+static void queue_rw(int write, int fd, unsigned slot, uint32_t len, uint64_t off, uint8_t flags)
+{
+    unsigned idx = ring.sq_local_tail & *ring.sq_mask;
+    struct io_uring_sqe* sqe = &ring.sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    if (ring.fixed)
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    else
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->flags = flags;
+    sqe->addr = (uint64_t)(uintptr_t)(ring.buffers + (size_t)slot * URING_CHUNK_SIZE);
+    sqe->len = len;
+    sqe->off = off;
+    sqe->buf_index = (uint16_t)slot;
+    sqe->user_data = ((uint64_t)slot << 1) | (write ? 1 : 0);
+
+    ring.sq_array[idx] = idx;
+    ring.sq_local_tail++;
+    ring.to_submit++;
+}
+
+/**
+ * @brief Submit queued SQEs and wait for at least one completion.
+ *
+ * @return 0 on success, non-zero on error.
+ */
+static int submit_and_wait(void)
+{
+    __atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+
+    for (;;)
+    {
+        long r = syscall(__NR_io_uring_enter, ring.fd, ring.to_submit, 1,
+                         IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r >= 0)
+        {
+            ring.to_submit -= (unsigned)r > ring.to_submit ? ring.to_submit : (unsigned)r;
+            return 0;
+        }
+        if (errno != EINTR)
+        {
+            perror("io_uring_enter failed");
+            return 1;
+        }
+    }
+}
+
+/**
+ * @brief Complete a chunk whose transfer did not finish in the ring.
+ *
+ * @param s         Chunk slot.
+ * @param buf       Chunk buffer.
+ * @param in_fd     Source file descriptor.
+ * @param out_fd    Destination file descriptor.
+ * @param write_res Result of the write SQE.
+ * @return 0 on success, non-zero on error.
+ */
+static int finish_chunk(const UringSlot* s, uint8_t* buf, int in_fd, int out_fd,
+                        int32_t write_res)
+{
+    if (write_res == (int32_t)s->len)
+        return 0;
+
+    if (s->read_res < 0)
+    {
+        fprintf(stderr, "Error reading data: %s\n", strerror(-s->read_res));
+        return 1;
+    }
+
+    uint32_t written = 0;
+    if (write_res == -ECANCELED)
+    {
+        /* Short read: the linked write never ran */
+        uint32_t have = (uint32_t)s->read_res;
+        while (have < s->len)
+        {
+            ssize_t r = pread(in_fd, buf + have, s->len - have, (off_t)(s->in_off + have));
+            if (r <= 0)
+            {
+                fprintf(stderr, "Error reading data: %s\n",
+                        r < 0 ? strerror(errno) : "unexpected end of file");
+                return 1;
+            }
+            have += (uint32_t)r;
+        }
+    }
+    else if (write_res < 0)
+    {
+        fprintf(stderr, "Error writing data: %s\n", strerror(-write_res));
+        return 1;
+    }
+    else
+    {
+        written = (uint32_t)write_res;
+    }
+
+    while (written < s->len)
+    {
+        ssize_t w = pwrite(out_fd, buf + written, s->len - written, (off_t)(s->out_off + written));
+        if (w <= 0)
+        {
+            perror("Error writing data");
+            return 1;
+        }
+        written += (uint32_t)w;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copy a byte range between two different files through io_uring.
+ *
+ * @param in_fd   Source file descriptor.
+ * @param in_off  Source offset.
+ * @param out_fd  Destination file descriptor.
+ * @param out_off Destination offset.
+ * @param len     Number of bytes to copy.
+ * @return 0 on success, non-zero on error.
+ */
+int uring_copy_range(int in_fd, uint64_t in_off, int out_fd, uint64_t out_off, uint64_t len)
+{
+    if (!uring_available())
+        return 1;
+
+    UringSlot slots[URING_QUEUE_DEPTH];
+    memset(slots, 0, sizeof(slots));
+
+    unsigned inflight = 0;
+    uint64_t pos = 0;
+    int ret = 0;
+
+    while ((ret == 0 && pos < len) || inflight > 0)
+    {
+        /* Fill every free slot with a linked read -> write pair */
+        for (unsigned s = 0; ret == 0 && pos < len && s < URING_QUEUE_DEPTH; s++)
+        {
+            if (slots[s].busy)
+                continue;
+
+            uint32_t n = (len - pos) > URING_CHUNK_SIZE ? URING_CHUNK_SIZE : (uint32_t)(len - pos);
+            slots[s].busy = 1;
+            slots[s].len = n;
+            slots[s].in_off = in_off + pos;
+            slots[s].out_off = out_off + pos;
+            slots[s].read_res = 0;
+
+            queue_rw(0, in_fd, s, n, slots[s].in_off, IOSQE_IO_LINK);
+            queue_rw(1, out_fd, s, n, slots[s].out_off, 0);
+            inflight++;
+            pos += n;
+        }
+
+        if (submit_and_wait() != 0)
+        {
+            /* Closing the ring waits for whatever is still in flight */
+            uring_shutdown();
+            ring_state = -1;
+            return 1;
+        }
+
+        /* Reap completions; a slot is free once its write has completed */
+        unsigned head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+        {
+            const struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+            unsigned s = (unsigned)(cqe->user_data >> 1);
+
+            if ((cqe->user_data & 1) == 0)
+            {
+                slots[s].read_res = cqe->res;
+            }
+            else
+            {
+                uint8_t* buf = ring.buffers + (size_t)s * URING_CHUNK_SIZE;
+                if (finish_chunk(&slots[s], buf, in_fd, out_fd, cqe->res) != 0)
+                    ret = 1;
+                slots[s].busy = 0;
+                inflight--;
+            }
+            head++;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return ret;
+}
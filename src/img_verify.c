@@ -0,0 +1,223 @@
+/**
+ * @file img_verify.c
+ * @brief Verifies IMAGEWTY images without extracting them.
+ *
+ * Payloads are streamed through source_read_range(), so verification honours
+ * the selected transfer mode (e.g. O_DIRECT with --direct) and also works on
+ * images inside zip bundles and on gzip/xz compressed images.
+ */
+
+#define _GNU_SOURCE
+
+#include "img_verify.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checksum.h"
+#include "file_table.h"
+#include "img_header.h"
+#include "img_source.h"
+
+/**
+ * @brief source_read_range() callback feeding an incremental checksum.
+ *
+ * @param data Chunk of data.
+ * @param len  Chunk length.
+ * @param ctx  ChecksumState to update.
+ * @return Always 0.
+ */
+static int checksum_chunk(const uint8_t* data, size_t len, void* ctx)
+{
+    checksum_update((ChecksumState*)ctx, data, len);
+    return 0;
+}
+
+/**
+ * @brief Check one V*.fex entry against the checksum of its target entry.
+ *
+ * @param src   Image.
+ * @param table File table of the image.
+ * @param v     Index of the V*.fex entry.
+ * @return 0 if the checksum matches (or the target is absent), non-zero otherwise.
+ */
+static int verify_vfile_entry(ImageSource* src, const FileTable* table, uint32_t v)
+{
+    const char* vname = file_table_str(table, table->filename[v]);
+    const char* realname = vname + 1;
+    long t = file_table_find(table, realname);
+    if (t < 0)
+    {
+        printf("[SKIP] %s: no entry '%s' in image\n", vname, realname);
+        return 0;
+    }
+
+    uint8_t chk[4];
+    if (table->original_length[v] < 4 || source_pread(src, chk, 4, table->offset[v]) != 0)
+    {
+        printf("[FAIL] %s: cannot read stored checksum\n", vname);
+        return 1;
+    }
+    uint32_t expected = (uint32_t)chk[0] | ((uint32_t)chk[1] << 8) | ((uint32_t)chk[2] << 16) |
+                        ((uint32_t)chk[3] << 24);
+
+    ChecksumState st;
+    checksum_init(&st);
+    if (source_read_range(src, table->offset[t], table->original_length[t], checksum_chunk,
+                          &st) != 0)
+    {
+        printf("[FAIL] %s: cannot read data\n", realname);
+        return 1;
+    }
+    uint32_t actual = checksum_final(&st);
+
+    if (actual != expected)
+    {
+        printf("[FAIL] %s checksum mismatch: expected %u, got %u\n", realname, expected, actual);
+        return 1;
+    }
+    printf("[OK]   %s checksum matches (%u)\n", realname, actual);
+    return 0;
+}
+
+/**
+ * @brief Mark the V*.fex entries covering the named entries.
+ *
+ * @param t           File table of the image.
+ * @param entries     Entry names (checked files or V*.fex entries).
+ * @param entry_count Number of names.
+ * @param selected    Output: non-zero for the V*.fex entries to check.
+ * @return Number of names that match no entry.
+ */
+static unsigned select_vfiles(const FileTable* t, const char* const* entries, int entry_count,
+                              uint8_t* selected)
+{
+    unsigned failures = 0;
+    for (int k = 0; k < entry_count; k++)
+    {
+        const char* name = entries[k];
+        if (file_table_find(t, name) < 0)
+        {
+            printf("[FAIL] %s: no such entry in image\n", name);
+            failures++;
+            continue;
+        }
+
+        long v = -1;
+        char vname[512];
+        if (is_checksum_vfile(name))
+            v = file_table_find(t, name);
+        else if (snprintf(vname, sizeof(vname), "V%s", name) < (int)sizeof(vname))
+            v = file_table_find(t, vname);
+        if (v < 0)
+            printf("[SKIP] %s: not covered by a V*.fex checksum\n", name);
+        else
+            selected[v] = 1;
+    }
+    return failures;
+}
+
+/**
+ * @brief Verify an image in place.
+ *
+ * @param img_filename Path to the IMAGEWTY image file (or "bundle.zip!/member").
+ * @param entries      Names of the entries to check.
+ * @param entry_count  Number of names, or 0 to check every entry.
+ * @return 0 if the image is consistent, non-zero otherwise.
+ */
+int verify_image(const char* img_filename, const char* const* entries, int entry_count)
+{
+    ImageSource src;
+    if (source_open(&src, img_filename) != 0)
+        return 1;
+    FILE* f = source_fopen(&src);
+    if (!f)
+    {
+        source_close(&src);
+        return 1;
+    }
+
+    ImageWTYHeader hdr;
+    read_image_header(f, &hdr);
+    if (strncmp(hdr.magic, IMAGEWTY_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "Error: '%s' is not a valid IMAGEWTY image.\n", img_filename);
+        fclose(f);
+        source_close(&src);
+        return 1;
+    }
+
+    Arena session;
+    arena_init(&session);
+
+    ImageWTYFileHeader* files =
+        read_all_file_headers(f, hdr.num_files, hdr.file_header_length, &session);
+    if (!files)
+    {
+        fprintf(stderr, "Error reading file headers from '%s'\n", img_filename);
+        arena_release(&session);
+        fclose(f);
+        source_close(&src);
+        return 1;
+    }
+
+    unsigned failures = 0;
+    FileTable t;
+    uint8_t* in_bounds = arena_calloc(&session, hdr.num_files, 1);
+    uint8_t* selected = entry_count > 0 ? arena_calloc(&session, hdr.num_files, 1) : NULL;
+    if (!in_bounds || (entry_count > 0 && !selected) ||
+        file_table_build(&t, files, hdr.num_files, &session) != 0)
+    {
+        if (!in_bounds || (entry_count > 0 && !selected))
+            perror("Memory allocation failed");
+        arena_release(&session);
+        fclose(f);
+        source_close(&src);
+        return 1;
+    }
+
+    if (selected)
+        failures += select_vfiles(&t, entries, entry_count, selected);
+
+    /* Every data range must lie inside the image */
+    for (uint32_t i = 0; i < t.count; i++)
+    {
+        if ((uint64_t)t.offset[i] + t.stored_length[i] > src.size ||
+            t.original_length[i] > t.stored_length[i])
+        {
+            printf("[FAIL] %s: data range 0x%X + %u (original %u) exceeds image size %lld\n",
+                   file_table_str(&t, t.filename[i]), t.offset[i], t.stored_length[i],
+                   t.original_length[i], (long long)src.size);
+            failures++;
+            continue;
+        }
+        in_bounds[i] = 1;
+    }
+
+    /* Recompute V*.fex checksums straight from the image data */
+    for (uint32_t i = 0; i < t.count; i++)
+    {
+        const char* name = file_table_str(&t, t.filename[i]);
+        if (!is_checksum_vfile(name) || !in_bounds[i] || (selected && !selected[i]))
+            continue;
+
+        long target = file_table_find(&t, name + 1);
+        if (target >= 0 && !in_bounds[target])
+            continue;
+        failures += verify_vfile_entry(&src, &t, i);
+    }
+
+    arena_release(&session);
+    fclose(f);
+    source_close(&src);
+
+    if (failures)
+    {
+        printf("Verification failed: %s (%u problem(s))\n", img_filename, failures);
+        return 1;
+    }
+    printf("Verification passed: %s\n", img_filename);
+    return 0;
+}
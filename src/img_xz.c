@@ -0,0 +1,378 @@
+/**
+ * @file img_xz.c
+ * @brief Block-indexed random access to xz files (liblzma).
+ */
+
+#define _GNU_SOURCE
+
+#include "img_xz.h"
+
+#include <errno.h>
+#include <lzma.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Size of the compressed input buffer */
+#define XZ_INPUT_SIZE (256 * 1024)
+
+/** Size of the buffer output is discarded into while skipping forward */
+#define XZ_SKIP_SIZE (256 * 1024)
+
+/**
+ * @brief Index and block decoder of one xz file.
+ */
+struct XzReader
+{
+    int fd;              /**< File descriptor */
+    lzma_index* index;   /**< Block index of all streams */
+    uint64_t size;       /**< Uncompressed size */
+    lzma_stream strm;    /**< Decoder of the current block */
+    lzma_block block;    /**< Header of the current block (referenced by strm) */
+    int active;          /**< strm is positioned at out */
+    uint64_t block_end;  /**< Uncompressed end of the current block */
+    uint64_t in;         /**< File offset of the next compressed byte to read */
+    uint64_t in_end;     /**< File offset of the end of the current block */
+    uint64_t out;        /**< Uncompressed offset of the decoder */
+    uint8_t* input;      /**< XZ_INPUT_SIZE bytes of compressed input */
+    uint8_t* skip;       /**< XZ_SKIP_SIZE bytes of discarded output */
+};
+
+/**
+ * @brief Read up to len bytes at an absolute offset.
+ *
+ * @param fd  File descriptor.
+ * @param buf Destination buffer.
+ * @param len Maximum number of bytes to read.
+ * @param off File offset.
+ * @return Number of bytes read (0 at end of file), or -1 on error.
+ */
+static ssize_t read_at(int fd, void* buf, size_t len, uint64_t off)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t r = pread(fd, (uint8_t*)buf + done, len - done, (off_t)(off + done));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+        {
+            perror("Error reading xz file");
+            return -1;
+        }
+        if (r == 0)
+            break;
+        done += (size_t)r;
+    }
+    return (ssize_t)done;
+}
+
+/**
+ * @brief Check for the xz magic bytes.
+ *
+ * @param head First bytes of a file.
+ * @param len  Number of bytes in head.
+ * @return Non-zero if the file starts like an xz file.
+ */
+int xz_is_xz(const uint8_t* head, size_t len)
+{
+    static const uint8_t magic[6] = {0xFD, '7', 'z', 'X', 'Z', 0x00};
+    return len >= sizeof(magic) && memcmp(head, magic, sizeof(magic)) == 0;
+}
+
+/**
+ * @brief Decode the indexes of all streams of the file.
+ *
+ * @param x    Reader (fd and input set).
+ * @param size File size.
+ * @return 0 on success, non-zero on error.
+ */
+static int load_index(XzReader* x, uint64_t size)
+{
+    lzma_stream s = LZMA_STREAM_INIT;
+    if (lzma_file_info_decoder(&s, &x->index, UINT64_MAX, size) != LZMA_OK)
+    {
+        fprintf(stderr, "Error: cannot initialize the xz index decoder\n");
+        return 1;
+    }
+
+    uint64_t pos = 0;
+    lzma_ret rc = LZMA_OK;
+    while (rc == LZMA_OK)
+    {
+        if (s.avail_in == 0)
+        {
+            ssize_t n = read_at(x->fd, x->input, XZ_INPUT_SIZE, pos);
+            if (n <= 0)
+            {
+                if (n == 0)
+                    fprintf(stderr, "Error: xz file is truncated\n");
+                lzma_end(&s);
+                return 1;
+            }
+            s.next_in = x->input;
+            s.avail_in = (size_t)n;
+            pos += (uint64_t)n;
+        }
+
+        rc = lzma_code(&s, LZMA_RUN);
+        if (rc == LZMA_SEEK_NEEDED)
+        {
+            pos = s.seek_pos;
+            s.avail_in = 0;
+            rc = LZMA_OK;
+        }
+    }
+    lzma_end(&s);
+
+    if (rc != LZMA_STREAM_END)
+    {
+        fprintf(stderr, "Error: not a valid xz file (liblzma error %d)\n", (int)rc);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Open an xz file and load its block index.
+ *
+ * @param fd File descriptor.
+ * @return Reader, or NULL on error.
+ */
+XzReader* xz_open(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        perror("Error reading xz file");
+        return NULL;
+    }
+
+    XzReader* x = calloc(1, sizeof(*x));
+    if (!x)
+    {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+    lzma_stream init = LZMA_STREAM_INIT;
+    x->strm = init;
+    x->fd = fd;
+    x->input = malloc(XZ_INPUT_SIZE);
+    x->skip = malloc(XZ_SKIP_SIZE);
+    if (!x->input || !x->skip)
+    {
+        perror("Memory allocation failed");
+        xz_close(x);
+        return NULL;
+    }
+
+    if (load_index(x, (uint64_t)st.st_size) != 0)
+    {
+        xz_close(x);
+        return NULL;
+    }
+    x->size = lzma_index_uncompressed_size(x->index);
+    return x;
+}
+
+/**
+ * @brief Uncompressed size of the file.
+ *
+ * @param x Reader.
+ * @return Size in bytes.
+ */
+uint64_t xz_size(const XzReader* x)
+{
+    return x->size;
+}
+
+/**
+ * @brief Number of blocks in the file.
+ *
+ * @param x Reader.
+ * @return Block count.
+ */
+uint64_t xz_block_count(const XzReader* x)
+{
+    return lzma_index_block_count(x->index);
+}
+
+/**
+ * @brief Set up the decoder at the start of the block holding an offset.
+ *
+ * @param x   Reader.
+ * @param off Uncompressed offset.
+ * @return 0 on success, non-zero on error.
+ */
+static int start_block(XzReader* x, uint64_t off)
+{
+    x->active = 0;
+
+    lzma_index_iter iter;
+    lzma_index_iter_init(&iter, x->index);
+    if (lzma_index_iter_locate(&iter, off))
+        return 1;
+
+    uint8_t hdr[LZMA_BLOCK_HEADER_SIZE_MAX];
+    if (read_at(x->fd, hdr, 1, iter.block.compressed_file_offset) != 1)
+        return 1;
+
+    /* The decoder reads the block header structure again at the block end */
+    lzma_filter filters[LZMA_FILTERS_MAX + 1];
+    lzma_block* block = &x->block;
+    memset(block, 0, sizeof(*block));
+    block->version = 1;
+    block->check = iter.stream.flags->check;
+    block->filters = filters;
+    block->header_size = lzma_block_header_size_decode(hdr[0]);
+
+    if (read_at(x->fd, hdr + 1, block->header_size - 1, iter.block.compressed_file_offset + 1) !=
+            (ssize_t)block->header_size - 1 ||
+        lzma_block_header_decode(block, NULL, hdr) != LZMA_OK)
+    {
+        fprintf(stderr, "Error: corrupt xz block header\n");
+        return 1;
+    }
+
+    lzma_ret rc = lzma_block_compressed_size(block, iter.block.unpadded_size);
+    if (rc == LZMA_OK)
+        rc = lzma_block_decoder(&x->strm, block);
+
+    /* The filter chain is only needed to set up the decoder */
+    for (size_t i = 0; filters[i].id != LZMA_VLI_UNKNOWN; i++)
+        free(filters[i].options);
+    block->filters = NULL;
+    if (rc != LZMA_OK)
+    {
+        fprintf(stderr, "Error: cannot decode xz block (liblzma error %d)\n", (int)rc);
+        return 1;
+    }
+
+    x->out = iter.block.uncompressed_file_offset;
+    x->block_end = x->out + iter.block.uncompressed_size;
+    x->in = iter.block.compressed_file_offset + block->header_size;
+    x->in_end = iter.block.compressed_file_offset + iter.block.total_size;
+    x->strm.avail_in = 0;
+    x->active = 1;
+    return 0;
+}
+
+/**
+ * @brief Decode the next bytes of the current block.
+ *
+ * @param x        Reader (active).
+ * @param dst      Destination buffer.
+ * @param len      Maximum number of bytes to produce (within the block).
+ * @param produced Output: number of bytes produced.
+ * @return 0 on success, non-zero on error.
+ */
+static int decode_some(XzReader* x, uint8_t* dst, size_t len, size_t* produced)
+{
+    lzma_stream* strm = &x->strm;
+    strm->next_out = dst;
+    strm->avail_out = len;
+
+    while (strm->avail_out == len)
+    {
+        if (strm->avail_in == 0)
+        {
+            uint64_t left = x->in_end - x->in;
+            size_t n = left > XZ_INPUT_SIZE ? XZ_INPUT_SIZE : (size_t)left;
+            if (n == 0 || read_at(x->fd, x->input, n, x->in) != (ssize_t)n)
+            {
+                fprintf(stderr, "Error: xz block data ends early\n");
+                x->active = 0;
+                return 1;
+            }
+            strm->next_in = x->input;
+            strm->avail_in = n;
+            x->in += n;
+        }
+
+        size_t room = strm->avail_out;
+        lzma_ret rc = lzma_code(strm, LZMA_RUN);
+        x->out += room - strm->avail_out;
+        if (rc == LZMA_STREAM_END)
+        {
+            x->active = 0;
+            break;
+        }
+        if (rc != LZMA_OK)
+        {
+            fprintf(stderr, "Error: corrupt xz data (liblzma error %d)\n", (int)rc);
+            x->active = 0;
+            return 1;
+        }
+    }
+    *produced = len - strm->avail_out;
+    return 0;
+}
+
+/**
+ * @brief Read uncompressed bytes.
+ *
+ * @param x   Reader.
+ * @param off Uncompressed offset.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @return 0 on success, non-zero on error.
+ */
+int xz_read(XzReader* x, uint64_t off, void* buf, size_t len)
+{
+    if (off > x->size || len > x->size - off)
+    {
+        fprintf(stderr, "Error: read past the end of the xz data\n");
+        return 1;
+    }
+
+    uint8_t* dst = buf;
+    while (len > 0)
+    {
+        if ((!x->active || off < x->out || off >= x->block_end) && start_block(x, off) != 0)
+        {
+            fprintf(stderr, "Error: cannot seek to offset %llu in xz data\n",
+                    (unsigned long long)off);
+            return 1;
+        }
+
+        size_t n = 1;
+        while (x->out < off && n > 0)
+        {
+            uint64_t gap = off - x->out;
+            if (decode_some(x, x->skip, gap > XZ_SKIP_SIZE ? XZ_SKIP_SIZE : (size_t)gap, &n) != 0)
+                return 1;
+        }
+
+        uint64_t in_block = x->block_end - off;
+        size_t want = len > in_block ? (size_t)in_block : len;
+        if (n > 0 && decode_some(x, dst, want, &n) != 0)
+            return 1;
+        if (n == 0)
+        {
+            fprintf(stderr, "Error: xz block ends before its indexed size\n");
+            return 1;
+        }
+        dst += n;
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Release a reader.
+ *
+ * @param x Reader (NULL is ignored).
+ */
+void xz_close(XzReader* x)
+{
+    if (!x)
+        return;
+    lzma_end(&x->strm);
+    lzma_index_end(x->index, NULL);
+    free(x->input);
+    free(x->skip);
+    free(x);
+}
@@ -0,0 +1,338 @@
+/**
+ * @file img_zip.c
+ * @brief Zip archive member lookup (central directory and Zip64 records).
+ */
+
+#define _GNU_SOURCE
+
+#include "img_zip.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** End of central directory record */
+#define ZIP_SIG_EOCD 0x06054b50u
+
+/** Zip64 end of central directory locator */
+#define ZIP_SIG_EOCD64_LOCATOR 0x07064b50u
+
+/** Zip64 end of central directory record */
+#define ZIP_SIG_EOCD64 0x06064b50u
+
+/** Central directory file header */
+#define ZIP_SIG_CENTRAL 0x02014b50u
+
+/** Local file header */
+#define ZIP_SIG_LOCAL 0x04034b50u
+
+/** Size of the fixed part of the end of central directory record */
+#define ZIP_EOCD_SIZE 22
+
+/** Size of the fixed part of a central directory file header */
+#define ZIP_CENTRAL_SIZE 46
+
+/** Size of the fixed part of a local file header */
+#define ZIP_LOCAL_SIZE 30
+
+/** Size of the fixed part of the Zip64 end of central directory record */
+#define ZIP_EOCD64_SIZE 56
+
+/** Size of the Zip64 end of central directory locator */
+#define ZIP_EOCD64_LOCATOR_SIZE 20
+
+/** Extra field carrying the Zip64 sizes and offset */
+#define ZIP_EXTRA_ZIP64 0x0001
+
+/** General purpose flag: member is encrypted */
+#define ZIP_FLAG_ENCRYPTED 0x0001
+
+/** Largest central directory loaded into memory */
+#define ZIP_MAX_DIRECTORY_SIZE (256 * 1024 * 1024)
+
+/**
+ * @brief Decode a little-endian 16-bit value.
+ *
+ * @param p Encoded bytes.
+ * @return Value.
+ */
+static uint16_t le16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+/**
+ * @brief Decode a little-endian 32-bit value.
+ *
+ * @param p Encoded bytes.
+ * @return Value.
+ */
+static uint32_t le32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Decode a little-endian 64-bit value.
+ *
+ * @param p Encoded bytes.
+ * @return Value.
+ */
+static uint64_t le64(const uint8_t* p)
+{
+    return (uint64_t)le32(p) | ((uint64_t)le32(p + 4) << 32);
+}
+
+/**
+ * @brief Read exactly len bytes at an absolute offset.
+ *
+ * @param fd  File descriptor.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @param off File offset.
+ * @return 0 on success, non-zero on error or premature end of file.
+ */
+static int read_at(int fd, void* buf, size_t len, uint64_t off)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t r = pread(fd, (uint8_t*)buf + done, len - done, (off_t)(off + done));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+        {
+            fprintf(stderr, "Error reading zip archive: %s\n",
+                    r < 0 ? strerror(errno) : "unexpected end of file");
+            return 1;
+        }
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+/**
+ * @brief Locate the central directory.
+ *
+ * @param fd     Archive file descriptor.
+ * @param size   Archive size.
+ * @param offset Output: archive offset of the central directory.
+ * @param length Output: size of the central directory.
+ * @return 0 on success, non-zero if the file is not a zip archive.
+ */
+static int find_central_directory(int fd, uint64_t size, uint64_t* offset, uint64_t* length)
+{
+    /* The end record sits in the last 22 bytes plus an up to 64 KiB comment */
+    size_t tail = size < ZIP_EOCD_SIZE + 65535 ? (size_t)size : ZIP_EOCD_SIZE + 65535;
+    uint8_t* buf = malloc(tail ? tail : 1);
+    if (!buf)
+    {
+        perror("Memory allocation failed");
+        return 1;
+    }
+    if (tail < ZIP_EOCD_SIZE || read_at(fd, buf, tail, size - tail) != 0)
+    {
+        free(buf);
+        fprintf(stderr, "Error: not a zip archive\n");
+        return 1;
+    }
+
+    size_t pos = tail - ZIP_EOCD_SIZE + 1;
+    while (pos-- > 0)
+    {
+        if (le32(buf + pos) == ZIP_SIG_EOCD)
+            break;
+    }
+    if (pos == (size_t)-1)
+    {
+        free(buf);
+        fprintf(stderr, "Error: not a zip archive (no end of central directory)\n");
+        return 1;
+    }
+
+    *length = le32(buf + pos + 12);
+    *offset = le32(buf + pos + 16);
+
+    /* Zip64: the locator immediately precedes the end record */
+    uint64_t locator = size - tail + pos - ZIP_EOCD64_LOCATOR_SIZE;
+    int zip64 = pos >= ZIP_EOCD64_LOCATOR_SIZE &&
+                le32(buf + pos - ZIP_EOCD64_LOCATOR_SIZE) == ZIP_SIG_EOCD64_LOCATOR;
+    uint64_t eocd64 = zip64 ? le64(buf + pos - ZIP_EOCD64_LOCATOR_SIZE + 8) : 0;
+    free(buf);
+
+    if (zip64)
+    {
+        uint8_t rec[ZIP_EOCD64_SIZE];
+        if (eocd64 >= locator || read_at(fd, rec, sizeof(rec), eocd64) != 0 ||
+            le32(rec) != ZIP_SIG_EOCD64)
+        {
+            fprintf(stderr, "Error: corrupt Zip64 end of central directory\n");
+            return 1;
+        }
+        *length = le64(rec + 40);
+        *offset = le64(rec + 48);
+    }
+
+    if (*offset > size || *length > size - *offset)
+    {
+        fprintf(stderr, "Error: central directory lies outside the archive\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Apply a Zip64 extended information field to 32-bit directory values.
+ *
+ * Each value saturated at 0xFFFFFFFF in the directory entry is replaced by
+ * the next 64-bit value of the field, in the order size, compressed size,
+ * local header offset.
+ *
+ * @param extra     Extra field area of the directory entry.
+ * @param extra_len Length of the area.
+ * @param size      Uncompressed size (updated).
+ * @param comp_size Compressed size (updated).
+ * @param local     Local header offset (updated).
+ * @return 0 on success, non-zero if a saturated value has no Zip64 replacement.
+ */
+static int apply_zip64_extra(const uint8_t* extra, size_t extra_len, uint64_t* size,
+                             uint64_t* comp_size, uint64_t* local)
+{
+    for (size_t pos = 0; pos + 4 <= extra_len;)
+    {
+        uint16_t id = le16(extra + pos);
+        uint16_t len = le16(extra + pos + 2);
+        if (pos + 4 + len > extra_len)
+            break;
+        if (id == ZIP_EXTRA_ZIP64)
+        {
+            const uint8_t* p = extra + pos + 4;
+            const uint8_t* end = p + len;
+            uint64_t* fields[3] = {size, comp_size, local};
+            for (int i = 0; i < 3; i++)
+            {
+                if (*fields[i] != UINT32_MAX)
+                    continue;
+                if (p + 8 > end)
+                    return 1;
+                *fields[i] = le64(p);
+                p += 8;
+            }
+            return 0;
+        }
+        pos += 4 + (size_t)len;
+    }
+    return *size == UINT32_MAX || *comp_size == UINT32_MAX || *local == UINT32_MAX;
+}
+
+/**
+ * @brief Look up a member of a zip archive by name.
+ *
+ * @param fd    Archive file descriptor.
+ * @param name  Member name as stored in the archive.
+ * @param entry Output: the member.
+ * @return 0 on success, 1 if there is no such member, -1 on error.
+ */
+int zip_find_entry(int fd, const char* name, ZipEntry* entry)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        perror("Error reading zip archive");
+        return -1;
+    }
+
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t cd_off;
+    uint64_t cd_len;
+    if (find_central_directory(fd, size, &cd_off, &cd_len) != 0)
+        return -1;
+    if (cd_len > ZIP_MAX_DIRECTORY_SIZE)
+    {
+        fprintf(stderr, "Error: central directory of %llu bytes is too large\n",
+                (unsigned long long)cd_len);
+        return -1;
+    }
+
+    uint8_t* cd = malloc(cd_len ? (size_t)cd_len : 1);
+    if (!cd)
+    {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    if (read_at(fd, cd, (size_t)cd_len, cd_off) != 0)
+    {
+        free(cd);
+        return -1;
+    }
+
+    size_t name_len = strlen(name);
+    int ret = 1;
+    for (size_t pos = 0; pos + ZIP_CENTRAL_SIZE <= cd_len;)
+    {
+        const uint8_t* p = cd + pos;
+        if (le32(p) != ZIP_SIG_CENTRAL)
+        {
+            fprintf(stderr, "Error: corrupt central directory\n");
+            ret = -1;
+            break;
+        }
+        uint16_t nlen = le16(p + 28);
+        uint16_t xlen = le16(p + 30);
+        uint16_t clen = le16(p + 32);
+        size_t rec_len = ZIP_CENTRAL_SIZE + (size_t)nlen + xlen + clen;
+        if (pos + rec_len > cd_len)
+        {
+            fprintf(stderr, "Error: corrupt central directory\n");
+            ret = -1;
+            break;
+        }
+        if (nlen != name_len || memcmp(p + ZIP_CENTRAL_SIZE, name, name_len) != 0)
+        {
+            pos += rec_len;
+            continue;
+        }
+
+        uint16_t flags = le16(p + 8);
+        uint64_t comp_size = le32(p + 20);
+        uint64_t usize = le32(p + 24);
+        uint64_t local = le32(p + 42);
+        entry->method = le16(p + 10);
+        entry->crc = le32(p + 16);
+
+        ret = -1;
+        uint8_t lh[ZIP_LOCAL_SIZE];
+        if (apply_zip64_extra(p + ZIP_CENTRAL_SIZE + nlen, xlen, &usize, &comp_size, &local) != 0)
+            fprintf(stderr, "Error: '%s' lacks its Zip64 sizes\n", name);
+        else if (flags & ZIP_FLAG_ENCRYPTED)
+            fprintf(stderr, "Error: '%s' is encrypted\n", name);
+        else if (entry->method != ZIP_METHOD_STORED && entry->method != ZIP_METHOD_DEFLATE)
+            fprintf(stderr, "Error: '%s' uses unsupported compression method %u\n", name,
+                    entry->method);
+        else if (read_at(fd, lh, sizeof(lh), local) != 0 || le32(lh) != ZIP_SIG_LOCAL)
+            fprintf(stderr, "Error: bad local header for '%s'\n", name);
+        else
+            ret = 0;
+
+        if (ret == 0)
+        {
+            entry->data_offset = local + ZIP_LOCAL_SIZE + le16(lh + 26) + le16(lh + 28);
+            entry->comp_size = comp_size;
+            entry->size = usize;
+            if (entry->data_offset > size || comp_size > size - entry->data_offset ||
+                (entry->method == ZIP_METHOD_STORED && comp_size != usize))
+            {
+                fprintf(stderr, "Error: data of '%s' lies outside the archive\n", name);
+                ret = -1;
+            }
+        }
+        break;
+    }
+
+    free(cd);
+    return ret;
+}
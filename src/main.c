@@ -12,9 +12,18 @@
 
 #include "checksum.h"
 #include "config_file.h"
+#include "img_bufpool.h"
+#include "img_cache.h"
+#include "img_edit.h"
 #include "img_extract.h"
 #include "img_header.h"
+#include "img_io.h"
+#include "img_lz4.h"
+#include "img_mount.h"
 #include "img_repack.h"
+#include "img_source.h"
+#include "img_store.h"
+#include "img_verify.h"
 #include "print_info.h"
 
 #define VERSION "1.0.0"
@@ -30,7 +39,14 @@ typedef enum
     CMD_INFO,        /**< Show information about an image. */
     CMD_EXTRACT,     /**< Extract files from an image. */
     CMD_REPACK,      /**< Repack files into a new image. */
-    CMD_CONFIG       /**< Load and display a config file. */
+    CMD_CONFIG,      /**< Load and display a config file. */
+    CMD_STORE,       /**< Add or retrieve images in the chunk store. */
+    CMD_REPLACE,     /**< Replace one embedded file in place. */
+    CMD_ADD,         /**< Add an embedded file to an image. */
+    CMD_REMOVE,      /**< Remove an embedded file from an image. */
+    CMD_COMPACT,     /**< Pack payloads tightly and reclaim gaps. */
+    CMD_VERIFY,      /**< Check an image's layout and checksums in place. */
+    CMD_MOUNT        /**< Serve an image as a read-only FUSE filesystem. */
 } Command;
 
 /**
@@ -48,17 +64,83 @@ static void usage(const char* prog)
         prog);
     printf("  %s extract <image.img>               Extract all files from the firmware image\n",
            prog);
-    printf("  %s repack <folder.dump> <new_image.img>  Repack extracted files into a new firmware "
-           "image\n",
+    printf("  %s extract -                         Extract an image streamed on stdin into %s\n",
+           prog, EXTRACT_STDIN_DUMP_DIR);
+    printf("  %s extract --tar=<out.tar|-> <image.img|->  Extract into a pax archive\n", prog);
+    printf("  %s extract <image.img> <entry>...    Extract only the named entries\n", prog);
+    printf("  %s extract --compress=lz4 <image.img>  Store large entries as <name>%s frames\n",
+           prog, LZ4_FILE_SUFFIX);
+    printf("  %s repack [options] <folder.dump> <new_image.img>  Repack extracted files into a new "
+           "firmware image\n",
+           prog);
+    printf("  %s repack [options] <folder.dump> -  Repack to stdout (e.g. into a compressor)\n",
+           prog);
+    printf("  %s repack --from-tar <in.tar|-> <new_image.img>  Repack from a tar/pax archive\n",
            prog);
     printf("  %s config <image.cfg>                Inspect or display IMAGEWTY configuration "
-           "files\n\n",
+           "files\n",
+           prog);
+    printf("  %s replace <image.img> <entry> <file>  Replace one embedded file in place\n", prog);
+    printf("  %s add <image.img> <file> [maintype] [subtype]  Add a file to an image\n", prog);
+    printf("  %s remove <image.img> <entry>        Remove an embedded file from an image\n", prog);
+    printf("  %s compact <image.img> [out.img]     Reclaim gaps and pack payloads tightly\n", prog);
+    printf("  %s verify <image.img> [entry...]     Check layout and V-file checksums in place\n",
+           prog);
+    printf("  %s mount <image.img> <dir>           Browse an image read-only in <dir> (FUSE)\n",
+           prog);
+    printf("  %s store add <image.img>             Add an image to the deduplicating chunk store\n",
            prog);
+    printf("  %s store get <id> <out.img>          Rebuild a stored image by its ID\n\n", prog);
+
+    printf("Repack options:\n");
+    printf("  --align=N    Align payload offsets to N bytes (power of two, %d..%d; accepts K/M "
+           "suffix)\n",
+           PADDING_ALIGNMENT, MAX_PAYLOAD_ALIGNMENT);
+    printf("  --dedup      Store byte-identical files once and share their data offset\n");
+    printf("  --incremental=PREV\n");
+    printf("               Update PREV (a previous repack output) instead of rewriting every\n"
+           "               payload; only files changed since PREV.manifest are written\n");
+    printf("  --cache[=DIR]\n");
+    printf("               Reuse identical earlier builds from a local cache (default: $%s,\n"
+           "               else ~/.cache/imagewty-tool/images)\n",
+           CACHE_ENV_VAR);
+    printf("  --plan       Print the planned layout, I/O volume and estimated time as JSON\n"
+           "               without writing anything\n");
+    printf("  --from-tar   Read image.cfg and the files from a tar/pax archive (- = stdin)\n"
+           "               instead of a dump folder\n\n");
+
+    printf("Global options:\n");
+    printf("  --io=auto|uring|sync\n");
+    printf("               Data transfer backend (default: $%s, else auto = io_uring where\n"
+           "               copy_file_range() is unsupported and the kernel allows it)\n",
+           IO_BACKEND_ENV_VAR);
+    printf("  --direct     Bypass the page cache (O_DIRECT, %d MiB transfers) for payload data\n",
+           IO_DIRECT_CHUNK_SIZE / (1024 * 1024));
+    printf("  --drop-cache Evict payload data from the page cache once it has been moved\n");
+    printf("  --huge-pages Back I/O buffers of %d MiB and more with huge pages\n",
+           BUFPOOL_HUGE_PAGE_SIZE / (1024 * 1024));
+    printf("  --zip-index=DIR\n");
+    printf("               Keep inflate checkpoints of deflated zip members in DIR, so later\n"
+           "               runs can seek within them without inflating from the start\n\n");
 
     printf("Notes:\n");
     printf("  - Extraction creates a folder named <image>.dump with all extracted files and a "
            "generated image.cfg.\n");
-    printf("  - Repacking recalculates all V-file checksums automatically.\n\n");
+    printf("  - Repacking recalculates all V-file checksums automatically.\n");
+    printf("  - Repack and checksum checks read <name>%s in place of a missing <name>,\n"
+           "    decompressing it with up to %d threads.\n",
+           LZ4_FILE_SUFFIX, LZ4_DECODE_THREADS);
+    printf("  - info, extract, verify and mount read images inside zip bundles, given as\n"
+           "    bundle.zip%sfirmware.img (Zip64 supported; stored or deflated members).\n",
+           SOURCE_ZIP_SEPARATOR);
+    printf("  - They also read gzip and xz compressed images (firmware.img.gz/.xz). The first\n"
+           "    access to a gzip image writes a checkpoint index next to it (<image>%s);\n"
+           "    xz images are seekable per block (compress with xz -T0 or --block-size).\n",
+           SOURCE_INDEX_SUFFIX);
+    printf("  - mount needs FUSE (root, or fusermount3 for other users) and runs until the\n"
+           "    directory is unmounted or it is interrupted.\n");
+    printf("  - The chunk store lives in $%s (default: %s).\n\n", STORE_ENV_VAR,
+           STORE_DEFAULT_DIR);
 
     printf("For more information, visit: https://github.com/uictorius/imagewty-tool\n");
 }
@@ -78,21 +160,38 @@ static Command parse_command(const char* cmd_str)
         return CMD_REPACK;
     if (strcmp(cmd_str, "config") == 0)
         return CMD_CONFIG;
+    if (strcmp(cmd_str, "store") == 0)
+        return CMD_STORE;
+    if (strcmp(cmd_str, "replace") == 0)
+        return CMD_REPLACE;
+    if (strcmp(cmd_str, "add") == 0)
+        return CMD_ADD;
+    if (strcmp(cmd_str, "remove") == 0)
+        return CMD_REMOVE;
+    if (strcmp(cmd_str, "compact") == 0)
+        return CMD_COMPACT;
+    if (strcmp(cmd_str, "verify") == 0)
+        return CMD_VERIFY;
+    if (strcmp(cmd_str, "mount") == 0)
+        return CMD_MOUNT;
     return CMD_INVALID;
 }
 
 /**
  * @brief Open an IMAGEWTY image and validate its header.
- * @param path Path to the image file.
+ * @param path Path to the image file (or "bundle.zip!/member").
+ * @param src Image source to open (closed again on failure).
  * @param hdr Pointer to ImageWTYHeader to populate.
  * @return FILE* on success, NULL on failure.
  */
-static FILE* open_image_file(const char* path, ImageWTYHeader* hdr)
+static FILE* open_image_file(const char* path, ImageSource* src, ImageWTYHeader* hdr)
 {
-    FILE* f = fopen(path, "rb");
+    if (source_open(src, path) != 0)
+        return NULL;
+    FILE* f = source_fopen(src);
     if (!f)
     {
-        perror("Error opening image");
+        source_close(src);
         return NULL;
     }
 
@@ -103,6 +202,7 @@ static FILE* open_image_file(const char* path, ImageWTYHeader* hdr)
     {
         fprintf(stderr, "Error: '%s' is not a valid IMAGEWTY image or may be encrypted.\n", path);
         fclose(f);
+        source_close(src);
         return NULL;
     }
 
@@ -116,21 +216,24 @@ static FILE* open_image_file(const char* path, ImageWTYHeader* hdr)
  */
 static int handle_info(const char* path)
 {
+    ImageSource src;
     ImageWTYHeader hdr;
-    FILE* f = open_image_file(path, &hdr);
+    FILE* f = open_image_file(path, &src, &hdr);
     if (!f)
         return 1;
 
     print_image_header(&hdr);
 
-    ImageWTYFileHeader* files = read_all_file_headers(f, hdr.num_files, hdr.file_header_length);
+    Arena session;
+    arena_init(&session);
+    ImageWTYFileHeader* files =
+        read_all_file_headers(f, hdr.num_files, hdr.file_header_length, &session);
     if (files)
-    {
         print_file_headers(files, hdr.num_files);
-        free(files);
-    }
 
+    arena_release(&session);
     fclose(f);
+    source_close(&src);
     return 0;
 }
 
@@ -143,8 +246,10 @@ static int handle_config(const char* path)
 {
     ImageWTYHeader hdr;
     ImageWTYFileHeader* files = NULL;
+    Arena session;
+    arena_init(&session);
 
-    int res = load_image_config(path, &hdr, &files);
+    int res = load_image_config(path, &hdr, &files, &session);
     if (res == 0)
     {
         print_image_header(&hdr);
@@ -159,15 +264,234 @@ static int handle_config(const char* path)
         fprintf(stderr, "Config file '%s' contains invalid fields\n", path);
     }
 
-    free_file_list(files);
+    arena_release(&session);
     return (res == 0) ? 0 : 1;
 }
 
+/**
+ * @brief Parse a size argument with an optional K or M suffix.
+ * @param str Input string (decimal or 0x-prefixed hex).
+ * @param value Output parameter: parsed value in bytes.
+ * @return 0 on success, non-zero if the string is not a valid size.
+ */
+static int parse_size(const char* str, uint64_t* value)
+{
+    char* end = NULL;
+    unsigned long long v = strtoull(str, &end, 0);
+    if (end == str)
+        return 1;
+
+    if (*end == 'K' || *end == 'k')
+    {
+        v *= 1024;
+        end++;
+    }
+    else if (*end == 'M' || *end == 'm')
+    {
+        v *= 1024 * 1024;
+        end++;
+    }
+    if (*end != '\0')
+        return 1;
+
+    *value = v;
+    return 0;
+}
+
+/**
+ * @brief Handle the 'extract' command and its options.
+ * @param argc Argument count (as passed to main).
+ * @param argv Argument vector (as passed to main).
+ * @return 0 on success, non-zero on failure.
+ */
+static int handle_extract(int argc, char* argv[])
+{
+    ExtractOptions opts;
+    extract_options_init(&opts);
+
+    /* Positional arguments (image, then entry names) are packed from argv[2] */
+    int kept = 2;
+    for (int i = 2; i < argc; i++)
+    {
+        char* arg = argv[i];
+        if (strncmp(arg, "--tar=", 6) == 0 && arg[6] != '\0')
+        {
+            opts.tar_path = arg + 6;
+        }
+        else if (strcmp(arg, "--compress=lz4") == 0)
+        {
+            opts.compress = 1;
+        }
+        else if (strncmp(arg, "--compress=", 11) == 0)
+        {
+            fprintf(stderr, "Unsupported compression '%s' (only lz4 is available)\n", arg + 11);
+            return 1;
+        }
+        else if (strncmp(arg, "--", 2) == 0)
+        {
+            fprintf(stderr, "Unknown extract option '%s'\n", arg);
+            return 1;
+        }
+        else
+        {
+            argv[kept++] = arg;
+        }
+    }
+
+    if (kept == 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    opts.entries = (const char* const*)argv + 3;
+    opts.entry_count = kept - 3;
+    return extract_image(argv[2], &opts);
+}
+
+/**
+ * @brief Handle the 'repack' command and its options.
+ * @param argc Argument count (as passed to main).
+ * @param argv Argument vector (as passed to main).
+ * @return 0 on success, non-zero on failure.
+ */
+static int handle_repack(int argc, char* argv[])
+{
+    RepackOptions opts;
+    repack_options_init(&opts);
+
+    const char* positional[2] = {NULL, NULL};
+    int npos = 0;
+
+    for (int i = 2; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--align=", 8) == 0)
+        {
+            uint64_t align;
+            if (parse_size(arg + 8, &align) != 0 || validate_alignment(align) != 0)
+            {
+                fprintf(stderr, "Invalid value for --align: '%s'\n", arg + 8);
+                return 1;
+            }
+            opts.alignment = (uint32_t)align;
+        }
+        else if (strcmp(arg, "--dedup") == 0)
+        {
+            opts.dedup = 1;
+        }
+        else if (strncmp(arg, "--incremental=", 14) == 0 && arg[14] != '\0')
+        {
+            opts.incremental_base = arg + 14;
+        }
+        else if (strcmp(arg, "--incremental") == 0 && i + 1 < argc)
+        {
+            opts.incremental_base = argv[++i];
+        }
+        else if (strcmp(arg, "--plan") == 0)
+        {
+            opts.plan = 1;
+        }
+        else if (strcmp(arg, "--from-tar") == 0)
+        {
+            opts.from_tar = 1;
+        }
+        else if (strcmp(arg, "--cache") == 0)
+        {
+            opts.cache_dir = cache_default_directory();
+        }
+        else if (strncmp(arg, "--cache=", 8) == 0 && arg[8] != '\0')
+        {
+            opts.cache_dir = arg + 8;
+        }
+        else if (strncmp(arg, "--", 2) == 0)
+        {
+            fprintf(stderr, "Unknown repack option '%s'\n", arg);
+            return 1;
+        }
+        else if (npos < 2)
+        {
+            positional[npos++] = arg;
+        }
+    }
+
+    if (npos < 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    return repack_image(positional[0], positional[1], &opts);
+}
+
+/**
+ * @brief Apply global options and remove them from the argument list.
+ *
+ * Global options may appear anywhere on the command line.
+ *
+ * @param argc Argument count (updated).
+ * @param argv Argument vector (global options are removed).
+ * @return 0 on success, non-zero on failure.
+ */
+static int apply_global_options(int* argc, char* argv[])
+{
+    const char* io_name = getenv(IO_BACKEND_ENV_VAR);
+    int kept = 1;
+
+    for (int i = 1; i < *argc; i++)
+    {
+        if (strncmp(argv[i], "--io=", 5) == 0)
+            io_name = argv[i] + 5;
+        else if (strcmp(argv[i], "--direct") == 0)
+            io_set_direct(1);
+        else if (strcmp(argv[i], "--drop-cache") == 0)
+            io_set_drop_cache(1);
+        else if (strcmp(argv[i], "--huge-pages") == 0)
+            bufpool_set_huge_pages(1);
+        else if (strncmp(argv[i], "--zip-index=", 12) == 0 && argv[i][12] != '\0')
+            source_set_index_dir(argv[i] + 12);
+        else
+            argv[kept++] = argv[i];
+    }
+    argv[kept] = NULL;
+    *argc = kept;
+
+    if (io_name && *io_name)
+    {
+        IoBackend backend;
+        if (io_backend_from_name(io_name, &backend) != 0)
+        {
+            fprintf(stderr, "Unknown I/O backend '%s' (expected auto, uring or sync)\n", io_name);
+            return 1;
+        }
+        return io_set_backend(backend);
+    }
+    return 0;
+}
+
+/**
+ * @brief Handle the 'store' command and its subcommands.
+ * @param argc Argument count (as passed to main).
+ * @param argv Argument vector (as passed to main).
+ * @return 0 on success, non-zero on failure.
+ */
+static int handle_store(int argc, char* argv[])
+{
+    if (strcmp(argv[2], "add") == 0 && argc >= 4)
+        return store_add_image(argv[3]);
+    if (strcmp(argv[2], "get") == 0 && argc >= 5)
+        return store_get_image(argv[3], argv[4]);
+
+    usage(argv[0]);
+    return 1;
+}
+
 /**
  * @brief Program entry point.
  */
 int main(int argc, char* argv[])
 {
+    if (apply_global_options(&argc, argv) != 0)
+        return 1;
+
     if (argc < MIN_ARGS)
     {
         usage(argv[0]);
@@ -182,18 +506,54 @@ int main(int argc, char* argv[])
         return handle_info(argv[2]);
 
     case CMD_EXTRACT:
-        return extract_image(argv[2]);
+        return handle_extract(argc, argv);
 
     case CMD_REPACK:
+        return handle_repack(argc, argv);
+
+    case CMD_CONFIG:
+        return handle_config(argv[2]);
+
+    case CMD_STORE:
+        return handle_store(argc, argv);
+
+    case CMD_REPLACE:
+        if (argc < 5)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        return replace_entry(argv[2], argv[3], argv[4]);
+
+    case CMD_ADD:
         if (argc < 4)
         {
             usage(argv[0]);
             return 1;
         }
-        return repack_image(argv[2], argv[3]);
+        return add_entry(argv[2], argv[3], argc > 4 ? argv[4] : NULL, argc > 5 ? argv[5] : NULL);
 
-    case CMD_CONFIG:
-        return handle_config(argv[2]);
+    case CMD_REMOVE:
+        if (argc < 4)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        return remove_entry(argv[2], argv[3]);
+
+    case CMD_COMPACT:
+        return compact_image(argv[2], argc > 3 ? argv[3] : NULL);
+
+    case CMD_VERIFY:
+        return verify_image(argv[2], (const char* const*)argv + 3, argc - 3);
+
+    case CMD_MOUNT:
+        if (argc < 4)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        return mount_image(argv[2], argv[3]);
 
     default:
         usage(argv[0]);
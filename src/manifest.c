@@ -0,0 +1,258 @@
+/**
+ * @file manifest.c
+ * @brief Loading, saving and building per-file content manifests.
+ *
+ * File format (text, one record per line after the magic line):
+ *
+ *     IMAGEWTY-MANIFEST 1
+ *     <size> <mtime_sec> <mtime_nsec> <sha256-hex> <filename>
+ *
+ * The file name comes last so it may contain spaces.
+ */
+
+#define _GNU_SOURCE
+
+#include "manifest.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "img_lz4.h"
+
+/** First line of every manifest file */
+#define MANIFEST_MAGIC "IMAGEWTY-MANIFEST 1"
+
+/**
+ * @brief Decode a hex-encoded SHA-256 digest.
+ *
+ * @param hex    Hex string of SHA256_DIGEST_SIZE * 2 characters.
+ * @param digest Output buffer of SHA256_DIGEST_SIZE bytes.
+ * @return 0 on success, non-zero on invalid input.
+ */
+static int hex_to_digest(const char* hex, uint8_t* digest)
+{
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++)
+    {
+        unsigned int byte;
+        if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+            return 1;
+        digest[i] = (uint8_t)byte;
+    }
+    return 0;
+}
+
+/**
+ * @brief Load a manifest from disk.
+ *
+ * @param path Path to the manifest file.
+ * @param m    Manifest to populate.
+ * @return 0 on success, non-zero if the file is missing or invalid.
+ */
+int manifest_load(const char* path, FileManifest* m)
+{
+    m->entries = NULL;
+    m->count = 0;
+
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return 1;
+
+    char line[512];
+    if (!fgets(line, sizeof(line), f) || strncmp(line, MANIFEST_MAGIC, strlen(MANIFEST_MAGIC)))
+    {
+        fclose(f);
+        return 1;
+    }
+
+    uint32_t capacity = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        ManifestEntry e;
+        char hex[SHA256_HEX_SIZE];
+        int name_pos = 0;
+
+        memset(&e, 0, sizeof(e));
+        if (sscanf(line, "%" SCNu64 " %" SCNd64 " %ld %64s %n", &e.size, &e.mtime_sec,
+                   &e.mtime_nsec, hex, &name_pos) != 4 ||
+            name_pos == 0 || hex_to_digest(hex, e.digest) != 0)
+        {
+            continue;
+        }
+
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(e.filename, sizeof(e.filename), "%s", line + name_pos);
+
+        if (m->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 32;
+            ManifestEntry* grown = realloc(m->entries, capacity * sizeof(*grown));
+            if (!grown)
+            {
+                perror("Memory allocation failed");
+                manifest_free(m);
+                fclose(f);
+                return 1;
+            }
+            m->entries = grown;
+        }
+        m->entries[m->count++] = e;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+/**
+ * @brief Write a manifest to disk (atomically, via a temporary file).
+ *
+ * @param path Path to the manifest file.
+ * @param m    Manifest to write.
+ * @return 0 on success, non-zero on error.
+ */
+int manifest_save(const char* path, const FileManifest* m)
+{
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid());
+
+    FILE* f = fopen(tmp, "w");
+    if (!f)
+    {
+        fprintf(stderr, "Cannot write manifest '%s': %s\n", tmp, strerror(errno));
+        return 1;
+    }
+
+    fprintf(f, "%s\n", MANIFEST_MAGIC);
+    for (uint32_t i = 0; i < m->count; i++)
+    {
+        const ManifestEntry* e = &m->entries[i];
+        char hex[SHA256_HEX_SIZE];
+        sha256_to_hex(e->digest, hex);
+        fprintf(f, "%" PRIu64 " %" PRId64 " %ld %s %s\n", e->size, e->mtime_sec, e->mtime_nsec,
+                hex, e->filename);
+    }
+
+    if (fclose(f) != 0 || rename(tmp, path) != 0)
+    {
+        fprintf(stderr, "Cannot write manifest '%s': %s\n", path, strerror(errno));
+        unlink(tmp);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Look up a record by file name.
+ *
+ * @param m    Manifest to search (may be NULL).
+ * @param name File name.
+ * @return Matching record, or NULL.
+ */
+const ManifestEntry* manifest_find(const FileManifest* m, const char* name)
+{
+    if (!m)
+        return NULL;
+
+    for (uint32_t i = 0; i < m->count; i++)
+    {
+        if (strcmp(m->entries[i].filename, name) == 0)
+            return &m->entries[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief io_read_range() callback feeding a SHA-256 context.
+ *
+ * @param data Chunk of data.
+ * @param len  Chunk length.
+ * @param ctx  Sha256Context to update.
+ * @return Always 0.
+ */
+static int sha256_chunk(const uint8_t* data, size_t len, void* ctx)
+{
+    sha256_update((Sha256Context*)ctx, data, len);
+    return 0;
+}
+
+/**
+ * @brief Describe a file, reusing a cached hash when size and mtime match.
+ *
+ * A file stored LZ4 compressed (<name>.lz4) is described by its
+ * uncompressed size and contents, and the mtime of the compressed file.
+ *
+ * @param dump_folder Folder containing the file.
+ * @param name        File name relative to dump_folder.
+ * @param cache       Previously recorded manifest used as hash cache (may be NULL).
+ * @param out         Record to fill in.
+ * @param hashed      Optional output: set to 1 if the file had to be read.
+ * @return 0 on success, non-zero on error.
+ */
+int manifest_describe_file(const char* dump_folder, const char* name, const FileManifest* cache,
+                           ManifestEntry* out, int* hashed)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dump_folder, name);
+
+    Lz4Input in;
+    if (lz4_input_open(path, &in) != 0)
+        return 1;
+
+    struct stat st;
+    if (fstat(in.fd, &st) != 0)
+    {
+        fprintf(stderr, "Cannot stat '%s': %s\n", path, strerror(errno));
+        lz4_input_close(&in);
+        return 1;
+    }
+
+    memset(out, 0, sizeof(*out));
+    snprintf(out->filename, sizeof(out->filename), "%s", name);
+    out->size = in.size;
+    out->mtime_sec = (int64_t)st.st_mtim.tv_sec;
+    out->mtime_nsec = st.st_mtim.tv_nsec;
+
+    if (hashed)
+        *hashed = 0;
+
+    const ManifestEntry* cached = manifest_find(cache, name);
+    if (cached && cached->size == out->size && cached->mtime_sec == out->mtime_sec &&
+        cached->mtime_nsec == out->mtime_nsec)
+    {
+        memcpy(out->digest, cached->digest, SHA256_DIGEST_SIZE);
+        lz4_input_close(&in);
+        return 0;
+    }
+
+    if (hashed)
+        *hashed = 1;
+
+    Sha256Context ctx;
+    sha256_init(&ctx);
+    int ret = lz4_input_read(&in, sha256_chunk, &ctx);
+    lz4_input_close(&in);
+    if (ret != 0)
+    {
+        fprintf(stderr, "Error reading '%s'\n", path);
+        return 1;
+    }
+    sha256_final(&ctx, out->digest);
+    return 0;
+}
+
+/**
+ * @brief Release memory held by a manifest.
+ *
+ * @param m Manifest to free.
+ */
+void manifest_free(FileManifest* m)
+{
+    free(m->entries);
+    m->entries = NULL;
+    m->count = 0;
+}
@@ -0,0 +1,248 @@
+/**
+ * @file sha256.c
+ * @brief Portable SHA-256 (FIPS 180-4) implementation.
+ *
+ * Used by the chunk store and other features that need a strong content
+ * hash without pulling in an external crypto library.
+ */
+
+#include "sha256.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "img_bufpool.h"
+
+/** Read size used by sha256_file() */
+#define SHA256_FILE_BUFFER_SIZE (64 * 1024)
+
+/** SHA-256 round constants */
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+    0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+    0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+    0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+    0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+    0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+    0xc67178f2};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/**
+ * @brief Process a single 64-byte block.
+ *
+ * @param ctx   Hashing context.
+ * @param block Block of 64 bytes.
+ */
+static void sha256_transform(Sha256Context* ctx, const uint8_t* block)
+{
+    uint32_t w[64];
+
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+    uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + K[i] + w[i];
+        uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
+}
+
+/**
+ * @brief Initialize a SHA-256 context with the standard initial hash value.
+ *
+ * @param ctx Context to initialize.
+ */
+void sha256_init(Sha256Context* ctx)
+{
+    static const uint32_t iv[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(ctx->state, iv, sizeof(iv));
+    ctx->length = 0;
+    ctx->block_len = 0;
+}
+
+/**
+ * @brief Feed data into a SHA-256 context.
+ *
+ * @param ctx  Hashing context.
+ * @param data Input bytes.
+ * @param len  Number of input bytes.
+ */
+void sha256_update(Sha256Context* ctx, const void* data, size_t len)
+{
+    const uint8_t* p = data;
+    ctx->length += len;
+
+    /* Complete a pending partial block first */
+    if (ctx->block_len > 0)
+    {
+        size_t take = 64 - ctx->block_len;
+        if (take > len)
+            take = len;
+        memcpy(ctx->block + ctx->block_len, p, take);
+        ctx->block_len += take;
+        p += take;
+        len -= take;
+
+        if (ctx->block_len < 64)
+            return;
+        sha256_transform(ctx, ctx->block);
+        ctx->block_len = 0;
+    }
+
+    /* Hash full blocks straight from the input */
+    for (; len >= 64; p += 64, len -= 64)
+        sha256_transform(ctx, p);
+
+    memcpy(ctx->block, p, len);
+    ctx->block_len = len;
+}
+
+/**
+ * @brief Apply final padding and write out the digest.
+ *
+ * @param ctx    Hashing context.
+ * @param digest Output buffer of SHA256_DIGEST_SIZE bytes.
+ */
+void sha256_final(Sha256Context* ctx, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint64_t bits = ctx->length * 8;
+
+    /* Append the 0x80 terminator and zero padding up to 56 mod 64 */
+    ctx->block[ctx->block_len++] = 0x80;
+    if (ctx->block_len > 56)
+    {
+        memset(ctx->block + ctx->block_len, 0, 64 - ctx->block_len);
+        sha256_transform(ctx, ctx->block);
+        ctx->block_len = 0;
+    }
+    memset(ctx->block + ctx->block_len, 0, 56 - ctx->block_len);
+
+    /* Message length in bits, big-endian */
+    for (int i = 0; i < 8; i++)
+        ctx->block[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha256_transform(ctx, ctx->block);
+
+    for (int i = 0; i < 8; i++)
+    {
+        digest[i * 4] = (uint8_t)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+/**
+ * @brief Hash a memory buffer in one call.
+ *
+ * @param data   Input bytes.
+ * @param len    Number of input bytes.
+ * @param digest Output buffer of SHA256_DIGEST_SIZE bytes.
+ */
+void sha256_buffer(const void* data, size_t len, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    Sha256Context ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, digest);
+}
+
+/**
+ * @brief Hash the complete contents of a file.
+ *
+ * @param path   Path to the file.
+ * @param digest Output buffer of SHA256_DIGEST_SIZE bytes.
+ * @return 0 on success, non-zero if the file cannot be read.
+ */
+int sha256_file(const char* path, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "sha256_file: Cannot open file '%s'\n", path);
+        return 1;
+    }
+
+    uint8_t* buf = bufpool_get(SHA256_FILE_BUFFER_SIZE);
+    if (!buf)
+    {
+        fclose(f);
+        return 1;
+    }
+
+    Sha256Context ctx;
+    size_t n;
+
+    sha256_init(&ctx);
+    while ((n = fread(buf, 1, SHA256_FILE_BUFFER_SIZE, f)) > 0)
+        sha256_update(&ctx, buf, n);
+
+    int err = ferror(f);
+    bufpool_put(buf);
+    fclose(f);
+    if (err)
+    {
+        fprintf(stderr, "sha256_file: Error reading '%s'\n", path);
+        return 1;
+    }
+
+    sha256_final(&ctx, digest);
+    return 0;
+}
+
+/**
+ * @brief Encode a digest as a lowercase hex string.
+ *
+ * @param digest Digest bytes.
+ * @param hex    Output buffer of SHA256_HEX_SIZE bytes.
+ */
+void sha256_to_hex(const uint8_t digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE])
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++)
+    {
+        hex[i * 2] = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 0x0F];
+    }
+    hex[SHA256_HEX_SIZE - 1] = '\0';
+}
@@ -0,0 +1,99 @@
+#!/bin/sh
+# -----------------------------------------------------------------------------
+# Edit commands must keep bytes that no entry describes
+# -----------------------------------------------------------------------------
+# Builds a small image, appends a vendor trailer behind the last entry and
+# checks that relocating edits neither overwrite nor drop it.
+#
+# Usage: tests/edit_trailer.sh [path/to/imagewty-tool]
+# -----------------------------------------------------------------------------
+
+set -eu
+
+TOOL=$(cd "$(dirname "${1:-./imagewty-tool}")" && pwd)/$(basename "${1:-./imagewty-tool}")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+
+TRAILER="VENDOR-SIGNATURE-BLOCK-0123456789"
+TRAILER_LEN=${#TRAILER}
+
+fail()
+{
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+# Write an image.cfg describing boot.fex and its checksum file Vboot.fex
+write_cfg()
+{
+    printf '[IMAGE_CFG]\nmagic="IMAGEWTY";\nheader_version=0x00000300;\n'
+    printf 'header_size=0x00000050;\nbase_ram=0x00000004;\nformat_version=0x00100234;\n'
+    printf 'total_image_size=0x00000000;\nheader_size_including_alignment=0x00000060;\n'
+    printf 'file_header_length=0x00000400;\nusb_product_id=0x00001234;\n'
+    printf 'usb_vendor_id=0x00008743;\nhardware_id=0x00000100;\nfirmware_id=0x00000100;\n'
+    printf 'unknown_field_1=0x00000001;\nunknown_field_2=0x00000400;\n'
+    printf 'unknown_field_3=0x00000000;\nnumber_of_files=0x00000002;\n\n[FILELIST]\n'
+    n=1
+    for name in boot.fex Vboot.fex; do
+        printf 'file_%d {\nfilename_length=0x00000100;\nfile_header_size=0x00000400;\n' $n
+        printf 'maintype="RFSFAT16";\nsubtype="%s";\nunknown0=0x00000000;\n' \
+            "$(echo "$name" | tr 'a-z.' 'A-Z_')00000000"
+        printf 'filename="%s";\nstored_length=0x00000000;\npad1=0x00000000;\n' "$name"
+        printf 'original_length=0x00000000;\npad2=0x00000000;\noffset=0x00000000;\n}\n'
+        n=$((n + 1))
+    done
+}
+
+# Create base.img with a trailer appended; prints the trailer offset
+make_image()
+{
+    rm -rf dump base.img
+    mkdir dump
+    write_cfg > dump/image.cfg
+    head -c 3000 /dev/urandom > dump/boot.fex
+    printf '\000\000\000\000' > dump/Vboot.fex
+    "$TOOL" repack dump base.img > /dev/null || fail "repack"
+    wc -c < base.img | tr -d ' '
+    printf '%s' "$TRAILER" >> base.img
+}
+
+# check_trailer <image> <offset>: the trailer is still at <offset>
+check_trailer()
+{
+    got=$(tail -c +"$(($2 + 1))" "$1" | head -c "$TRAILER_LEN")
+    [ "$got" = "$TRAILER" ] || fail "$3: trailer lost or overwritten"
+}
+
+# check_image <image>: layout and checksums are still valid
+check_image()
+{
+    "$TOOL" verify "$1" > /dev/null || fail "$2: image does not verify"
+}
+
+# replace: a larger payload is relocated behind the trailer
+off=$(make_image)
+head -c 9000 /dev/urandom > big.fex
+"$TOOL" replace base.img boot.fex big.fex > /dev/null || fail "replace"
+check_trailer base.img "$off" replace
+check_image base.img replace
+
+# add: moves boot.fex out of the way of the grown table, then appends
+off=$(make_image)
+head -c 5000 /dev/urandom > extra.fex
+"$TOOL" add base.img extra.fex > /dev/null || fail "add"
+check_trailer base.img "$off" add
+check_image base.img add
+
+# remove + compact: removing the last entry leaves a gap before the trailer,
+# which compact closes, in place and into a new file
+off=$(make_image)
+"$TOOL" remove base.img Vboot.fex > /dev/null || fail "remove"
+check_trailer base.img "$off" remove
+"$TOOL" compact base.img packed.img > /dev/null || fail "compact to a new file"
+check_trailer packed.img "$(($(wc -c < packed.img) - TRAILER_LEN))" "compact to a new file"
+check_image packed.img "compact to a new file"
+"$TOOL" compact base.img > /dev/null || fail "compact in place"
+cmp -s base.img packed.img || fail "compact in place differs from compact to a new file"
+
+echo "edit_trailer: all tests passed"